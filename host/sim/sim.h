@@ -0,0 +1,148 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "root_pipeline.h"
+
+/**
+ * Host mesh simulator: one process per node runs the firmware, the
+ * parent process is the mesh (sim_hub.c). They talk over one
+ * SOCK_SEQPACKET socket per node, one packet per message.
+ */
+#define SIM_PACKET_MAX      ( 64 * 1024 )
+#define SIM_ROUTER_BSSID    { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 }
+
+typedef enum {
+    /* node to hub */
+    SIM_HELLO,          /* esp_mesh_start() */
+    SIM_SEND,           /* esp_mesh_send(): addr is 'to', all zero for the root */
+    SIM_GROUPS,         /* esp_mesh_set_group_id(): the addresses */
+    SIM_BYE,            /* answer to SIM_QUIT: a sim_report_t */
+    /* hub to node */
+    SIM_INFO,           /* position in the tree: sim_info_t, children, routing table */
+    SIM_EVENT,          /* a MESH_EVENT 'id' and its data */
+    SIM_DATA,           /* a frame for esp_mesh_recv(): addr is 'from' */
+    SIM_MQTT,           /* a message from the broker: the topic, a NUL, the data */
+    SIM_QUIT,
+} sim_kind_t;
+
+typedef struct {
+    uint8_t     kind;
+    uint8_t     proto;
+    uint8_t     tos;
+    uint8_t     addr[6];
+    int32_t     flag;
+    int32_t     id;
+    int64_t     stamp_us;   /* SIM_DATA: when the origin handed the frame to the mesh */
+    uint16_t    len;
+} sim_hdr_t;
+
+/**
+ * SIM_INFO payload; followed by 'children' then 'table' addresses
+ */
+typedef struct {
+    uint16_t    layer;
+    uint8_t     is_root;
+    uint8_t     connected;
+    uint8_t     parent_bssid[6];
+    uint8_t     root[6];
+    uint16_t    total;
+    uint16_t    children;
+    uint16_t    table;
+} sim_info_t;
+
+/**
+ * SIM_BYE payload; the root fills in what it received and its broker saw
+ */
+#define SIM_REPORT_TEXT     ( 512 )
+
+typedef struct {
+    uint32_t    presses;
+    uint32_t    rx_overflow;
+    uint8_t     is_root;
+    uint32_t    frames_in;          /* esp_mesh_recv() on the root */
+    uint32_t    frame_us[4];        /* p50, p90, p99, max from the origin's send to that */
+    uint32_t    publishes;
+    uint32_t    readings;           /* ESP-send, or records in ESP-batch */
+    uint32_t    summaries;          /* ESP-summary and ESP-alert */
+    int64_t     first_us;           /* first and last reading published */
+    int64_t     last_us;
+    uint32_t    latency_us[4];      /* p50, p90, p99, max from a batched reading's press to its publish */
+    uint32_t    by_ref;             /* publishes the outbox held in a frame buffer */
+    uint32_t    copies;             /* payload copies along the frame path */
+    uint64_t    copied_bytes;
+    uint32_t    pool_peak;          /* most frame buffers in use at once */
+    uint32_t    pool_exhausted;
+    uint32_t    arena_peak;         /* most outbox arena bytes in use at once */
+    root_pipeline_stats_t pipeline; /* receive and route stages */
+    uint32_t    outbox_peak;        /* publish stage: most messages queued */
+    uint32_t    outbox_dropped;
+    uint32_t    outbox_wait_us[3];  /* p50, p99, max from post to publish */
+    uint32_t    frag_sent;          /* large messages this node started */
+    uint32_t    frag_done;
+    uint32_t    frag_failed;
+    uint32_t    frag_resent;        /* fragments sent more than once */
+    uint32_t    frag_us[4];         /* p50, p90, p99, max from frag_send() to the last ack */
+    uint32_t    flood_sent;         /* readings the flooding node queued */
+    int64_t     flood_us;           /* for this long */
+    uint32_t    flood_readings;     /* of them published; not in 'readings' */
+    char        latency_stats[SIM_REPORT_TEXT];  /* last ESP-stats/latency */
+} sim_report_t;
+
+/**
+ * Latency samples, summed up as percentiles at the end
+ */
+typedef struct {
+    uint32_t   *us;
+    size_t      count;
+    size_t      size;
+} sim_latency_t;
+
+void sim_latency_add( sim_latency_t *latency, int64_t us );
+void sim_latency_percentiles( sim_latency_t *latency, uint32_t out[4] );
+
+/**
+ * Node side (sim_mesh.c, sim_mqtt.c, sim_main.c)
+ */
+void sim_node_start( int index, int fd );
+bool sim_node_attached( void );
+uint32_t sim_node_presses( void );
+void sim_mqtt_report( sim_report_t *report );
+void sim_mqtt_deliver( const uint8_t *message, size_t len );
+void sim_load_report( sim_report_t *report );
+int sim_flood_id( void );
+
+/**
+ * Simulator process (sim_hub.c)
+ */
+#define SIM_FLOOD_NODE      ( 1 )   /* index of the flooding node */
+
+typedef struct {
+    int         nodes;
+    int         layers;
+    int         fanout;
+    double      rate;               /* button presses per second and node */
+    int         duration_s;
+    int         join_ms;
+    int         hop_us;
+    int         jitter_us;
+    double      loss;               /* per hop */
+    int         link_fps;           /* frames per second a link carries, 0 unlimited */
+    int         link_queue;         /* frames a link holds before it drops */
+    int         churn_s;            /* a node leaves every 'churn_s', 0 never */
+    int         churn_down_ms;
+    int         sweep_s;            /* cmd/<root>/reregister every 'sweep_s', 0 never */
+    int         frag_s;             /* the deepest node sends a large message every 'frag_s', 0 never */
+    int         flood_fps;          /* readings per second of the flooding node, 0 none */
+    int         broadcast_s;        /* the root presses its button every 'broadcast_s', 0 never */
+    uint32_t    seed;
+} sim_config_t;
+
+int sim_hub_run( const sim_config_t *config, const int *fds );
+
+void sim_mac( int index, uint8_t mac[6] );
+int sim_mac_index( const uint8_t mac[6] );
+
+#endif
@@ -0,0 +1,1270 @@
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_mesh.h"
+#include "esp_timer.h"
+
+#include "mesh_proto.h"
+
+#include "sim.h"
+
+/**
+ * The mesh: a fixed tree, filled layer by layer, that nodes join once
+ * their parent is in, and that carries every frame hop by hop with the
+ * configured latency, loss and link capacity. Everything runs on one
+ * thread around a queue of timed events.
+ */
+#define HUB_GROUPS_MAX      ( 8 )
+#define HUB_OUT_MAX         ( 256 )         /* packets queued for a node before frames to it drop */
+#define HUB_QUIT_WAIT_US    ( 5000000 )
+#define HUB_DRAIN_US        ( CONFIG_APP_BATCH_WINDOW_MS * 1000LL + 1000000 )    /* after the last press, for the readings on their way */
+#define HUB_FLOOD           ( -1 )          /* 'dst' of a group frame on its way down the tree */
+#define HUB_BROADCASTS_MAX  ( 1024 )
+
+typedef enum {
+    HUB_ARRIVE,         /* a frame reaches 'node' */
+    HUB_JOIN,           /* 'node' attaches to its parent */
+    HUB_CHURN,          /* a random node leaves */
+    HUB_SWEEP,          /* the broker asks the root to re-register every node */
+} hub_event_kind_t;
+
+typedef struct hub_packet {
+    struct hub_packet  *next;
+    size_t              len;
+    uint8_t             data[];
+} hub_packet_t;
+
+typedef struct {
+    int64_t     busy_until;     /* the link sends its next frame from then */
+    int64_t     last_arrival;   /* frames arrive in order */
+} hub_link_t;
+
+typedef struct {
+    int             fd;
+    int             parent;
+    int             layer;
+    int             child_first;
+    int             child_count;
+    bool            started;
+    bool            attached;
+    bool            join_pending;
+    bool            bye;
+    bool            acked;      /* got a registration ack since the last sweep */
+    uint8_t         groups[HUB_GROUPS_MAX][6];
+    int             group_count;
+    hub_link_t      up;         /* to the parent */
+    hub_link_t      down;       /* from the parent */
+    hub_packet_t   *out_head;
+    hub_packet_t   *out_tail;
+    int             out_count;
+    sim_report_t    report;
+} hub_node_t;
+
+typedef struct {
+    int64_t             at;
+    hub_event_kind_t    kind;
+    int                 node;
+    int                 src;
+    int                 dst;
+    uint8_t             hops;
+    uint8_t             group[6];   /* HUB_FLOOD: the group address */
+    hub_packet_t       *frame;      /* SIM_DATA packet, for HUB_ARRIVE */
+} hub_event_t;
+
+/**
+ * A root broadcast, told apart by its text number: from the first copy
+ * the root handed the mesh to the last node it reached
+ */
+typedef struct {
+    int32_t     counter;
+    int64_t     sent_at;
+    int64_t     last_at;
+    uint16_t    targets;        /* nodes attached when it was sent, the root aside */
+    uint16_t    reached;
+    uint16_t    sends;          /* esp_mesh_send() calls it took the root */
+} hub_broadcast_t;
+
+typedef struct {
+    uint32_t    sent;
+    uint32_t    delivered;
+    uint32_t    hops;
+    uint32_t    lost;
+    uint32_t    no_route;
+    uint32_t    link_full;
+    uint32_t    node_full;
+    uint32_t    joins;
+    uint32_t    leaves;
+    uint32_t    sweeps;
+    uint32_t    sweeps_done;    /* every attached node acked before the next sweep */
+    int64_t     sweep_max_us;
+    int64_t     sweep_sum_us;
+} hub_stats_t;
+
+static const sim_config_t *cfg;
+static hub_node_t *nodes;
+static hub_event_t *heap;
+static int heap_count;
+static int heap_size;
+static hub_stats_t stats;
+static int64_t sweep_at = -1;       /* the open sweep, -1 when none */
+static hub_broadcast_t broadcasts[HUB_BROADCASTS_MAX];
+static int broadcast_count;
+static uint64_t rand_state;
+
+static uint32_t hub_rand( void )
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return (uint32_t)( rand_state >> 32 );
+}
+
+static double hub_uniform( void )
+{
+    return hub_rand() / 4294967296.0;
+}
+
+/**
+ * Timed events: a binary min-heap on 'at'
+ */
+static void heap_push( const hub_event_t *event )
+{
+    int i;
+
+    if( heap_count == heap_size )
+    {
+        heap_size = heap_size ? heap_size * 2 : 1024;
+        heap = realloc( heap, heap_size * sizeof( *heap ) );
+        if( !heap )
+        {
+            abort();
+        }
+    }
+    for( i = heap_count++; i > 0 && heap[( i - 1 ) / 2].at > event->at; i = ( i - 1 ) / 2 )
+    {
+        heap[i] = heap[( i - 1 ) / 2];
+    }
+    heap[i] = *event;
+}
+
+static void heap_pop( hub_event_t *event )
+{
+    hub_event_t last = heap[--heap_count];
+    int i = 0;
+
+    *event = heap[0];
+    for( ;; )
+    {
+        int child = 2 * i + 1;
+
+        if( child >= heap_count )
+        {
+            break;
+        }
+        if( child + 1 < heap_count && heap[child + 1].at < heap[child].at )
+        {
+            child++;
+        }
+        if( heap[child].at >= last.at )
+        {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+}
+
+/**
+ * Packets to the nodes wait in a queue per node until its socket takes
+ * them, so the hub never blocks on a busy node
+ */
+static hub_packet_t *packet_new( sim_kind_t kind, const uint8_t addr[6], int32_t id, const void *payload,
+                                 size_t len )
+{
+    hub_packet_t *packet = malloc( sizeof( *packet ) + sizeof( sim_hdr_t ) + len );
+    sim_hdr_t hdr = { .kind = kind, .id = id, .len = (uint16_t)len };
+
+    if( !packet )
+    {
+        abort();
+    }
+    if( addr )
+    {
+        memcpy( hdr.addr, addr, 6 );
+    }
+    packet->next = NULL;
+    packet->len = sizeof( hdr ) + len;
+    memcpy( packet->data, &hdr, sizeof( hdr ) );
+    if( len )
+    {
+        memcpy( packet->data + sizeof( hdr ), payload, len );
+    }
+    return packet;
+}
+
+static hub_packet_t *packet_copy( const hub_packet_t *packet )
+{
+    hub_packet_t *copy = malloc( sizeof( *copy ) + packet->len );
+
+    if( !copy )
+    {
+        abort();
+    }
+    memcpy( copy, packet, sizeof( *copy ) + packet->len );
+    copy->next = NULL;
+    return copy;
+}
+
+static void node_queue( int index, hub_packet_t *packet )
+{
+    hub_node_t *node = &nodes[index];
+
+    if( node->out_tail )
+    {
+        node->out_tail->next = packet;
+    }
+    else
+    {
+        node->out_head = packet;
+    }
+    node->out_tail = packet;
+    node->out_count++;
+}
+
+static void node_flush( int index )
+{
+    hub_node_t *node = &nodes[index];
+    hub_packet_t *packet;
+
+    while( ( packet = node->out_head ) != NULL )
+    {
+        if( send( node->fd, packet->data, packet->len, MSG_DONTWAIT | MSG_NOSIGNAL ) < 0 )
+        {
+            if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+            {
+                return;
+            }
+            /* the node died: nothing more reaches it */
+        }
+        node->out_head = packet->next;
+        if( !node->out_head )
+        {
+            node->out_tail = NULL;
+        }
+        node->out_count--;
+        free( packet );
+    }
+}
+
+/**
+ * Tree
+ */
+static bool node_reachable( int index )
+{
+    for( ; index >= 0; index = nodes[index].parent )
+    {
+        if( !nodes[index].attached )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Appends the addresses of 'index' and of the nodes attached below it
+ */
+static int subtree_macs( int index, uint8_t *macs, int count )
+{
+    hub_node_t *node = &nodes[index];
+
+    sim_mac( index, &macs[count * 6] );
+    count++;
+    for( int c = node->child_first; c < node->child_first + node->child_count; c++ )
+    {
+        if( nodes[c].attached )
+        {
+            count = subtree_macs( c, macs, count );
+        }
+    }
+    return count;
+}
+
+static int subtree_size( int index )
+{
+    int count = 1;
+
+    for( int c = nodes[index].child_first; c < nodes[index].child_first + nodes[index].child_count; c++ )
+    {
+        if( nodes[c].attached )
+        {
+            count += subtree_size( c );
+        }
+    }
+    return count;
+}
+
+static int total_nodes( void )
+{
+    return nodes[0].attached ? subtree_size( 0 ) : 0;
+}
+
+static void send_info( int index )
+{
+    hub_node_t *node = &nodes[index];
+    size_t size = sizeof( sim_info_t ) + ( node->child_count + cfg->nodes ) * 6;
+    uint8_t *payload = malloc( size );
+    uint8_t *children = payload + sizeof( sim_info_t );
+    sim_info_t info = {
+        .layer = (uint16_t)node->layer,
+        .is_root = node->parent < 0,
+        .connected = node->attached,
+        .total = (uint16_t)total_nodes(),
+    };
+    static const uint8_t router[6] = SIM_ROUTER_BSSID;
+
+    if( !payload )
+    {
+        abort();
+    }
+    if( node->parent < 0 )
+    {
+        memcpy( info.parent_bssid, router, 6 );
+    }
+    else
+    {
+        sim_mac( node->parent, info.parent_bssid );
+        info.parent_bssid[5]++;
+    }
+    sim_mac( 0, info.root );
+    for( int c = node->child_first; c < node->child_first + node->child_count; c++ )
+    {
+        if( nodes[c].attached )
+        {
+            sim_mac( c, &children[info.children++ * 6] );
+        }
+    }
+    info.table = (uint16_t)subtree_macs( index, children + info.children * 6, 0 );
+    memcpy( payload, &info, sizeof( info ) );
+    node_queue( index, packet_new( SIM_INFO, NULL, 0, payload,
+                                   sizeof( info ) + ( info.children + info.table ) * 6 ) );
+    free( payload );
+}
+
+static void send_event( int index, mesh_event_id_t id, const void *data, size_t len )
+{
+    node_queue( index, packet_new( SIM_EVENT, NULL, id, data, len ) );
+}
+
+static void schedule_join( int index, int64_t now, int delay_ms )
+{
+    hub_event_t event = { .kind = HUB_JOIN, .node = index };
+
+    if( nodes[index].join_pending || nodes[index].attached )
+    {
+        return;
+    }
+    /* a little spread, as nodes never find their parent at the same instant */
+    event.at = now + delay_ms * 1000LL + hub_rand() % ( cfg->join_ms * 500LL + 1 );
+    nodes[index].join_pending = true;
+    heap_push( &event );
+}
+
+/**
+ * Tells the ancestors of 'index', up to the first one cut off from the
+ * root, that its subtree of 'size' nodes came or went
+ */
+static void notify_ancestors( int index, mesh_event_id_t id, int size )
+{
+    for( int a = nodes[index].parent; a >= 0; a = nodes[a].parent )
+    {
+        mesh_event_routing_table_change_t change = {
+            .rt_size_new = (uint16_t)subtree_size( a ),
+            .rt_size_change = (uint16_t)size,
+        };
+
+        send_info( a );
+        send_event( a, id, &change, sizeof( change ) );
+        if( !nodes[a].attached )
+        {
+            break;
+        }
+    }
+}
+
+static void node_attach( int index, int64_t now )
+{
+    hub_node_t *node = &nodes[index];
+    mesh_event_connected_t connected = { .self_layer = (uint16_t)node->layer };
+    mesh_event_root_address_t root;
+    static const uint8_t router[6] = SIM_ROUTER_BSSID;
+
+    node->attached = true;
+    node->join_pending = false;
+    stats.joins++;
+
+    send_info( index );
+    if( node->parent < 0 )
+    {
+        memcpy( connected.connected.bssid, router, 6 );
+    }
+    else
+    {
+        sim_mac( node->parent, connected.connected.bssid );
+        connected.connected.bssid[5]++;
+    }
+    connected.connected.channel = 1;
+    send_event( index, MESH_EVENT_PARENT_CONNECTED, &connected, sizeof( connected ) );
+    if( node->parent < 0 )
+    {
+        mesh_event_toDS_state_t state = MESH_TODS_REACHABLE;
+
+        send_event( index, MESH_EVENT_TODS_STATE, &state, sizeof( state ) );
+    }
+    else
+    {
+        mesh_event_child_connected_t child = { .aid = (uint8_t)( index - nodes[node->parent].child_first + 1 ),
+                                               .is_mesh_child = true };
+
+        sim_mac( index, child.mac );
+        send_info( node->parent );
+        send_event( node->parent, MESH_EVENT_CHILD_CONNECTED, &child, sizeof( child ) );
+        notify_ancestors( index, MESH_EVENT_ROUTING_TABLE_ADD, subtree_size( index ) );
+    }
+    sim_mac( 0, root.addr );
+    send_event( index, MESH_EVENT_ROOT_ADDRESS, &root, sizeof( root ) );
+
+    for( int c = node->child_first; c < node->child_first + node->child_count; c++ )
+    {
+        if( nodes[c].started )
+        {
+            schedule_join( c, now, cfg->join_ms );
+        }
+    }
+}
+
+static void node_detach( int index, int64_t now )
+{
+    hub_node_t *node = &nodes[index];
+    mesh_event_disconnected_t disconnected = { .reason = 8 };    /* WIFI_REASON_ASSOC_LEAVE */
+
+    if( !node->attached )
+    {
+        return;
+    }
+    node->attached = false;
+    stats.leaves++;
+
+    send_info( index );
+    send_event( index, MESH_EVENT_PARENT_DISCONNECTED, &disconnected, sizeof( disconnected ) );
+    if( node->parent >= 0 )
+    {
+        mesh_event_child_disconnected_t child = { .aid = (uint8_t)( index - nodes[node->parent].child_first + 1 ),
+                                                  .is_mesh_child = true };
+
+        sim_mac( index, child.mac );
+        send_info( node->parent );
+        send_event( node->parent, MESH_EVENT_CHILD_DISCONNECTED, &child, sizeof( child ) );
+        notify_ancestors( index, MESH_EVENT_ROUTING_TABLE_REMOVE, subtree_size( index ) );
+    }
+}
+
+static void churn( int64_t now )
+{
+    hub_event_t event = { .kind = HUB_CHURN, .at = now + cfg->churn_s * 1000000LL };
+    int candidates = 0;
+    int pick = -1;
+
+    /* a node picked at random among the attached ones, never the root */
+    for( int i = 1; i < cfg->nodes; i++ )
+    {
+        if( nodes[i].attached && hub_rand() % ++candidates == 0 )
+        {
+            pick = i;
+        }
+    }
+    if( pick > 0 )
+    {
+        node_detach( pick, now );
+        schedule_join( pick, now, cfg->churn_down_ms );
+    }
+    heap_push( &event );
+}
+
+/**
+ * Re-registration sweeps: the root gets cmd/<its id>/reregister from the
+ * broker, the sweep is done once every attached node saw an ack again
+ */
+static void sweep( int64_t now )
+{
+    /* the root, node 0, has id 1; the message has no data */
+    static const char message[] = "cmd/1/reregister";
+    hub_event_t event = { .kind = HUB_SWEEP, .at = now + cfg->sweep_s * 1000000LL };
+
+    for( int i = 0; i < cfg->nodes; i++ )
+    {
+        nodes[i].acked = false;
+    }
+    sweep_at = now;
+    stats.sweeps++;
+    node_queue( 0, packet_new( SIM_MQTT, NULL, 0, message, sizeof( message ) ) );
+    if( event.at < cfg->duration_s * 1000000LL )
+    {
+        heap_push( &event );
+    }
+}
+
+static void sweep_acked( int index, const hub_packet_t *frame, int64_t now )
+{
+    const sim_hdr_t *hdr = (const sim_hdr_t *)frame->data;
+    mesh_frame_t decoded;
+
+    if( sweep_at < 0 || hdr->proto != MESH_PROTO_BIN ||
+        mesh_proto_decode( frame->data + sizeof( *hdr ), hdr->len, &decoded ) != 0 ||
+        decoded.type != MESH_MSG_CONNECT_ACK )
+    {
+        return;
+    }
+    nodes[index].acked = true;
+    for( int i = 1; i < cfg->nodes; i++ )
+    {
+        if( nodes[i].attached && !nodes[i].acked )
+        {
+            return;
+        }
+    }
+    stats.sweeps_done++;
+    stats.sweep_sum_us += now - sweep_at;
+    if( now - sweep_at > stats.sweep_max_us )
+    {
+        stats.sweep_max_us = now - sweep_at;
+    }
+    sweep_at = -1;
+}
+
+/**
+ * Frames
+ */
+static bool is_ancestor( int ancestor, int index )
+{
+    for( ; index >= 0 && nodes[index].layer >= nodes[ancestor].layer; index = nodes[index].parent )
+    {
+        if( index == ancestor )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int next_hop( int at, int dst )
+{
+    if( !is_ancestor( at, dst ) )
+    {
+        return nodes[at].parent;
+    }
+    while( nodes[dst].parent != at )
+    {
+        dst = nodes[dst].parent;
+    }
+    return dst;
+}
+
+static bool is_member( int index, const uint8_t group[6] )
+{
+    for( int g = 0; g < nodes[index].group_count; g++ )
+    {
+        if( !memcmp( nodes[index].groups[g], group, 6 ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool subtree_member( int index, const uint8_t group[6] )
+{
+    if( is_member( index, group ) )
+    {
+        return true;
+    }
+    for( int c = nodes[index].child_first; c < nodes[index].child_first + nodes[index].child_count; c++ )
+    {
+        if( nodes[c].attached && subtree_member( c, group ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Sends the frame of 'event', now at event->node, over the link to
+ * 'next', a neighbour
+ */
+static void hop( hub_event_t *event, int next, int64_t now )
+{
+    int at = event->node;
+    bool up = next == nodes[at].parent;
+    hub_link_t *link = up ? &nodes[at].up : &nodes[next].down;
+    int64_t start = now > link->busy_until ? now : link->busy_until;
+    int64_t arrival;
+
+    /* a hop over a link that is down, or to a node that left */
+    if( up ? !nodes[at].attached : !nodes[next].attached )
+    {
+        stats.no_route++;
+        free( event->frame );
+        return;
+    }
+    if( cfg->link_fps )
+    {
+        int64_t service = 1000000LL / cfg->link_fps;
+
+        if( start - now > service * cfg->link_queue )
+        {
+            stats.link_full++;
+            free( event->frame );
+            return;
+        }
+        link->busy_until = start + service;
+    }
+    if( cfg->loss > 0 && hub_uniform() < cfg->loss )
+    {
+        stats.lost++;
+        free( event->frame );
+        return;
+    }
+    arrival = start + cfg->hop_us + ( cfg->jitter_us ? hub_rand() % ( cfg->jitter_us + 1 ) : 0 );
+    if( arrival < link->last_arrival )
+    {
+        arrival = link->last_arrival;
+    }
+    link->last_arrival = arrival;
+    event->at = arrival;
+    event->node = next;
+    event->hops++;
+    heap_push( event );
+}
+
+static void forward( hub_event_t *event, int64_t now )
+{
+    hop( event, next_hop( event->node, event->dst ), now );
+}
+
+/**
+ * Root broadcasts: the root's text numbers; anything else is not one
+ */
+static hub_broadcast_t *broadcast_find( const uint8_t *payload, size_t len, bool add, int64_t now )
+{
+    int32_t counter;
+
+    if( len < 2 || payload[len - 1] != '\0' || !isdigit( payload[0] ) )
+    {
+        return NULL;
+    }
+    counter = (int32_t)strtol( (const char *)payload, NULL, 10 );
+    for( int i = broadcast_count - 1; i >= 0; i-- )
+    {
+        if( broadcasts[i].counter == counter )
+        {
+            return &broadcasts[i];
+        }
+    }
+    if( !add || broadcast_count == HUB_BROADCASTS_MAX )
+    {
+        return NULL;
+    }
+    broadcasts[broadcast_count] = (hub_broadcast_t){ .counter = counter, .sent_at = now };
+    for( int i = 1; i < cfg->nodes; i++ )
+    {
+        broadcasts[broadcast_count].targets += nodes[i].attached;
+    }
+    return &broadcasts[broadcast_count++];
+}
+
+static void broadcast_reached( const hub_packet_t *frame, int64_t now )
+{
+    const sim_hdr_t *hdr = (const sim_hdr_t *)frame->data;
+    hub_broadcast_t *broadcast;
+
+    if( hdr->proto != MESH_PROTO_JSON ||
+        !( broadcast = broadcast_find( frame->data + sizeof( *hdr ), hdr->len, false, now ) ) )
+    {
+        return;
+    }
+    broadcast->reached++;
+    broadcast->last_at = now;
+}
+
+static void deliver( hub_event_t *event, int64_t now )
+{
+    if( nodes[event->node].out_count >= HUB_OUT_MAX )
+    {
+        stats.node_full++;
+        free( event->frame );
+        return;
+    }
+    stats.delivered++;
+    stats.hops += event->hops;
+    sweep_acked( event->node, event->frame, now );
+    if( event->src == 0 )
+    {
+        broadcast_reached( event->frame, now );
+    }
+    node_queue( event->node, event->frame );
+}
+
+/**
+ * A group frame from the root, now at event->node: the mesh replicates
+ * it down the tree, one copy over every link with members below, and
+ * hands it up at every member on the way
+ */
+static void flood( hub_event_t *event, int64_t now )
+{
+    const hub_node_t *node = &nodes[event->node];
+
+    for( int c = node->child_first; c < node->child_first + node->child_count; c++ )
+    {
+        hub_event_t copy = *event;
+
+        if( !nodes[c].attached || !subtree_member( c, event->group ) )
+        {
+            continue;
+        }
+        copy.frame = packet_copy( event->frame );
+        hop( &copy, c, now );
+    }
+    if( event->node != event->src && is_member( event->node, event->group ) )
+    {
+        deliver( event, now );
+    }
+    else
+    {
+        free( event->frame );
+    }
+}
+
+static void arrive( hub_event_t *event, int64_t now )
+{
+    if( event->dst == HUB_FLOOD )
+    {
+        flood( event, now );
+    }
+    else if( event->node != event->dst )
+    {
+        forward( event, now );
+    }
+    else
+    {
+        deliver( event, now );
+    }
+}
+
+/**
+ * The SIM_DATA packet the mesh carries for a send of 'src'
+ */
+static hub_packet_t *data_packet( int src, const sim_hdr_t *hdr, const uint8_t *payload, int64_t now )
+{
+    hub_packet_t *frame = packet_new( SIM_DATA, NULL, 0, payload, hdr->len );
+    sim_hdr_t data = *hdr;
+
+    data.kind = SIM_DATA;
+    data.stamp_us = now;
+    sim_mac( src, data.addr );
+    memcpy( frame->data, &data, sizeof( data ) );
+    return frame;
+}
+
+static void route( int src, int dst, const sim_hdr_t *hdr, const uint8_t *payload, int64_t now )
+{
+    hub_event_t event = { .kind = HUB_ARRIVE, .node = src, .src = src, .dst = dst, .at = now };
+
+    event.frame = data_packet( src, hdr, payload, now );
+    stats.sent++;
+    arrive( &event, now );
+}
+
+static void on_send( int src, const sim_hdr_t *hdr, const uint8_t *payload, int64_t now )
+{
+    static const uint8_t zero[6] = { 0, };
+    hub_broadcast_t *broadcast;
+    int dst;
+
+    if( src == 0 && hdr->proto == MESH_PROTO_JSON && ( broadcast = broadcast_find( payload, hdr->len, true, now ) ) )
+    {
+        broadcast->sends++;
+    }
+    if( hdr->flag & MESH_DATA_GROUP )
+    {
+        /**
+         * From the root, down the tree; from anywhere else, to every
+         * member on its own
+         */
+        if( src == 0 )
+        {
+            hub_event_t event = { .kind = HUB_ARRIVE, .node = 0, .src = 0, .dst = HUB_FLOOD, .at = now };
+
+            memcpy( event.group, hdr->addr, 6 );
+            event.frame = data_packet( src, hdr, payload, now );
+            stats.sent++;
+            flood( &event, now );
+            return;
+        }
+        for( int i = 0; i < cfg->nodes; i++ )
+        {
+            if( i != src && is_member( i, hdr->addr ) )
+            {
+                route( src, i, hdr, payload, now );
+            }
+        }
+        return;
+    }
+    dst = memcmp( hdr->addr, zero, 6 ) ? sim_mac_index( hdr->addr ) : 0;
+    if( dst < 0 || dst >= cfg->nodes )
+    {
+        stats.sent++;
+        stats.no_route++;
+        return;
+    }
+    route( src, dst, hdr, payload, now );
+}
+
+static void on_packet( int index, const uint8_t *packet, size_t len, int64_t now )
+{
+    hub_node_t *node = &nodes[index];
+    sim_hdr_t hdr;
+
+    if( len < sizeof( hdr ) )
+    {
+        return;
+    }
+    memcpy( &hdr, packet, sizeof( hdr ) );
+    if( len < sizeof( hdr ) + hdr.len )
+    {
+        return;
+    }
+    packet += sizeof( hdr );
+    switch( hdr.kind )
+    {
+        case SIM_HELLO:
+            /* a restarted mesh leaves its parent and scans again */
+            node_detach( index, now );
+            node->started = true;
+            if( node->parent < 0 || nodes[node->parent].attached )
+            {
+                schedule_join( index, now, cfg->join_ms );
+            }
+            break;
+
+        case SIM_SEND:
+            on_send( index, &hdr, packet, now );
+            break;
+
+        case SIM_GROUPS:
+            node->group_count = hdr.len / 6 < HUB_GROUPS_MAX ? hdr.len / 6 : HUB_GROUPS_MAX;
+            memcpy( node->groups, packet, node->group_count * 6 );
+            break;
+
+        case SIM_BYE:
+            if( hdr.len >= sizeof( node->report ) )
+            {
+                memcpy( &node->report, packet, sizeof( node->report ) );
+            }
+            node->bye = true;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Waits for packets until 'until', or the next timed event
+ */
+static void hub_poll( struct pollfd *fds, int64_t until )
+{
+    static uint8_t packet[SIM_PACKET_MAX];
+    int64_t now = esp_timer_get_time();
+    int64_t wait = ( heap_count && heap[0].at < until ? heap[0].at : until ) - now;
+    struct timespec timeout = { 0, 0 };
+    ssize_t len;
+
+    if( wait > 0 )
+    {
+        timeout.tv_sec = wait / 1000000;
+        timeout.tv_nsec = ( wait % 1000000 ) * 1000;
+    }
+    for( int i = 0; i < cfg->nodes; i++ )
+    {
+        fds[i].fd = nodes[i].fd;
+        fds[i].events = POLLIN | ( nodes[i].out_head ? POLLOUT : 0 );
+        fds[i].revents = 0;
+    }
+    if( ppoll( fds, cfg->nodes, &timeout, NULL ) < 0 && errno != EINTR )
+    {
+        perror( "ppoll" );
+        exit( 1 );
+    }
+
+    now = esp_timer_get_time();
+    for( int i = 0; i < cfg->nodes; i++ )
+    {
+        if( !( fds[i].revents & ( POLLIN | POLLHUP | POLLERR ) ) )
+        {
+            continue;
+        }
+        while( ( len = recv( nodes[i].fd, packet, sizeof( packet ), MSG_DONTWAIT ) ) > 0 )
+        {
+            on_packet( i, packet, (size_t)len, now );
+        }
+        if( len == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) )
+        {
+            /* the node's process exited */
+            close( nodes[i].fd );
+            nodes[i].fd = -1;
+            nodes[i].bye = true;
+        }
+    }
+
+    while( heap_count && heap[0].at <= now )
+    {
+        hub_event_t event;
+
+        heap_pop( &event );
+        switch( event.kind )
+        {
+            case HUB_ARRIVE:
+                arrive( &event, now );
+                break;
+
+            case HUB_JOIN:
+                nodes[event.node].join_pending = false;
+                if( event.node == 0 || node_reachable( nodes[event.node].parent ) )
+                {
+                    node_attach( event.node, now );
+                }
+                break;
+
+            case HUB_CHURN:
+                churn( now );
+                break;
+
+            case HUB_SWEEP:
+                sweep( now );
+                break;
+        }
+    }
+
+    for( int i = 0; i < cfg->nodes; i++ )
+    {
+        if( nodes[i].fd >= 0 )
+        {
+            node_flush( i );
+        }
+    }
+}
+
+static double percent( uint32_t part, uint32_t whole )
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+/**
+ * Root broadcasts that reached every node attached when they were sent
+ */
+static int broadcasts_complete( void )
+{
+    int complete = 0;
+
+    for( int i = 0; i < broadcast_count; i++ )
+    {
+        complete += broadcasts[i].reached >= broadcasts[i].targets;
+    }
+    return complete;
+}
+
+static void hub_report( int64_t elapsed_us )
+{
+    const sim_report_t *root = &nodes[0].report;
+    uint32_t presses = 0;
+    uint32_t rx_overflow = 0;
+    int reported = 0;
+    int attached = 0;
+    double window_s = ( root->last_us - root->first_us ) / 1e6;
+
+    for( int i = 0; i < cfg->nodes; i++ )
+    {
+        presses += nodes[i].report.presses;
+        rx_overflow += nodes[i].report.rx_overflow;
+        reported += nodes[i].bye;
+        attached += nodes[i].attached;
+    }
+
+    printf( "mesh: %d nodes (%d attached at the end), %d layers, fan-out %d, "
+            "%.1f presses/s per node for %d s, %.1f s in all\n",
+            cfg->nodes, attached, cfg->layers, cfg->fanout, cfg->rate, cfg->duration_s, elapsed_us / 1e6 );
+    printf( "  links    %d us + up to %d us per hop, loss %.2f%%, %s\n", cfg->hop_us, cfg->jitter_us,
+            cfg->loss * 100, cfg->link_fps ? "limited" : "unlimited" );
+    if( cfg->link_fps )
+    {
+        printf( "           %d frames/s per link, %d queued at most\n", cfg->link_fps, cfg->link_queue );
+    }
+    printf( "  frames   %u sent, %u delivered (%.2f hops each), %u lost, %u unroutable, "
+            "%u link full, %u node busy, %u receive queue full\n",
+            stats.sent, stats.delivered, stats.delivered ? (double)stats.hops / stats.delivered : 0.0,
+            stats.lost, stats.no_route, stats.link_full, stats.node_full, rx_overflow );
+    printf( "  tree     %u joins, %u leaves\n", stats.joins, stats.leaves );
+    if( stats.sweeps )
+    {
+        printf( "  sweeps   %u of %u re-registered every node, in %.1f ms on average, %.1f ms at most\n",
+                stats.sweeps_done, stats.sweeps,
+                stats.sweeps_done ? stats.sweep_sum_us / 1e3 / stats.sweeps_done : 0.0, stats.sweep_max_us / 1e3 );
+    }
+    if( broadcast_count )
+    {
+        sim_latency_t fanout = { 0, };
+        uint32_t fanout_us[4] = { 0, };
+        uint32_t targets = 0;
+        uint32_t sends = 0;
+
+        for( int i = 0; i < broadcast_count; i++ )
+        {
+            targets += broadcasts[i].targets;
+            sends += broadcasts[i].sends;
+            if( broadcasts[i].reached )
+            {
+                sim_latency_add( &fanout, broadcasts[i].last_at - broadcasts[i].sent_at );
+            }
+        }
+        sim_latency_percentiles( &fanout, fanout_us );
+        printf( "  fan-out  %d of %d root broadcasts reached every node, %.1f nodes and %.1f sends each (%s)\n",
+                broadcasts_complete(), broadcast_count, (double)targets / broadcast_count,
+                (double)sends / broadcast_count, CONFIG_MESH_FANOUT_GROUP ? "group send" : "one unicast per node" );
+        printf( "           first send to last node: p50 %.1f ms, p90 %.1f ms, max %.1f ms\n", fanout_us[0] / 1e3,
+                fanout_us[1] / 1e3, fanout_us[3] / 1e3 );
+        free( fanout.us );
+    }
+    for( int i = 0; i < cfg->nodes; i++ )
+    {
+        const sim_report_t *node = &nodes[i].report;
+
+        if( !node->frag_sent )
+        {
+            continue;
+        }
+        printf( "  frag     %u of %u %d-byte messages from layer %d acknowledged, %u failed, "
+                "%u fragments resent\n", node->frag_done, node->frag_sent, CONFIG_APP_FRAG_MAX_MSG,
+                nodes[i].layer, node->frag_failed, node->frag_resent );
+        if( node->frag_us[3] )
+        {
+            printf( "           p50 %.1f ms (%.1f kB/s), p90 %.1f ms, max %.1f ms\n", node->frag_us[0] / 1e3,
+                    CONFIG_APP_FRAG_MAX_MSG * 1e6 / 1024 / node->frag_us[0], node->frag_us[1] / 1e3,
+                    node->frag_us[3] / 1e3 );
+        }
+    }
+    if( !root->is_root )
+    {
+        printf( "  root     no report (%d of %d nodes answered)\n", reported, cfg->nodes );
+        return;
+    }
+    printf( "  root     %u frames in (%.1f/s), %u publishes\n", root->frames_in,
+            root->frames_in / ( elapsed_us / 1e6 ), root->publishes );
+    if( root->frames_in )
+    {
+        printf( "  latency  send to root receive: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+                root->frame_us[0] / 1e3, root->frame_us[1] / 1e3, root->frame_us[2] / 1e3,
+                root->frame_us[3] / 1e3 );
+    }
+    printf( "  readings %u of %u button presses published (%.1f%%), %.1f/s, %u summaries and alerts\n",
+            root->readings, presses, percent( root->readings, presses ),
+            window_s > 0 ? root->readings / window_s : 0.0, root->summaries );
+    if( cfg->flood_fps )
+    {
+        const sim_report_t *flood = &nodes[SIM_FLOOD_NODE].report;
+        double flood_s = flood->flood_us / 1e6;
+
+        printf( "  flood    node %d: %u readings in %.1f s (%.0f/s), %u published (%.1f/s, limit %d/s + %d), "
+                "%u over rate and %u over queue at the root\n", SIM_FLOOD_NODE + 1, flood->flood_sent, flood_s,
+                flood_s > 0 ? flood->flood_sent / flood_s : 0.0, root->flood_readings,
+                flood_s > 0 ? root->flood_readings / flood_s : 0.0, CONFIG_APP_ROOT_NODE_RATE,
+                CONFIG_APP_ROOT_NODE_BURST, root->pipeline.limited, root->pipeline.flow_full );
+    }
+    if( root->latency_us[3] )
+    {
+        printf( "  latency  press to publish: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+                root->latency_us[0] / 1e3, root->latency_us[1] / 1e3, root->latency_us[2] / 1e3,
+                root->latency_us[3] / 1e3 );
+    }
+    if( root->publishes )
+    {
+        printf( "  copies   %.2f per MQTT message (%.0f bytes), %u of %u publishes by reference\n",
+                (double)root->copies / root->publishes, (double)root->copied_bytes / root->publishes,
+                root->by_ref, root->publishes );
+        printf( "  buffers  pool peak %u of %d, %u times empty; outbox arena peak %u of %d bytes\n",
+                root->pool_peak, CONFIG_APP_FRAME_POOL_BUFS, root->pool_exhausted, root->arena_peak,
+                CONFIG_APP_MQTT_OUTBOX_ARENA_SIZE );
+    }
+    if( root->pipeline.rx.frames )
+    {
+        const root_pipeline_stats_t *pipe = &root->pipeline;
+
+        printf( "  pipeline receive %u frames in %u batches (%u at most), stack backlog peak %u, "
+                "%.0f us per batch, %u us at most\n", pipe->rx.frames, pipe->batches, pipe->batch_max,
+                pipe->rx.peak_depth, pipe->batches ? (double)pipe->rx.busy_us / pipe->batches : 0.0,
+                pipe->rx.max_us );
+        printf( "           route %u frames, queue peak %u, %u dropped, %.0f us per frame, %u us at most\n",
+                pipe->route.frames, pipe->route.peak_depth, pipe->route.dropped,
+                pipe->route.frames ? (double)pipe->route.busy_us / pipe->route.frames : 0.0, pipe->route.max_us );
+        printf( "           publish %u messages, outbox peak %u, %u dropped, wait p50 %.1f ms, p99 %.1f ms, "
+                "max %.1f ms\n", root->publishes, root->outbox_peak, root->outbox_dropped,
+                root->outbox_wait_us[0] / 1e3, root->outbox_wait_us[1] / 1e3, root->outbox_wait_us[2] / 1e3 );
+    }
+    if( root->latency_stats[0] )
+    {
+        printf( "  ESP-stats/latency %s\n", root->latency_stats );
+    }
+}
+
+int sim_hub_run( const sim_config_t *config, const int *fds )
+{
+    struct pollfd *poll_fds;
+    int64_t start = esp_timer_get_time();
+    int64_t end = config->duration_s * 1000000LL + HUB_DRAIN_US;
+    int64_t deadline;
+    int next_child = 1;
+    int layer_first = 0;
+    int layer_count = 1;
+
+    cfg = config;
+    rand_state = ( (uint64_t)config->seed << 32 ) ^ 0x9e3779b97f4a7c15ull;
+    nodes = calloc( config->nodes, sizeof( *nodes ) );
+    poll_fds = calloc( config->nodes, sizeof( *poll_fds ) );
+    if( !nodes || !poll_fds )
+    {
+        return -1;
+    }
+
+    /**
+     * The tree, layer by layer: node i's children are the next free
+     * indices, so every layer is a contiguous range
+     */
+    nodes[0].parent = -1;
+    nodes[0].layer = MESH_ROOT_LAYER;
+    for( int layer = MESH_ROOT_LAYER; next_child < config->nodes; layer++ )
+    {
+        int next_count = 0;
+
+        for( int p = layer_first; p < layer_first + layer_count; p++ )
+        {
+            nodes[p].child_first = next_child;
+            for( int c = 0; c < config->fanout && next_child < config->nodes; c++ )
+            {
+                nodes[next_child].parent = p;
+                nodes[next_child].layer = layer + 1;
+                nodes[p].child_count++;
+                next_child++;
+                next_count++;
+            }
+        }
+        layer_first += layer_count;
+        layer_count = next_count;
+    }
+    for( int i = 0; i < config->nodes; i++ )
+    {
+        nodes[i].fd = fds[i];
+    }
+    if( config->churn_s )
+    {
+        hub_event_t event = { .kind = HUB_CHURN, .at = start + config->churn_s * 1000000LL };
+
+        heap_push( &event );
+    }
+    if( config->sweep_s )
+    {
+        hub_event_t event = { .kind = HUB_SWEEP, .at = start + config->sweep_s * 1000000LL };
+
+        heap_push( &event );
+    }
+
+    while( esp_timer_get_time() < end )
+    {
+        hub_poll( poll_fds, end );
+    }
+
+    /**
+     * Every node answers with its counters, the root with what it published
+     */
+    for( int i = 0; i < config->nodes; i++ )
+    {
+        node_queue( i, packet_new( SIM_QUIT, NULL, 0, NULL, 0 ) );
+    }
+    deadline = esp_timer_get_time() + HUB_QUIT_WAIT_US;
+    for( ;; )
+    {
+        int waiting = 0;
+
+        for( int i = 0; i < config->nodes; i++ )
+        {
+            waiting += !nodes[i].bye;
+        }
+        if( !waiting || esp_timer_get_time() > deadline )
+        {
+            break;
+        }
+        hub_poll( poll_fds, esp_timer_get_time() + 100000 );
+    }
+
+    hub_report( end );
+    free( poll_fds );
+    if( nodes[0].report.readings == 0 || stats.sweeps_done != stats.sweeps )
+    {
+        return 1;
+    }
+    if( config->flood_fps )
+    {
+        /**
+         * The flooding node gets its rate, in whole frames, and no more;
+         * the others lose nothing to it
+         */
+        const sim_report_t *flood = &nodes[SIM_FLOOD_NODE].report;
+        const sim_report_t *root = &nodes[0].report;
+        double allowed = CONFIG_APP_ROOT_NODE_RATE * ( flood->flood_us / 1e6 );
+        uint32_t presses = 0;
+
+        for( int i = 0; i < config->nodes; i++ )
+        {
+            presses += nodes[i].report.presses;
+        }
+        if( root->flood_readings > allowed + CONFIG_APP_ROOT_NODE_BURST + 1 ||
+            ( flood->flood_sent > allowed + CONFIG_APP_ROOT_NODE_BURST && root->flood_readings < allowed ) ||
+            root->readings < presses * 0.95 )
+        {
+            return 1;
+        }
+    }
+    if( config->broadcast_s && config->loss == 0 && !config->churn_s &&
+        ( !broadcast_count || broadcasts_complete() != broadcast_count ) )
+    {
+        /* on links that lose nothing, every broadcast reaches every node */
+        return 1;
+    }
+    if( config->frag_s )
+    {
+        const sim_report_t *deepest = &nodes[config->nodes - 1].report;
+
+        if( !deepest->frag_sent || deepest->frag_done != deepest->frag_sent )
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
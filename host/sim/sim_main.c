@@ -0,0 +1,426 @@
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "sys_config.h"
+#include "app.h"
+#include "frag.h"
+#include "mesh_proto.h"
+#include "registration.h"
+#include "tx_queue.h"
+#include "sim.h"
+
+/**
+ * mesh_sim_host: runs the firmware of every node of a simulated mesh,
+ * each node in a process of its own, and reports the throughput and
+ * latency of the readings at the root. The buttons are pressed for the
+ * given duration, then the mesh runs a while longer so that the last
+ * readings can reach the broker.
+ */
+#define SIM_PRESS_HOLD_MS   ( 5 )
+#define SIM_FRAG_POLL_MS    ( 1 )
+
+void app_main( void );
+
+static uint32_t presses = 0;
+static portMUX_TYPE frag_lock = portMUX_INITIALIZER_UNLOCKED;
+static sim_latency_t frag_latency;
+static uint32_t frag_sent = 0;
+static int64_t load_end_us;
+static int flood_id = 0;
+static uint32_t flood_sent = 0;
+static int64_t flood_us = 0;
+
+uint32_t sim_node_presses( void )
+{
+    return __atomic_load_n( &presses, __ATOMIC_RELAXED );
+}
+
+/**
+ * Fragmentation benchmark: a message of CONFIG_APP_FRAG_MAX_MSG bytes to
+ * the root every 'arg' seconds until the presses end, through the
+ * firmware's own sender, timed until the receiver acknowledged all of
+ * it; the root drops FRAG_KIND_BENCH on arrival
+ */
+static void task_sim_frag( void *arg )
+{
+    static uint8_t message[CONFIG_APP_FRAG_MAX_MSG];
+    int period_s = (int)(intptr_t)arg;
+
+    for( size_t i = 0; i < sizeof( message ); i++ )
+    {
+        message[i] = (uint8_t)i;
+    }
+    for( ;; )
+    {
+        frag_stats_t before, after;
+        int64_t start;
+
+        vTaskDelay( pdMS_TO_TICKS( period_s * 1000 ) );
+        if( esp_timer_get_time() > load_end_us )
+        {
+            break;
+        }
+        frag_get_stats( &before );
+        start = esp_timer_get_time();
+        if( !sim_node_attached() || frag_send( NULL, FRAG_KIND_BENCH, message, sizeof( message ) ) != ESP_OK )
+        {
+            continue;
+        }
+        __atomic_add_fetch( &frag_sent, 1, __ATOMIC_RELAXED );
+        do
+        {
+            vTaskDelay( pdMS_TO_TICKS( SIM_FRAG_POLL_MS ) );
+            frag_get_stats( &after );
+        } while( after.tx_done == before.tx_done && after.tx_failed == before.tx_failed );
+        if( after.tx_done != before.tx_done )
+        {
+            portENTER_CRITICAL( &frag_lock );
+            sim_latency_add( &frag_latency, esp_timer_get_time() - start );
+            portEXIT_CRITICAL( &frag_lock );
+        }
+    }
+    vTaskDelete( NULL );
+}
+
+/**
+ * Flooding node: readings at 'arg' frames/s from registration until the
+ * presses end, queued as the button queues them, for the root's rate
+ * limit and round robin to hold off
+ */
+static void task_sim_flood( void *arg )
+{
+    int fps = (int)(intptr_t)arg;
+    int64_t start = 0;
+    int64_t next;
+
+    while( !registration_is_registered() )
+    {
+        vTaskDelay( pdMS_TO_TICKS( 10 ) );
+    }
+    next = start = esp_timer_get_time();
+    while( ( next += 1000000 / fps ) < load_end_us )
+    {
+        uint8_t payload[MESH_PAYLOAD_DATA_SIZE];
+        mesh_payload_data_t reading = { .value = 1 };
+        int64_t now = esp_timer_get_time();
+        tx_frame_t *frame;
+        int len;
+
+        if( next > now )
+        {
+            vTaskDelay( pdMS_TO_TICKS( ( next - now ) / 1000 ) );
+        }
+        frame = tx_queue_alloc( TX_PRIO_TELEMETRY, TX_POLICY_DROP_OLDEST, 0 );
+        if( !frame )
+        {
+            continue;
+        }
+        now = esp_timer_get_time();
+        mesh_proto_put_data( &reading, payload, sizeof( payload ) );
+        len = app_frame_build( MESH_MSG_DATA, payload, sizeof( payload ), now, frame->data, sizeof( frame->data ) );
+        if( len < 0 )
+        {
+            tx_queue_release( frame );
+            continue;
+        }
+        frame->len = len;
+        frame->stamp_us = now;
+        tx_queue_submit( frame );
+        __atomic_add_fetch( &flood_sent, 1, __ATOMIC_RELAXED );
+    }
+    __atomic_store_n( &flood_us, esp_timer_get_time() - start, __ATOMIC_RELAXED );
+    vTaskDelete( NULL );
+}
+
+int sim_flood_id( void )
+{
+    return flood_id;
+}
+
+void sim_load_report( sim_report_t *report )
+{
+    frag_stats_t stats;
+
+    report->flood_sent = __atomic_load_n( &flood_sent, __ATOMIC_RELAXED );
+    report->flood_us = __atomic_load_n( &flood_us, __ATOMIC_RELAXED );
+    frag_get_stats( &stats );
+    report->frag_sent = __atomic_load_n( &frag_sent, __ATOMIC_RELAXED );
+    report->frag_done = stats.tx_done;
+    report->frag_failed = stats.tx_failed;
+    report->frag_resent = stats.tx_resent;
+    portENTER_CRITICAL( &frag_lock );
+    sim_latency_percentiles( &frag_latency, report->frag_us );
+    portEXIT_CRITICAL( &frag_lock );
+}
+
+static void press( void )
+{
+    host_gpio_input( BUTTON, 0 );
+    usleep( SIM_PRESS_HOLD_MS * 1000 );
+    host_gpio_input( BUTTON, 1 );
+}
+
+/**
+ * A node: the firmware, and a finger on its button once it joined. The
+ * presses are a Poisson process of 'rate', kept apart by more than the
+ * debounce time so that each one is a reading. The flooding node sends
+ * its readings and presses no button; the root presses every
+ * 'broadcast_s', for a broadcast to every node.
+ */
+static void node_run( int index, int fd, double rate, int frag_s, int flood_fps, int broadcast_s,
+                      int64_t press_end_us, esp_log_level_t level )
+{
+    int64_t gap_min_us = ( CONFIG_APP_BUTTON_DEBOUNCE_MS + SIM_PRESS_HOLD_MS ) * 1000LL;
+
+    esp_log_level_set( "*", level );
+    sim_node_start( index, fd );
+    app_main();
+    load_end_us = press_end_us;
+    if( frag_s )
+    {
+        xTaskCreate( task_sim_frag, "sim_frag", 4096, (void *)(intptr_t)frag_s, 5, NULL );
+    }
+    if( flood_fps )
+    {
+        flood_id = SIM_FLOOD_NODE + 1;
+        if( index == SIM_FLOOD_NODE )
+        {
+            rate = 0;
+            xTaskCreate( task_sim_flood, "sim_flood", 4096, (void *)(intptr_t)flood_fps, 5, NULL );
+        }
+    }
+
+    while( esp_timer_get_time() < press_end_us )
+    {
+        int64_t gap_us = rate > 0 ? (int64_t)( -log( 1.0 - ( esp_random() + 1.0 ) / 4294967297.0 ) / rate * 1e6 )
+                                  : 1000000;
+
+        if( index == 0 )
+        {
+            gap_us = broadcast_s ? broadcast_s * 1000000LL : 1000000;
+        }
+        usleep( gap_us > gap_min_us ? gap_us : gap_min_us );
+        if( rate > 0 && index > 0 && sim_node_attached() )
+        {
+            __atomic_add_fetch( &presses, 1, __ATOMIC_RELAXED );
+            press();
+        }
+        else if( broadcast_s && index == 0 && sim_node_attached() )
+        {
+            press();
+        }
+    }
+    for( ;; )
+    {
+        pause();
+    }
+}
+
+static void usage( const char *name )
+{
+    fprintf( stderr,
+             "usage: %s [options]\n"
+             "  -n, --nodes N        nodes, the root included (10)\n"
+             "  -l, --layers N       layers at most (CONFIG_MESH_MAX_LAYER, %d)\n"
+             "  -f, --fanout N       children per node (CONFIG_MESH_AP_CONNECTIONS, %d)\n"
+             "  -r, --rate R         button presses per second on every node but the root (2)\n"
+             "  -d, --duration S     seconds to run (10)\n"
+             "  -j, --join-ms MS     time a node takes to join once its parent is in (50)\n"
+             "      --hop-us US      latency of a hop (2000)\n"
+             "      --jitter-us US   random latency added to a hop, up to (1000)\n"
+             "      --loss P         probability a hop loses a frame (0)\n"
+             "      --link-fps N     frames per second a link carries, 0 for no limit (0)\n"
+             "      --link-queue N   frames a link holds before it drops (32)\n"
+             "      --churn S        a random node leaves every S seconds, 0 never (0)\n"
+             "      --churn-down MS  time it stays away (3000)\n"
+             "      --sweep S        the broker sends cmd/<root>/reregister every S seconds, 0 never (0)\n"
+             "      --frag S         the deepest node sends the root a CONFIG_APP_FRAG_MAX_MSG message\n"
+             "                       every S seconds, 0 never (0)\n"
+             "      --flood FPS      node %d sends FPS readings per second instead of pressing, 0 never (0)\n"
+             "      --broadcast S    the root presses its button every S seconds, a broadcast to every\n"
+             "                       node, 0 never (0)\n"
+             "      --seed N         random seed (1)\n"
+             "  -v, --verbose        firmware warnings, -vv its info logs too\n",
+             name, CONFIG_MESH_MAX_LAYER, CONFIG_MESH_AP_CONNECTIONS, SIM_FLOOD_NODE + 1 );
+}
+
+int main( int argc, char **argv )
+{
+    static const struct option options[] = {
+        { "nodes", required_argument, NULL, 'n' },
+        { "layers", required_argument, NULL, 'l' },
+        { "fanout", required_argument, NULL, 'f' },
+        { "rate", required_argument, NULL, 'r' },
+        { "duration", required_argument, NULL, 'd' },
+        { "join-ms", required_argument, NULL, 'j' },
+        { "hop-us", required_argument, NULL, 'H' },
+        { "jitter-us", required_argument, NULL, 'J' },
+        { "loss", required_argument, NULL, 'L' },
+        { "link-fps", required_argument, NULL, 'F' },
+        { "link-queue", required_argument, NULL, 'Q' },
+        { "churn", required_argument, NULL, 'C' },
+        { "churn-down", required_argument, NULL, 'D' },
+        { "sweep", required_argument, NULL, 'W' },
+        { "frag", required_argument, NULL, 'G' },
+        { "flood", required_argument, NULL, 'O' },
+        { "broadcast", required_argument, NULL, 'B' },
+        { "seed", required_argument, NULL, 'S' },
+        { "verbose", no_argument, NULL, 'v' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    sim_config_t config = {
+        .nodes = 10,
+        .layers = CONFIG_MESH_MAX_LAYER,
+        .fanout = CONFIG_MESH_AP_CONNECTIONS,
+        .rate = 2,
+        .duration_s = 10,
+        .join_ms = 50,
+        .hop_us = 2000,
+        .jitter_us = 1000,
+        .link_queue = 32,
+        .churn_down_ms = 3000,
+        .seed = 1,
+    };
+    esp_log_level_t level = ESP_LOG_ERROR;
+    long capacity = 1;
+    long layer_size = 1;
+    int *fds;
+    pid_t *pids;
+    int opt;
+    int status;
+    int result;
+
+    while( ( opt = getopt_long( argc, argv, "n:l:f:r:d:j:vh", options, NULL ) ) != -1 )
+    {
+        switch( opt )
+        {
+            case 'n': config.nodes = atoi( optarg ); break;
+            case 'l': config.layers = atoi( optarg ); break;
+            case 'f': config.fanout = atoi( optarg ); break;
+            case 'r': config.rate = atof( optarg ); break;
+            case 'd': config.duration_s = atoi( optarg ); break;
+            case 'j': config.join_ms = atoi( optarg ); break;
+            case 'H': config.hop_us = atoi( optarg ); break;
+            case 'J': config.jitter_us = atoi( optarg ); break;
+            case 'L': config.loss = atof( optarg ); break;
+            case 'F': config.link_fps = atoi( optarg ); break;
+            case 'Q': config.link_queue = atoi( optarg ); break;
+            case 'C': config.churn_s = atoi( optarg ); break;
+            case 'D': config.churn_down_ms = atoi( optarg ); break;
+            case 'W': config.sweep_s = atoi( optarg ); break;
+            case 'G': config.frag_s = atoi( optarg ); break;
+            case 'O': config.flood_fps = atoi( optarg ); break;
+            case 'B': config.broadcast_s = atoi( optarg ); break;
+            case 'S': config.seed = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+            case 'v': level = level < ESP_LOG_INFO ? level + 1 : level; break;
+            default:  usage( argv[0] ); return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    /**
+     * The firmware sizes its tables for the mesh sdkconfig describes
+     */
+    if( config.layers < 1 || config.layers > CONFIG_MESH_MAX_LAYER ||
+        config.fanout < 1 || config.fanout > CONFIG_MESH_AP_CONNECTIONS )
+    {
+        fprintf( stderr, "layers must be 1..%d and fan-out 1..%d\n", CONFIG_MESH_MAX_LAYER,
+                 CONFIG_MESH_AP_CONNECTIONS );
+        return 2;
+    }
+    for( int layer = 1; layer < config.layers && capacity < config.nodes; layer++ )
+    {
+        layer_size *= config.fanout;
+        capacity += layer_size;
+    }
+    if( config.nodes < 1 || config.nodes > CONFIG_MESH_ROUTE_TABLE_SIZE || config.nodes > capacity )
+    {
+        fprintf( stderr, "%d nodes do not fit: at most %ld in %d layers of fan-out %d, "
+                 "and CONFIG_MESH_ROUTE_TABLE_SIZE (%d)\n",
+                 config.nodes, capacity, config.layers, config.fanout, CONFIG_MESH_ROUTE_TABLE_SIZE );
+        return 2;
+    }
+    if( config.duration_s < 1 || config.join_ms < 1 || config.hop_us < 0 || config.jitter_us < 0 ||
+        config.loss < 0 || config.loss > 1 || config.link_fps < 0 || config.link_queue < 1 ||
+        config.churn_s < 0 || config.churn_down_ms < 0 || config.sweep_s < 0 || config.frag_s < 0 ||
+        config.flood_fps < 0 || config.flood_fps > 1000 || ( config.flood_fps && config.nodes <= SIM_FLOOD_NODE ) ||
+        config.broadcast_s < 0 || config.rate < 0 )
+    {
+        usage( argv[0] );
+        return 2;
+    }
+
+    /**
+     * The clock starts before the nodes fork, so they all share it, as
+     * the TSF of a real mesh
+     */
+    esp_timer_get_time();
+    setvbuf( stdout, NULL, _IOLBF, 0 );
+
+    fds = calloc( config.nodes, sizeof( *fds ) );
+    pids = calloc( config.nodes, sizeof( *pids ) );
+    if( !fds || !pids )
+    {
+        return 1;
+    }
+    for( int i = 0; i < config.nodes; i++ )
+    {
+        int pair[2];
+
+        if( socketpair( AF_UNIX, SOCK_SEQPACKET, 0, pair ) != 0 )
+        {
+            perror( "socketpair" );
+            return 1;
+        }
+        pids[i] = fork();
+        if( pids[i] < 0 )
+        {
+            perror( "fork" );
+            return 1;
+        }
+        if( pids[i] == 0 )
+        {
+            for( int j = 0; j < i; j++ )
+            {
+                close( fds[j] );
+            }
+            close( pair[0] );
+            free( fds );
+            free( pids );
+            node_run( i, pair[1], config.rate, i == config.nodes - 1 && i > 0 ? config.frag_s : 0,
+                      config.flood_fps, config.broadcast_s, config.duration_s * 1000000LL, level );
+            _exit( 0 );
+        }
+        close( pair[1] );
+        fds[i] = pair[0];
+    }
+
+    result = sim_hub_run( &config, fds );
+
+    for( int i = 0; i < config.nodes; i++ )
+    {
+        kill( pids[i], SIGKILL );
+        waitpid( pids[i], &status, 0 );
+    }
+    free( fds );
+    free( pids );
+    return result;
+}
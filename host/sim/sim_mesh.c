@@ -0,0 +1,645 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_log.h"
+#include "esp_mesh.h"
+#include "esp_timer.h"
+
+#include "sim.h"
+
+/**
+ * ESP-MESH on a simulated node: the hub decides the tree and carries the
+ * frames, a reader thread turns its packets into the node's state, the
+ * MESH_EVENTs on the default loop and the frames esp_mesh_recv() returns
+ */
+#define SIM_RX_QUEUE_LEN    ( 32 )
+#define SIM_GROUPS_MAX      ( 8 )
+
+typedef struct {
+    mesh_addr_t from;
+    mesh_proto_t proto;
+    mesh_tos_t  tos;
+    int         flag;
+    int64_t     stamp_us;
+    uint16_t    size;
+    uint8_t     data[];
+} sim_frame_t;
+
+ESP_EVENT_DEFINE_BASE( MESH_EVENT );
+
+static int sim_fd = -1;
+static char sim_id[12];
+static portMUX_TYPE sim_lock = portMUX_INITIALIZER_UNLOCKED;
+static pthread_mutex_t sim_tx_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sim_info_t sim_info;
+static uint8_t *sim_children = NULL;
+static uint8_t *sim_table = NULL;
+static mesh_addr_t sim_groups[SIM_GROUPS_MAX];
+static int sim_group_count = 0;
+static bool sim_started = false;
+static bool sim_ever_attached = false;
+static QueueHandle_t sim_rx = NULL;
+static uint32_t sim_rx_overflow = 0;
+static uint32_t sim_frames_in = 0;
+static sim_latency_t sim_frame_latency;
+static mesh_cfg_t sim_config;
+
+char *sim_node_id( void )
+{
+    return sim_id;
+}
+
+void sim_latency_add( sim_latency_t *latency, int64_t us )
+{
+    if( latency->count == latency->size )
+    {
+        size_t size = latency->size ? latency->size * 2 : 4096;
+        uint32_t *grown = realloc( latency->us, size * sizeof( *grown ) );
+
+        if( !grown )
+        {
+            return;
+        }
+        latency->us = grown;
+        latency->size = size;
+    }
+    latency->us[latency->count++] = us > 0 ? (uint32_t)us : 0;
+}
+
+static int latency_compare( const void *a, const void *b )
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * p50, p90, p99 and max
+ */
+void sim_latency_percentiles( sim_latency_t *latency, uint32_t out[4] )
+{
+    static const int pct[3] = { 50, 90, 99 };
+
+    if( !latency->count )
+    {
+        return;
+    }
+    qsort( latency->us, latency->count, sizeof( *latency->us ), latency_compare );
+    for( int i = 0; i < 3; i++ )
+    {
+        out[i] = latency->us[( latency->count - 1 ) * pct[i] / 100];
+    }
+    out[3] = latency->us[latency->count - 1];
+}
+
+void sim_mac( int index, uint8_t mac[6] )
+{
+    mac[0] = 0x24;
+    mac[1] = 0x0a;
+    mac[2] = 0xc4;
+    mac[3] = (uint8_t)( index >> 8 );
+    mac[4] = (uint8_t)index;
+    mac[5] = 0x00;
+}
+
+int sim_mac_index( const uint8_t mac[6] )
+{
+    if( mac[0] != 0x24 || mac[1] != 0x0a || mac[2] != 0xc4 || mac[5] > 0x01 )
+    {
+        return -1;
+    }
+    return mac[3] << 8 | mac[4];
+}
+
+static esp_err_t sim_write( const sim_hdr_t *hdr, const void *payload )
+{
+    uint8_t packet[sizeof( sim_hdr_t ) + MESH_MPS];
+    ssize_t sent;
+
+    if( hdr->len > MESH_MPS )
+    {
+        return ESP_ERR_MESH_EXCEED_MTU;
+    }
+    memcpy( packet, hdr, sizeof( *hdr ) );
+    if( hdr->len )
+    {
+        memcpy( packet + sizeof( *hdr ), payload, hdr->len );
+    }
+    pthread_mutex_lock( &sim_tx_mutex );
+    do
+    {
+        sent = send( sim_fd, packet, sizeof( *hdr ) + hdr->len, MSG_NOSIGNAL );
+    } while( sent < 0 && errno == EINTR );
+    pthread_mutex_unlock( &sim_tx_mutex );
+    return sent < 0 ? ESP_FAIL : ESP_OK;
+}
+
+static void sim_set_info( const uint8_t *payload, size_t len )
+{
+    sim_info_t info;
+    uint8_t *children;
+    uint8_t *table;
+    uint8_t *old_children;
+    uint8_t *old_table;
+
+    if( len < sizeof( info ) )
+    {
+        return;
+    }
+    memcpy( &info, payload, sizeof( info ) );
+    if( len < sizeof( info ) + ( info.children + info.table ) * 6u )
+    {
+        return;
+    }
+    children = malloc( info.children * 6u + 1 );
+    table = malloc( info.table * 6u + 1 );
+    if( !children || !table )
+    {
+        abort();
+    }
+    memcpy( children, payload + sizeof( info ), info.children * 6u );
+    memcpy( table, payload + sizeof( info ) + info.children * 6u, info.table * 6u );
+
+    portENTER_CRITICAL( &sim_lock );
+    old_children = sim_children;
+    old_table = sim_table;
+    sim_info = info;
+    sim_children = children;
+    sim_table = table;
+    sim_ever_attached |= info.connected;
+    portEXIT_CRITICAL( &sim_lock );
+    free( old_children );
+    free( old_table );
+}
+
+static void sim_quit( void )
+{
+    sim_hdr_t hdr = { .kind = SIM_BYE };
+    sim_report_t report;
+
+    memset( &report, 0, sizeof( report ) );
+    report.presses = sim_node_presses();
+    report.rx_overflow = sim_rx_overflow;
+    sim_load_report( &report );
+    if( esp_mesh_is_root() )
+    {
+        report.is_root = 1;
+        portENTER_CRITICAL( &sim_lock );
+        report.frames_in = sim_frames_in;
+        sim_latency_percentiles( &sim_frame_latency, report.frame_us );
+        portEXIT_CRITICAL( &sim_lock );
+        sim_mqtt_report( &report );
+    }
+    hdr.len = sizeof( report );
+    sim_write( &hdr, &report );
+    _exit( 0 );
+}
+
+static void *sim_reader( void *arg )
+{
+    static uint8_t packet[SIM_PACKET_MAX];
+    sim_hdr_t hdr;
+    sim_frame_t *frame;
+    ssize_t len;
+
+    for( ;; )
+    {
+        len = recv( sim_fd, packet, sizeof( packet ), 0 );
+        if( len < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if( len < (ssize_t)sizeof( hdr ) )
+        {
+            /* the simulator is gone */
+            _exit( 1 );
+        }
+        memcpy( &hdr, packet, sizeof( hdr ) );
+        switch( hdr.kind )
+        {
+            case SIM_INFO:
+                sim_set_info( packet + sizeof( hdr ), hdr.len );
+                break;
+
+            case SIM_EVENT:
+                esp_event_post( MESH_EVENT, hdr.id, packet + sizeof( hdr ), hdr.len, portMAX_DELAY );
+                break;
+
+            case SIM_DATA:
+                frame = malloc( sizeof( *frame ) + hdr.len );
+                if( !frame )
+                {
+                    abort();
+                }
+                memcpy( frame->from.addr, hdr.addr, 6 );
+                frame->proto = (mesh_proto_t)hdr.proto;
+                frame->tos = (mesh_tos_t)hdr.tos;
+                frame->flag = hdr.flag;
+                frame->stamp_us = hdr.stamp_us;
+                frame->size = hdr.len;
+                memcpy( frame->data, packet + sizeof( hdr ), hdr.len );
+                /* a full receive queue drops, as the stack does */
+                if( xQueueSend( sim_rx, &frame, 0 ) != pdTRUE )
+                {
+                    sim_rx_overflow++;
+                    free( frame );
+                }
+                break;
+
+            case SIM_MQTT:
+                sim_mqtt_deliver( packet + sizeof( hdr ), hdr.len );
+                break;
+
+            case SIM_QUIT:
+                sim_quit();
+                break;
+
+            default:
+                break;
+        }
+    }
+    return NULL;
+}
+
+void sim_node_start( int index, int fd )
+{
+    static char name[24];
+    uint8_t mac[6];
+    pthread_t thread;
+
+    sim_fd = fd;
+    snprintf( sim_id, sizeof( sim_id ), "%d", index + 1 );
+    snprintf( name, sizeof( name ), "[node %s]", sim_id );
+    host_log_set_name( name );
+    sim_mac( index, mac );
+    host_set_mac( mac );
+    sim_rx = xQueueCreate( SIM_RX_QUEUE_LEN, sizeof( sim_frame_t * ) );
+    if( !sim_rx || pthread_create( &thread, NULL, sim_reader, NULL ) != 0 )
+    {
+        abort();
+    }
+    pthread_detach( thread );
+}
+
+bool sim_node_attached( void )
+{
+    bool attached;
+
+    portENTER_CRITICAL( &sim_lock );
+    attached = sim_ever_attached;
+    portEXIT_CRITICAL( &sim_lock );
+    return attached;
+}
+
+/**
+ * WiFi and TCP/IP: only what the mesh reports about its links
+ */
+esp_err_t tcpip_adapter_init( void )
+{
+    return ESP_OK;
+}
+
+esp_err_t tcpip_adapter_dhcps_stop( tcpip_adapter_if_t tcpip_if )
+{
+    return ESP_OK;
+}
+
+esp_err_t tcpip_adapter_dhcpc_stop( tcpip_adapter_if_t tcpip_if )
+{
+    return ESP_OK;
+}
+
+esp_err_t tcpip_adapter_dhcpc_start( tcpip_adapter_if_t tcpip_if )
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_init( const wifi_init_config_t *config )
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage( wifi_storage_t storage )
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start( void )
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info( wifi_ap_record_t *ap )
+{
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+
+    memset( ap, 0, sizeof( *ap ) );
+    portENTER_CRITICAL( &sim_lock );
+    if( sim_info.connected )
+    {
+        memcpy( ap->bssid, sim_info.parent_bssid, 6 );
+        ap->rssi = (int8_t)( -40 - 4 * sim_info.layer );
+        err = ESP_OK;
+    }
+    portEXIT_CRITICAL( &sim_lock );
+    return err;
+}
+
+esp_err_t esp_wifi_ap_get_sta_list( wifi_sta_list_t *list )
+{
+    memset( list, 0, sizeof( *list ) );
+    portENTER_CRITICAL( &sim_lock );
+    for( int i = 0; i < sim_info.children && i < ESP_WIFI_MAX_CONN_NUM; i++ )
+    {
+        memcpy( list->sta[i].mac, &sim_children[i * 6], 6 );
+        list->sta[i].rssi = (int8_t)( -44 - 4 * sim_info.layer );
+        list->num++;
+    }
+    portEXIT_CRITICAL( &sim_lock );
+    return ESP_OK;
+}
+
+/**
+ * Mesh
+ */
+esp_err_t esp_mesh_init( void )
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_start( void )
+{
+    sim_hdr_t hdr = { .kind = SIM_HELLO };
+
+    sim_started = true;
+    esp_event_post( MESH_EVENT, MESH_EVENT_STARTED, NULL, 0, portMAX_DELAY );
+    return sim_write( &hdr, NULL );
+}
+
+esp_err_t esp_mesh_stop( void )
+{
+    if( !sim_started )
+    {
+        return ESP_ERR_MESH_NOT_START;
+    }
+    sim_started = false;
+    portENTER_CRITICAL( &sim_lock );
+    sim_info.connected = 0;
+    portEXIT_CRITICAL( &sim_lock );
+    esp_event_post( MESH_EVENT, MESH_EVENT_STOPPED, NULL, 0, portMAX_DELAY );
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_config( const mesh_cfg_t *config )
+{
+    sim_config = *config;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_config( mesh_cfg_t *config )
+{
+    *config = sim_config;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_max_layer( int max_layer )
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_vote_percentage( float percentage )
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_ap_assoc_expire( int seconds )
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_set_ap_authmode( wifi_auth_mode_t authmode )
+{
+    return ESP_OK;
+}
+
+/**
+ * The hub places every node itself: a parent hint changes nothing
+ */
+esp_err_t esp_mesh_set_parent( const wifi_config_t *parent, const mesh_addr_t *parent_mesh_id,
+                               mesh_type_t my_type, int my_layer )
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_send( const mesh_addr_t *to, const mesh_data_t *data, int flag,
+                         const mesh_opt_t opt[], int opt_count )
+{
+    sim_hdr_t hdr = { .kind = SIM_SEND };
+    bool connected;
+
+    if( !data || ( !to && ( flag & MESH_DATA_GROUP ) ) )
+    {
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    if( data->size > MESH_MPS )
+    {
+        return ESP_ERR_MESH_EXCEED_MTU;
+    }
+    portENTER_CRITICAL( &sim_lock );
+    connected = sim_info.connected;
+    portEXIT_CRITICAL( &sim_lock );
+    if( !connected )
+    {
+        return ESP_ERR_MESH_DISCONNECTED;
+    }
+    if( to )
+    {
+        memcpy( hdr.addr, to->addr, 6 );
+    }
+    hdr.proto = (uint8_t)data->proto;
+    hdr.tos = (uint8_t)data->tos;
+    hdr.flag = flag;
+    hdr.len = data->size;
+    return sim_write( &hdr, data->data );
+}
+
+esp_err_t esp_mesh_recv( mesh_addr_t *from, mesh_data_t *data, int timeout_ms, int *flag,
+                         mesh_opt_t opt[], int opt_count )
+{
+    TickType_t wait = (uint32_t)timeout_ms == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS( timeout_ms );
+    sim_frame_t *frame;
+    esp_err_t err = ESP_OK;
+
+    if( xQueueReceive( sim_rx, &frame, wait ) != pdTRUE )
+    {
+        data->size = 0;
+        return ESP_ERR_MESH_TIMEOUT;
+    }
+    if( frame->size > data->size )
+    {
+        data->size = 0;
+        err = ESP_ERR_MESH_ARGUMENT;
+    }
+    else
+    {
+        memcpy( data->data, frame->data, frame->size );
+        data->size = frame->size;
+        data->proto = frame->proto;
+        data->tos = frame->tos;
+        *from = frame->from;
+        if( flag )
+        {
+            *flag = frame->flag;
+        }
+        if( esp_mesh_is_root() )
+        {
+            int64_t now = esp_timer_get_time();
+
+            portENTER_CRITICAL( &sim_lock );
+            sim_frames_in++;
+            sim_latency_add( &sim_frame_latency, now - frame->stamp_us );
+            portEXIT_CRITICAL( &sim_lock );
+        }
+    }
+    free( frame );
+    return err;
+}
+
+esp_err_t esp_mesh_get_rx_pending( mesh_rx_pending_t *pending )
+{
+    pending->toDS = 0;
+    pending->toSelf = (int)uxQueueMessagesWaiting( sim_rx );
+    return ESP_OK;
+}
+
+/**
+ * Frames leave for the hub as soon as they are sent
+ */
+esp_err_t esp_mesh_get_tx_pending( mesh_tx_pending_t *pending )
+{
+    memset( pending, 0, sizeof( *pending ) );
+    return ESP_OK;
+}
+
+bool esp_mesh_is_root( void )
+{
+    bool root;
+
+    portENTER_CRITICAL( &sim_lock );
+    root = sim_info.is_root;
+    portEXIT_CRITICAL( &sim_lock );
+    return root;
+}
+
+int esp_mesh_get_layer( void )
+{
+    int layer;
+
+    portENTER_CRITICAL( &sim_lock );
+    layer = sim_info.connected ? sim_info.layer : 0;
+    portEXIT_CRITICAL( &sim_lock );
+    return layer;
+}
+
+esp_err_t esp_mesh_get_id( mesh_addr_t *id )
+{
+    *id = sim_config.mesh_id;
+    return ESP_OK;
+}
+
+esp_err_t esp_mesh_get_parent_bssid( mesh_addr_t *bssid )
+{
+    portENTER_CRITICAL( &sim_lock );
+    memcpy( bssid->addr, sim_info.parent_bssid, 6 );
+    portEXIT_CRITICAL( &sim_lock );
+    return ESP_OK;
+}
+
+int esp_mesh_get_routing_table_size( void )
+{
+    int size;
+
+    portENTER_CRITICAL( &sim_lock );
+    size = sim_info.table ? sim_info.table : 1;
+    portEXIT_CRITICAL( &sim_lock );
+    return size;
+}
+
+esp_err_t esp_mesh_get_routing_table( mesh_addr_t *mac, int len, int *size )
+{
+    int n = 0;
+
+    if( !mac || len < (int)sizeof( mesh_addr_t ) || !size )
+    {
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    portENTER_CRITICAL( &sim_lock );
+    for( ; n < sim_info.table && n < len / (int)sizeof( mesh_addr_t ); n++ )
+    {
+        memcpy( mac[n].addr, &sim_table[n * 6], 6 );
+    }
+    portEXIT_CRITICAL( &sim_lock );
+    *size = n;
+    return ESP_OK;
+}
+
+int esp_mesh_get_total_node_num( void )
+{
+    int total;
+
+    portENTER_CRITICAL( &sim_lock );
+    total = sim_info.total ? sim_info.total : 1;
+    portEXIT_CRITICAL( &sim_lock );
+    return total;
+}
+
+/**
+ * Every process counts from the simulator's start: the TSF is shared
+ */
+int64_t esp_mesh_get_tsf_time( void )
+{
+    return esp_timer_get_time();
+}
+
+esp_err_t esp_mesh_set_group_id( const mesh_addr_t *addr, int num )
+{
+    sim_hdr_t hdr = { .kind = SIM_GROUPS };
+    uint8_t groups[SIM_GROUPS_MAX * 6];
+
+    if( !addr || num <= 0 || num > SIM_GROUPS_MAX )
+    {
+        return ESP_ERR_MESH_ARGUMENT;
+    }
+    portENTER_CRITICAL( &sim_lock );
+    for( int i = 0; i < num; i++ )
+    {
+        sim_groups[i] = addr[i];
+        memcpy( &groups[i * 6], addr[i].addr, 6 );
+    }
+    sim_group_count = num;
+    portEXIT_CRITICAL( &sim_lock );
+    hdr.len = (uint16_t)( num * 6 );
+    return sim_write( &hdr, groups );
+}
+
+bool esp_mesh_is_my_group( const mesh_addr_t *addr )
+{
+    bool mine = false;
+
+    portENTER_CRITICAL( &sim_lock );
+    for( int i = 0; i < sim_group_count && !mine; i++ )
+    {
+        mine = !memcmp( sim_groups[i].addr, addr->addr, 6 );
+    }
+    portEXIT_CRITICAL( &sim_lock );
+    return mine;
+}
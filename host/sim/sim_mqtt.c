@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_timer.h"
+#include "mqtt_client.h"
+
+#include "frame_pool.h"
+#include "mqtt_outbox.h"
+#include "sim.h"
+
+/**
+ * The broker behind the root: it takes every publish at once and
+ * measures what the firmware sends upstream. A batched reading's latency
+ * is the time from its button press, as the batch carries it, to its
+ * publish. The flooding node's readings are counted apart.
+ */
+#define SIM_MQTT_CONNECT_MS     ( 100 )
+#define SIM_MQTT_INBOX_LEN      ( 8 )
+
+struct esp_mqtt_client {
+    esp_event_handler_t handler;
+    void               *handler_arg;
+    int                 msg_id;
+};
+
+static const char *MQTT_EVENTS = "MQTT_EVENTS";
+
+static portMUX_TYPE mqtt_lock = portMUX_INITIALIZER_UNLOCKED;
+static QueueHandle_t mqtt_inbox = NULL;
+static sim_report_t mqtt_stats;
+static sim_latency_t mqtt_latency;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init( const esp_mqtt_client_config_t *config )
+{
+    return calloc( 1, sizeof( struct esp_mqtt_client ) );
+}
+
+esp_err_t esp_mqtt_client_register_event( esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                          esp_event_handler_t handler, void *arg )
+{
+    client->handler = handler;
+    client->handler_arg = arg;
+    return ESP_OK;
+}
+
+/**
+ * Connects, then hands the messages from the broker to the firmware, as
+ * the esp-mqtt task does
+ */
+static void task_mqtt_client( void *arg )
+{
+    esp_mqtt_client_handle_t client = arg;
+    esp_mqtt_event_t event = { .event_id = MQTT_EVENT_CONNECTED, .client = client };
+    char *message;
+
+    vTaskDelay( pdMS_TO_TICKS( SIM_MQTT_CONNECT_MS ) );
+    if( client->handler )
+    {
+        client->handler( client->handler_arg, MQTT_EVENTS, event.event_id, &event );
+    }
+    for( ;; )
+    {
+        xQueueReceive( mqtt_inbox, &message, portMAX_DELAY );
+        event.event_id = MQTT_EVENT_DATA;
+        event.topic = message;
+        event.topic_len = (int)strlen( message );
+        event.data = message + event.topic_len + 1;
+        event.data_len = (int)strlen( event.data );
+        event.total_data_len = event.data_len;
+        event.current_data_offset = 0;
+        if( client->handler )
+        {
+            client->handler( client->handler_arg, MQTT_EVENTS, event.event_id, &event );
+        }
+        free( message );
+    }
+}
+
+esp_err_t esp_mqtt_client_start( esp_mqtt_client_handle_t client )
+{
+    if( !mqtt_inbox && !( mqtt_inbox = xQueueCreate( SIM_MQTT_INBOX_LEN, sizeof( char * ) ) ) )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return xTaskCreate( task_mqtt_client, "mqtt_task", 4096, client, 5, NULL ) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * 'message' is the topic, a NUL, then the data; dropped before the
+ * client runs or when the firmware falls behind
+ */
+void sim_mqtt_deliver( const uint8_t *message, size_t len )
+{
+    char *copy;
+
+    if( !mqtt_inbox || !memchr( message, '\0', len ) || !( copy = malloc( len + 1 ) ) )
+    {
+        return;
+    }
+    memcpy( copy, message, len );
+    copy[len] = '\0';
+    if( xQueueSend( mqtt_inbox, &copy, 0 ) != pdTRUE )
+    {
+        free( copy );
+    }
+}
+
+esp_err_t esp_mqtt_client_disconnect( esp_mqtt_client_handle_t client )
+{
+    return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe( esp_mqtt_client_handle_t client, const char *topic, int qos )
+{
+    return __atomic_add_fetch( &client->msg_id, 1, __ATOMIC_RELAXED );
+}
+
+int esp_mqtt_client_unsubscribe( esp_mqtt_client_handle_t client, const char *topic )
+{
+    return __atomic_add_fetch( &client->msg_id, 1, __ATOMIC_RELAXED );
+}
+
+static void reading_add( int64_t now )
+{
+    mqtt_stats.readings++;
+    if( !mqtt_stats.first_us )
+    {
+        mqtt_stats.first_us = now;
+    }
+    mqtt_stats.last_us = now;
+}
+
+/**
+ * {"t0":<ms>,"r":[[node_id,seq,<ms after t0>,value],...]}; called with
+ * mqtt_lock held
+ */
+static void batch_measure( const char *data, int len, int64_t now )
+{
+    char *text = strndup( data, len );
+    char *p;
+    int64_t t0;
+
+    if( !text || !( p = strstr( text, "\"t0\":" ) ) )
+    {
+        free( text );
+        return;
+    }
+    t0 = strtoll( p + 5, &p, 10 );
+    while( ( p = strstr( p, "[" ) ) != NULL )
+    {
+        long field[4];
+        int n = 0;
+
+        p++;
+        if( *p == '[' )
+        {
+            continue;
+        }
+        for( ; n < 4; n++ )
+        {
+            field[n] = strtol( p, &p, 10 );
+            if( *p != ',' )
+            {
+                break;
+            }
+            p++;
+        }
+        if( n == 3 && field[0] == sim_flood_id() )
+        {
+            mqtt_stats.flood_readings++;
+        }
+        else if( n == 3 )
+        {
+            reading_add( now );
+            sim_latency_add( &mqtt_latency, now - ( t0 + field[2] ) * 1000 );
+        }
+    }
+    free( text );
+}
+
+int esp_mqtt_client_publish( esp_mqtt_client_handle_t client, const char *topic, const char *data,
+                             int len, int qos, int retain )
+{
+    int64_t now = esp_timer_get_time();
+
+    if( len <= 0 )
+    {
+        len = data ? (int)strlen( data ) : 0;
+    }
+    portENTER_CRITICAL( &mqtt_lock );
+    mqtt_stats.publishes++;
+    if( !strcmp( topic, "ESP-send" ) )
+    {
+        reading_add( now );
+    }
+    else if( !strcmp( topic, "ESP-batch" ) )
+    {
+        batch_measure( data, len, now );
+    }
+    else if( !strcmp( topic, "ESP-summary" ) || !strcmp( topic, "ESP-alert" ) )
+    {
+        mqtt_stats.summaries++;
+    }
+    else if( !strcmp( topic, "ESP-stats/latency" ) )
+    {
+        size_t n = (size_t)len < SIM_REPORT_TEXT - 1 ? (size_t)len : SIM_REPORT_TEXT - 1;
+
+        memcpy( mqtt_stats.latency_stats, data, n );
+        mqtt_stats.latency_stats[n] = '\0';
+    }
+    portEXIT_CRITICAL( &mqtt_lock );
+    return __atomic_add_fetch( &client->msg_id, 1, __ATOMIC_RELAXED );
+}
+
+void sim_mqtt_report( sim_report_t *report )
+{
+    mqtt_outbox_stats_t outbox;
+    frame_pool_stats_t pool;
+
+    mqtt_outbox_get_stats( &outbox );
+    frame_pool_get_stats( &pool );
+    report->by_ref = outbox.by_ref;
+    report->arena_peak = outbox.arena_peak;
+    report->copies = pool.copies;
+    report->copied_bytes = pool.copied_bytes;
+    report->pool_peak = pool.peak;
+    report->pool_exhausted = pool.exhausted;
+    root_pipeline_get_stats( &report->pipeline );
+    report->outbox_peak = outbox.peak_depth;
+    report->outbox_dropped = outbox.dropped;
+    report->outbox_wait_us[0] = outbox.latency_p50_us;
+    report->outbox_wait_us[1] = outbox.latency_p99_us;
+    report->outbox_wait_us[2] = outbox.latency_max_us;
+
+    portENTER_CRITICAL( &mqtt_lock );
+    report->publishes = mqtt_stats.publishes;
+    report->readings = mqtt_stats.readings;
+    report->flood_readings = mqtt_stats.flood_readings;
+    report->summaries = mqtt_stats.summaries;
+    report->first_us = mqtt_stats.first_us;
+    report->last_us = mqtt_stats.last_us;
+    memcpy( report->latency_stats, mqtt_stats.latency_stats, sizeof( report->latency_stats ) );
+    sim_latency_percentiles( &mqtt_latency, report->latency_us );
+    portEXIT_CRITICAL( &mqtt_lock );
+}
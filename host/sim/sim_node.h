@@ -0,0 +1,10 @@
+#ifndef __SIM_NODE_H__
+#define __SIM_NODE_H__
+
+/**
+ * Included ahead of the firmware sources in the simulator build, which
+ * defines NODE_ID as sim_node_id(): the node's index plus one
+ */
+char *sim_node_id( void );
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __HOST_DRIVER_ADC_H__
+#define __HOST_DRIVER_ADC_H__
+
+#include "esp_err.h"
+
+typedef enum {
+    ADC_WIDTH_BIT_9,
+    ADC_WIDTH_BIT_10,
+    ADC_WIDTH_BIT_11,
+    ADC_WIDTH_BIT_12,
+} adc_bits_width_t;
+
+esp_err_t adc1_config_width( adc_bits_width_t width );
+
+/**
+ * A slow random walk around 0, well inside the alert thresholds
+ */
+int hall_sensor_read( void );
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __HOST_DRIVER_GPIO_H__
+#define __HOST_DRIVER_GPIO_H__
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_attr.h"
+
+/**
+ * Pins hold the level last set; an input's level and edge interrupt are
+ * driven from the host with host_gpio_input()
+ */
+typedef int gpio_num_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+    GPIO_INTR_LOW_LEVEL,
+    GPIO_INTR_HIGH_LEVEL,
+} gpio_int_type_t;
+
+typedef enum {
+    GPIO_MODE_DISABLE,
+    GPIO_MODE_INPUT,
+    GPIO_MODE_OUTPUT,
+    GPIO_MODE_INPUT_OUTPUT,
+} gpio_mode_t;
+
+typedef enum {
+    GPIO_PULLUP_DISABLE,
+    GPIO_PULLUP_ENABLE,
+} gpio_pullup_t;
+
+typedef enum {
+    GPIO_PULLDOWN_DISABLE,
+    GPIO_PULLDOWN_ENABLE,
+} gpio_pulldown_t;
+
+typedef struct {
+    uint64_t        pin_bit_mask;
+    gpio_mode_t     mode;
+    gpio_pullup_t   pull_up_en;
+    gpio_pulldown_t pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+
+typedef void ( *gpio_isr_t )( void *arg );
+
+esp_err_t gpio_config( const gpio_config_t *config );
+esp_err_t gpio_set_level( gpio_num_t gpio, uint32_t level );
+int gpio_get_level( gpio_num_t gpio );
+esp_err_t gpio_set_intr_type( gpio_num_t gpio, gpio_int_type_t type );
+esp_err_t gpio_install_isr_service( int flags );
+esp_err_t gpio_isr_handler_add( gpio_num_t gpio, gpio_isr_t handler, void *arg );
+
+/**
+ * Host only: sets the level of input 'gpio' and runs its ISR if the
+ * change is an edge it was set to interrupt on
+ */
+void host_gpio_input( gpio_num_t gpio, int level );
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "driver/gpio.h"
+#include "driver/adc.h"
+#include "esp_system.h"
+
+/**
+ * GPIO
+ */
+#define GPIO_PIN_COUNT  ( 40 )
+
+typedef struct {
+    int             level;
+    gpio_int_type_t intr_type;
+    gpio_isr_t      isr;
+    void           *arg;
+} host_gpio_t;
+
+static host_gpio_t gpios[GPIO_PIN_COUNT];
+static portMUX_TYPE gpio_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool gpio_valid( gpio_num_t gpio )
+{
+    return gpio >= 0 && gpio < GPIO_PIN_COUNT;
+}
+
+esp_err_t gpio_config( const gpio_config_t *config )
+{
+    portENTER_CRITICAL( &gpio_lock );
+    for( int pin = 0; pin < GPIO_PIN_COUNT; pin++ )
+    {
+        if( config->pin_bit_mask & ( 1ull << pin ) )
+        {
+            gpios[pin].intr_type = config->intr_type;
+            /* an input idles at the level its pull sets */
+            if( config->mode == GPIO_MODE_INPUT )
+            {
+                gpios[pin].level = config->pull_up_en == GPIO_PULLUP_ENABLE;
+            }
+        }
+    }
+    portEXIT_CRITICAL( &gpio_lock );
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level( gpio_num_t gpio, uint32_t level )
+{
+    if( !gpio_valid( gpio ) )
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL( &gpio_lock );
+    gpios[gpio].level = level ? 1 : 0;
+    portEXIT_CRITICAL( &gpio_lock );
+    return ESP_OK;
+}
+
+int gpio_get_level( gpio_num_t gpio )
+{
+    int level;
+
+    if( !gpio_valid( gpio ) )
+    {
+        return 0;
+    }
+    portENTER_CRITICAL( &gpio_lock );
+    level = gpios[gpio].level;
+    portEXIT_CRITICAL( &gpio_lock );
+    return level;
+}
+
+esp_err_t gpio_set_intr_type( gpio_num_t gpio, gpio_int_type_t type )
+{
+    if( !gpio_valid( gpio ) )
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL( &gpio_lock );
+    gpios[gpio].intr_type = type;
+    portEXIT_CRITICAL( &gpio_lock );
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service( int flags )
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add( gpio_num_t gpio, gpio_isr_t handler, void *arg )
+{
+    if( !gpio_valid( gpio ) )
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL( &gpio_lock );
+    gpios[gpio].isr = handler;
+    gpios[gpio].arg = arg;
+    portEXIT_CRITICAL( &gpio_lock );
+    return ESP_OK;
+}
+
+void host_gpio_input( gpio_num_t gpio, int level )
+{
+    host_gpio_t pin;
+    bool fire;
+
+    if( !gpio_valid( gpio ) )
+    {
+        return;
+    }
+    level = level ? 1 : 0;
+    portENTER_CRITICAL( &gpio_lock );
+    pin = gpios[gpio];
+    gpios[gpio].level = level;
+    portEXIT_CRITICAL( &gpio_lock );
+
+    switch( pin.intr_type )
+    {
+        case GPIO_INTR_POSEDGE:     fire = !pin.level && level; break;
+        case GPIO_INTR_NEGEDGE:     fire = pin.level && !level; break;
+        case GPIO_INTR_ANYEDGE:     fire = pin.level != level; break;
+        case GPIO_INTR_LOW_LEVEL:   fire = !level; break;
+        case GPIO_INTR_HIGH_LEVEL:  fire = level; break;
+        default:                    fire = false; break;
+    }
+    if( fire && pin.isr )
+    {
+        pin.isr( pin.arg );
+    }
+}
+
+/**
+ * ADC
+ */
+static int hall_value = 0;
+
+esp_err_t adc1_config_width( adc_bits_width_t width )
+{
+    return ESP_OK;
+}
+
+int hall_sensor_read( void )
+{
+    int step = (int)( esp_random() % 5 ) - 2;
+
+    /* stays within +-20 */
+    if( hall_value + step > 20 || hall_value + step < -20 )
+    {
+        step = -step;
+    }
+    hall_value += step;
+    return hall_value;
+}
@@ -0,0 +1,8 @@
+#ifndef __HOST_ESP_ATTR_H__
+#define __HOST_ESP_ATTR_H__
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif
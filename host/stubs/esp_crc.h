@@ -0,0 +1,11 @@
+#ifndef __HOST_ESP_CRC_H__
+#define __HOST_ESP_CRC_H__
+
+#include <stdint.h>
+
+/**
+ * Same result as the ROM routine: crc32_le( 0, "123456789", 9 ) == 0xcbf43926
+ */
+uint32_t esp_crc32_le( uint32_t crc, const uint8_t *buf, uint32_t len );
+
+#endif
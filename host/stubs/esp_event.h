@@ -0,0 +1,23 @@
+#ifndef __HOST_ESP_EVENT_H__
+#define __HOST_ESP_EVENT_H__
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef const char *esp_event_base_t;
+typedef void ( *esp_event_handler_t )( void *arg, esp_event_base_t base, int32_t id, void *data );
+
+#define ESP_EVENT_ANY_ID                ( -1 )
+#define ESP_EVENT_DECLARE_BASE( id )    extern esp_event_base_t id
+#define ESP_EVENT_DEFINE_BASE( id )     esp_event_base_t id = #id
+
+/**
+ * The default loop: handlers run one at a time on its task, in the
+ * order events were posted
+ */
+esp_err_t esp_event_loop_create_default( void );
+esp_err_t esp_event_handler_register( esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg );
+esp_err_t esp_event_post( esp_event_base_t base, int32_t id, const void *data, size_t size, uint32_t wait );
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef __HOST_ESP_EVENT_LOOP_H__
+#define __HOST_ESP_EVENT_LOOP_H__
+
+#include "esp_event.h"
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_event.h"
+#include "esp_crc.h"
+
+static esp_log_level_t log_level = ESP_LOG_WARN;
+static const char *log_name = "";
+
+const char *esp_err_to_name( esp_err_t code )
+{
+    switch( code )
+    {
+        case ESP_OK:                return "ESP_OK";
+        case ESP_FAIL:              return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+        default:                    return "UNKNOWN ERROR";
+    }
+}
+
+void esp_log_level_set( const char *tag, esp_log_level_t level )
+{
+    ( void )tag;
+    log_level = level;
+}
+
+void host_log_set_name( const char *name )
+{
+    log_name = name;
+}
+
+void host_log( esp_log_level_t level, const char *tag, const char *format, ... )
+{
+    static const char letters[] = "-EWIDV";
+    char line[512];
+    va_list args;
+    int len;
+
+    if( level > log_level )
+    {
+        return;
+    }
+    /* one write per line, so lines of several processes do not mix */
+    len = snprintf( line, sizeof( line ), "%c (%lld) %s%s%s", letters[level],
+                    (long long)( esp_timer_get_time() / 1000 ), log_name, *log_name ? " " : "", tag );
+    va_start( args, format );
+    if( len < (int)sizeof( line ) - 1 )
+    {
+        len += vsnprintf( line + len, sizeof( line ) - 1 - len, format, args );
+    }
+    va_end( args );
+    if( len > (int)sizeof( line ) - 2 )
+    {
+        len = sizeof( line ) - 2;
+    }
+    line[len++] = '\n';
+    fwrite( line, 1, len, stderr );
+}
+
+/**
+ * System
+ */
+static uint8_t host_mac[6] = { 0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01 };
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+static portMUX_TYPE random_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void host_set_mac( const uint8_t mac[6] )
+{
+    memcpy( host_mac, mac, 6 );
+    for( int i = 0; i < 6; i++ )
+    {
+        random_state = ( random_state ^ mac[i] ) * 0x100000001b3ull;
+    }
+}
+
+esp_err_t esp_efuse_mac_get_default( uint8_t *mac )
+{
+    memcpy( mac, host_mac, 6 );
+    return ESP_OK;
+}
+
+uint32_t esp_random( void )
+{
+    uint64_t x;
+
+    portENTER_CRITICAL( &random_lock );
+    x = random_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    random_state = x;
+    portEXIT_CRITICAL( &random_lock );
+    return (uint32_t)( x >> 32 );
+}
+
+uint32_t esp_get_free_heap_size( void )
+{
+    return 200 * 1024;
+}
+
+uint32_t esp_get_minimum_free_heap_size( void )
+{
+    return 200 * 1024;
+}
+
+void esp_restart( void )
+{
+    host_log( ESP_LOG_WARN, "host: ", "esp_restart()" );
+    exit( 0 );
+}
+
+uint32_t esp_crc32_le( uint32_t crc, const uint8_t *buf, uint32_t len )
+{
+    crc = ~crc;
+    while( len-- )
+    {
+        crc ^= *buf++;
+        for( int bit = 0; bit < 8; bit++ )
+        {
+            crc = ( crc >> 1 ) ^ ( 0xedb88320u & -( crc & 1 ) );
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * Default event loop: posts copy their data into the queue, the loop
+ * task runs the matching handlers
+ */
+#define EVENT_HANDLERS_MAX  ( 16 )
+#define EVENT_QUEUE_LEN     ( 32 )
+
+typedef struct {
+    esp_event_base_t    base;
+    int32_t             id;
+    esp_event_handler_t handler;
+    void               *arg;
+} event_handler_t;
+
+typedef struct {
+    esp_event_base_t    base;
+    int32_t             id;
+    void               *data;
+} event_t;
+
+static event_handler_t event_handlers[EVENT_HANDLERS_MAX];
+static int event_handler_count = 0;
+static portMUX_TYPE event_lock = portMUX_INITIALIZER_UNLOCKED;
+static QueueHandle_t event_queue = NULL;
+
+static void task_event_loop( void *arg )
+{
+    event_t event;
+    event_handler_t handler;
+
+    for( ;; )
+    {
+        xQueueReceive( event_queue, &event, portMAX_DELAY );
+        for( int i = 0; ; i++ )
+        {
+            portENTER_CRITICAL( &event_lock );
+            if( i >= event_handler_count )
+            {
+                portEXIT_CRITICAL( &event_lock );
+                break;
+            }
+            handler = event_handlers[i];
+            portEXIT_CRITICAL( &event_lock );
+            if( handler.base == event.base && ( handler.id == ESP_EVENT_ANY_ID || handler.id == event.id ) )
+            {
+                handler.handler( handler.arg, event.base, event.id, event.data );
+            }
+        }
+        free( event.data );
+    }
+}
+
+esp_err_t esp_event_loop_create_default( void )
+{
+    if( event_queue )
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    event_queue = xQueueCreate( EVENT_QUEUE_LEN, sizeof( event_t ) );
+    if( !event_queue )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if( xTaskCreate( task_event_loop, "sys_evt", 4096, NULL, 20, NULL ) != pdPASS )
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register( esp_event_base_t base, int32_t id, esp_event_handler_t handler, void *arg )
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    portENTER_CRITICAL( &event_lock );
+    if( event_handler_count < EVENT_HANDLERS_MAX )
+    {
+        event_handlers[event_handler_count++] = ( event_handler_t ){ base, id, handler, arg };
+        err = ESP_OK;
+    }
+    portEXIT_CRITICAL( &event_lock );
+    return err;
+}
+
+esp_err_t esp_event_post( esp_event_base_t base, int32_t id, const void *data, size_t size, uint32_t wait )
+{
+    event_t event = { base, id, NULL };
+
+    if( !event_queue )
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if( size )
+    {
+        event.data = malloc( size );
+        if( !event.data )
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy( event.data, data, size );
+    }
+    if( xQueueSend( event_queue, &event, wait ) != pdTRUE )
+    {
+        free( event.data );
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,33 @@
+#ifndef __HOST_ESP_LOG_H__
+#define __HOST_ESP_LOG_H__
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+/**
+ * Log lines go to stderr; only warnings and errors unless raised, as
+ * most modules log every frame under DEBUG. The level applies to every
+ * tag.
+ */
+void esp_log_level_set( const char *tag, esp_log_level_t level );
+void host_log( esp_log_level_t level, const char *tag, const char *format, ... )
+    __attribute__(( format( printf, 3, 4 ) ));
+
+/**
+ * Host only: put 'name' on every line, for processes sharing a terminal
+ */
+void host_log_set_name( const char *name );
+
+#define ESP_LOGE( tag, format, ... )    host_log( ESP_LOG_ERROR, tag, format, ##__VA_ARGS__ )
+#define ESP_LOGW( tag, format, ... )    host_log( ESP_LOG_WARN, tag, format, ##__VA_ARGS__ )
+#define ESP_LOGI( tag, format, ... )    host_log( ESP_LOG_INFO, tag, format, ##__VA_ARGS__ )
+#define ESP_LOGD( tag, format, ... )    host_log( ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__ )
+#define ESP_LOGV( tag, format, ... )    host_log( ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__ )
+
+#endif
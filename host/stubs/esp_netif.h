@@ -0,0 +1,4 @@
+#ifndef __HOST_ESP_NETIF_H__
+#define __HOST_ESP_NETIF_H__
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __HOST_ESP_PARTITION_H__
+#define __HOST_ESP_PARTITION_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_spi_flash.h"
+
+/**
+ * The data partitions of partitions.csv, held in memory and erased
+ * (all 0xff) at start; writes only clear bits, as on flash
+ */
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef int esp_partition_subtype_t;
+
+#define ESP_PARTITION_SUBTYPE_ANY   ( 0xff )
+
+typedef struct {
+    esp_partition_type_t    type;
+    esp_partition_subtype_t subtype;
+    uint32_t                address;
+    uint32_t                size;
+    char                    label[17];
+    bool                    encrypted;
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first( esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                 const char *label );
+esp_err_t esp_partition_read( const esp_partition_t *part, size_t offset, void *dst, size_t size );
+esp_err_t esp_partition_write( const esp_partition_t *part, size_t offset, const void *src, size_t size );
+esp_err_t esp_partition_erase_range( const esp_partition_t *part, size_t offset, size_t size );
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __HOST_ESP_SYSTEM_H__
+#define __HOST_ESP_SYSTEM_H__
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_attr.h"
+
+#define MACSTR          "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR( a )    ( a )[0], ( a )[1], ( a )[2], ( a )[3], ( a )[4], ( a )[5]
+
+uint32_t esp_random( void );
+uint32_t esp_get_free_heap_size( void );
+uint32_t esp_get_minimum_free_heap_size( void );
+void esp_restart( void );
+
+/**
+ * Station MAC of this host "chip"; host_set_mac() sets it, and seeds
+ * esp_random(), before the firmware starts
+ */
+esp_err_t esp_efuse_mac_get_default( uint8_t *mac );
+void host_set_mac( const uint8_t mac[6] );
+
+#endif
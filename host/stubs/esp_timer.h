@@ -0,0 +1,37 @@
+#ifndef __HOST_ESP_TIMER_H__
+#define __HOST_ESP_TIMER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * Microseconds of the monotonic clock since start
+ */
+int64_t esp_timer_get_time( void );
+
+/**
+ * Timers run their callbacks on one timer task, as ESP_TIMER_TASK does
+ */
+typedef struct esp_timer *esp_timer_handle_t;
+typedef void ( *esp_timer_cb_t )( void *arg );
+
+typedef enum {
+    ESP_TIMER_TASK,
+} esp_timer_dispatch_t;
+
+typedef struct {
+    esp_timer_cb_t          callback;
+    void                   *arg;
+    esp_timer_dispatch_t    dispatch_method;
+    const char             *name;
+    bool                    skip_unhandled_events;
+} esp_timer_create_args_t;
+
+esp_err_t esp_timer_create( const esp_timer_create_args_t *args, esp_timer_handle_t *timer );
+esp_err_t esp_timer_start_once( esp_timer_handle_t timer, uint64_t timeout_us );
+esp_err_t esp_timer_start_periodic( esp_timer_handle_t timer, uint64_t period_us );
+esp_err_t esp_timer_stop( esp_timer_handle_t timer );
+
+#endif
@@ -0,0 +1,186 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+/**
+ * Armed timers form a list sorted by expiry; one thread sleeps until the
+ * first and runs its callback with the list unlocked
+ */
+struct esp_timer {
+    esp_timer_cb_t      callback;
+    void               *arg;
+    int64_t             expiry_us;
+    uint64_t            period_us;
+    bool                armed;
+    struct esp_timer   *next;
+};
+
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_changed;
+static struct esp_timer *timer_list = NULL;
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+
+static void timer_unlink( struct esp_timer *timer )
+{
+    struct esp_timer **p = &timer_list;
+
+    while( *p && *p != timer )
+    {
+        p = &( *p )->next;
+    }
+    if( *p )
+    {
+        *p = timer->next;
+    }
+    timer->armed = false;
+}
+
+static void timer_insert( struct esp_timer *timer )
+{
+    struct esp_timer **p = &timer_list;
+
+    while( *p && ( *p )->expiry_us <= timer->expiry_us )
+    {
+        p = &( *p )->next;
+    }
+    timer->next = *p;
+    *p = timer;
+    timer->armed = true;
+    pthread_cond_signal( &timer_changed );
+}
+
+static void task_timer( void *arg )
+{
+    struct esp_timer *timer;
+    struct timespec deadline;
+    esp_timer_cb_t callback;
+    void *callback_arg;
+    int64_t now;
+    int64_t left;
+
+    pthread_mutex_lock( &timer_mutex );
+    for( ;; )
+    {
+        if( !timer_list )
+        {
+            pthread_cond_wait( &timer_changed, &timer_mutex );
+            continue;
+        }
+        now = esp_timer_get_time();
+        left = timer_list->expiry_us - now;
+        if( left > 0 )
+        {
+            clock_gettime( CLOCK_MONOTONIC, &deadline );
+            left += deadline.tv_nsec / 1000;
+            deadline.tv_sec += left / 1000000;
+            deadline.tv_nsec = ( left % 1000000 ) * 1000;
+            pthread_cond_timedwait( &timer_changed, &timer_mutex, &deadline );
+            continue;
+        }
+
+        timer = timer_list;
+        timer_unlink( timer );
+        if( timer->period_us )
+        {
+            timer->expiry_us += timer->period_us;
+            if( timer->expiry_us < now )
+            {
+                timer->expiry_us = now + timer->period_us;
+            }
+            timer_insert( timer );
+        }
+        callback = timer->callback;
+        callback_arg = timer->arg;
+        pthread_mutex_unlock( &timer_mutex );
+        callback( callback_arg );
+        pthread_mutex_lock( &timer_mutex );
+    }
+}
+
+static void timer_service_start( void )
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &timer_changed, &attr );
+    pthread_condattr_destroy( &attr );
+    if( xTaskCreate( task_timer, "esp_timer", 4096, NULL, 22, NULL ) != pdPASS )
+    {
+        abort();
+    }
+}
+
+esp_err_t esp_timer_create( const esp_timer_create_args_t *args, esp_timer_handle_t *timer )
+{
+    struct esp_timer *t;
+
+    if( !args || !args->callback || !timer )
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    t = calloc( 1, sizeof( *t ) );
+    if( !t )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    t->callback = args->callback;
+    t->arg = args->arg;
+    pthread_once( &timer_once, timer_service_start );
+    *timer = t;
+    return ESP_OK;
+}
+
+static esp_err_t timer_start( esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us )
+{
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+
+    if( !timer )
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock( &timer_mutex );
+    if( !timer->armed )
+    {
+        timer->expiry_us = esp_timer_get_time() + (int64_t)timeout_us;
+        timer->period_us = period_us;
+        timer_insert( timer );
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock( &timer_mutex );
+    return err;
+}
+
+esp_err_t esp_timer_start_once( esp_timer_handle_t timer, uint64_t timeout_us )
+{
+    return timer_start( timer, timeout_us, 0 );
+}
+
+esp_err_t esp_timer_start_periodic( esp_timer_handle_t timer, uint64_t period_us )
+{
+    return timer_start( timer, period_us, period_us );
+}
+
+esp_err_t esp_timer_stop( esp_timer_handle_t timer )
+{
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+
+    if( !timer )
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock( &timer_mutex );
+    if( timer->armed )
+    {
+        timer_unlink( timer );
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock( &timer_mutex );
+    return err;
+}
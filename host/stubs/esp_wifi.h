@@ -0,0 +1,103 @@
+#ifndef __HOST_ESP_WIFI_H__
+#define __HOST_ESP_WIFI_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_system.h"
+#include "tcpip_adapter.h"
+
+/**
+ * The radio exists only as the simulated mesh: the link calls report
+ * the simulated parent and children
+ */
+#define ESP_WIFI_MAX_CONN_NUM   ( 10 )
+
+typedef enum {
+    WIFI_AUTH_OPEN,
+    WIFI_AUTH_WEP,
+    WIFI_AUTH_WPA_PSK,
+    WIFI_AUTH_WPA2_PSK,
+    WIFI_AUTH_WPA_WPA2_PSK,
+} wifi_auth_mode_t;
+
+typedef enum {
+    WIFI_STORAGE_FLASH,
+    WIFI_STORAGE_RAM,
+} wifi_storage_t;
+
+typedef struct {
+    int unused;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT()  { 0 }
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    bool    bssid_set;
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_sta_config_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    uint8_t channel;
+    uint8_t max_connection;
+} wifi_ap_config_t;
+
+typedef union {
+    wifi_ap_config_t  ap;
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t primary;
+    int8_t  rssi;
+} wifi_ap_record_t;
+
+typedef struct {
+    uint8_t mac[6];
+    int8_t  rssi;
+} wifi_sta_info_t;
+
+typedef struct {
+    wifi_sta_info_t sta[ESP_WIFI_MAX_CONN_NUM];
+    int             num;
+} wifi_sta_list_t;
+
+typedef struct {
+    uint8_t             ssid[32];
+    uint8_t             ssid_len;
+    uint8_t             bssid[6];
+    uint8_t             channel;
+    wifi_auth_mode_t    authmode;
+} wifi_event_sta_connected_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t reason;
+} wifi_event_sta_disconnected_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t aid;
+    bool    is_mesh_child;
+} wifi_event_ap_staconnected_t;
+
+typedef wifi_event_ap_staconnected_t wifi_event_ap_stadisconnected_t;
+
+esp_err_t esp_wifi_init( const wifi_init_config_t *config );
+esp_err_t esp_wifi_set_storage( wifi_storage_t storage );
+esp_err_t esp_wifi_start( void );
+esp_err_t esp_wifi_sta_get_ap_info( wifi_ap_record_t *ap );
+esp_err_t esp_wifi_ap_get_sta_list( wifi_sta_list_t *list );
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "sdkconfig.h"
+
+/**
+ * FreeRTOS on the host: tasks are threads, queues and semaphores are
+ * mutex and condition variable rings, and a tick is 1/CONFIG_FREERTOS_HZ
+ * of the monotonic clock since start
+ */
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE                         ( 0 )
+#define pdTRUE                          ( 1 )
+#define pdFAIL                          ( pdFALSE )
+#define pdPASS                          ( pdTRUE )
+
+#define configTICK_RATE_HZ              ( CONFIG_FREERTOS_HZ )
+#define portTICK_PERIOD_MS              ( 1000 / configTICK_RATE_HZ )
+#define portMAX_DELAY                   ( (TickType_t)0xffffffffu )
+#define pdMS_TO_TICKS( ms )             ( (TickType_t)( (uint64_t)( ms ) * configTICK_RATE_HZ / 1000 ) )
+#define portNUM_PROCESSORS              ( 2 )
+#define portYIELD_FROM_ISR()            do { } while( 0 )
+
+/**
+ * Critical sections: a portMUX is a mutex; code holding one never blocks
+ * or takes the same one again, as on the target
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { PTHREAD_MUTEX_INITIALIZER }
+
+#define portENTER_CRITICAL( mux )       pthread_mutex_lock( &( mux )->mutex )
+#define portEXIT_CRITICAL( mux )        pthread_mutex_unlock( &( mux )->mutex )
+#define portENTER_CRITICAL_ISR( mux )   portENTER_CRITICAL( mux )
+#define portEXIT_CRITICAL_ISR( mux )    portEXIT_CRITICAL( mux )
+
+#endif
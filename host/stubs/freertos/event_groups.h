@@ -0,0 +1,21 @@
+#ifndef __HOST_EVENT_GROUPS_H__
+#define __HOST_EVENT_GROUPS_H__
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_event_group *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+
+#define BIT0    ( 1u << 0 )
+#define BIT1    ( 1u << 1 )
+#define BIT2    ( 1u << 2 )
+#define BIT3    ( 1u << 3 )
+
+EventGroupHandle_t xEventGroupCreate( void );
+EventBits_t xEventGroupSetBits( EventGroupHandle_t group, EventBits_t bits );
+EventBits_t xEventGroupClearBits( EventGroupHandle_t group, EventBits_t bits );
+EventBits_t xEventGroupGetBits( EventGroupHandle_t group );
+EventBits_t xEventGroupWaitBits( EventGroupHandle_t group, EventBits_t bits, BaseType_t clear,
+                                 BaseType_t all, TickType_t wait );
+
+#endif
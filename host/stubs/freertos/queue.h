@@ -0,0 +1,21 @@
+#ifndef __HOST_QUEUE_H__
+#define __HOST_QUEUE_H__
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue *QueueHandle_t;
+
+/**
+ * Items are copied in and out as on the target; 'wait' is in ticks,
+ * portMAX_DELAY waits for ever
+ */
+QueueHandle_t xQueueCreate( UBaseType_t length, UBaseType_t item_size );
+void vQueueDelete( QueueHandle_t queue );
+BaseType_t xQueueSend( QueueHandle_t queue, const void *item, TickType_t wait );
+BaseType_t xQueueReceive( QueueHandle_t queue, void *item, TickType_t wait );
+UBaseType_t uxQueueMessagesWaiting( QueueHandle_t queue );
+
+#define xQueueSendToBack( queue, item, wait )       xQueueSend( queue, item, wait )
+#define xQueueSendFromISR( queue, item, woken )     ( ( void )( woken ), xQueueSend( queue, item, 0 ) )
+
+#endif
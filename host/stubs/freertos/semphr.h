@@ -0,0 +1,23 @@
+#ifndef __HOST_SEMPHR_H__
+#define __HOST_SEMPHR_H__
+
+#include "freertos/queue.h"
+
+/**
+ * Semaphores are queues of empty items, as in FreeRTOS; the mutex is
+ * not recursive and has no priority inheritance
+ */
+typedef QueueHandle_t SemaphoreHandle_t;
+
+QueueHandle_t host_semaphore_create( UBaseType_t max, UBaseType_t initial );
+
+#define xSemaphoreCreateBinary()                    host_semaphore_create( 1, 0 )
+#define xSemaphoreCreateCounting( max, initial )    host_semaphore_create( max, initial )
+#define xSemaphoreCreateMutex()                     host_semaphore_create( 1, 1 )
+#define xSemaphoreTake( sem, wait )                 xQueueReceive( sem, NULL, wait )
+#define xSemaphoreGive( sem )                       xQueueSend( sem, NULL, 0 )
+#define xSemaphoreGiveFromISR( sem, woken )         ( ( void )( woken ), xQueueSend( sem, NULL, 0 ) )
+#define uxSemaphoreGetCount( sem )                  uxQueueMessagesWaiting( sem )
+#define vSemaphoreDelete( sem )                     vQueueDelete( sem )
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef __HOST_TASK_H__
+#define __HOST_TASK_H__
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task *TaskHandle_t;
+typedef void ( *TaskFunction_t )( void * );
+
+#define tskNO_AFFINITY                  ( 0x7fffffff )
+
+/**
+ * Starts 'task' on a thread of its own; stack size, priority and core
+ * are ignored
+ */
+BaseType_t xTaskCreatePinnedToCore( TaskFunction_t task, const char *name, uint32_t stack, void *param,
+                                    UBaseType_t priority, TaskHandle_t *handle, BaseType_t core );
+#define xTaskCreate( task, name, stack, param, priority, handle ) \
+    xTaskCreatePinnedToCore( task, name, stack, param, priority, handle, tskNO_AFFINITY )
+
+/**
+ * Only a task deleting itself (NULL) is supported
+ */
+void vTaskDelete( TaskHandle_t task );
+
+void vTaskDelay( TickType_t ticks );
+void vTaskDelayUntil( TickType_t *previous, TickType_t increment );
+TickType_t xTaskGetTickCount( void );
+const char *pcTaskGetTaskName( TaskHandle_t task );
+
+/**
+ * Threads have no watermark or run-time counters to report: the calls
+ * answer as a system with no tasks would
+ */
+typedef struct {
+    TaskHandle_t    xHandle;
+    const char     *pcTaskName;
+    UBaseType_t     xTaskNumber;
+    UBaseType_t     uxCurrentPriority;
+    UBaseType_t     uxBasePriority;
+    uint32_t        ulRunTimeCounter;
+    uint32_t        usStackHighWaterMark;
+    BaseType_t      xCoreID;
+} TaskStatus_t;
+
+#define uxTaskGetStackHighWaterMark( task ) ( (UBaseType_t)0 )
+UBaseType_t uxTaskGetNumberOfTasks( void );
+UBaseType_t uxTaskGetSystemState( TaskStatus_t *status, UBaseType_t count, uint32_t *total_run_time );
+TaskHandle_t xTaskGetIdleTaskHandleForCPU( UBaseType_t cpu );
+
+#endif
@@ -0,0 +1,393 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+#include "esp_timer.h"
+
+struct host_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    UBaseType_t     length;
+    UBaseType_t     item_size;
+    UBaseType_t     head;
+    UBaseType_t     count;
+    uint8_t         items[];
+};
+
+struct host_task {
+    TaskFunction_t  task;
+    void           *param;
+    const char     *name;
+    pthread_t       thread;
+};
+
+struct host_event_group {
+    pthread_mutex_t mutex;
+    pthread_cond_t  changed;
+    EventBits_t     bits;
+};
+
+static struct timespec host_start;
+static pthread_once_t host_start_once = PTHREAD_ONCE_INIT;
+
+static void host_start_init( void )
+{
+    clock_gettime( CLOCK_MONOTONIC, &host_start );
+}
+
+int64_t esp_timer_get_time( void )
+{
+    struct timespec now;
+
+    pthread_once( &host_start_once, host_start_init );
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (int64_t)( now.tv_sec - host_start.tv_sec ) * 1000000 + ( now.tv_nsec - host_start.tv_nsec ) / 1000;
+}
+
+TickType_t xTaskGetTickCount( void )
+{
+    return (TickType_t)( esp_timer_get_time() * configTICK_RATE_HZ / 1000000 );
+}
+
+static void sleep_us( int64_t us )
+{
+    struct timespec ts = { us / 1000000, ( us % 1000000 ) * 1000 };
+
+    while( us > 0 && nanosleep( &ts, &ts ) != 0 && errno == EINTR )
+    {
+    }
+}
+
+void vTaskDelay( TickType_t ticks )
+{
+    if( ticks )
+    {
+        sleep_us( (int64_t)ticks * 1000000 / configTICK_RATE_HZ );
+    }
+    else
+    {
+        sched_yield();
+    }
+}
+
+void vTaskDelayUntil( TickType_t *previous, TickType_t increment )
+{
+    TickType_t wake = *previous + increment;
+    int32_t left = (int32_t)( wake - xTaskGetTickCount() );
+
+    if( left > 0 )
+    {
+        sleep_us( (int64_t)left * 1000000 / configTICK_RATE_HZ );
+    }
+    *previous = wake;
+}
+
+static void *task_entry( void *arg )
+{
+    struct host_task *t = arg;
+
+    t->task( t->param );
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore( TaskFunction_t task, const char *name, uint32_t stack, void *param,
+                                    UBaseType_t priority, TaskHandle_t *handle, BaseType_t core )
+{
+    struct host_task *t = calloc( 1, sizeof( *t ) );
+
+    ( void )stack;
+    ( void )priority;
+    ( void )core;
+    if( !t )
+    {
+        return pdFAIL;
+    }
+    t->task = task;
+    t->param = param;
+    t->name = name;
+    if( pthread_create( &t->thread, NULL, task_entry, t ) != 0 )
+    {
+        free( t );
+        return pdFAIL;
+    }
+    pthread_detach( t->thread );
+    if( handle )
+    {
+        *handle = t;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete( TaskHandle_t task )
+{
+    if( !task )
+    {
+        pthread_exit( NULL );
+    }
+    abort();
+}
+
+const char *pcTaskGetTaskName( TaskHandle_t task )
+{
+    return task ? task->name : "";
+}
+
+UBaseType_t uxTaskGetNumberOfTasks( void )
+{
+    return 0;
+}
+
+UBaseType_t uxTaskGetSystemState( TaskStatus_t *status, UBaseType_t count, uint32_t *total_run_time )
+{
+    if( total_run_time )
+    {
+        *total_run_time = 0;
+    }
+    return 0;
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU( UBaseType_t cpu )
+{
+    return NULL;
+}
+
+/**
+ * Absolute CLOCK_MONOTONIC time 'wait' ticks from now
+ */
+static void deadline_after( struct timespec *deadline, TickType_t wait )
+{
+    uint64_t ns;
+
+    clock_gettime( CLOCK_MONOTONIC, deadline );
+    ns = (uint64_t)deadline->tv_nsec + (uint64_t)wait * ( 1000000000u / configTICK_RATE_HZ );
+    deadline->tv_sec += ns / 1000000000u;
+    deadline->tv_nsec = ns % 1000000000u;
+}
+
+static void cond_init_monotonic( pthread_cond_t *cond )
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( cond, &attr );
+    pthread_condattr_destroy( &attr );
+}
+
+QueueHandle_t xQueueCreate( UBaseType_t length, UBaseType_t item_size )
+{
+    struct host_queue *q = calloc( 1, sizeof( *q ) + (size_t)length * item_size );
+
+    if( !q || !length )
+    {
+        free( q );
+        return NULL;
+    }
+    pthread_mutex_init( &q->mutex, NULL );
+    cond_init_monotonic( &q->not_empty );
+    cond_init_monotonic( &q->not_full );
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+QueueHandle_t host_semaphore_create( UBaseType_t max, UBaseType_t initial )
+{
+    QueueHandle_t q = xQueueCreate( max, 0 );
+
+    if( q )
+    {
+        q->count = initial;
+    }
+    return q;
+}
+
+void vQueueDelete( QueueHandle_t q )
+{
+    pthread_mutex_destroy( &q->mutex );
+    pthread_cond_destroy( &q->not_empty );
+    pthread_cond_destroy( &q->not_full );
+    free( q );
+}
+
+/**
+ * Waits on 'cond' until 'ready' holds or 'wait' ticks passed; called
+ * with the queue locked
+ */
+static bool queue_wait( struct host_queue *q, pthread_cond_t *cond, bool ( *ready )( struct host_queue * ),
+                        TickType_t wait )
+{
+    struct timespec deadline;
+
+    if( ready( q ) )
+    {
+        return true;
+    }
+    if( !wait )
+    {
+        return false;
+    }
+    if( wait == portMAX_DELAY )
+    {
+        while( !ready( q ) )
+        {
+            pthread_cond_wait( cond, &q->mutex );
+        }
+        return true;
+    }
+
+    deadline_after( &deadline, wait );
+    while( !ready( q ) )
+    {
+        if( pthread_cond_timedwait( cond, &q->mutex, &deadline ) == ETIMEDOUT )
+        {
+            return ready( q );
+        }
+    }
+    return true;
+}
+
+static bool queue_has_room( struct host_queue *q )
+{
+    return q->count < q->length;
+}
+
+static bool queue_has_item( struct host_queue *q )
+{
+    return q->count > 0;
+}
+
+BaseType_t xQueueSend( QueueHandle_t q, const void *item, TickType_t wait )
+{
+    pthread_mutex_lock( &q->mutex );
+    if( !queue_wait( q, &q->not_full, queue_has_room, wait ) )
+    {
+        pthread_mutex_unlock( &q->mutex );
+        return pdFALSE;
+    }
+    if( q->item_size )
+    {
+        memcpy( &q->items[( ( q->head + q->count ) % q->length ) * q->item_size], item, q->item_size );
+    }
+    q->count++;
+    pthread_cond_signal( &q->not_empty );
+    pthread_mutex_unlock( &q->mutex );
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive( QueueHandle_t q, void *item, TickType_t wait )
+{
+    pthread_mutex_lock( &q->mutex );
+    if( !queue_wait( q, &q->not_empty, queue_has_item, wait ) )
+    {
+        pthread_mutex_unlock( &q->mutex );
+        return pdFALSE;
+    }
+    if( q->item_size )
+    {
+        memcpy( item, &q->items[q->head * q->item_size], q->item_size );
+    }
+    q->head = ( q->head + 1 ) % q->length;
+    q->count--;
+    pthread_cond_signal( &q->not_full );
+    pthread_mutex_unlock( &q->mutex );
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting( QueueHandle_t q )
+{
+    UBaseType_t count;
+
+    pthread_mutex_lock( &q->mutex );
+    count = q->count;
+    pthread_mutex_unlock( &q->mutex );
+    return count;
+}
+
+EventGroupHandle_t xEventGroupCreate( void )
+{
+    struct host_event_group *group = calloc( 1, sizeof( *group ) );
+
+    if( group )
+    {
+        pthread_mutex_init( &group->mutex, NULL );
+        cond_init_monotonic( &group->changed );
+    }
+    return group;
+}
+
+EventBits_t xEventGroupSetBits( EventGroupHandle_t group, EventBits_t bits )
+{
+    EventBits_t now;
+
+    pthread_mutex_lock( &group->mutex );
+    group->bits |= bits;
+    now = group->bits;
+    pthread_cond_broadcast( &group->changed );
+    pthread_mutex_unlock( &group->mutex );
+    return now;
+}
+
+EventBits_t xEventGroupClearBits( EventGroupHandle_t group, EventBits_t bits )
+{
+    EventBits_t before;
+
+    pthread_mutex_lock( &group->mutex );
+    before = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock( &group->mutex );
+    return before;
+}
+
+EventBits_t xEventGroupGetBits( EventGroupHandle_t group )
+{
+    EventBits_t now;
+
+    pthread_mutex_lock( &group->mutex );
+    now = group->bits;
+    pthread_mutex_unlock( &group->mutex );
+    return now;
+}
+
+static bool bits_set( EventBits_t now, EventBits_t bits, BaseType_t all )
+{
+    return all ? ( now & bits ) == bits : ( now & bits ) != 0;
+}
+
+EventBits_t xEventGroupWaitBits( EventGroupHandle_t group, EventBits_t bits, BaseType_t clear,
+                                 BaseType_t all, TickType_t wait )
+{
+    struct timespec deadline;
+    EventBits_t now;
+
+    deadline_after( &deadline, wait == portMAX_DELAY ? 0 : wait );
+    pthread_mutex_lock( &group->mutex );
+    while( !bits_set( group->bits, bits, all ) && wait )
+    {
+        if( wait == portMAX_DELAY )
+        {
+            pthread_cond_wait( &group->changed, &group->mutex );
+        }
+        else if( pthread_cond_timedwait( &group->changed, &group->mutex, &deadline ) == ETIMEDOUT )
+        {
+            break;
+        }
+    }
+    now = group->bits;
+    if( clear && bits_set( now, bits, all ) )
+    {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock( &group->mutex );
+    return now;
+}
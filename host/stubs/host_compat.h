@@ -0,0 +1,16 @@
+#ifndef __HOST_COMPAT_H__
+#define __HOST_COMPAT_H__
+
+/**
+ * Included ahead of every source in the host build: what newlib on the
+ * ESP32 provides and the host C library may not
+ */
+#include <stddef.h>
+#include <string.h>
+
+#if defined( __GLIBC__ ) && ( __GLIBC__ < 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ < 38 ) )
+#define HOST_NEED_STRLCPY
+size_t strlcpy( char *dst, const char *src, size_t size );
+#endif
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef __HOST_LWIP_SYS_H__
+#define __HOST_LWIP_SYS_H__
+
+/**
+ * Nothing of lwIP is used on the host; FIXED_IP builds are not supported
+ */
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __HOST_NVS_H__
+#define __HOST_NVS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * Non-volatile storage held in memory: it lasts as long as the process
+ */
+#define ESP_ERR_NVS_BASE                ( 0x1100 )
+#define ESP_ERR_NVS_NOT_INITIALIZED     ( ESP_ERR_NVS_BASE + 0x01 )
+#define ESP_ERR_NVS_NOT_FOUND           ( ESP_ERR_NVS_BASE + 0x02 )
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE    ( ESP_ERR_NVS_BASE + 0x05 )
+#define ESP_ERR_NVS_INVALID_LENGTH      ( ESP_ERR_NVS_BASE + 0x0c )
+#define ESP_ERR_NVS_NO_FREE_PAGES       ( ESP_ERR_NVS_BASE + 0x0d )
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+esp_err_t nvs_open( const char *name, nvs_open_mode_t mode, nvs_handle_t *handle );
+void nvs_close( nvs_handle_t handle );
+esp_err_t nvs_commit( nvs_handle_t handle );
+esp_err_t nvs_get_blob( nvs_handle_t handle, const char *key, void *value, size_t *length );
+esp_err_t nvs_set_blob( nvs_handle_t handle, const char *key, const void *value, size_t length );
+esp_err_t nvs_get_u32( nvs_handle_t handle, const char *key, uint32_t *value );
+esp_err_t nvs_set_u32( nvs_handle_t handle, const char *key, uint32_t value );
+esp_err_t nvs_erase_key( nvs_handle_t handle, const char *key );
+
+#endif
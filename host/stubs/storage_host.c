@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "esp_partition.h"
+
+/**
+ * NVS: a flat table of (namespace, key) entries; a handle is the index
+ * of its namespace plus one
+ */
+#define NVS_NAMESPACES_MAX  ( 8 )
+#define NVS_ENTRIES_MAX     ( 32 )
+#define NVS_NAME_LEN        ( 16 )
+#define NVS_BLOB_MAX        ( 512 )
+
+typedef struct {
+    uint32_t    ns;
+    char        key[NVS_NAME_LEN];
+    size_t      length;
+    uint8_t     value[NVS_BLOB_MAX];
+} nvs_entry_t;
+
+static char nvs_namespaces[NVS_NAMESPACES_MAX][NVS_NAME_LEN];
+static nvs_entry_t nvs_entries[NVS_ENTRIES_MAX];
+static int nvs_entry_count = 0;
+static bool nvs_ready = false;
+static portMUX_TYPE nvs_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t nvs_flash_init( void )
+{
+    nvs_ready = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase( void )
+{
+    portENTER_CRITICAL( &nvs_lock );
+    memset( nvs_namespaces, 0, sizeof( nvs_namespaces ) );
+    nvs_entry_count = 0;
+    portEXIT_CRITICAL( &nvs_lock );
+    return ESP_OK;
+}
+
+esp_err_t nvs_open( const char *name, nvs_open_mode_t mode, nvs_handle_t *handle )
+{
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    int free_slot = -1;
+
+    if( !nvs_ready )
+    {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    portENTER_CRITICAL( &nvs_lock );
+    for( int i = 0; i < NVS_NAMESPACES_MAX; i++ )
+    {
+        if( !strncmp( nvs_namespaces[i], name, NVS_NAME_LEN ) )
+        {
+            *handle = i + 1;
+            err = ESP_OK;
+            break;
+        }
+        if( !nvs_namespaces[i][0] && free_slot < 0 )
+        {
+            free_slot = i;
+        }
+    }
+    if( err != ESP_OK && mode == NVS_READWRITE )
+    {
+        if( free_slot < 0 )
+        {
+            err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        else
+        {
+            strlcpy( nvs_namespaces[free_slot], name, NVS_NAME_LEN );
+            *handle = free_slot + 1;
+            err = ESP_OK;
+        }
+    }
+    portEXIT_CRITICAL( &nvs_lock );
+    return err;
+}
+
+void nvs_close( nvs_handle_t handle )
+{
+}
+
+esp_err_t nvs_commit( nvs_handle_t handle )
+{
+    return ESP_OK;
+}
+
+/**
+ * Called with nvs_lock held
+ */
+static nvs_entry_t *nvs_find( nvs_handle_t handle, const char *key )
+{
+    for( int i = 0; i < nvs_entry_count; i++ )
+    {
+        if( nvs_entries[i].ns == handle && !strncmp( nvs_entries[i].key, key, NVS_NAME_LEN ) )
+        {
+            return &nvs_entries[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_get_blob( nvs_handle_t handle, const char *key, void *value, size_t *length )
+{
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    nvs_entry_t *entry;
+
+    portENTER_CRITICAL( &nvs_lock );
+    entry = nvs_find( handle, key );
+    if( entry && !value )
+    {
+        *length = entry->length;
+        err = ESP_OK;
+    }
+    else if( entry && *length < entry->length )
+    {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    else if( entry )
+    {
+        memcpy( value, entry->value, entry->length );
+        *length = entry->length;
+        err = ESP_OK;
+    }
+    portEXIT_CRITICAL( &nvs_lock );
+    return err;
+}
+
+esp_err_t nvs_set_blob( nvs_handle_t handle, const char *key, const void *value, size_t length )
+{
+    esp_err_t err = ESP_OK;
+    nvs_entry_t *entry;
+
+    if( length > NVS_BLOB_MAX )
+    {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    portENTER_CRITICAL( &nvs_lock );
+    entry = nvs_find( handle, key );
+    if( !entry && nvs_entry_count < NVS_ENTRIES_MAX )
+    {
+        entry = &nvs_entries[nvs_entry_count++];
+        entry->ns = handle;
+        strlcpy( entry->key, key, NVS_NAME_LEN );
+    }
+    if( entry )
+    {
+        memcpy( entry->value, value, length );
+        entry->length = length;
+    }
+    else
+    {
+        err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    portEXIT_CRITICAL( &nvs_lock );
+    return err;
+}
+
+esp_err_t nvs_get_u32( nvs_handle_t handle, const char *key, uint32_t *value )
+{
+    size_t length = sizeof( *value );
+
+    return nvs_get_blob( handle, key, value, &length );
+}
+
+esp_err_t nvs_set_u32( nvs_handle_t handle, const char *key, uint32_t value )
+{
+    return nvs_set_blob( handle, key, &value, sizeof( value ) );
+}
+
+esp_err_t nvs_erase_key( nvs_handle_t handle, const char *key )
+{
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+    nvs_entry_t *entry;
+
+    portENTER_CRITICAL( &nvs_lock );
+    entry = nvs_find( handle, key );
+    if( entry )
+    {
+        *entry = nvs_entries[--nvs_entry_count];
+        err = ESP_OK;
+    }
+    portEXIT_CRITICAL( &nvs_lock );
+    return err;
+}
+
+/**
+ * Partitions: the data rows of partitions.csv
+ */
+typedef struct {
+    esp_partition_t part;
+    uint8_t        *flash;
+} host_partition_t;
+
+static host_partition_t partitions[] = {
+    { { ESP_PARTITION_TYPE_DATA, 0x02, 0x9000, 0x6000, "nvs", false }, NULL },
+    { { ESP_PARTITION_TYPE_DATA, 0x01, 0xf000, 0x1000, "phy_init", false }, NULL },
+    { { ESP_PARTITION_TYPE_DATA, 0x40, 0x140000, 0x40000, "fwdlog", false }, NULL },
+};
+static portMUX_TYPE partition_lock = portMUX_INITIALIZER_UNLOCKED;
+
+const esp_partition_t *esp_partition_find_first( esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                 const char *label )
+{
+    const esp_partition_t *found = NULL;
+
+    portENTER_CRITICAL( &partition_lock );
+    for( size_t i = 0; i < sizeof( partitions ) / sizeof( partitions[0] ); i++ )
+    {
+        host_partition_t *p = &partitions[i];
+
+        if( p->part.type != type || ( subtype != ESP_PARTITION_SUBTYPE_ANY && p->part.subtype != subtype ) ||
+            ( label && strcmp( p->part.label, label ) ) )
+        {
+            continue;
+        }
+        if( !p->flash && ( p->flash = malloc( p->part.size ) ) != NULL )
+        {
+            memset( p->flash, 0xff, p->part.size );
+        }
+        found = p->flash ? &p->part : NULL;
+        break;
+    }
+    portEXIT_CRITICAL( &partition_lock );
+    return found;
+}
+
+static uint8_t *partition_flash( const esp_partition_t *part, size_t offset, size_t size )
+{
+    host_partition_t *p = (host_partition_t *)part;
+
+    if( !part || offset > part->size || size > part->size - offset )
+    {
+        return NULL;
+    }
+    return p->flash + offset;
+}
+
+esp_err_t esp_partition_read( const esp_partition_t *part, size_t offset, void *dst, size_t size )
+{
+    uint8_t *flash = partition_flash( part, offset, size );
+
+    if( !flash )
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy( dst, flash, size );
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write( const esp_partition_t *part, size_t offset, const void *src, size_t size )
+{
+    uint8_t *flash = partition_flash( part, offset, size );
+    const uint8_t *bytes = src;
+
+    if( !flash )
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for( size_t i = 0; i < size; i++ )
+    {
+        flash[i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range( const esp_partition_t *part, size_t offset, size_t size )
+{
+    uint8_t *flash = partition_flash( part, offset, size );
+
+    if( !flash || offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE )
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset( flash, 0xff, size );
+    return ESP_OK;
+}
@@ -0,0 +1,16 @@
+#ifndef __HOST_TCPIP_ADAPTER_H__
+#define __HOST_TCPIP_ADAPTER_H__
+
+#include "esp_err.h"
+
+typedef enum {
+    TCPIP_ADAPTER_IF_STA,
+    TCPIP_ADAPTER_IF_AP,
+} tcpip_adapter_if_t;
+
+esp_err_t tcpip_adapter_init( void );
+esp_err_t tcpip_adapter_dhcps_stop( tcpip_adapter_if_t tcpip_if );
+esp_err_t tcpip_adapter_dhcpc_stop( tcpip_adapter_if_t tcpip_if );
+esp_err_t tcpip_adapter_dhcpc_start( tcpip_adapter_if_t tcpip_if );
+
+#endif
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "json_scan.h"
+#include "host_bench.h"
+
+#ifdef HAVE_CJSON
+#include "cJSON.h"
+#endif
+
+/**
+ * Throughput of the root's legacy frame handling: json_scan pulling the
+ * four fields root_handle_json() reads, against cJSON_Parse() building
+ * the tree and looking them up as the root did before. The frames are
+ * the ones older firmware sends, laid out as cJSON_Print() wrote them,
+ * and are scanned in turn.
+ */
+static const char *frames[] = {
+    "{\n\t\"Topic\":\t\"Connect-Mesh\",\n\t\"ID\":\t\"17\",\n\t\"SSID\":\t\"24:0a:c4:01:02:03\"\n}",
+    "{\n\t\"Topic\":\t\"Send-Data\",\n\t\"Data\":\t156\n}",
+    "{\n\t\"Topic\":\t\"Send-Data\",\n\t\"ID\":\t\"204\",\n\t\"Data\":\t-3071\n}",
+};
+#define FRAME_COUNT     ( sizeof( frames ) / sizeof( frames[0] ) )
+
+static void report( const char *what, long n, size_t bytes, uint64_t ns )
+{
+    printf( "  %-22s %8.1f ns/msg %10.0f msgs/s %8.1f MB/s\n", what, (double)ns / n,
+            n * 1e9 / ns, bytes * 1e3 / ns );
+}
+
+int main( int argc, char **argv )
+{
+    long n = bench_iterations( argc, argv, 1000000 );
+    size_t lens[FRAME_COUNT];
+    size_t bytes = 0;
+    int32_t sum = 0;
+    uint64_t start;
+
+    for( size_t f = 0; f < FRAME_COUNT; f++ )
+    {
+        lens[f] = strlen( frames[f] );
+    }
+    for( long i = 0; i < n; i++ )
+    {
+        bytes += lens[i % FRAME_COUNT];
+    }
+
+    printf( "%ld messages, %zu bytes\n", n, bytes );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        const char *text = frames[i % FRAME_COUNT];
+        json_field_t fields[] = { { .key = "Topic" }, { .key = "ID" }, { .key = "SSID" }, { .key = "Data" } };
+        int32_t value;
+
+        bench_keep( text );
+        if( json_scan( text, lens[i % FRAME_COUNT], fields, 4 ) > 0 )
+        {
+            sum += fields[0].value_len + fields[1].value_len + fields[2].value_len;
+            if( json_field_int( &fields[3], &value ) )
+            {
+                sum += value;
+            }
+        }
+    }
+    report( "json_scan", n, bytes, bench_now_ns() - start );
+
+#ifdef HAVE_CJSON
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        cJSON *root = cJSON_Parse( frames[i % FRAME_COUNT] );
+        cJSON *item;
+
+        if( root )
+        {
+            sum += strlen( cJSON_GetObjectItem( root, "Topic" )->valuestring );
+            if( ( item = cJSON_GetObjectItem( root, "ID" ) ) )
+            {
+                sum += strlen( item->valuestring );
+            }
+            if( ( item = cJSON_GetObjectItem( root, "SSID" ) ) )
+            {
+                sum += strlen( item->valuestring );
+            }
+            if( ( item = cJSON_GetObjectItem( root, "Data" ) ) )
+            {
+                sum += item->valueint;
+            }
+            cJSON_Delete( root );
+        }
+    }
+    report( "cJSON_Parse", n, bytes, bench_now_ns() - start );
+#else
+    printf( "  (built without cJSON: no cJSON timings)\n" );
+#endif
+
+    bench_keep( &sum );
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mesh_proto.h"
+#include "json_scan.h"
+#include "host_bench.h"
+
+#ifdef HAVE_CJSON
+#include "cJSON.h"
+#endif
+
+/**
+ * Binary frames against the cJSON text frames they replaced: cost of
+ * building and reading a reading and a registration, and their size on
+ * the air. The JSON frames are laid out as cJSON_Print() wrote them,
+ * sent with their NUL as before.
+ */
+#define BENCH_NODE_ID   "17"
+#define BENCH_MAC_STR   "24:0a:c4:01:02:03"
+#define BENCH_VALUE     ( 156 )
+
+static const uint8_t bench_mac[6] = { 0x24, 0x0a, 0xc4, 0x01, 0x02, 0x03 };
+
+static int bin_data_encode( uint8_t *buf, size_t size, uint32_t seq )
+{
+    uint8_t payload[MESH_PAYLOAD_DATA_SIZE];
+    mesh_payload_data_t data = { .value = BENCH_VALUE };
+    mesh_frame_t frame = { .type = MESH_MSG_DATA, .node_id = 17, .seq = seq,
+                           .payload_len = sizeof( payload ), .payload = payload };
+
+    memcpy( frame.mac, bench_mac, 6 );
+    mesh_proto_put_data( &data, payload, sizeof( payload ) );
+    return mesh_proto_encode( &frame, buf, size );
+}
+
+static int bin_connect_encode( uint8_t *buf, size_t size, uint32_t seq )
+{
+    mesh_frame_t frame = { .type = MESH_MSG_CONNECT, .node_id = 17, .seq = seq };
+
+    memcpy( frame.mac, bench_mac, 6 );
+    return mesh_proto_encode( &frame, buf, size );
+}
+
+static int json_data_print( char *buf, size_t size )
+{
+    return snprintf( buf, size, "{\n\t\"Topic\":\t\"Send-Data\",\n\t\"Data\":\t%d\n}", BENCH_VALUE ) + 1;
+}
+
+static int json_connect_print( char *buf, size_t size )
+{
+    return snprintf( buf, size, "{\n\t\"Topic\":\t\"Connect-Mesh\",\n\t\"ID\":\t\"%s\",\n\t\"SSID\":\t\"%s\"\n}",
+                     BENCH_NODE_ID, BENCH_MAC_STR ) + 1;
+}
+
+static void report( const char *what, long n, uint64_t ns )
+{
+    printf( "  %-34s %8.1f ns/op\n", what, (double)ns / n );
+}
+
+int main( int argc, char **argv )
+{
+    long n = bench_iterations( argc, argv, 1000000 );
+    uint8_t bin[MESH_PROTO_FRAME_MAX];
+    char text[128];
+    mesh_frame_t frame;
+    mesh_payload_data_t data;
+    int32_t sum = 0;
+    uint64_t start;
+    int bin_data_len = bin_data_encode( bin, sizeof( bin ), 0 );
+    int bin_connect_len = bin_connect_encode( bin, sizeof( bin ), 0 );
+    int json_data_len = json_data_print( text, sizeof( text ) );
+    int json_connect_len = json_connect_print( text, sizeof( text ) );
+
+    printf( "bytes on air      binary   json\n" );
+    printf( "  reading         %6d %6d\n", bin_data_len, json_data_len );
+    printf( "  registration    %6d %6d\n", bin_connect_len, json_connect_len );
+
+    printf( "%ld iterations\n", n );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        bin_data_encode( bin, sizeof( bin ), (uint32_t)i );
+        bench_keep( bin );
+    }
+    report( "binary reading encode", n, bench_now_ns() - start );
+
+    bin_data_encode( bin, sizeof( bin ), 0 );
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        bench_keep( bin );
+        if( mesh_proto_decode( bin, bin_data_len, &frame ) == 0 && mesh_proto_get_data( &frame, &data ) == 0 )
+        {
+            sum += data.value;
+        }
+    }
+    report( "binary reading decode", n, bench_now_ns() - start );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        bin_connect_encode( bin, sizeof( bin ), (uint32_t)i );
+        bench_keep( bin );
+    }
+    report( "binary registration encode", n, bench_now_ns() - start );
+
+    /**
+     * The root still reads text frames of older firmware with json_scan
+     */
+    json_data_print( text, sizeof( text ) );
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        json_field_t fields[] = { { .key = "Topic" }, { .key = "Data" } };
+        int32_t value;
+
+        bench_keep( text );
+        if( json_scan( text, json_data_len - 1, fields, 2 ) == 2 && json_field_int( &fields[1], &value ) )
+        {
+            sum += value;
+        }
+    }
+    report( "json reading decode (json_scan)", n, bench_now_ns() - start );
+
+#ifdef HAVE_CJSON
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        cJSON *root = cJSON_CreateObject();
+        char *rendered;
+
+        cJSON_AddStringToObject( root, "Topic", "Send-Data" );
+        cJSON_AddNumberToObject( root, "Data", BENCH_VALUE );
+        rendered = cJSON_Print( root );
+        bench_keep( rendered );
+        cJSON_free( rendered );
+        cJSON_Delete( root );
+    }
+    report( "json reading encode (cJSON)", n, bench_now_ns() - start );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        cJSON *root = cJSON_Parse( text );
+
+        if( root )
+        {
+            sum += cJSON_GetObjectItem( root, "Data" )->valueint;
+            cJSON_Delete( root );
+        }
+    }
+    report( "json reading decode (cJSON)", n, bench_now_ns() - start );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        cJSON *root = cJSON_CreateObject();
+        char *rendered;
+
+        cJSON_AddStringToObject( root, "Topic", "Connect-Mesh" );
+        cJSON_AddStringToObject( root, "ID", BENCH_NODE_ID );
+        cJSON_AddStringToObject( root, "SSID", BENCH_MAC_STR );
+        rendered = cJSON_Print( root );
+        bench_keep( rendered );
+        cJSON_free( rendered );
+        cJSON_Delete( root );
+    }
+    report( "json registration encode (cJSON)", n, bench_now_ns() - start );
+#else
+    printf( "  (built without cJSON: no cJSON timings)\n" );
+#endif
+
+    bench_keep( &sum );
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "node_registry.h"
+#include "host_bench.h"
+
+/**
+ * Registry lookups with CONFIG_MESH_ROUTE_TABLE_SIZE nodes registered,
+ * against the activeNode[] table it replaced: a strcmp scan over MAC
+ * strings, which also had to format the binary address first
+ */
+#define MACSTR  "%02x:%02x:%02x:%02x:%02x:%02x"
+
+typedef struct {
+    char id[NODE_ID_LEN];
+    char ssid[18];
+} bench_node_t;
+
+static bench_node_t active_node[CONFIG_MESH_ROUTE_TABLE_SIZE];
+static int active_count = 0;
+static uint8_t macs[2 * CONFIG_MESH_ROUTE_TABLE_SIZE][6];
+
+static void mac_make( uint8_t mac[6], uint32_t n )
+{
+    mac[0] = 0x24;
+    mac[1] = 0x0a;
+    mac[2] = 0xc4;
+    mac[3] = (uint8_t)( n >> 16 );
+    mac[4] = (uint8_t)( n >> 8 );
+    mac[5] = (uint8_t)n;
+}
+
+static int scan_lookup( const char *mac_str )
+{
+    for( int i = 0; i < active_count; i++ )
+    {
+        if( strcmp( mac_str, active_node[i].ssid ) == 0 )
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void report( const char *what, long n, uint64_t ns )
+{
+    printf( "  %-36s %8.1f ns/lookup\n", what, (double)ns / n );
+}
+
+int main( int argc, char **argv )
+{
+    long n = bench_iterations( argc, argv, 10000000 );
+    uint32_t *order = malloc( n * sizeof( *order ) );
+    char mac_str[18];
+    long found = 0;
+    uint64_t start;
+
+    /**
+     * The first half registered, the second half unknown
+     */
+    node_registry_init();
+    for( int i = 0; i < 2 * CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        mac_make( macs[i], (uint32_t)i * 40503u );
+        if( i < CONFIG_MESH_ROUTE_TABLE_SIZE )
+        {
+            snprintf( active_node[i].id, NODE_ID_LEN, "%d", i );
+            snprintf( active_node[i].ssid, sizeof( active_node[i].ssid ), MACSTR,
+                      macs[i][0], macs[i][1], macs[i][2], macs[i][3], macs[i][4], macs[i][5] );
+            active_count++;
+            node_registry_upsert( macs[i], active_node[i].id, NULL );
+        }
+    }
+    srand( 1 );
+    for( long i = 0; i < n; i++ )
+    {
+        order[i] = rand() % CONFIG_MESH_ROUTE_TABLE_SIZE;
+    }
+
+    printf( "%d nodes, %ld lookups\n", CONFIG_MESH_ROUTE_TABLE_SIZE, n );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        found += node_registry_lookup( macs[order[i]], NULL, 0 ) >= 0;
+    }
+    report( "registry hit", n, bench_now_ns() - start );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        found += node_registry_lookup( macs[CONFIG_MESH_ROUTE_TABLE_SIZE + order[i]], NULL, 0 ) >= 0;
+    }
+    report( "registry miss", n, bench_now_ns() - start );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        found += scan_lookup( active_node[order[i]].ssid ) >= 0;
+    }
+    report( "linear scan hit", n, bench_now_ns() - start );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        const uint8_t *mac = macs[order[i]];
+
+        snprintf( mac_str, sizeof( mac_str ), MACSTR, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5] );
+        found += scan_lookup( mac_str ) >= 0;
+    }
+    report( "linear scan hit, MAC formatted", n, bench_now_ns() - start );
+
+    start = bench_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        const uint8_t *mac = macs[CONFIG_MESH_ROUTE_TABLE_SIZE + order[i]];
+
+        snprintf( mac_str, sizeof( mac_str ), MACSTR, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5] );
+        found += scan_lookup( mac_str ) >= 0;
+    }
+    report( "linear scan miss, MAC formatted", n, bench_now_ns() - start );
+
+    bench_keep( &found );
+    free( order );
+    return 0;
+}
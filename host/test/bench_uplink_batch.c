@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "frame_pool.h"
+#include "mqtt_outbox.h"
+#include "uplink_batch.h"
+#include "input_events.h"
+#include "host_bench.h"
+
+/**
+ * Readings from the root's route stage to the broker, through the real
+ * batcher, outbox and publisher task; built once with
+ * CONFIG_APP_BATCH_ENABLE and once without. The client is faked and
+ * costs nothing, so the numbers are the root's own work per reading and
+ * the messages the broker would have to take.
+ */
+#define BENCH_NODES     ( 300 )
+
+static uint32_t publishes = 0;
+static uint64_t published_bytes = 0;
+
+bool mqtt_app_connected( void )
+{
+    return true;
+}
+
+int mqtt_app_client_publish( const char *topic, const char *data, size_t len, int qos, bool retain )
+{
+    __atomic_add_fetch( &publishes, 1, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &published_bytes, len, __ATOMIC_RELAXED );
+    bench_keep( data );
+    return 1;
+}
+
+/**
+ * The window timer only fires if a run outlasts it; the last batch is
+ * flushed by hand
+ */
+esp_err_t input_events_post( input_source_t source, int32_t value )
+{
+    return ESP_OK;
+}
+
+static uint64_t cpu_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Waits until the publisher left at most 'depth' messages queued;
+ * counts the waits
+ */
+static uint32_t outbox_wait( uint32_t depth )
+{
+    mqtt_outbox_stats_t stats;
+    uint32_t waits = 0;
+
+    for( ;; )
+    {
+        mqtt_outbox_get_stats( &stats );
+        if( stats.depth <= depth )
+        {
+            return waits;
+        }
+        waits++;
+        sched_yield();
+    }
+}
+
+int main( int argc, char **argv )
+{
+    long n = bench_iterations( argc, argv, 200000 );
+    uplink_batch_stats_t batch;
+    mqtt_outbox_stats_t outbox;
+    uint32_t full = 0;
+    uint64_t start, cpu_start, ns, cpu_ns;
+    int64_t sampled_us = 0;
+
+    if( frame_pool_init() != ESP_OK || mqtt_outbox_init() != ESP_OK || uplink_batch_init() != ESP_OK ||
+        xTaskCreate( task_mqtt_publisher, "mqtt_pub", 4096, NULL, 5, NULL ) != pdPASS )
+    {
+        return 1;
+    }
+
+    start = bench_now_ns();
+    cpu_start = cpu_now_ns();
+    for( long i = 0; i < n; i++ )
+    {
+        /**
+         * The route stage waits for the publisher rather than have the
+         * outbox drop, so every reading is published
+         */
+        sampled_us += 1000;
+        full += outbox_wait( CONFIG_APP_MQTT_OUTBOX_LEN / 2 );
+        if( uplink_batch_add( (uint16_t)( 1 + i % BENCH_NODES ), (uint32_t)( i / BENCH_NODES ), sampled_us,
+                              (int32_t)( i & 0xfff ) ) != ESP_OK )
+        {
+            break;
+        }
+    }
+    uplink_batch_flush();
+    outbox_wait( 0 );
+    ns = bench_now_ns() - start;
+    cpu_ns = cpu_now_ns() - cpu_start;
+
+    uplink_batch_get_stats( &batch );
+    mqtt_outbox_get_stats( &outbox );
+    printf( "%ld readings from %d nodes, %s\n", n, BENCH_NODES,
+            CONFIG_APP_BATCH_ENABLE ? "batched (CONFIG_APP_BATCH_ENABLE)" : "one publish each" );
+    printf( "  readings/s         %10.0f\n", n * 1e9 / ns );
+    printf( "  root CPU/reading   %10.0f ns\n", (double)cpu_ns / n );
+    printf( "  publishes          %10u (%.4f per reading, %.0f/s)\n", publishes, (double)publishes / n,
+            publishes * 1e9 / ns );
+    printf( "  payload B/reading  %10.1f\n", (double)published_bytes / n );
+    printf( "  waits for outbox   %10u, %u readings dropped\n", full, outbox.dropped + batch.dropped );
+    return batch.records == (uint32_t)n && outbox.dropped == 0 ? 0 : 1;
+}
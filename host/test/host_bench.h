@@ -0,0 +1,34 @@
+#ifndef __HOST_BENCH_H__
+#define __HOST_BENCH_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline uint64_t bench_now_ns( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Keeps the compiler from dropping work whose result is never read
+ */
+static inline void bench_keep( const void *p )
+{
+    __asm__ volatile( "" : : "g"( p ) : "memory" );
+}
+
+/**
+ * Iterations from the first argument, or 'def'
+ */
+static inline long bench_iterations( int argc, char **argv, long def )
+{
+    long n = argc > 1 ? strtol( argv[1], NULL, 10 ) : 0;
+
+    return n > 0 ? n : def;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __HOST_TEST_H__
+#define __HOST_TEST_H__
+
+#include <stdio.h>
+
+/**
+ * Minimal harness for the host tests: CHECK() reports a failed condition
+ * and carries on, host_test_done() turns the failures into the exit status
+ */
+static int host_test_failures = 0;
+
+#define CHECK( cond ) \
+    do { \
+        if( !( cond ) ) \
+        { \
+            fprintf( stderr, "%s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #cond ); \
+            host_test_failures++; \
+        } \
+    } while( 0 )
+
+#define RUN( test ) \
+    do { \
+        printf( "%s\n", #test ); \
+        test(); \
+    } while( 0 )
+
+static inline int host_test_done( void )
+{
+    if( host_test_failures )
+    {
+        printf( "%d check(s) failed\n", host_test_failures );
+        return 1;
+    }
+    printf( "all passed\n" );
+    return 0;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * White-box: the windows are checked through the root calls and their
+ * counters, against the real node registry; the broker is faked as
+ * away, so nothing is published
+ */
+#include "dedup.c"
+
+#include "host_test.h"
+
+bool mqtt_app_connected( void )
+{
+    return false;
+}
+
+esp_err_t mqtt_outbox_post( const char *topic, const char *data, size_t len )
+{
+    return ESP_ERR_INVALID_STATE;
+}
+
+static void mac_make( uint8_t mac[6], uint32_t n )
+{
+    mac[0] = 0x24;
+    mac[1] = 0x0a;
+    mac[2] = 0xc4;
+    mac[3] = (uint8_t)( n >> 16 );
+    mac[4] = (uint8_t)( n >> 8 );
+    mac[5] = (uint8_t)n;
+}
+
+static void reset( void )
+{
+    node_registry_init();
+    memset( windows, 0, sizeof( windows ) );
+    memset( parked, 0, sizeof( parked ) );
+    memset( &stats, 0, sizeof( stats ) );
+}
+
+static void test_commit( void )
+{
+    uint8_t mac[6];
+
+    reset();
+    mac_make( mac, 1 );
+    CHECK( node_registry_upsert( mac, "1", NULL ) >= 0 );
+
+    /**
+     * A number that was only checked, as for a frame dropped on its way
+     * to the outbox, is not a duplicate when it comes back
+     */
+    CHECK( dedup_is_new( mac, 100 ) );
+    CHECK( dedup_is_new( mac, 100 ) );
+    dedup_commit( mac, 100 );
+    CHECK( !dedup_is_new( mac, 100 ) );
+    CHECK( stats.checked == 3 && stats.duplicates == 1 );
+
+    /**
+     * Out of order inside the window
+     */
+    dedup_commit( mac, 103 );
+    CHECK( dedup_is_new( mac, 101 ) && dedup_is_new( mac, 102 ) );
+    dedup_commit( mac, 101 );
+    CHECK( !dedup_is_new( mac, 101 ) && dedup_is_new( mac, 102 ) && !dedup_is_new( mac, 103 ) );
+}
+
+static void test_window( void )
+{
+    uint8_t mac[6];
+
+    reset();
+    mac_make( mac, 1 );
+    CHECK( node_registry_upsert( mac, "1", NULL ) >= 0 );
+    dedup_commit( mac, 1000 );
+    dedup_commit( mac, 1000 - DEDUP_WINDOW + 1 );
+    CHECK( !dedup_is_new( mac, 1000 - DEDUP_WINDOW + 1 ) );
+
+    /**
+     * Behind the window: let through and counted
+     */
+    CHECK( dedup_is_new( mac, 1000 - DEDUP_WINDOW ) );
+    dedup_commit( mac, 1000 - DEDUP_WINDOW );
+    CHECK( stats.stale == 1 && dedup_is_new( mac, 1000 - DEDUP_WINDOW ) );
+
+    /**
+     * A jump ahead past the window forgets the old numbers
+     */
+    dedup_commit( mac, 1000 + DEDUP_WINDOW );
+    CHECK( !dedup_is_new( mac, 1000 + DEDUP_WINDOW ) && dedup_is_new( mac, 1000 ) );
+
+    /**
+     * A jump back past DEDUP_RESTART_GAP is a node whose NVS was erased
+     */
+    dedup_commit( mac, 3UL << DEDUP_BOOT_SHIFT );
+    dedup_commit( mac, 5 );
+    CHECK( stats.restarts == 1 );
+    CHECK( !dedup_is_new( mac, 5 ) && dedup_is_new( mac, 3UL << DEDUP_BOOT_SHIFT ) );
+}
+
+static void test_untracked( void )
+{
+    uint8_t mac[6];
+
+    reset();
+    mac_make( mac, 1 );
+    dedup_commit( mac, 7 );
+    CHECK( dedup_is_new( mac, 7 ) && dedup_is_new( mac, 7 ) );
+    CHECK( stats.untracked == 2 && stats.duplicates == 0 );
+}
+
+static void test_park( void )
+{
+    uint8_t a[6];
+    uint8_t b[6];
+    int index;
+
+    reset();
+    mac_make( a, 1 );
+    mac_make( b, 2 );
+    index = node_registry_upsert( a, "1", NULL );
+    dedup_commit( a, 42 );
+
+    /**
+     * 'a' leaves and 'b' takes its index; 'a' keeps its numbers when it
+     * registers again, at another index
+     */
+    dedup_park( index );
+    node_registry_remove( a, NULL, 0 );
+    CHECK( node_registry_upsert( b, "2", NULL ) == index );
+    CHECK( dedup_is_new( b, 42 ) );
+    dedup_commit( b, 42 );
+    CHECK( node_registry_upsert( a, "1", NULL ) != index );
+    CHECK( !dedup_is_new( a, 42 ) && dedup_is_new( a, 43 ) );
+    CHECK( !dedup_is_new( b, 42 ) );
+}
+
+/**
+ * The mesh event handler only leaves a request for task_stats
+ */
+static void test_request( void )
+{
+    CHECK( !dedup_publish_requested() );
+    dedup_request_publish();
+    dedup_request_publish();
+    CHECK( dedup_publish_requested() );
+    CHECK( !dedup_publish_requested() );
+}
+
+int main( void )
+{
+    RUN( test_commit );
+    RUN( test_window );
+    RUN( test_untracked );
+    RUN( test_park );
+    RUN( test_request );
+    return host_test_done();
+}
@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_scan.h"
+#include "host_test.h"
+
+/**
+ * Frames as older firmware sent them (cJSON_Print layout)
+ */
+static const char connect_frame[] =
+    "{\n\t\"Topic\":\t\"Connect-Mesh\",\n\t\"ID\":\t\"17\",\n\t\"SSID\":\t\"24:0a:c4:01:02:03\"\n}";
+static const char data_frame[] =
+    "{\n\t\"Topic\":\t\"Send-Data\",\n\t\"Data\":\t156\n}";
+
+enum { F_TOPIC, F_ID, F_SSID, F_DATA, F_COUNT };
+
+static void fields_init( json_field_t *fields )
+{
+    memset( fields, 0, F_COUNT * sizeof( *fields ) );
+    fields[F_TOPIC].key = "Topic";
+    fields[F_ID].key = "ID";
+    fields[F_SSID].key = "SSID";
+    fields[F_DATA].key = "Data";
+}
+
+static void test_legacy_frames( void )
+{
+    json_field_t fields[F_COUNT];
+    char out[24];
+    int32_t value;
+
+    fields_init( fields );
+    CHECK( json_scan( connect_frame, strlen( connect_frame ), fields, F_COUNT ) == 3 );
+    CHECK( json_field_eq( &fields[F_TOPIC], "Connect-Mesh" ) );
+    CHECK( json_field_eq( &fields[F_ID], "17" ) );
+    CHECK( json_field_copy( &fields[F_SSID], out, sizeof( out ) ) && strcmp( out, "24:0a:c4:01:02:03" ) == 0 );
+    CHECK( fields[F_DATA].value == NULL );
+
+    /**
+     * Values are slices of the input
+     */
+    CHECK( fields[F_ID].value > connect_frame && fields[F_ID].value < connect_frame + sizeof( connect_frame ) );
+    CHECK( fields[F_ID].value_len == 2 && fields[F_ID].is_string );
+
+    fields_init( fields );
+    CHECK( json_scan( data_frame, strlen( data_frame ), fields, F_COUNT ) == 2 );
+    CHECK( json_field_eq( &fields[F_TOPIC], "Send-Data" ) );
+    CHECK( !fields[F_DATA].is_string );
+    CHECK( json_field_int( &fields[F_DATA], &value ) && value == 156 );
+
+    /**
+     * The sent NUL is not part of the object
+     */
+    fields_init( fields );
+    CHECK( json_scan( data_frame, sizeof( data_frame ), fields, F_COUNT ) == 2 );
+}
+
+static void test_escaped_quotes( void )
+{
+    static const char frame[] = "{\"Topic\":\"say \\\"hi\\\"\",\"ke\\\"y\":1,\"ID\":\"a\\\\\",\"Data\":-7}";
+    json_field_t fields[F_COUNT];
+    int32_t value;
+
+    fields_init( fields );
+    CHECK( json_scan( frame, strlen( frame ), fields, F_COUNT ) == 3 );
+
+    /**
+     * Nothing is unescaped: the slice runs to the closing quote
+     */
+    CHECK( fields[F_TOPIC].value_len == strlen( "say \\\"hi\\\"" ) );
+    CHECK( memcmp( fields[F_TOPIC].value, "say \\\"hi\\\"", fields[F_TOPIC].value_len ) == 0 );
+
+    /**
+     * An escaped backslash before the closing quote ends the string
+     */
+    CHECK( fields[F_ID].value_len == 3 && memcmp( fields[F_ID].value, "a\\\\", 3 ) == 0 );
+    CHECK( json_field_int( &fields[F_DATA], &value ) && value == -7 );
+
+    /**
+     * A quote escaped at the very end never closes the string
+     */
+    fields_init( fields );
+    CHECK( json_scan( "{\"Topic\":\"abc\\\"}", 16, fields, F_COUNT ) == -1 );
+}
+
+static void test_missing_keys( void )
+{
+    json_field_t fields[F_COUNT];
+    char out[8] = "x";
+    int32_t value = 99;
+
+    fields_init( fields );
+    CHECK( json_scan( "{}", 2, fields, F_COUNT ) == 0 );
+    CHECK( json_scan( " { } ", 5, fields, F_COUNT ) == 0 );
+    CHECK( json_scan( "{\"Other\":1,\"topic\":\"case matters\"}", 34, fields, F_COUNT ) == 0 );
+    for( int i = 0; i < F_COUNT; i++ )
+    {
+        CHECK( fields[i].value == NULL );
+    }
+    CHECK( !json_field_eq( &fields[F_TOPIC], "" ) );
+    CHECK( !json_field_copy( &fields[F_TOPIC], out, sizeof( out ) ) && strcmp( out, "x" ) == 0 );
+    CHECK( !json_field_int( &fields[F_DATA], &value ) && value == 99 );
+
+    /**
+     * A previous scan's values are cleared
+     */
+    CHECK( json_scan( data_frame, strlen( data_frame ), fields, F_COUNT ) == 2 );
+    CHECK( json_scan( "{\"ID\":\"1\"}", 10, fields, F_COUNT ) == 1 );
+    CHECK( fields[F_TOPIC].value == NULL && fields[F_DATA].value == NULL );
+
+    /**
+     * Nested values are skipped over, duplicates keep the first
+     */
+    static const char nested[] = "{\"x\":{\"Topic\":\"no\",\"a\":[1,\"}\",{}]},\"Topic\":\"yes\",\"Topic\":\"later\"}";
+    CHECK( json_scan( nested, strlen( nested ), fields, F_COUNT ) == 1 );
+    CHECK( json_field_eq( &fields[F_TOPIC], "yes" ) );
+
+    /**
+     * Values that are not integers
+     */
+    static const char numbers[] = "{\"Data\":1.5,\"ID\":\"42\",\"SSID\":2147483648}";
+    CHECK( json_scan( numbers, strlen( numbers ), fields, F_COUNT ) == 3 );
+    CHECK( !json_field_int( &fields[F_DATA], &value ) );
+    CHECK( json_field_int( &fields[F_ID], &value ) && value == 42 );
+    CHECK( !json_field_int( &fields[F_SSID], &value ) );
+}
+
+static void test_truncated( void )
+{
+    const char *frames[] = { connect_frame, data_frame, "{\"Data\":156}", "{\"a\":{\"b\":[1,2]}}" };
+    json_field_t fields[F_COUNT];
+
+    for( size_t f = 0; f < sizeof( frames ) / sizeof( frames[0] ); f++ )
+    {
+        size_t len = strlen( frames[f] );
+
+        for( size_t cut = 0; cut < len; cut++ )
+        {
+            fields_init( fields );
+            CHECK( json_scan( frames[f], cut, fields, F_COUNT ) == -1 );
+        }
+        CHECK( json_scan( frames[f], len, fields, F_COUNT ) >= 0 );
+    }
+
+    /**
+     * Malformed objects
+     */
+    const char *bad[] = { "", "[]", "\"Topic\"", "{\"Topic\"}", "{\"Topic\":}", "{Topic:1}",
+                          "{\"a\":1,}", "{\"a\":1 \"b\":2}", "{\"a\":{\"b\":1}", "{\"a\":[1,2}" };
+    for( size_t b = 0; b < sizeof( bad ) / sizeof( bad[0] ); b++ )
+    {
+        CHECK( json_scan( bad[b], strlen( bad[b] ), fields, F_COUNT ) == -1 );
+    }
+}
+
+static void test_not_terminated( void )
+{
+    size_t len = strlen( connect_frame );
+    char *exact = malloc( len );
+    char padded[256];
+    json_field_t fields[F_COUNT];
+
+    /**
+     * A buffer holding just the frame: nothing past 'len' is read
+     * (run under the address sanitizer to see it)
+     */
+    memcpy( exact, connect_frame, len );
+    fields_init( fields );
+    CHECK( json_scan( exact, len, fields, F_COUNT ) == 3 );
+    CHECK( json_field_eq( &fields[F_SSID], "24:0a:c4:01:02:03" ) );
+
+    /**
+     * Bytes after the frame are ignored, and a frame cut off in the
+     * middle of a buffer is refused whatever follows
+     */
+    memset( padded, '}', sizeof( padded ) );
+    memcpy( padded, data_frame, strlen( data_frame ) );
+    fields_init( fields );
+    CHECK( json_scan( padded, strlen( data_frame ), fields, F_COUNT ) == 2 );
+    CHECK( json_scan( padded, strlen( data_frame ) - 2, fields, F_COUNT ) == -1 );
+
+    /**
+     * A string running to the end of the buffer
+     */
+    memcpy( exact, "{\"Topic\":\"", 10 );
+    memset( exact + 10, 'a', len - 10 );
+    CHECK( json_scan( exact, len, fields, F_COUNT ) == -1 );
+    free( exact );
+}
+
+int main( void )
+{
+    RUN( test_legacy_frames );
+    RUN( test_escaped_quotes );
+    RUN( test_missing_keys );
+    RUN( test_truncated );
+    RUN( test_not_terminated );
+    return host_test_done();
+}
@@ -0,0 +1,269 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "mesh_proto.h"
+#include "host_test.h"
+
+static const uint8_t test_mac[6] = { 0x24, 0x0a, 0xc4, 0x01, 0x02, 0x03 };
+
+static void frame_init( mesh_frame_t *frame, uint8_t type, const uint8_t *payload, uint16_t len )
+{
+    memset( frame, 0, sizeof( *frame ) );
+    frame->type = type;
+    frame->node_id = 0x1234;
+    memcpy( frame->mac, test_mac, 6 );
+    frame->seq = 0xa1b2c3d4;
+    frame->origin_ts = 0x01020304;
+    frame->layer = 3;
+    frame->flags = MESH_FLAG_REPLAY;
+    frame->payload_len = len;
+    frame->payload = payload;
+}
+
+static void test_round_trip( void )
+{
+    uint8_t payload[MESH_PAYLOAD_DATA_SIZE];
+    uint8_t buf[MESH_PROTO_FRAME_MAX];
+    mesh_payload_data_t data = { .value = -156 };
+    mesh_payload_data_t out_data;
+    mesh_frame_t frame;
+    mesh_frame_t out;
+    int len;
+
+    CHECK( mesh_proto_put_data( &data, payload, sizeof( payload ) ) == MESH_PAYLOAD_DATA_SIZE );
+    frame_init( &frame, MESH_MSG_DATA, payload, sizeof( payload ) );
+    len = mesh_proto_encode( &frame, buf, sizeof( buf ) );
+    CHECK( len == MESH_PROTO_HDR_SIZE + MESH_PAYLOAD_DATA_SIZE );
+    CHECK( mesh_proto_decode( buf, len, &out ) == 0 );
+    CHECK( out.version == MESH_PROTO_VERSION );
+    CHECK( out.type == MESH_MSG_DATA );
+    CHECK( out.node_id == 0x1234 );
+    CHECK( memcmp( out.mac, test_mac, 6 ) == 0 );
+    CHECK( out.seq == 0xa1b2c3d4 );
+    CHECK( out.origin_ts == 0x01020304 );
+    CHECK( out.layer == 3 );
+    CHECK( out.flags == MESH_FLAG_REPLAY );
+    CHECK( out.payload_len == MESH_PAYLOAD_DATA_SIZE );
+    CHECK( out.payload == &buf[MESH_PROTO_HDR_SIZE] );
+    CHECK( mesh_proto_get_data( &out, &out_data ) == 0 );
+    CHECK( out_data.value == -156 );
+
+    /**
+     * Little-endian on the wire whatever the host
+     */
+    CHECK( buf[2] == 0x34 && buf[3] == 0x12 );
+    CHECK( buf[10] == 0xd4 && buf[13] == 0xa1 );
+
+    /**
+     * A frame without payload
+     */
+    frame_init( &frame, MESH_MSG_CONNECT, NULL, 0 );
+    len = mesh_proto_encode( &frame, buf, sizeof( buf ) );
+    CHECK( len == MESH_PROTO_HDR_SIZE );
+    CHECK( mesh_proto_decode( buf, len, &out ) == 0 );
+    CHECK( out.type == MESH_MSG_CONNECT && out.payload_len == 0 );
+    CHECK( mesh_proto_get_data( &out, &out_data ) == -1 );
+}
+
+static void test_typed_payloads( void )
+{
+    uint8_t payload[MESH_PROTO_MAX_PAYLOAD];
+    uint8_t buf[MESH_PROTO_FRAME_MAX];
+    mesh_payload_metrics_t metrics = { .uptime_s = 3600, .free_heap = 123456, .rx_errors = 7,
+                                       .txq_dropped = 9, .boot_first_tx_ms = 812, .rejoin = 2 };
+    mesh_payload_metrics_t out_metrics;
+    mesh_payload_command_t cmd = { .seq = 77, .name_len = 3, .name = "led", .args_len = 1,
+                                   .args = (const uint8_t *)"1" };
+    mesh_payload_command_t out_cmd;
+    mesh_payload_connect_ack_t ack = { .seq = 5, .status = MESH_REG_OK, .slot = 300, .epoch = 9 };
+    mesh_payload_connect_ack_t out_ack;
+    uint8_t bitmap[3] = { 0x01, 0x00, 0x80 };
+    mesh_payload_heartbeat_t beat = { .epoch = 9, .bitmap_len = sizeof( bitmap ), .bitmap = bitmap };
+    mesh_payload_heartbeat_t out_beat;
+    mesh_payload_topology_t topo = { .parent = { 1, 2, 3, 4, 5, 6 }, .children = 4, .subtree = 300,
+                                     .rssi = -71, .tx_pending = 12, .tx_bps = 4000000, .rx_bps = 17 };
+    mesh_payload_topology_t out_topo;
+    mesh_frame_t frame;
+    mesh_frame_t out;
+    int n;
+
+    n = mesh_proto_put_metrics( &metrics, payload, sizeof( payload ) );
+    CHECK( n == MESH_PAYLOAD_METRICS_SIZE );
+    frame_init( &frame, MESH_MSG_METRICS, payload, n );
+    CHECK( mesh_proto_decode( buf, mesh_proto_encode( &frame, buf, sizeof( buf ) ), &out ) == 0 );
+    CHECK( mesh_proto_get_metrics( &out, &out_metrics ) == 0 );
+    CHECK( out_metrics.uptime_s == 3600 && out_metrics.free_heap == 123456 );
+    CHECK( out_metrics.rx_errors == 7 && out_metrics.txq_dropped == 9 );
+    CHECK( out_metrics.boot_first_tx_ms == 812 && out_metrics.rejoin == 2 );
+
+    /**
+     * Metrics of older firmware stop before the boot fields
+     */
+    frame_init( &frame, MESH_MSG_METRICS, payload, MESH_PAYLOAD_METRICS_SIZE_MIN );
+    CHECK( mesh_proto_decode( buf, mesh_proto_encode( &frame, buf, sizeof( buf ) ), &out ) == 0 );
+    CHECK( mesh_proto_get_metrics( &out, &out_metrics ) == 0 );
+    CHECK( out_metrics.uptime_s == 3600 && out_metrics.boot_first_tx_ms == 0 && out_metrics.rejoin == 0 );
+
+    n = mesh_proto_put_connect_ack( &ack, payload, sizeof( payload ) );
+    CHECK( n == MESH_PAYLOAD_CONNECT_ACK_SIZE );
+    frame_init( &frame, MESH_MSG_CONNECT_ACK, payload, n );
+    CHECK( mesh_proto_decode( buf, mesh_proto_encode( &frame, buf, sizeof( buf ) ), &out ) == 0 );
+    CHECK( mesh_proto_get_connect_ack( &out, &out_ack ) == 0 );
+    CHECK( out_ack.seq == 5 && out_ack.status == MESH_REG_OK && out_ack.slot == 300 && out_ack.epoch == 9 );
+
+    /**
+     * Acks of older roots carry no slot
+     */
+    frame_init( &frame, MESH_MSG_CONNECT_ACK, payload, MESH_PAYLOAD_CONNECT_ACK_SIZE_MIN );
+    CHECK( mesh_proto_decode( buf, mesh_proto_encode( &frame, buf, sizeof( buf ) ), &out ) == 0 );
+    CHECK( mesh_proto_get_connect_ack( &out, &out_ack ) == 0 );
+    CHECK( out_ack.seq == 5 && out_ack.slot == MESH_SLOT_NONE && out_ack.epoch == 0 );
+
+    n = mesh_proto_put_heartbeat( &beat, payload, sizeof( payload ) );
+    CHECK( n == MESH_PAYLOAD_HEARTBEAT_HDR + 3 );
+    frame_init( &frame, MESH_MSG_HEARTBEAT, payload, n );
+    CHECK( mesh_proto_decode( buf, mesh_proto_encode( &frame, buf, sizeof( buf ) ), &out ) == 0 );
+    CHECK( mesh_proto_get_heartbeat( &out, &out_beat ) == 0 );
+    CHECK( out_beat.epoch == 9 && out_beat.bitmap_len == 3 && memcmp( out_beat.bitmap, bitmap, 3 ) == 0 );
+    beat.bitmap_len = MESH_HEARTBEAT_SLOTS / 8 + 1;
+    CHECK( mesh_proto_put_heartbeat( &beat, payload, sizeof( payload ) ) == -1 );
+
+    n = mesh_proto_put_command( &cmd, payload, sizeof( payload ) );
+    CHECK( n == MESH_PAYLOAD_COMMAND_HDR + 4 );
+    frame_init( &frame, MESH_MSG_COMMAND, payload, n );
+    CHECK( mesh_proto_decode( buf, mesh_proto_encode( &frame, buf, sizeof( buf ) ), &out ) == 0 );
+    CHECK( mesh_proto_get_command( &out, &out_cmd ) == 0 );
+    CHECK( out_cmd.seq == 77 && out_cmd.name_len == 3 && memcmp( out_cmd.name, "led", 3 ) == 0 );
+    CHECK( out_cmd.args_len == 1 && out_cmd.args[0] == '1' );
+
+    /**
+     * A name running past the payload is refused
+     */
+    payload[2] = 200;
+    CHECK( mesh_proto_decode( buf, mesh_proto_encode( &frame, buf, sizeof( buf ) ), &out ) == 0 );
+    CHECK( mesh_proto_get_command( &out, &out_cmd ) == -1 );
+
+    n = mesh_proto_put_topology( &topo, payload, sizeof( payload ) );
+    CHECK( n == MESH_PAYLOAD_TOPOLOGY_SIZE );
+    frame_init( &frame, MESH_MSG_TOPOLOGY, payload, n );
+    CHECK( mesh_proto_decode( buf, mesh_proto_encode( &frame, buf, sizeof( buf ) ), &out ) == 0 );
+    CHECK( mesh_proto_get_topology( &out, &out_topo ) == 0 );
+    CHECK( memcmp( out_topo.parent, topo.parent, 6 ) == 0 && out_topo.children == 4 );
+    CHECK( out_topo.subtree == 300 && out_topo.rssi == -71 && out_topo.tx_pending == 12 );
+    CHECK( out_topo.tx_bps == 4000000 && out_topo.rx_bps == 17 );
+
+    /**
+     * Typed getters check the message type
+     */
+    CHECK( mesh_proto_get_metrics( &out, &out_metrics ) == -1 );
+}
+
+static void test_truncated( void )
+{
+    uint8_t payload[MESH_PAYLOAD_ALERT_SIZE] = { 0, };
+    uint8_t buf[MESH_PROTO_FRAME_MAX];
+    mesh_frame_t frame;
+    mesh_frame_t out;
+    int len;
+
+    frame_init( &frame, MESH_MSG_ALERT, payload, sizeof( payload ) );
+    len = mesh_proto_encode( &frame, buf, sizeof( buf ) );
+    CHECK( len == MESH_PROTO_HDR_SIZE + MESH_PAYLOAD_ALERT_SIZE );
+    for( int cut = 0; cut < len; cut++ )
+    {
+        CHECK( mesh_proto_decode( buf, cut, &out ) == -1 );
+    }
+    CHECK( mesh_proto_decode( buf, len, &out ) == 0 );
+
+    /**
+     * Trailing bytes past the payload are ignored
+     */
+    CHECK( mesh_proto_decode( buf, sizeof( buf ), &out ) == 0 );
+    CHECK( out.payload_len == MESH_PAYLOAD_ALERT_SIZE );
+
+    /**
+     * A length field larger than the frame
+     */
+    buf[20] = 0xff;
+    buf[21] = 0xff;
+    CHECK( mesh_proto_decode( buf, sizeof( buf ), &out ) == -1 );
+}
+
+static void test_v1_decode( void )
+{
+    uint8_t buf[MESH_PROTO_HDR_SIZE_V1 + MESH_PAYLOAD_DATA_SIZE] = {
+        1, MESH_MSG_DATA,
+        0x07, 0x00,                             /* node_id */
+        0x24, 0x0a, 0xc4, 0x01, 0x02, 0x03,     /* mac */
+        0x2a, 0x00, 0x00, 0x00,                 /* seq */
+        MESH_PAYLOAD_DATA_SIZE, 0x00,           /* len */
+        0x9c, 0x00, 0x00, 0x00,                 /* 156 */
+    };
+    mesh_payload_data_t data;
+    mesh_frame_t out;
+
+    CHECK( mesh_proto_decode( buf, sizeof( buf ), &out ) == 0 );
+    CHECK( out.version == 1 );
+    CHECK( out.node_id == 7 );
+    CHECK( memcmp( out.mac, test_mac, 6 ) == 0 );
+    CHECK( out.seq == 42 );
+    CHECK( out.origin_ts == 0 && out.layer == 0 && out.flags == 0 );
+    CHECK( out.payload == &buf[MESH_PROTO_HDR_SIZE_V1] );
+    CHECK( mesh_proto_get_data( &out, &data ) == 0 );
+    CHECK( data.value == 156 );
+    CHECK( mesh_proto_decode( buf, sizeof( buf ) - 1, &out ) == -1 );
+
+    /**
+     * Only current frames are modified in place
+     */
+    CHECK( mesh_proto_set_flags( buf, sizeof( buf ), MESH_FLAG_REPLAY ) == -1 );
+    CHECK( mesh_proto_add_tail( buf, sizeof( buf ), 1 ) == -1 );
+
+    /**
+     * Unknown versions are refused
+     */
+    buf[0] = 0;
+    CHECK( mesh_proto_decode( buf, sizeof( buf ), &out ) == -1 );
+    buf[0] = MESH_PROTO_VERSION + 1;
+    CHECK( mesh_proto_decode( buf, sizeof( buf ), &out ) == -1 );
+}
+
+static void test_oversize( void )
+{
+    uint8_t payload[MESH_PROTO_MAX_PAYLOAD + 1] = { 0, };
+    uint8_t buf[MESH_PROTO_FRAME_MAX + 1];
+    mesh_payload_command_t cmd = { .seq = 1, .name_len = 4, .name = "diag",
+                                   .args_len = MESH_PROTO_MAX_PAYLOAD, .args = payload };
+    mesh_frame_t frame;
+    mesh_frame_t out;
+
+    frame_init( &frame, MESH_MSG_DATA, payload, MESH_PROTO_MAX_PAYLOAD + 1 );
+    CHECK( mesh_proto_encode( &frame, buf, sizeof( buf ) ) == -1 );
+
+    frame.payload_len = MESH_PROTO_MAX_PAYLOAD;
+    CHECK( mesh_proto_encode( &frame, buf, MESH_PROTO_FRAME_MAX - 1 ) == -1 );
+    CHECK( mesh_proto_encode( &frame, buf, MESH_PROTO_FRAME_MAX ) == MESH_PROTO_FRAME_MAX );
+
+    CHECK( mesh_proto_put_command( &cmd, payload, sizeof( payload ) ) == -1 );
+    CHECK( mesh_proto_put_data( &(mesh_payload_data_t){ 1 }, payload, MESH_PAYLOAD_DATA_SIZE - 1 ) == -1 );
+
+    /**
+     * Fragment data follows the header: the length may pass the frame
+     * maximum but not 16 bits
+     */
+    frame_init( &frame, MESH_MSG_FRAGMENT, payload, MESH_PAYLOAD_FRAGMENT_HDR );
+    CHECK( mesh_proto_encode( &frame, buf, sizeof( buf ) ) == MESH_PROTO_HDR_SIZE + MESH_PAYLOAD_FRAGMENT_HDR );
+    CHECK( mesh_proto_add_tail( buf, sizeof( buf ), 1000 ) == 0 );
+    CHECK( mesh_proto_decode( buf, MESH_PROTO_HDR_SIZE + MESH_PAYLOAD_FRAGMENT_HDR, &out ) == -1 );
+    CHECK( mesh_proto_add_tail( buf, sizeof( buf ), 0xffff ) == -1 );
+}
+
+int main( void )
+{
+    RUN( test_round_trip );
+    RUN( test_typed_payloads );
+    RUN( test_truncated );
+    RUN( test_v1_decode );
+    RUN( test_oversize );
+    return host_test_done();
+}
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+/**
+ * White-box: the arena is driven directly, then through post and the
+ * real publisher task against a fake MQTT client
+ */
+#include "mqtt_outbox.c"
+
+#include "freertos/semphr.h"
+
+#include "host_test.h"
+
+/**
+ * Heap calls made while 'counting' is set; the outbox must not make any
+ * once initialized
+ */
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t count, size_t size );
+extern void *__libc_realloc( void *ptr, size_t size );
+extern void __libc_free( void *ptr );
+
+static int counting = 0;
+static uint32_t heap_calls = 0;
+
+static void heap_count( void )
+{
+    if( __atomic_load_n( &counting, __ATOMIC_RELAXED ) )
+    {
+        __atomic_fetch_add( &heap_calls, 1, __ATOMIC_RELAXED );
+    }
+}
+
+void *malloc( size_t size )
+{
+    heap_count();
+    return __libc_malloc( size );
+}
+
+void *calloc( size_t count, size_t size )
+{
+    heap_count();
+    return __libc_calloc( count, size );
+}
+
+void *realloc( void *ptr, size_t size )
+{
+    heap_count();
+    return __libc_realloc( ptr, size );
+}
+
+void free( void *ptr )
+{
+    __libc_free( ptr );
+}
+
+/**
+ * Fake frame pool: only the copy path is used
+ */
+void frame_pool_ref( frame_buf_t *buf ) { ( void )buf; }
+void frame_pool_release( frame_buf_t *buf ) { ( void )buf; }
+uint32_t frame_pool_available( void ) { return 0; }
+void frame_pool_count_copy( size_t len ) { ( void )len; }
+
+/**
+ * Fake MQTT client: checks every payload and, while 'gated', holds the
+ * publisher inside the call until the gate is given
+ */
+static SemaphoreHandle_t publish_gate;
+static bool gated = false;
+static uint32_t publish_bad = 0;
+static uint32_t fifo_last = 0;
+
+bool mqtt_app_connected( void )
+{
+    return true;
+}
+
+int mqtt_app_client_publish( const char *topic, const char *data, size_t len, int qos, bool retain )
+{
+    uint32_t seq;
+
+    ( void )qos;
+    ( void )retain;
+    if( gated )
+    {
+        xSemaphoreTake( publish_gate, portMAX_DELAY );
+    }
+
+    /**
+     * Payloads are a sequence number followed by bytes derived from it
+     */
+    memcpy( &seq, data, sizeof( seq ) );
+    for( size_t i = sizeof( seq ); i < len; i++ )
+    {
+        if( (uint8_t)data[i] != (uint8_t)( seq * 31 + i ) )
+        {
+            publish_bad++;
+            break;
+        }
+    }
+
+    /**
+     * Topics that do not coalesce come out in order
+     */
+    if( strcmp( topic, "ESP-send" ) == 0 )
+    {
+        if( seq <= fifo_last )
+        {
+            publish_bad++;
+        }
+        fifo_last = seq;
+    }
+    return 1;
+}
+
+static void payload_fill( char *buf, uint32_t seq, size_t len )
+{
+    memcpy( buf, &seq, sizeof( seq ) );
+    for( size_t i = sizeof( seq ); i < len; i++ )
+    {
+        buf[i] = (char)(uint8_t)( seq * 31 + i );
+    }
+}
+
+/**
+ * Waits for the publisher to hand back every slot, which it does after
+ * releasing the payload
+ */
+static void outbox_drain( void )
+{
+    while( uxQueueMessagesWaiting( free_slots ) < CONFIG_APP_MQTT_OUTBOX_LEN )
+    {
+        sched_yield();
+    }
+}
+
+static size_t arena_used_get( void )
+{
+    size_t used;
+
+    portENTER_CRITICAL( &outbox_lock );
+    used = arena_used;
+    portEXIT_CRITICAL( &outbox_lock );
+    return used;
+}
+
+static void test_arena_wrap( void )
+{
+    char *a, *b, *c, *d, *e;
+
+    a = arena_alloc( 3000 - ARENA_HDR );
+    b = arena_alloc( 3000 - ARENA_HDR );
+    c = arena_alloc( 2000 - ARENA_HDR );
+    CHECK( a == (char *)arena + ARENA_HDR && b == a + 3000 && c == b + 3000 );
+    CHECK( arena_head == 8000 && arena_used == 8000 );
+
+    /**
+     * 192 bytes left at the end and nothing free at the start
+     */
+    CHECK( arena_alloc( 400 - ARENA_HDR ) == NULL );
+
+    /**
+     * Once the first block is gone the end is skipped: the block goes
+     * to the start and the skipped bytes count as used
+     */
+    arena_free( a );
+    CHECK( arena_tail == 3000 && arena_used == 5000 );
+    d = arena_alloc( 400 - ARENA_HDR );
+    CHECK( d == (char *)arena + ARENA_HDR );
+    CHECK( ( (arena_hdr_t *)&arena[8000] )->size == 0 );
+    CHECK( arena_head == 400 && arena_used == 5592 );
+
+    /**
+     * The gap up to the tail fills exactly; head meeting the tail is full
+     */
+    e = arena_alloc( 2600 - ARENA_HDR );
+    CHECK( e == d + 400 && arena_head == arena_tail && arena_used == sizeof( arena ) );
+    CHECK( arena_alloc( 0 ) == NULL );
+
+    /**
+     * Reclaiming steps over the skipped end
+     */
+    arena_free( b );
+    arena_free( c );
+    CHECK( arena_tail == 0 && arena_used == 3000 );
+
+    /**
+     * Released out of order: held until the block before it goes
+     */
+    arena_free( e );
+    CHECK( arena_used == 3000 && arena_tail == 0 );
+    arena_free( d );
+    CHECK( arena_used == 0 && arena_tail == 3000 );
+
+    /**
+     * An empty arena starts over at 0
+     */
+    a = arena_alloc( 16 );
+    CHECK( a == (char *)arena + ARENA_HDR && arena_used == 20 );
+    arena_free( a );
+    CHECK( arena_used == 0 );
+}
+
+static void test_arena_exact_end( void )
+{
+    char *a, *b, *c;
+
+    a = arena_alloc( 4096 - ARENA_HDR );
+    b = arena_alloc( 4096 - ARENA_HDR );
+    CHECK( a && b && arena_head == 0 && arena_used == sizeof( arena ) );
+    arena_free( a );
+    c = arena_alloc( 100 );
+    CHECK( c == a );
+    arena_free( b );
+    arena_free( c );
+    CHECK( arena_used == 0 );
+}
+
+static void test_arena_limits( void )
+{
+    char *a;
+
+    /**
+     * A block may take half the arena; MQTT_OUTBOX_PAYLOAD_MAX fits
+     */
+    CHECK( arena_alloc( sizeof( arena ) / 2 - ARENA_HDR + 1 ) == NULL );
+    a = arena_alloc( MQTT_OUTBOX_PAYLOAD_MAX );
+    CHECK( a != NULL );
+    arena_free( a );
+    CHECK( arena_used == 0 );
+
+    /**
+     * Sizes are rounded up to the alignment
+     */
+    a = arena_alloc( 1 );
+    CHECK( ( (arena_hdr_t *)a - 1 )->size == 8 );
+    arena_free( a );
+}
+
+/**
+ * Random sizes released in random order against a model of the live
+ * blocks: blocks stay aligned, inside the arena, apart and intact
+ */
+static void test_arena_model( void )
+{
+    enum { LIVE_MAX = 64 };
+    struct { char *p; size_t len; uint32_t seq; } live[LIVE_MAX];
+    int count = 0;
+    uint32_t seq = 0;
+    uint32_t refused = 0;
+
+    srand( 7 );
+    for( int step = 0; step < 200000; step++ )
+    {
+        if( count < LIVE_MAX && ( rand() % 3 || !count ) )
+        {
+            size_t len = 4 + rand() % ( rand() % 8 ? 300 : MQTT_OUTBOX_PAYLOAD_MAX - 4 );
+            char *p = arena_alloc( len );
+
+            if( !p )
+            {
+                /**
+                 * Refused only with blocks still held
+                 */
+                CHECK( count > 0 );
+                refused++;
+                continue;
+            }
+            CHECK( ( (uintptr_t)p & ( ARENA_ALIGN - 1 ) ) == 0 );
+            CHECK( p >= (char *)arena && p + len <= (char *)arena + sizeof( arena ) );
+            for( int i = 0; i < count; i++ )
+            {
+                CHECK( p + len <= live[i].p - ARENA_HDR || live[i].p + live[i].len <= p - ARENA_HDR );
+            }
+            payload_fill( p, seq, len );
+            live[count].p = p;
+            live[count].len = len;
+            live[count].seq = seq++;
+            count++;
+        }
+        else
+        {
+            int i = rand() % count;
+            uint32_t got;
+
+            memcpy( &got, live[i].p, sizeof( got ) );
+            CHECK( got == live[i].seq );
+            CHECK( live[i].len <= 4 || (uint8_t)live[i].p[live[i].len - 1] ==
+                   (uint8_t)( live[i].seq * 31 + live[i].len - 1 ) );
+            arena_free( live[i].p );
+            live[i] = live[--count];
+        }
+        CHECK( arena_used <= sizeof( arena ) );
+    }
+    while( count )
+    {
+        arena_free( live[--count].p );
+    }
+    CHECK( arena_used == 0 );
+    CHECK( refused > 0 );
+}
+
+/**
+ * A coalesced value replaced while queued is released out of order and
+ * reclaimed once the publisher is done with the blocks before it
+ */
+static void test_outbox_coalesce( void )
+{
+    char buf[200];
+    mqtt_outbox_stats_t before, after;
+    size_t used;
+
+    mqtt_outbox_get_stats( &before );
+    gated = true;
+
+    payload_fill( buf, 1000, 100 );
+    CHECK( mqtt_outbox_post( "ESP-send", buf, 100 ) == ESP_OK );
+    while( uxQueueMessagesWaiting( ready ) )
+    {
+        sched_yield();
+    }
+
+    /**
+     * The publisher holds the first message; these stay queued
+     */
+    payload_fill( buf, 1, 60 );
+    CHECK( mqtt_outbox_post( "ESP-fleet", buf, 60 ) == ESP_OK );
+    payload_fill( buf, 1001, 100 );
+    CHECK( mqtt_outbox_post( "ESP-send", buf, 100 ) == ESP_OK );
+    used = arena_used_get();
+    payload_fill( buf, 2, 200 );
+    CHECK( mqtt_outbox_post( "ESP-fleet", buf, 200 ) == ESP_OK );
+    CHECK( arena_used_get() == used + ARENA_HDR + 200 );
+    CHECK( uxQueueMessagesWaiting( ready ) == 2 );
+
+    gated = false;
+    for( int i = 0; i < 3; i++ )
+    {
+        xSemaphoreGive( publish_gate );
+    }
+    outbox_drain();
+
+    mqtt_outbox_get_stats( &after );
+    CHECK( after.posted - before.posted == 4 );
+    CHECK( after.coalesced - before.coalesced == 1 );
+    CHECK( after.published - before.published == 3 );
+    CHECK( arena_used_get() == 0 );
+    CHECK( publish_bad == 0 );
+}
+
+/**
+ * Bursts of posts of mixed sizes and topics while the publisher drains
+ * them: the arena wraps, skips ends, fills up and refuses, all without
+ * a heap call
+ */
+static void test_outbox_cycles( long cycles )
+{
+    static const char *topics[] = { "ESP-send", "ESP-send", "ESP-send", "ESP-fleet", "ESP-stats/health" };
+    static char buf[MQTT_OUTBOX_PAYLOAD_MAX];
+    mqtt_outbox_stats_t before, after;
+    uint32_t seq = fifo_last + 1;
+    uint32_t refused = 0;
+    long done = 0;
+
+    srand( 11 );
+    mqtt_outbox_get_stats( &before );
+    __atomic_store_n( &counting, 1, __ATOMIC_RELAXED );
+    while( done < cycles )
+    {
+        int burst = 1 + rand() % ( CONFIG_APP_MQTT_OUTBOX_LEN + 16 );
+
+        for( int i = 0; i < burst && done < cycles; i++, done++ )
+        {
+            size_t len = 4 + rand() % ( rand() % 16 ? 400 : MQTT_OUTBOX_PAYLOAD_MAX - 4 );
+
+            payload_fill( buf, seq, len );
+            if( mqtt_outbox_post( topics[rand() % 5], buf, len ) != ESP_OK )
+            {
+                refused++;
+            }
+            seq++;
+        }
+        outbox_drain();
+    }
+    __atomic_store_n( &counting, 0, __ATOMIC_RELAXED );
+    mqtt_outbox_get_stats( &after );
+
+    printf( "  %ld posts, %u refused, %u coalesced, arena peak %u\n", cycles, (unsigned)refused,
+            (unsigned)( after.coalesced - before.coalesced ), (unsigned)after.arena_peak );
+    CHECK( heap_calls == 0 );
+    CHECK( publish_bad == 0 );
+    CHECK( after.posted - before.posted == cycles - refused );
+    CHECK( after.posted - before.posted == ( after.published - before.published ) +
+                                           ( after.coalesced - before.coalesced ) );
+    CHECK( after.dropped - before.dropped == refused );
+    CHECK( refused > 0 && refused < cycles / 4 );
+    CHECK( after.arena_peak <= sizeof( arena ) );
+    CHECK( arena_used_get() == 0 );
+}
+
+int main( int argc, char **argv )
+{
+    long cycles = argc > 1 ? strtol( argv[1], NULL, 10 ) : 1000000;
+
+    RUN( test_arena_wrap );
+    RUN( test_arena_exact_end );
+    RUN( test_arena_limits );
+    RUN( test_arena_model );
+
+    publish_gate = xSemaphoreCreateCounting( 8, 0 );
+    CHECK( mqtt_outbox_init() == ESP_OK );
+    CHECK( xTaskCreate( task_mqtt_publisher, "mqtt_pub", 4096, NULL, 5, NULL ) == pdPASS );
+
+    RUN( test_outbox_coalesce );
+    printf( "test_outbox_cycles\n" );
+    test_outbox_cycles( cycles );
+    return host_test_done();
+}
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * White-box: the slot and id tables are checked directly, so the source
+ * is built into the test (CONFIG_MESH_ROUTE_TABLE_SIZE is small to get
+ * collisions)
+ */
+#include "node_registry.c"
+
+#include "host_test.h"
+
+#define MASK    ( NODE_REGISTRY_CAPACITY - 1 )
+
+static void mac_make( uint8_t mac[6], uint32_t n )
+{
+    mac[0] = 0x24;
+    mac[1] = 0x0a;
+    mac[2] = 0xc4;
+    mac[3] = (uint8_t)( n >> 16 );
+    mac[4] = (uint8_t)( n >> 8 );
+    mac[5] = (uint8_t)n;
+}
+
+/**
+ * Fills 'macs' with 'count' addresses whose probe starts at slot 'home'
+ */
+static void macs_at( uint32_t home, uint8_t macs[][6], int count )
+{
+    uint32_t n = 0;
+
+    for( int found = 0; found < count; n++ )
+    {
+        mac_make( macs[found], n );
+        if( ( mac_hash( macs[found] ) & MASK ) == home )
+        {
+            found++;
+        }
+    }
+}
+
+/**
+ * Fills 'ids' with 'count' ids whose probe starts at position 'home'
+ */
+static void ids_at( uint32_t home, char ids[][NODE_ID_LEN], int count )
+{
+    uint32_t n = 0;
+
+    for( int found = 0; found < count; n++ )
+    {
+        snprintf( ids[found], NODE_ID_LEN, "%u", (unsigned)n );
+        if( ( id_hash( ids[found] ) & MASK ) == home )
+        {
+            found++;
+        }
+    }
+}
+
+static int slot_of( const uint8_t mac[6] )
+{
+    return probe( mac, NULL );
+}
+
+/**
+ * Structural invariants after every operation
+ */
+static void check_invariants( void )
+{
+    int used = 0;
+
+    for( int i = 0; i < NODE_REGISTRY_CAPACITY; i++ )
+    {
+        if( slots[i].state == SLOT_USED )
+        {
+            used++;
+            CHECK( probe( slots[i].mac, NULL ) == i );
+            CHECK( index_slot[slots[i].index] == i );
+            CHECK( id_probe( slots[i].id, NULL ) >= 0 );
+        }
+
+        /**
+         * The backward cleanup leaves no tombstone in front of an empty slot
+         */
+        if( slots[i].state == SLOT_DELETED )
+        {
+            CHECK( slots[( i + 1 ) & MASK].state != SLOT_EMPTY );
+        }
+        if( id_table[i] == ID_DELETED )
+        {
+            CHECK( id_table[( i + 1 ) & MASK] != ID_EMPTY );
+        }
+        if( id_table[i] >= 0 )
+        {
+            CHECK( slots[id_table[i]].state == SLOT_USED );
+        }
+    }
+    CHECK( used == node_registry_count() );
+    CHECK( used + free_top == CONFIG_MESH_ROUTE_TABLE_SIZE );
+}
+
+static void test_basic( void )
+{
+    uint8_t mac[6];
+    uint8_t out_mac[6];
+    char id[NODE_ID_LEN];
+    bool created;
+    int index;
+
+    node_registry_init();
+    mac_make( mac, 1 );
+    CHECK( node_registry_lookup( mac, id, sizeof( id ) ) == -1 );
+
+    index = node_registry_upsert( mac, "7", &created );
+    CHECK( index >= 0 && created );
+    CHECK( node_registry_upsert( mac, "7", &created ) == index && !created );
+    CHECK( node_registry_lookup( mac, id, sizeof( id ) ) == index && strcmp( id, "7" ) == 0 );
+    CHECK( node_registry_find_id( "7", out_mac ) == index && memcmp( out_mac, mac, 6 ) == 0 );
+    CHECK( node_registry_get( index, out_mac, id, sizeof( id ) ) && memcmp( out_mac, mac, 6 ) == 0 );
+    CHECK( node_registry_count() == 1 );
+
+    /**
+     * A new id replaces the old one in the id index
+     */
+    CHECK( node_registry_upsert( mac, "8", &created ) == index && !created );
+    CHECK( node_registry_find_id( "7", NULL ) == -1 );
+    CHECK( node_registry_find_id( "8", NULL ) == index );
+
+    CHECK( node_registry_remove( mac, id, sizeof( id ) ) == index && strcmp( id, "8" ) == 0 );
+    CHECK( node_registry_remove( mac, NULL, 0 ) == -1 );
+    CHECK( node_registry_lookup( mac, NULL, 0 ) == -1 );
+    CHECK( node_registry_find_id( "8", NULL ) == -1 );
+    CHECK( !node_registry_get( index, NULL, NULL, 0 ) );
+    CHECK( node_registry_count() == 0 );
+    check_invariants();
+}
+
+static void test_full( void )
+{
+    uint8_t mac[6];
+    char id[NODE_ID_LEN];
+    int index;
+
+    node_registry_init();
+    for( int i = 0; i < CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        mac_make( mac, i );
+        snprintf( id, sizeof( id ), "%d", i );
+        CHECK( node_registry_upsert( mac, id, NULL ) >= 0 );
+    }
+    mac_make( mac, CONFIG_MESH_ROUTE_TABLE_SIZE );
+    CHECK( node_registry_upsert( mac, "x", NULL ) == -1 );
+
+    /**
+     * A released index goes to the next node
+     */
+    mac_make( mac, 3 );
+    index = node_registry_remove( mac, NULL, 0 );
+    CHECK( index >= 0 );
+    mac_make( mac, CONFIG_MESH_ROUTE_TABLE_SIZE );
+    CHECK( node_registry_upsert( mac, "x", NULL ) == index );
+    check_invariants();
+}
+
+static const char ids[4][NODE_ID_LEN] = { "a", "b", "c", "d" };
+
+static void test_tombstones( void )
+{
+    uint8_t macs[4][6];
+    uint32_t home = 5;
+
+    node_registry_init();
+    macs_at( home, macs, 4 );
+    for( int i = 0; i < 3; i++ )
+    {
+        CHECK( node_registry_upsert( macs[i], ids[i], NULL ) >= 0 );
+        CHECK( slot_of( macs[i] ) == (int)( ( home + i ) & MASK ) );
+    }
+
+    /**
+     * Removing the middle of the chain leaves a tombstone, so the node
+     * behind it is still found in place
+     */
+    CHECK( node_registry_remove( macs[1], NULL, 0 ) >= 0 );
+    CHECK( slots[( home + 1 ) & MASK].state == SLOT_DELETED );
+    CHECK( slot_of( macs[2] ) == (int)( ( home + 2 ) & MASK ) );
+    CHECK( node_registry_lookup( macs[1], NULL, 0 ) == -1 );
+    check_invariants();
+
+    /**
+     * The next colliding node reuses the tombstone
+     */
+    CHECK( node_registry_upsert( macs[3], ids[3], NULL ) >= 0 );
+    CHECK( slot_of( macs[3] ) == (int)( ( home + 1 ) & MASK ) );
+    CHECK( node_registry_remove( macs[3], NULL, 0 ) >= 0 );
+    check_invariants();
+
+    /**
+     * Removing the end of the chain clears it and the tombstone before it
+     */
+    CHECK( node_registry_remove( macs[2], NULL, 0 ) >= 0 );
+    CHECK( slots[( home + 2 ) & MASK].state == SLOT_EMPTY );
+    CHECK( slots[( home + 1 ) & MASK].state == SLOT_EMPTY );
+    CHECK( slots[home].state == SLOT_USED );
+    CHECK( slot_of( macs[0] ) == (int)home );
+    check_invariants();
+
+    CHECK( node_registry_remove( macs[0], NULL, 0 ) >= 0 );
+    CHECK( slots[home].state == SLOT_EMPTY );
+    check_invariants();
+}
+
+static void test_tombstones_wrap( void )
+{
+    uint8_t macs[3][6];
+    uint32_t home = NODE_REGISTRY_CAPACITY - 1;
+
+    node_registry_init();
+    macs_at( home, macs, 3 );
+    for( int i = 0; i < 3; i++ )
+    {
+        CHECK( node_registry_upsert( macs[i], ids[i], NULL ) >= 0 );
+    }
+    CHECK( slot_of( macs[1] ) == 0 && slot_of( macs[2] ) == 1 );
+
+    /**
+     * The cleanup walks back across the end of the table
+     */
+    CHECK( node_registry_remove( macs[0], NULL, 0 ) >= 0 );
+    CHECK( node_registry_remove( macs[1], NULL, 0 ) >= 0 );
+    CHECK( slots[home].state == SLOT_DELETED && slots[0].state == SLOT_DELETED );
+    CHECK( slot_of( macs[2] ) == 1 );
+    CHECK( node_registry_remove( macs[2], NULL, 0 ) >= 0 );
+    CHECK( slots[1].state == SLOT_EMPTY && slots[0].state == SLOT_EMPTY && slots[home].state == SLOT_EMPTY );
+    check_invariants();
+}
+
+static void test_id_index( void )
+{
+    uint8_t macs[4][6];
+    char node_ids[3][NODE_ID_LEN];
+    uint32_t home = 9;
+    uint8_t out[6];
+    int pos;
+
+    node_registry_init();
+    for( int i = 0; i < 4; i++ )
+    {
+        mac_make( macs[i], 100 + i );
+    }
+    ids_at( home, node_ids, 3 );
+    for( int i = 0; i < 3; i++ )
+    {
+        CHECK( node_registry_upsert( macs[i], node_ids[i], NULL ) >= 0 );
+        CHECK( id_probe( node_ids[i], NULL ) == (int)( ( home + i ) & MASK ) );
+    }
+
+    /**
+     * Middle of an id chain: tombstone, the id behind it still found
+     */
+    CHECK( node_registry_remove( macs[1], NULL, 0 ) >= 0 );
+    CHECK( id_table[( home + 1 ) & MASK] == ID_DELETED );
+    CHECK( node_registry_find_id( node_ids[2], out ) >= 0 && memcmp( out, macs[2], 6 ) == 0 );
+    CHECK( node_registry_find_id( node_ids[1], NULL ) == -1 );
+    check_invariants();
+
+    /**
+     * End of the chain: cleared back to the live id
+     */
+    CHECK( node_registry_remove( macs[2], NULL, 0 ) >= 0 );
+    CHECK( id_table[( home + 2 ) & MASK] == ID_EMPTY && id_table[( home + 1 ) & MASK] == ID_EMPTY );
+    CHECK( id_table[home] >= 0 );
+    check_invariants();
+
+    /**
+     * A node taking over an id: removing the old holder keeps the new one
+     */
+    CHECK( node_registry_upsert( macs[3], node_ids[0], NULL ) >= 0 );
+    CHECK( node_registry_find_id( node_ids[0], out ) >= 0 && memcmp( out, macs[3], 6 ) == 0 );
+    CHECK( node_registry_remove( macs[0], NULL, 0 ) >= 0 );
+    pos = id_probe( node_ids[0], NULL );
+    CHECK( pos >= 0 && id_table[pos] == slot_of( macs[3] ) );
+    CHECK( node_registry_find_id( node_ids[0], out ) >= 0 && memcmp( out, macs[3], 6 ) == 0 );
+    CHECK( node_registry_remove( macs[3], NULL, 0 ) >= 0 );
+    CHECK( node_registry_find_id( node_ids[0], NULL ) == -1 );
+    check_invariants();
+}
+
+/**
+ * Random churn against a plain model of the registered nodes
+ */
+#define POOL    ( 4 * CONFIG_MESH_ROUTE_TABLE_SIZE )
+
+static void test_random( void )
+{
+    bool present[POOL] = { false, };
+    int index_of[POOL];
+    char id_of[POOL][NODE_ID_LEN];
+    int count = 0;
+    uint8_t mac[6];
+    char id[NODE_ID_LEN];
+
+    srand( 1 );
+    node_registry_init();
+    for( int step = 0; step < 200000; step++ )
+    {
+        int n = rand() % POOL;
+        bool created;
+
+        mac_make( mac, n * 7919 );
+        if( rand() % 2 )
+        {
+            /**
+             * A node's id changes now and then; ids stay unique
+             */
+            snprintf( id, sizeof( id ), "%d", n + POOL * ( rand() % 4 ) );
+            int index = node_registry_upsert( mac, id, &created );
+            if( present[n] )
+            {
+                CHECK( index == index_of[n] && !created );
+            }
+            else if( count < CONFIG_MESH_ROUTE_TABLE_SIZE )
+            {
+                CHECK( index >= 0 && created );
+                present[n] = true;
+                index_of[n] = index;
+                count++;
+            }
+            else
+            {
+                CHECK( index == -1 );
+            }
+            if( present[n] )
+            {
+                strcpy( id_of[n], id );
+            }
+        }
+        else
+        {
+            CHECK( node_registry_remove( mac, NULL, 0 ) == ( present[n] ? index_of[n] : -1 ) );
+            count -= present[n];
+            present[n] = false;
+        }
+
+        if( step % 97 == 0 )
+        {
+            check_invariants();
+            for( int i = 0; i < POOL; i++ )
+            {
+                mac_make( mac, i * 7919 );
+                CHECK( node_registry_lookup( mac, id, sizeof( id ) ) == ( present[i] ? index_of[i] : -1 ) );
+                if( present[i] )
+                {
+                    CHECK( strcmp( id, id_of[i] ) == 0 );
+                    CHECK( node_registry_find_id( id_of[i], NULL ) >= 0 );
+                }
+            }
+        }
+        if( host_test_failures )
+        {
+            printf( "  failed at step %d\n", step );
+            return;
+        }
+    }
+    CHECK( node_registry_count() == count );
+}
+
+int main( void )
+{
+    RUN( test_basic );
+    RUN( test_full );
+    RUN( test_tombstones );
+    RUN( test_tombstones_wrap );
+    RUN( test_id_index );
+    RUN( test_random );
+    return host_test_done();
+}
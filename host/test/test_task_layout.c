@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * White-box: the layout table is checked against the configuration the
+ * test is built with (one task unpinned, one on a core that does not
+ * exist); the FreeRTOS calls and the log are faked, so the test takes
+ * no stubs but their headers
+ */
+#include "task_layout.c"
+
+#include "host_test.h"
+
+/**
+ * Fake scheduler: records the last task created and reports the tasks
+ * of 'tasks' with their run-time counters
+ */
+static struct {
+    TaskFunction_t  fn;
+    const char     *name;
+    uint32_t        stack;
+    void           *param;
+    UBaseType_t     prio;
+    BaseType_t      core;
+} created;
+
+static struct host_task *idle_task[portNUM_PROCESSORS] = { (struct host_task *)0x10, (struct host_task *)0x20 };
+static TaskStatus_t tasks[4];
+static UBaseType_t task_count = 0;
+static uint32_t run_time = 0;
+
+BaseType_t xTaskCreatePinnedToCore( TaskFunction_t task, const char *name, uint32_t stack, void *param,
+                                    UBaseType_t priority, TaskHandle_t *handle, BaseType_t core )
+{
+    created.fn = task;
+    created.name = name;
+    created.stack = stack;
+    created.param = param;
+    created.prio = priority;
+    created.core = core;
+    if( handle )
+    {
+        *handle = (TaskHandle_t)0x30;
+    }
+    return pdPASS;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks( void )
+{
+    return task_count;
+}
+
+UBaseType_t uxTaskGetSystemState( TaskStatus_t *status, UBaseType_t count, uint32_t *total_run_time )
+{
+    UBaseType_t n = task_count < count ? task_count : count;
+
+    memcpy( status, tasks, n * sizeof( *status ) );
+    *total_run_time = run_time;
+    return n;
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU( UBaseType_t cpu )
+{
+    return cpu < portNUM_PROCESSORS ? idle_task[cpu] : NULL;
+}
+
+/**
+ * DEBUG builds log every layout; the test drops the lines
+ */
+void host_log( esp_log_level_t level, const char *tag, const char *format, ... )
+{
+}
+
+static void task_fn( void *param )
+{
+    ( void )param;
+}
+
+static void test_create( void )
+{
+    static const struct {
+        task_layout_id_t id;
+        uint32_t stack;
+        UBaseType_t prio;
+        BaseType_t core;
+    } expected[] = {
+        { TASK_LAYOUT_MESH_RX, CONFIG_APP_TASK_MESH_RX_STACK, CONFIG_APP_TASK_MESH_RX_PRIO, 1 },
+        { TASK_LAYOUT_MQTT_PUBLISHER, CONFIG_APP_TASK_MQTT_PUBLISHER_STACK, CONFIG_APP_TASK_MQTT_PUBLISHER_PRIO, 0 },
+        { TASK_LAYOUT_FWDLOG, CONFIG_APP_TASK_FWDLOG_STACK, CONFIG_APP_TASK_FWDLOG_PRIO, tskNO_AFFINITY },
+        { TASK_LAYOUT_DOWNLINK, CONFIG_APP_TASK_DOWNLINK_STACK, CONFIG_APP_TASK_DOWNLINK_PRIO, tskNO_AFFINITY },
+    };
+    TaskHandle_t handle = NULL;
+    int param;
+
+    for( int i = 0; i < sizeof( expected ) / sizeof( expected[0] ); i++ )
+    {
+        memset( &created, 0, sizeof( created ) );
+        CHECK( task_layout_create( expected[i].id, task_fn, "task", &param, &handle ) == pdPASS );
+        CHECK( created.fn == task_fn && created.param == &param && strcmp( created.name, "task" ) == 0 );
+        CHECK( created.stack == expected[i].stack );
+        CHECK( created.prio == expected[i].prio );
+        CHECK( created.core == expected[i].core );
+        CHECK( handle == (TaskHandle_t)0x30 );
+    }
+
+    /**
+     * Every task has a stack and a priority
+     */
+    for( int id = 0; id < TASK_LAYOUT_COUNT; id++ )
+    {
+        memset( &created, 0, sizeof( created ) );
+        CHECK( task_layout_create( id, task_fn, "task", NULL, NULL ) == pdPASS );
+        CHECK( created.stack > 0 && created.prio > 0 );
+        CHECK( created.core == tskNO_AFFINITY || created.core < portNUM_PROCESSORS );
+    }
+}
+
+static void test_cpu_sample( void )
+{
+    task_cpu_sample_t sample;
+
+    tasks[0] = (TaskStatus_t){ .xHandle = (TaskHandle_t)0x30, .ulRunTimeCounter = 500 };
+    tasks[1] = (TaskStatus_t){ .xHandle = idle_task[1], .ulRunTimeCounter = 300 };
+    tasks[2] = (TaskStatus_t){ .xHandle = idle_task[0], .ulRunTimeCounter = 900 };
+    task_count = 3;
+    run_time = 1000;
+
+    task_layout_cpu_sample( &sample );
+    CHECK( sample.total == 1000 );
+    CHECK( sample.idle[0] == 900 && sample.idle[1] == 300 );
+
+    /**
+     * Without the idle tasks the counters stay zero
+     */
+    task_count = 1;
+    task_layout_cpu_sample( &sample );
+    CHECK( sample.total == 1000 && sample.idle[0] == 0 && sample.idle[1] == 0 );
+}
+
+static void test_cpu_busy( void )
+{
+    task_cpu_sample_t prev = { .total = 1000, .idle = { 900, 300 } };
+    task_cpu_sample_t now = { .total = 2000, .idle = { 1650, 300 } };
+
+    CHECK( task_layout_cpu_busy( &prev, &now, 0 ) == 25 );
+    CHECK( task_layout_cpu_busy( &prev, &now, 1 ) == 100 );
+    CHECK( task_layout_cpu_busy( &prev, &prev, 0 ) == 0 );
+
+    /**
+     * Counters that wrapped once
+     */
+    prev = (task_cpu_sample_t){ .total = UINT32_MAX - 99, .idle = { UINT32_MAX - 9, 0 } };
+    now = (task_cpu_sample_t){ .total = 100, .idle = { 90, 50 } };
+    CHECK( task_layout_cpu_busy( &prev, &now, 0 ) == 50 );
+    CHECK( task_layout_cpu_busy( &prev, &now, 1 ) == 75 );
+
+    /**
+     * An idle counter ahead of the total, as samples taken out of order
+     * give, reads as idle
+     */
+    now.idle[0] = 500;
+    CHECK( task_layout_cpu_busy( &prev, &now, 0 ) == 0 );
+}
+
+int main( void )
+{
+    RUN( test_create );
+    RUN( test_cpu_sample );
+    RUN( test_cpu_busy );
+    return host_test_done();
+}
@@ -16,12 +16,108 @@
  * Drivers;
  */
 #include "driver/gpio.h"
+#include "driver/adc.h"
 
 /**
  * GPIOs Config;
  */
 #include "app.h"
 
+/**
+ * Binary mesh frames
+ */
+#include "mesh_proto.h"
+
+/**
+ * Connected nodes (root only)
+ */
+#include "node_registry.h"
+
+/**
+ * Root-to-nodes broadcast
+ */
+#include "mesh_fanout.h"
+
+/**
+ * Button/sensor event queue
+ */
+#include "input_events.h"
+
+/**
+ * Prioritized transmit queue
+ */
+#include "tx_queue.h"
+
+/**
+ * Sensor sampling and windowed aggregates
+ */
+#include "sampler.h"
+
+/**
+ * Store-and-forward log for outages
+ */
+#include "fwdlog.h"
+
+/**
+ * MQTT to mesh commands
+ */
+#include "downlink.h"
+
+/**
+ * Acknowledged Connect-Mesh
+ */
+#include "registration.h"
+
+/**
+ * Heartbeats and the root's liveness table
+ */
+#include "liveness.h"
+
+/**
+ * Messages larger than one frame
+ */
+#include "frag.h"
+
+/**
+ * Shared frame buffers
+ */
+#include "frame_pool.h"
+
+/**
+ * Readings batched into one publish
+ */
+#include "uplink_batch.h"
+
+/**
+ * End-to-end latency tracing
+ */
+#include "trace_stats.h"
+
+/**
+ * Health counters
+ */
+#include "metrics.h"
+
+/**
+ * Core, priority and stack of the tasks
+ */
+#include "task_layout.h"
+
+/**
+ * Receive, route and publish stages on the root
+ */
+#include "root_pipeline.h"
+
+/**
+ * Uplink sequence numbers and duplicate suppression on the root
+ */
+#include "dedup.h"
+
+/**
+ * Tree shape and parent link reports
+ */
+#include "topology.h"
+
 /**
  * Standard configurations loaded
  */
@@ -31,12 +127,14 @@
  * Logs;
  */
 #include "esp_log.h"
+#include "esp_timer.h"
 
 /**
  * Rede mesh;
  */
 #include "esp_mesh.h"
 #include "esp_mesh_internal.h"
+#include "mesh.h"
 
 /**
  * Lwip
@@ -48,32 +146,294 @@
 /**
 * Json
 */
-#include "cJSON.h"
+#include "json_scan.h"
 
 // interaction with public mqtt broker
-void mqtt_app_start(void);
-void mqtt_app_publish(char* topic, char *publish_string);
+#include "mqtt_app.h"
+#include "mqtt_outbox.h"
 /**
  * Gloabal Variables; 
  */
 extern EventGroupHandle_t wifi_event_group;
 extern const int CONNECTED_BIT;
-extern mesh_addr_t route_table[];
 extern char mac_address_root_str[];
-nodeEsp activeNode[30];
-int lengthOfActiveNode = 0;
 /**
  * Constants;
  */
 static const char *TAG = "app: ";
 
-#define RX_SIZE          (100)
-static uint8_t rx_buf[RX_SIZE] = { 0, };
+/**
+ * How long task_mesh_tx and the replay wait for a frame buffer
+ */
+#define FRAME_BUF_WAIT_MS (100)
+
+/**
+ * Longest time task_mesh_tx blocks for an input event before re-checking
+ * its role; a due registration announcement shortens it
+ */
+#define TX_IDLE_WAIT_MS  (500)
+
+/**
+ * How long an alert may wait for a control slot
+ */
+#define TX_ALERT_WAIT_MS (100)
+
+/**
+ * Own identity stamped into every binary frame; set by task_app_create()
+ * before any task runs, then only read. Each frame takes its sequence
+ * number atomically.
+ */
+static uint8_t self_mac[6];
+static uint16_t self_node_id;
+static uint32_t tx_seq = 0;
+
+/**
+ * Encodes a frame of the given type into 'buf', stamped with the time
+ * of the input event that produced it (0: now);
+ * returns the frame size or -1 if it does not fit.
+ */
+int app_frame_build( uint8_t type, const uint8_t *payload, uint16_t payload_len,
+                     int64_t event_us, uint8_t *buf, size_t size )
+{
+    mesh_frame_t frame;
+
+    frame.type = type;
+    frame.node_id = self_node_id;
+    memcpy( frame.mac, self_mac, 6 );
+    frame.seq = __atomic_fetch_add( &tx_seq, 1, __ATOMIC_RELAXED );
+    frame.origin_ts = trace_stamp( event_us );
+    frame.layer = esp_mesh_get_layer();
+    frame.flags = 0;
+    frame.payload_len = payload_len;
+    frame.payload = payload;
+    return mesh_proto_encode( &frame, buf, size );
+}
+
+/**
+ * Parses "aa:bb:cc:dd:ee:ff" into its 6 bytes
+ */
+static bool mac_from_str( const char *str, uint8_t mac[6] )
+{
+    return str && sscanf( str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                          &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5] ) == 6;
+}
+
+/**
+ * Adds the node to the registry or refreshes its id; the id is copied
+ * so nothing points into the received frame after it is released.
+ * Returns the node index, or -1 if the registry is full.
+ */
+static int root_register_node( const char *id, const uint8_t mac[6] )
+{
+    bool created;
+    int index = node_registry_upsert( mac, id, &created );
+
+    if( index < 0 )
+    {
+        ESP_LOGW( TAG, "Node registry full, "MACSTR" not tracked", MAC2STR( mac ) );
+        return -1;
+    }
+    if( created )
+    {
+        trace_stats_forget( index );
+        metrics_forget( index );
+        root_pipeline_forget( index );
+        topology_forget( index );
+    }
+    return index;
+}
+
+/**
+ * Root: the broker and the router's network are both reachable
+ */
+static bool root_uplink_ready( void )
+{
+    return mqtt_app_connected() && mesh_app_is_connected();
+}
+
+/**
+ * Hands the first 'len' bytes of 'fb' to the MQTT outbox by reference
+ */
+static esp_err_t root_publish( const char *topic, frame_buf_t *fb, int len )
+{
+    esp_err_t err;
+
+    if( len >= FRAME_POOL_BUF_SIZE )
+    {
+        len = FRAME_POOL_BUF_SIZE - 1;
+    }
+    err = mqtt_outbox_post_buf( topic, fb, (const char *)fb->data, len );
+    if( err != ESP_OK )
+    {
+        ESP_LOGW( TAG, "outbox full, dropped publish on %s", topic );
+    }
+    return err;
+}
+
+/**
+ * Root handling of a MESH_PROTO_BIN frame, decoded in place. Summaries
+ * and alerts are written over the frame they came from and the buffer
+ * goes to the MQTT outbox by reference.
+ */
+static void root_handle_bin( frame_buf_t *fb )
+{
+    const uint8_t *buf = fb->data;
+    size_t len = fb->len;
+    char *msg = (char *)fb->data;
+    int n;
+    mesh_frame_t frame;
+    mesh_payload_data_t reading;
+    mesh_payload_metrics_t health;
+    mesh_payload_summary_t summary;
+    mesh_payload_alert_t alert;
+    char id[NODE_ID_LEN];
+    int index;
+    bool uplink;
+    esp_err_t err = ESP_FAIL;
+
+    if( mesh_proto_decode( buf, len, &frame ) != 0 )
+    {
+        #ifdef DEBUG
+            ESP_LOGI( TAG, "ERROR : Malformed frame (%d bytes)\r\n", (int)len );
+        #endif
+        return;
+    }
+    snprintf( id, sizeof( id ), "%u", frame.node_id );
+    uplink = frame.type == MESH_MSG_DATA || frame.type == MESH_MSG_SUMMARY || frame.type == MESH_MSG_ALERT;
+
+    /**
+     * Readings that arrive while they cannot be published are parked in
+     * the log and come back through replay_frame()
+     */
+    if( uplink && !root_uplink_ready() && fwdlog_append( buf, len ) == ESP_OK )
+    {
+        return;
+    }
+
+    /**
+     * A retry, or a frame that reached the previous root too, comes back
+     * with a sequence number already published; the number is committed
+     * below, once the frame is queued for publish
+     */
+    if( uplink && !dedup_is_new( frame.mac, frame.seq ) )
+    {
+        #ifdef DEBUG
+            ESP_LOGI( TAG, "Duplicate frame from node %s, seq %u", id, frame.seq );
+        #endif
+        return;
+    }
+
+    switch( frame.type )
+    {
+        case MESH_MSG_CONNECT:
+            index = root_register_node( id, frame.mac );
+            if( index >= 0 )
+            {
+                registration_root_ack( &frame, MESH_REG_OK, index );
+                liveness_arm( index );
+            }
+            else
+            {
+                registration_root_ack( &frame, MESH_REG_FULL, MESH_SLOT_NONE );
+            }
+            #ifdef DEBUG
+            ESP_LOGI( TAG, "NON-ROOT(MAC:"MACSTR")- Node Connect-Mesh: %s, seq %u", MAC2STR( frame.mac ), id, frame.seq );
+            #endif
+            mqtt_app_publish( "ESP-connect", id );
+            break;
+
+        case MESH_MSG_DATA:
+            if( mesh_proto_get_data( &frame, &reading ) != 0 )
+            {
+                break;
+            }
+            #ifdef DEBUG
+            ESP_LOGI( TAG, "NON-ROOT(ID:%s)- Node Send-Data: %d, seq %u", id, reading.value, frame.seq );
+            #endif
+            err = uplink_batch_add( frame.node_id, frame.seq, trace_to_local( frame.origin_ts ), reading.value );
+            if( !( frame.flags & MESH_FLAG_REPLAY ) )
+            {
+                trace_stats_record( node_registry_lookup( frame.mac, NULL, 0 ), frame.layer, frame.origin_ts );
+            }
+            break;
+
+        case MESH_MSG_METRICS:
+            if( mesh_proto_get_metrics( &frame, &health ) != 0 )
+            {
+                break;
+            }
+            metrics_store( node_registry_lookup( frame.mac, NULL, 0 ), &health );
+            break;
+
+        case MESH_MSG_TOPOLOGY:
+            topology_store( node_registry_lookup( frame.mac, NULL, 0 ), &frame );
+            break;
+
+        case MESH_MSG_CMD_ACK:
+            downlink_root_handle_ack( &frame );
+            break;
+
+        case MESH_MSG_HEARTBEAT:
+            liveness_root_handle( &frame );
+            break;
+
+        case MESH_MSG_FRAGMENT:
+            frag_receive( &frame );
+            break;
+
+        case MESH_MSG_FRAG_ACK:
+            frag_handle_ack( &frame );
+            break;
+
+        case MESH_MSG_SUMMARY:
+            if( mesh_proto_get_summary( &frame, &summary ) != 0 )
+            {
+                break;
+            }
+            n = snprintf( msg, FRAME_POOL_BUF_SIZE,
+                          "{\"id\":\"%s\",\"seq\":%u,\"t\":%lld,\"window_ms\":%u,\"n\":%u,"
+                          "\"min\":%d,\"max\":%d,\"mean\":%d,\"last\":%d}",
+                          id, frame.seq, (long long)( trace_to_local( frame.origin_ts ) / 1000 ), summary.window_ms,
+                          summary.count, summary.min, summary.max, summary.mean, summary.last );
+            err = root_publish( "ESP-summary", fb, n );
+            if( !( frame.flags & MESH_FLAG_REPLAY ) )
+            {
+                trace_stats_record( node_registry_lookup( frame.mac, NULL, 0 ), frame.layer, frame.origin_ts );
+            }
+            break;
+
+        case MESH_MSG_ALERT:
+            if( mesh_proto_get_alert( &frame, &alert ) != 0 )
+            {
+                break;
+            }
+            #ifdef DEBUG
+            ESP_LOGI( TAG, "NON-ROOT(ID:%s)- Node Alert %u: %d, seq %u", id, alert.kind, alert.value, frame.seq );
+            #endif
+            n = snprintf( msg, FRAME_POOL_BUF_SIZE,
+                          "{\"id\":\"%s\",\"seq\":%u,\"t\":%lld,\"alert\":\"%s\",\"value\":%d,\"ref\":%d}",
+                          id, frame.seq, (long long)( trace_to_local( frame.origin_ts ) / 1000 ),
+                          alert.kind == MESH_ALERT_HIGH ? "high" : alert.kind == MESH_ALERT_LOW ? "low" : "rate",
+                          alert.value, alert.ref );
+            err = root_publish( "ESP-alert", fb, n );
+            if( !( frame.flags & MESH_FLAG_REPLAY ) )
+            {
+                trace_stats_record( node_registry_lookup( frame.mac, NULL, 0 ), frame.layer, frame.origin_ts );
+            }
+            break;
 
-#define TX_SIZE          (100)
-static uint8_t tx_buf[TX_SIZE] = { 0, };
+        default:
+            #ifdef DEBUG
+            ESP_LOGI( TAG, "Unknown frame type %d", frame.type );
+            #endif
+            break;
+    }
 
-bool SignalConnect = 0;
+    if( uplink && err == ESP_OK )
+    {
+        dedup_commit( frame.mac, frame.seq );
+    }
+}
 /**
  * Configure the ESP32 gpios (lLED & button );
  */
@@ -102,79 +462,362 @@ void gpios_setup( void )
      * Configure the GPIO BUTTON
     */
     gpio_config_t io_conf_input;
-    io_conf_input.intr_type = GPIO_PIN_INTR_DISABLE; 
+    io_conf_input.intr_type = GPIO_INTR_NEGEDGE; 
     io_conf_input.pin_bit_mask = GPIO_INPUT_PIN_SEL;
     io_conf_input.mode = GPIO_MODE_INPUT;
     io_conf_input.pull_down_en = GPIO_PULLDOWN_DISABLE;
     io_conf_input.pull_up_en = GPIO_PULLUP_ENABLE;
     gpio_config(&io_conf_input);
+
+    /**
+     * Button presses (active low) are delivered to task_mesh_tx as events
+     */
+    ESP_ERROR_CHECK( input_events_init() );
+    ESP_ERROR_CHECK( input_events_add_gpio( BUTTON, INPUT_SRC_BUTTON, GPIO_INTR_NEGEDGE,
+                                            CONFIG_APP_BUTTON_DEBOUNCE_MS ) );
+
+    /**
+     * The built-in hall sensor is the default sampled input
+     */
+    adc1_config_width( ADC_WIDTH_BIT_12 );
 }
-void public_disconnect_msg(char* macID)
-{    
-    for (int i = 0; i < lengthOfActiveNode; i++){
-        if (strcmp(macID, activeNode[i].ssid)==0){
-            mqtt_app_publish("ESP-disconnect", activeNode[i].id);
+/**
+ * Root handling of a legacy JSON frame, tokenized in place
+ */
+static void root_handle_json( const mesh_addr_t *from, const uint8_t *buf, size_t len )
+{
+    enum { F_TOPIC, F_ID, F_SSID, F_DATA, F_COUNT };
+    json_field_t fields[F_COUNT] = {
+        [F_TOPIC] = { .key = "Topic" },
+        [F_ID]    = { .key = "ID" },
+        [F_SSID]  = { .key = "SSID" },
+        [F_DATA]  = { .key = "Data" },
+    };
+    char id[NODE_ID_LEN];
+    char ssid[18];
+    int32_t nodeData;
+    uint8_t mac[6];
+
+    if( json_scan( (const char*)buf, len, fields, F_COUNT ) < 0 )
+    {
+        #ifdef DEBUG
+            ESP_LOGI( TAG, "ERROR : Malformed JSON frame (%d bytes)\r\n", (int)len );
+        #endif
+        return;
+    }
+
+    if( json_field_eq( &fields[F_TOPIC], "Connect-Mesh" ) && json_field_copy( &fields[F_ID], id, sizeof( id ) ) )
+    {
+        json_field_copy( &fields[F_SSID], ssid, sizeof( ssid ) );
+        root_register_node( id, mac_from_str( ssid, mac ) ? mac : from->addr );
+        #ifdef DEBUG
+        ESP_LOGI(TAG, "NON-ROOT(MAC:"MACSTR")- Node Connect-Mesh: %s, ", MAC2STR(from->addr), id);
+        #endif
+        mqtt_app_publish("ESP-connect", id);
+    }
+    else if( json_field_eq( &fields[F_TOPIC], "Send-Data" ) && json_field_int( &fields[F_DATA], &nodeData ) )
+    {
+        #ifdef DEBUG
+        ESP_LOGI(TAG, "NON-ROOT(MAC:"MACSTR")- Node Send-Data: %d, ", MAC2STR(from->addr), nodeData);
+        #endif
+        /**
+         * Legacy frames carry neither a sequence number nor a timestamp,
+         * and the id only if the sender registered
+         */
+        if( !json_field_copy( &fields[F_ID], id, sizeof( id ) ) &&
+            node_registry_lookup( from->addr, id, sizeof( id ) ) < 0 )
+        {
+            id[0] = '\0';
+        }
+        uplink_batch_add( (uint16_t)atoi( id ), 0, esp_timer_get_time(), nodeData );
+    }
+}
+
+/**
+ * Root entry point for every frame addressed to it
+ */
+void app_root_handle_frame( const mesh_addr_t *from, frame_buf_t *fb, mesh_proto_t proto )
+{
+    if( proto == MESH_PROTO_BIN )
+    {
+        root_handle_bin( fb );
+        return;
+    }
+
+    /**
+     * Legacy JSON frames from older firmware
+     */
+    root_handle_json( from, fb->data, fb->len );
+
+    #ifdef DEBUG 
+        ESP_LOGI( TAG,"ROOT(MAC:%s) - Msg: %.*s, ", mac_address_root_str, fb->len, (const char*)fb->data );
+        /**
+         * Log message to console
+         */
+        ESP_LOGI( TAG, "send by NON-ROOT: "MACSTR"\r\n", MAC2STR(from->addr) );
+    #endif
+}
+
+/**
+ * The root copies a reassembled message into the outbox whole
+ */
+#if CONFIG_APP_FRAG_MAX_MSG > MQTT_OUTBOX_PAYLOAD_MAX
+#error "CONFIG_APP_FRAG_MAX_MSG must fit in half of CONFIG_APP_MQTT_OUTBOX_ARENA_SIZE"
+#endif
+
+/**
+ * A reassembled message: the root publishes diagnostics on ESP-diag/<id>;
+ * nodes take no message kind from the root yet
+ */
+static void on_large_message( const uint8_t mac[6], uint16_t node_id, uint8_t kind,
+                              const uint8_t *data, size_t len )
+{
+    char topic[24];
+
+    if( esp_mesh_is_root() && kind == FRAG_KIND_DIAG )
+    {
+        snprintf( topic, sizeof( topic ), "ESP-diag/%u", node_id );
+        if( mqtt_outbox_post( topic, (const char*)data, len ) != ESP_OK )
+        {
+            ESP_LOGW( TAG, "outbox full, dropped %u byte diagnostics of node %u", (unsigned)len, node_id );
         }
+        return;
     }
+    #ifdef DEBUG
+    ESP_LOGI( TAG, "Message kind %u (%u bytes) from "MACSTR" not handled", kind, (unsigned)len, MAC2STR( mac ) );
+    #endif
 }
-void send_connect_msg()
+
+void public_disconnect_msg(const uint8_t *mac)
 {    
-    uint8_t chipid[20];
-    char mac_str[30];
-    esp_efuse_mac_get_default(chipid);
-    snprintf( mac_str, sizeof( mac_str ), ""MACSTR"", MAC2STR( chipid ) );
-    
-    cJSON *root;
-    root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "Topic", "Connect-Mesh");
-    cJSON_AddStringToObject(root, "ID", NODE_ID);
-    cJSON_AddStringToObject(root, "SSID", mac_str);
-    char *rendered = cJSON_Print(root);
-    snprintf( (char*)tx_buf, TX_SIZE,  rendered ); 
-    mesh_data_t data;
-    data.data = tx_buf;
-    data.size = strlen((char*)tx_buf) + 1;
-    esp_err_t err = esp_mesh_send(&mac_address_root_str, &data, MESH_DATA_P2P, NULL, 0);
-    if (err) 
+    char id[NODE_ID_LEN];
+    int index = node_registry_remove( mac, id, sizeof( id ) );
+    if( index >= 0 )
+    {
+        liveness_forget( index );
+        dedup_park( index );
+        topology_forget( index );
+        mqtt_app_publish("ESP-disconnect", id);
+    }
+}
+/**
+ * Sender task callback
+ */
+static void on_input_frame_sent( const tx_frame_t *frame, esp_err_t err, void *arg )
+{
+    if( err == ESP_OK )
+    {
+        input_latency_record( frame->stamp_us );
+    }
+}
+
+/**
+ * Queues this node's health snapshot for the root; bulk class, so it
+ * never displaces a reading or a control frame
+ */
+static void send_metrics_msg( void )
+{
+    uint8_t payload[MESH_PAYLOAD_METRICS_SIZE];
+    mesh_payload_metrics_t health;
+
+    tx_frame_t *frame = tx_queue_alloc( TX_PRIO_BULK, TX_POLICY_DROP_NEW, 0 );
+    if( !frame )
+    {
+        return;
+    }
+
+    metrics_snapshot( &health );
+    mesh_proto_put_metrics( &health, payload, sizeof( payload ) );
+    int len = app_frame_build( MESH_MSG_METRICS, payload, sizeof( payload ), 0,
+                               frame->data, sizeof( frame->data ) );
+    if( len < 0 )
+    {
+        tx_queue_release( frame );
+        return;
+    }
+    frame->len = len;
+    tx_queue_submit( frame );
+}
+
+/**
+ * Queues this node's place in the tree and parent link for the root;
+ * bulk class, like the health snapshot
+ */
+static void send_topology_msg( void )
+{
+    uint8_t payload[MESH_PAYLOAD_TOPOLOGY_SIZE];
+    mesh_payload_topology_t topo;
+
+    tx_frame_t *frame = tx_queue_alloc( TX_PRIO_BULK, TX_POLICY_DROP_NEW, 0 );
+    if( !frame )
+    {
+        return;
+    }
+
+    topology_snapshot( &topo );
+    mesh_proto_put_topology( &topo, payload, sizeof( payload ) );
+    int len = app_frame_build( MESH_MSG_TOPOLOGY, payload, sizeof( payload ), 0,
+                               frame->data, sizeof( frame->data ) );
+    if( len < 0 )
+    {
+        tx_queue_release( frame );
+        return;
+    }
+    frame->len = len;
+    tx_queue_submit( frame );
+}
+/**
+ * Default sampler input
+ */
+static int32_t sensor_read( void )
+{
+    return hall_sensor_read();
+}
+
+/**
+ * Encodes the summary or alert a sampler event announced into 'buf';
+ * returns the frame size, or -1 if it was already taken
+ */
+static int sampler_frame_build( const input_event_t *event, uint8_t *buf, size_t size )
+{
+    uint8_t payload[MESH_PAYLOAD_SUMMARY_SIZE];
+    mesh_payload_summary_t summary;
+    mesh_payload_alert_t alert;
+
+    if( event->source == INPUT_SRC_SUMMARY && sampler_take_summary( &summary ) )
+    {
+        mesh_proto_put_summary( &summary, payload, sizeof( payload ) );
+        return app_frame_build( MESH_MSG_SUMMARY, payload, MESH_PAYLOAD_SUMMARY_SIZE,
+                                event->timestamp_us, buf, size );
+    }
+    if( event->source == INPUT_SRC_SENSOR && sampler_take_alert( &alert ) )
+    {
+        mesh_proto_put_alert( &alert, payload, sizeof( payload ) );
+        return app_frame_build( MESH_MSG_ALERT, payload, MESH_PAYLOAD_ALERT_SIZE,
+                                event->timestamp_us, buf, size );
+    }
+    return -1;
+}
+
+/**
+ * Queues a sampler summary (telemetry class) or alert (control class,
+ * so it overtakes queued readings)
+ */
+static void send_sampler_msg( const input_event_t *event )
+{
+    tx_frame_t *frame;
+
+    if( event->source == INPUT_SRC_SENSOR )
+    {
+        frame = tx_queue_alloc( TX_PRIO_CONTROL, TX_POLICY_BLOCK, TX_ALERT_WAIT_MS / portTICK_PERIOD_MS );
+    }
+    else
+    {
+        frame = tx_queue_alloc( TX_PRIO_TELEMETRY, TX_POLICY_DROP_OLDEST, 0 );
+    }
+    if( !frame )
     {
         #ifdef DEBUG 
-            ESP_LOGI( TAG, "ERROR : Sending Message!\r\n" ); 
-        #endif
-    } else {
-        SignalConnect = 1;
-        #ifdef DEBUG 
-            ESP_LOGI( TAG, "\r\nNON-ROOT sends (%s) (%s) to ROOT (%s)\r\n", mac_str, tx_buf, mac_address_root_str );                         
+            ESP_LOGI( TAG, "ERROR : Transmit queue full!\r\n" ); 
         #endif
+        return;
+    }
+
+    int len = sampler_frame_build( event, frame->data, sizeof( frame->data ) );
+    if( len < 0 )
+    {
+        tx_queue_release( frame );
+        return;
+    }
+    frame->len = len;
+    frame->persist = true;
+    frame->stamp_us = event->timestamp_us;
+    frame->done = on_input_frame_sent;
+    tx_queue_submit( frame );
+}
+
+/**
+ * Hands one logged frame back: to the MQTT path on the root, to the
+ * transmit queue (bulk class, behind live traffic) elsewhere
+ */
+static bool replay_frame( uint8_t *buf, size_t len )
+{
+    tx_frame_t *frame;
+
+    mesh_proto_set_flags( buf, len, MESH_FLAG_REPLAY );
+    if( esp_mesh_is_root() )
+    {
+        frame_buf_t *fb;
+
+        if( !root_uplink_ready() )
+        {
+            return false;
+        }
+        fb = frame_pool_alloc( pdMS_TO_TICKS( FRAME_BUF_WAIT_MS ) );
+        if( !fb )
+        {
+            return false;
+        }
+        memcpy( fb->data, buf, len );
+        frame_pool_count_copy( len );
+        fb->len = len;
+        root_handle_bin( fb );
+        frame_pool_release( fb );
+        return true;
     }
-    
 
+    if( !mesh_app_is_connected() )
+    {
+        return false;
+    }
+    frame = tx_queue_alloc( TX_PRIO_BULK, TX_POLICY_DROP_NEW, 0 );
+    if( !frame )
+    {
+        return false;
+    }
+    memcpy( frame->data, buf, len );
+    frame->len = len;
+    frame->persist = true;
+    tx_queue_submit( frame );
+    return true;
 }
 /**
- * Button Manipulation Task
+ * Button and Sampler Task
  */
 void task_mesh_tx( void *pvParameter )
 {   
     int counter = 0;
-    char mac_str[30];
-    int route_table_size = 0;
-    
-    esp_err_t err;
-
-    mesh_data_t data;
-    data.data = tx_buf;
-    data.size = TX_SIZE;
-
-    /**
-     *  Defines the format of the message to be sent;
-     * 'MESH_PROTO_BIN' is the standard binary format, but there are others:
-     * 'MESH_PROTO_JSON'
-     * 'MESH_PROTO_MQTT'
-     * 'MESH_PROTO_HTTP'
-     */
-    data.proto = MESH_PROTO_JSON;
+    input_event_t event;
+    bool received;
+    bool pressed;
+    bool sampled;
+    tx_frame_t *frame;
+    frame_buf_t *fb;
+    uint32_t wait_ms = TX_IDLE_WAIT_MS;
     
     for( ;; ) 
     {
+        /**
+         * Sleeps until the button ISR or the sampler posts an event
+         */
+        received = input_events_wait( &event, ( wait_ms + portTICK_PERIOD_MS - 1 ) / portTICK_PERIOD_MS );
+
+        /**
+         * Connect-Mesh announcement or retry on a node, sweep on the root
+         */
+        wait_ms = registration_poll();
+        if( wait_ms > TX_IDLE_WAIT_MS )
+        {
+            wait_ms = TX_IDLE_WAIT_MS;
+        }
+
+        /**
+         * The batch whose window closed, on the root
+         */
+        uplink_batch_poll();
+        pressed = received && event.source == INPUT_SRC_BUTTON;
+        sampled = received && ( event.source == INPUT_SRC_SUMMARY || event.source == INPUT_SRC_SENSOR );
+
         /**
          * If this device is the root, then create the socket server connection;
          */
@@ -185,68 +828,52 @@ void task_mesh_tx( void *pvParameter )
 
             gpio_set_level( LED_BUILDING, 1 );
 
+            /**
+             * The root's own samples go straight to the MQTT path
+             */
+            if( sampled && ( fb = frame_pool_alloc( pdMS_TO_TICKS( FRAME_BUF_WAIT_MS ) ) ) != NULL )
+            {
+                int len = sampler_frame_build( &event, fb->data, FRAME_POOL_BUF_SIZE );
+                if( len > 0 )
+                {
+                    fb->len = len;
+                    root_handle_bin( fb );
+                }
+                frame_pool_release( fb );
+            }
+
             /**
              * The button was pressed?
              */
-            if( gpio_get_level( BUTTON ) == 0 ) 
+            if( pressed ) 
             {       
                 #ifdef DEBUG 
                     ESP_LOGI( TAG, "Button %d Pressed.\r\n", BUTTON );
                 #endif
                 
-                counter++;
-                snprintf( (char*)tx_buf, TX_SIZE, "%d",  counter ); 
                 /**
-                 * Calculating the size of the data type buffer
-                 * pointed by esp_mesh_send() method
+                 * Here the ROOT sends the message to all nodes but himself:)
                  */
-                data.size = strlen((char*)tx_buf) + 1;
-                        
+                frame = tx_queue_alloc( TX_PRIO_CONTROL, TX_POLICY_DROP_NEW, 0 );
+                if( !frame )
+                {
+                    #ifdef DEBUG 
+                        ESP_LOGI( TAG, "ERROR : Transmit queue full!\r\n" ); 
+                    #endif
+                    continue;
+                }
                 /**
-                * Updates the reading of mac addresses of devices on the mesh network
+                 * The counter goes out as a text number, not a binary frame
                  */
-                esp_mesh_get_routing_table((mesh_addr_t *) &route_table,
-                               CONFIG_MESH_ROUTE_TABLE_SIZE * 6, &route_table_size);
-
-                for( int i = 0; i < route_table_size; i++ ) 
-                {
-                    /**
-                     * Convert address binary to string;
-                     */
-                    sprintf(mac_str, MACSTR, MAC2STR(route_table[i].addr));
-                    
-                    /**
-                      * Routing routine for sending the message quoted by the button. 
-                      * Here the ROOT sends a message to all node but himself:)
-                      */
-                    if( strcmp( mac_address_root_str, mac_str) != 0 )
-                    {   
-                        /**
-                         * Actual sending of datatype already loaded
-                         */
-                        err = esp_mesh_send(&route_table[i], &data, MESH_DATA_P2P, NULL, 0);
-                        if (err) 
-                        {
-                            /**
-                             * Error child node message
-                             */
-                            #ifdef DEBUG 
-                                ESP_LOGI( TAG, "ERROR : Sending Message!\r\n" ); 
-                            #endif
-                        } else {
-                    
-                            /**
-                             * Mensagem Enviada com sucesso pelo ROOT;
-                             */
-                            #ifdef DEBUG 
-                                ESP_LOGI( TAG, "ROOT sends (%s) (%s) to NON-ROOT (%s)\r\n", mac_address_root_str, tx_buf, mac_str );                         
-                            #endif
-                        }
-                    }                    
-
-                }                     
+                counter++;
+                snprintf( (char*)frame->data, sizeof( frame->data ), "%d",  counter ); 
+                frame->len = strlen( (char*)frame->data ) + 1;
+                frame->proto = MESH_PROTO_JSON;
+                frame->dest = TX_DEST_ALL;
+                frame->stamp_us = event.timestamp_us;
+                frame->done = on_input_frame_sent;
+                tx_queue_submit( frame );
             }
-            vTaskDelay( 300/portTICK_PERIOD_MS );   
         } 
 
         /**
@@ -254,72 +881,121 @@ void task_mesh_tx( void *pvParameter )
          */
          else
         {   
-            if (!SignalConnect){
-                send_connect_msg();
-                vTaskDelay( 500/portTICK_PERIOD_MS);
+            if( sampled )
+            {
+                send_sampler_msg( &event );
             }
             /**
              * The button was pressed?
              */
-            if( gpio_get_level( BUTTON ) == 0 ) 
+            if( pressed ) 
             {   
                 #ifdef DEBUG 
                     ESP_LOGI( TAG, "Child Button %d Pressed.\r\n", BUTTON );
                 #endif
-                //Send data
-                cJSON *root;
-                root=cJSON_CreateObject();
-	            cJSON_AddStringToObject(root, "Topic", "Send-Data");
-	            cJSON_AddNumberToObject(root, "Data", 156);
-                char *rendered=cJSON_Print(root);       
-                snprintf( (char*)tx_buf, TX_SIZE,  rendered ); 
 
                 /**
-                 * Calculating the size of the data type buffer
-                 * pointed by esp_mesh_send() method
+                 * Readings may displace older queued readings, never control frames
                  */
-                data.size = strlen((char*)tx_buf) + 1;
-                err = esp_mesh_send(&mac_address_root_str, &data, MESH_DATA_P2P, NULL, 0);
-                if (err) 
+                frame = tx_queue_alloc( TX_PRIO_TELEMETRY, TX_POLICY_DROP_OLDEST, 0 );
+                if( !frame )
                 {
                     #ifdef DEBUG 
-                        ESP_LOGI( TAG, "ERROR : Sending Message!\r\n" ); 
-                    #endif
-                } else {
-                    #ifdef DEBUG 
-                        uint8_t chipid[20];
-                        esp_efuse_mac_get_default(chipid);
-                        snprintf( mac_str, sizeof( mac_str ), ""MACSTR"", MAC2STR( chipid ) );
-                        ESP_LOGI( TAG, "\r\nNON-ROOT sends (%s) (%s) to ROOT (%s)\r\n", mac_str, tx_buf, mac_address_root_str );                         
+                        ESP_LOGI( TAG, "ERROR : Transmit queue full!\r\n" ); 
                     #endif
+                    continue;
                 }
+
+                //Send data
+                uint8_t payload[MESH_PAYLOAD_DATA_SIZE];
+                mesh_payload_data_t reading = { .value = sampler_last() };
+                mesh_proto_put_data( &reading, payload, sizeof( payload ) );
+                int len = app_frame_build( MESH_MSG_DATA, payload, sizeof( payload ), event.timestamp_us,
+                                           frame->data, sizeof( frame->data ) );
+                if( len < 0 )
+                {
+                    tx_queue_release( frame );
+                    continue;
+                }
+                frame->len = len;
+                frame->persist = true;
+                frame->stamp_us = event.timestamp_us;
+                frame->done = on_input_frame_sent;
+                tx_queue_submit( frame );
             }
+        }
+    }
+}
+
+/**
+ * Root receive stage: hands the frame just received, and every frame
+ * already pending behind it, to the decode/route workers. Waits for
+ * room in their queues, so a backlog stays in the mesh stack.
+ */
+static void root_receive( const mesh_addr_t *from, frame_buf_t *fb, mesh_proto_t proto )
+{
+    int64_t start = esp_timer_get_time();
+    mesh_rx_pending_t pending = { 0, };
+    mesh_addr_t next_from;
+    mesh_data_t data;
+    frame_buf_t *next;
+    int flag = 0;
+    uint32_t frames = 1;
 
-            vTaskDelay( 300/portTICK_PERIOD_MS );      
+    root_pipeline_submit( from, fb, proto, portMAX_DELAY );
+    while( frames < CONFIG_APP_ROOT_RX_BATCH &&
+           esp_mesh_get_rx_pending( &pending ) == ESP_OK && pending.toSelf > 0 )
+    {
+        if( ( next = frame_pool_alloc( 0 ) ) == NULL )
+        {
+            break;
+        }
+        data.data = next->data;
+        data.size = FRAME_POOL_BUF_SIZE;
+        if( esp_mesh_recv( &next_from, &data, 0, &flag, NULL, 0 ) != ESP_OK || !data.size )
+        {
+            frame_pool_release( next );
+            break;
         }
+        next->len = data.size;
+        metrics_inc( METRIC_MESH_RX_FRAMES );
+        metrics_add( METRIC_MESH_RX_BYTES, data.size );
+        root_pipeline_submit( &next_from, next, data.proto, portMAX_DELAY );
+        frame_pool_release( next );
+        frames++;
     }
+    if( esp_mesh_get_rx_pending( &pending ) != ESP_OK )
+    {
+        pending.toSelf = 0;
+    }
+    root_pipeline_rx_done( frames, (uint32_t)( esp_timer_get_time() - start ), pending.toSelf );
 }
 
 void task_mesh_rx ( void *pvParameter )
 {
     esp_err_t err;
     mesh_addr_t from;
+    frame_buf_t *fb;
 
     mesh_data_t data;
-    data.data = rx_buf;
-    data.size = RX_SIZE;
 
     char mac_address_str[30];
     int flag = 0;
     
-    static uint8_t buffer_s[10];
-    mesh_data_t data_s;
-    data_s.data = buffer_s;
-    data_s.size = sizeof(buffer_s);    
 
     for( ;; )
     {
-        data.size = RX_SIZE;
+        /**
+         * Every frame lands in a pool buffer of its own, which the root
+         * hands on to the MQTT path without copying it
+         */
+        fb = frame_pool_alloc( portMAX_DELAY );
+        if( !fb )
+        {
+            continue;
+        }
+        data.data = fb->data;
+        data.size = FRAME_POOL_BUF_SIZE;
 
        /**
         * Waits for message reception
@@ -327,64 +1003,24 @@ void task_mesh_rx ( void *pvParameter )
         err = esp_mesh_recv( &from, &data, portMAX_DELAY, &flag, NULL, 0 );
         if( err != ESP_OK || !data.size ) 
         {
+            metrics_inc( METRIC_MESH_RX_ERRORS );
             #ifdef DEBUG 
                 ESP_LOGI( TAG, "err:0x%x, size:%d", err, data.size );
             #endif
+            frame_pool_release( fb );
             continue;
         }
+        fb->len = data.size;
+        metrics_inc( METRIC_MESH_RX_FRAMES );
+        metrics_add( METRIC_MESH_RX_BYTES, data.size );
 
         /**
          * Is it routed for ROOT Node?
          */
         if( esp_mesh_is_root() ) 
         {
-            //**ROOT handle message
-            
-            char myJson[100];
-            snprintf(myJson, 100, (char*) data.data);
-            
-            cJSON *root = cJSON_Parse(myJson);
-            char* topic = cJSON_GetObjectItem(root,"Topic")->valuestring;
-            if (strcmp(topic,"Connect-Mesh")==0){
-                char* id = cJSON_GetObjectItem(root,"ID")->valuestring;
-                char* ssid = cJSON_GetObjectItem(root,"SSID")->valuestring;
-                for (int i = 0; i <= lengthOfActiveNode; i++){
-                    if (i == lengthOfActiveNode){
-                        activeNode[lengthOfActiveNode].id = id;
-                        activeNode[lengthOfActiveNode++].ssid = ssid;
-                        break;}
-                    if (lengthOfActiveNode != 0)
-                        if (strcmp(ssid,activeNode[i].ssid)==0) {
-                            activeNode[i].id = id;
-                            break;}
-                            ESP_LOGI(TAG, "Active node HERE");   
-                }
-                ESP_LOGI(TAG, "Active node%s",activeNode[0].ssid);
-                snprintf( mac_address_str, sizeof(mac_address_str), ""MACSTR"", MAC2STR(from.addr) );
-                #ifdef DEBUG
-                ESP_LOGI(TAG, "NON-ROOT(MAC:%s)- Node %s: %s, ", mac_address_str, topic, id);  
-                ESP_LOGI(TAG, "Tried to publish %s", id);  
-                #endif
-                mqtt_app_publish("ESP-connect", id);                
-            }
-            if (strcmp(topic,"Send-Data")==0){
-                int nodeData = cJSON_GetObjectItem(root,"Data")->valueint;
-                #ifdef DEBUG
-                ESP_LOGI(TAG, "NON-ROOT(MAC:%s)- Node %s: %d, ", mac_address_str, topic, nodeData);  
-                ESP_LOGI(TAG, "Tried to publish %d", nodeData);  
-                #endif
-                char nodeDt[20];
-                snprintf(nodeDt,sizeof(nodeDt),"%d",nodeData);
-                mqtt_app_publish("ESP-send", nodeDt); 
-            }
-            
-            #ifdef DEBUG 
-                ESP_LOGI( TAG,"ROOT(MAC:%s) - Msg: %s, ", mac_address_root_str, data.data );
-                /**
-                 * Log message to console
-                 */
-                ESP_LOGI( TAG, "send by NON-ROOT: %s\r\n", mac_address_str );
-            #endif
+            //**ROOT hands the message on to the pipeline
+            root_receive( &from, fb, data.proto );
 
         } 
 
@@ -403,16 +1039,99 @@ void task_mesh_rx ( void *pvParameter )
                 ESP_LOGI( TAG, "send by ROOT: %s\r\n", mac_address_str );
             #endif
 
+            /**
+             * Commands from the MQTT downlink, children's heartbeats,
+             * large messages, registration acks and sweeps
+             */
+            mesh_frame_t frame;
+            if( data.proto == MESH_PROTO_BIN && mesh_proto_decode( data.data, data.size, &frame ) == 0 )
+            {
+                if( frame.type == MESH_MSG_COMMAND )
+                {
+                    downlink_node_handle( &frame );
+                }
+                else if( frame.type == MESH_MSG_HEARTBEAT )
+                {
+                    liveness_node_merge( &frame );
+                }
+                else if( frame.type == MESH_MSG_FRAGMENT )
+                {
+                    frag_receive( &frame );
+                }
+                else if( frame.type == MESH_MSG_FRAG_ACK )
+                {
+                    frag_handle_ack( &frame );
+                }
+                else
+                {
+                    registration_node_handle( &from, &frame );
+                }
+            }
+
             /**
              * Toggle the LED_BUILDING at each button increment
              */
-            if( data.size > 0 )
+            else if( data.proto == MESH_PROTO_JSON && data.size > 0 )
             {
                 gpio_set_level( LED_BUILDING, atoi((char*)data.data) % 2 );
             }
                            
         }
 
+        frame_pool_release( fb );
+    }
+
+    vTaskDelete(NULL);
+}
+
+/**
+ * Statistics Task: the root periodically publishes the collected stats,
+ * every other node reports its health snapshot and topology to the root;
+ * both keep the heartbeat schedule
+ */
+void task_stats( void *pvParameter )
+{
+    TickType_t wake = xTaskGetTickCount();
+    uint32_t elapsed_s = 0;
+
+    for( ;; )
+    {
+        vTaskDelayUntil( &wake, 1000 / portTICK_PERIOD_MS );
+        elapsed_s++;
+        liveness_tick( elapsed_s );
+        if( esp_mesh_is_root() )
+        {
+            if( elapsed_s % CONFIG_APP_STATS_PERIOD_S == 0 )
+            {
+                trace_stats_publish();
+                metrics_publish();
+                root_pipeline_publish_overload();
+            }
+
+            /**
+             * With the stats, and on the next tick when the mesh event
+             * handler asked for it ahead of a root handover
+             */
+            if( dedup_publish_requested() || elapsed_s % CONFIG_APP_STATS_PERIOD_S == 0 )
+            {
+                dedup_publish_state();
+            }
+            if( elapsed_s % CONFIG_APP_TOPO_PERIOD_S == 0 )
+            {
+                topology_publish();
+            }
+        }
+        else if( registration_is_registered() )
+        {
+            if( elapsed_s % CONFIG_APP_METRICS_PERIOD_S == 0 )
+            {
+                send_metrics_msg();
+            }
+            if( elapsed_s % CONFIG_APP_TOPO_PERIOD_S == 0 )
+            {
+                send_topology_msg();
+            }
+        }
     }
 
     vTaskDelete(NULL);
@@ -435,25 +1154,81 @@ void task_app_create( void )
         ESP_LOGI( TAG, "CHILD NODE\r\n");         
     }
     #endif
+    TaskHandle_t task;
+
+    esp_efuse_mac_get_default( self_mac );
+    self_node_id = (uint16_t)atoi( NODE_ID );
+    tx_seq = dedup_seq_start();
+
+    node_registry_init();
+    ESP_ERROR_CHECK( frame_pool_init() );
+    ESP_ERROR_CHECK( root_pipeline_start() );
+    ESP_ERROR_CHECK( tx_queue_init() );
+    ESP_ERROR_CHECK( uplink_batch_init() );
+    if( fwdlog_start( replay_frame ) != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Store-and-forward log unavailable" );
+    }
+    if( sampler_start( sensor_read ) != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Could not start the sampler" );
+    }
+    if( frag_start( on_large_message ) != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Large messages unavailable" );
+    }
+    if( mesh_fanout_join() != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Could not join the broadcast group" );
+    }
+
     /**
      * Creates a Task to receive message;
      */
-    if( xTaskCreate( task_mesh_rx, "task_mesh_rx", 1024 * 5, NULL, 2, NULL) != pdPASS )
+    if( task_layout_create( TASK_LAYOUT_MESH_RX, task_mesh_rx, "task_mesh_rx", NULL, &task ) != pdPASS )
     {
         #ifdef DEBUG
         ESP_LOGI( TAG, "ERROR - task_mesh_rx NOT ALLOCATED :/\r\n" );  
         #endif
         return;   
     }
+    metrics_register_task( task );
+
+    /**
+     * Creates the single Task draining the transmit queue;
+     */
+    if( task_layout_create( TASK_LAYOUT_MESH_SENDER, task_mesh_sender, "task_mesh_sender", NULL, &task ) != pdPASS )
+    {
+        #ifdef DEBUG
+        ESP_LOGI( TAG, "ERROR - task_mesh_sender NOT ALLOCATED :/\r\n" );  
+        #endif
+        return;   
+    }
+    metrics_register_task( task );
 
     /**
      *  Creates a Task to transfer message;
      */
-    if( xTaskCreate( task_mesh_tx, "task_mesh_tx", 1024 * 8, NULL, 1, NULL ) != pdPASS )
+    if( task_layout_create( TASK_LAYOUT_MESH_TX, task_mesh_tx, "task_mesh_tx", NULL, &task ) != pdPASS )
     {
         #ifdef DEBUG
         ESP_LOGI( TAG, "ERROR - task_mesh_tx NOT ALLOCATED :/\r\n" );  
         #endif
         return;   
     }     
+    metrics_register_task( task );
+
+    /**
+     *  Creates the Task publishing statistics (root) or health reports (nodes);
+     */
+    if( task_layout_create( TASK_LAYOUT_STATS, task_stats, "task_stats", NULL, &task ) != pdPASS )
+    {
+        #ifdef DEBUG
+        ESP_LOGI( TAG, "ERROR - task_stats NOT ALLOCATED :/\r\n" );  
+        #endif
+    }
+    else
+    {
+        metrics_register_task( task );
+    }
 }
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "boot_trace.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "boot: ";
+
+static const char *stage_names[BOOT_STAGE_MAX] = {
+    [BOOT_APP_START]        = "app",
+    [BOOT_NVS_READY]        = "nvs",
+    [BOOT_WIFI_STARTED]     = "wifi",
+    [BOOT_MESH_STARTED]     = "mesh",
+    [BOOT_PARENT_CONNECTED] = "parent",
+    [BOOT_MQTT_CONNECTED]   = "mqtt",
+    [BOOT_FIRST_TX]         = "first_tx",
+    [BOOT_FIRST_PUBLISH]    = "first_pub",
+};
+
+static uint32_t stage_ms[BOOT_STAGE_MAX];
+
+void boot_mark( boot_stage_t stage )
+{
+    uint32_t now = (uint32_t)( esp_timer_get_time() / 1000 );
+    uint32_t unset = 0;
+
+    /**
+     * Only the first time counts; a reading taken within the first
+     * millisecond is stored as 1 so it still reads as reached
+     */
+    if( __atomic_compare_exchange_n( &stage_ms[stage], &unset, now ? now : 1, false,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+    {
+        ESP_LOGI( TAG, "%s at %u ms", stage_names[stage], (unsigned)now );
+    }
+}
+
+uint32_t boot_stage_ms( boot_stage_t stage )
+{
+    return __atomic_load_n( &stage_ms[stage], __ATOMIC_RELAXED );
+}
+
+int boot_trace_json( char *buf, size_t size )
+{
+    int len = snprintf( buf, size, "{" );
+
+    for( int i = 0; i < BOOT_STAGE_MAX && len < size; i++ )
+    {
+        uint32_t ms = boot_stage_ms( i );
+        if( ms )
+        {
+            len += snprintf( buf + len, size - len, "%s\"%s\":%u",
+                             buf[len - 1] == '{' ? "" : ",", stage_names[i], (unsigned)ms );
+        }
+    }
+    if( len < size )
+    {
+        len += snprintf( buf + len, size - len, "}" );
+    }
+    return len;
+}
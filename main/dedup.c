@@ -0,0 +1,581 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "nvs.h"
+#include "esp_log.h"
+
+#include "dedup.h"
+#include "mqtt_app.h"
+#include "mqtt_outbox.h"
+#include "node_registry.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "dedup: ";
+
+#define DEDUP_NAMESPACE     "dedup"
+#define DEDUP_BOOTS_KEY     "boots"
+
+/**
+ * The windows go out in parts of up to DEDUP_PART_WINDOWS, each retained
+ * on its own topic DEDUP_STATE_TOPIC "/<part>" as
+ * {"root":"id","part":n,"parts":n,"nodes":["aabbccddeeff:high:seen",..]};
+ * the parts an earlier, longer publish left on the broker are sent again
+ * empty
+ */
+#define DEDUP_ENTRY_LEN     ( 41 )      /* "aabbccddeeff:0000002a:00000000000000ff", quoted, and a comma */
+#define DEDUP_PART_WINDOWS  ( 20 )
+#define DEDUP_PART_SIZE     ( 64 + NODE_ID_LEN + DEDUP_PART_WINDOWS * DEDUP_ENTRY_LEN )
+#define DEDUP_STATE_PARTS   ( ( 2 * CONFIG_MESH_ROUTE_TABLE_SIZE + DEDUP_PART_WINDOWS - 1 ) / DEDUP_PART_WINDOWS )
+
+#if DEDUP_PART_SIZE > MQTT_OUTBOX_PAYLOAD_MAX
+#error "A part of the dedup state does not fit in the MQTT outbox arena, raise CONFIG_APP_MQTT_OUTBOX_ARENA_SIZE"
+#endif
+
+/**
+ * How long a part waits for room in the outbox before the publish is
+ * given up
+ */
+#define DEDUP_POST_RETRY_MS ( 50 )
+#define DEDUP_POST_RETRIES  ( 20 )
+
+/**
+ * Window of one node: bit i of 'seen' is sequence number high - i;
+ * 'seen' is 0 until the first number
+ */
+typedef struct {
+    uint8_t  mac[6];
+    bool     valid;
+    uint32_t high;
+    uint64_t seen;
+} dedup_window_t;
+
+/**
+ * Windows of the registered nodes by node index, and of the nodes that
+ * are not registered, replaced in turn once all are taken
+ */
+static dedup_window_t windows[CONFIG_MESH_ROUTE_TABLE_SIZE];
+static dedup_window_t parked[CONFIG_MESH_ROUTE_TABLE_SIZE];
+static int park_next = 0;
+
+static dedup_stats_t stats = { 0, };
+
+/**
+ * Route workers, the stats task, the mesh event handler and the MQTT
+ * event task all reach the windows
+ */
+static portMUX_TYPE dedup_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static char state_msg[DEDUP_PART_SIZE];
+static bool state_publishing = false;
+static bool state_requested = false;
+
+/**
+ * Parts on the broker: of the last publish, or of the previous root's
+ */
+static int state_parts = 0;
+
+/**
+ * Part being read back, and the parts read so far
+ */
+static char state_rx[DEDUP_PART_SIZE];
+static bool state_rx_seen[DEDUP_STATE_PARTS];
+
+/**
+ * First sequence number of this boot, once the boot count was bumped
+ */
+static bool seq_initialized = false;
+static uint32_t seq_first = 0;
+
+uint32_t dedup_seq_start( void )
+{
+    nvs_handle_t nvs;
+    uint32_t boots = 0;
+    esp_err_t err;
+
+    if( seq_initialized )
+    {
+        return seq_first;
+    }
+    err = nvs_open( DEDUP_NAMESPACE, NVS_READWRITE, &nvs );
+    if( err == ESP_OK )
+    {
+        /**
+         * No count yet on the first boot
+         */
+        nvs_get_u32( nvs, DEDUP_BOOTS_KEY, &boots );
+        boots++;
+        err = nvs_set_u32( nvs, DEDUP_BOOTS_KEY, boots );
+        if( err == ESP_OK )
+        {
+            err = nvs_commit( nvs );
+        }
+        nvs_close( nvs );
+    }
+    if( err != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Could not save the boot count (0x%x), sequence numbers may repeat", err );
+    }
+    seq_first = boots << DEDUP_BOOT_SHIFT;
+    seq_initialized = true;
+    return seq_first;
+}
+
+/**
+ * True if 'seq' is in the window already. Called with dedup_lock held.
+ */
+static bool window_has( const dedup_window_t *w, uint32_t seq )
+{
+    uint32_t back = w->high - seq;
+
+    return w->seen && back < DEDUP_WINDOW && ( w->seen & ( 1ULL << back ) );
+}
+
+/**
+ * Records 'seq'. Called with dedup_lock held.
+ */
+static void window_add( dedup_window_t *w, uint32_t seq )
+{
+    uint32_t ahead = seq - w->high;
+    uint32_t back = w->high - seq;
+
+    if( !w->seen )
+    {
+        w->high = seq;
+        w->seen = 1;
+    }
+    else if( ahead && ahead < 0x80000000UL )
+    {
+        w->seen = ahead < DEDUP_WINDOW ? ( w->seen << ahead ) | 1 : 1;
+        w->high = seq;
+    }
+    else if( back < DEDUP_WINDOW )
+    {
+        w->seen |= 1ULL << back;
+    }
+    else if( back > DEDUP_RESTART_GAP )
+    {
+        stats.restarts++;
+        w->high = seq;
+        w->seen = 1;
+    }
+    else
+    {
+        stats.stale++;
+    }
+}
+
+/**
+ * Adds the numbers of another window of the same node
+ */
+static void window_merge( dedup_window_t *w, uint32_t high, uint64_t seen )
+{
+    uint32_t ahead = high - w->high;
+    uint32_t back = w->high - high;
+
+    if( !seen )
+    {
+        return;
+    }
+    if( !w->seen )
+    {
+        w->high = high;
+        w->seen = seen;
+    }
+    else if( ahead && ahead < 0x80000000UL )
+    {
+        w->seen = ( ahead < DEDUP_WINDOW ? w->seen << ahead : 0 ) | seen;
+        w->high = high;
+    }
+    else if( back < DEDUP_WINDOW )
+    {
+        w->seen |= seen << back;
+    }
+}
+
+/**
+ * Parks the numbers of 'mac'; called with dedup_lock held
+ */
+static void window_park( const uint8_t mac[6], uint32_t high, uint64_t seen )
+{
+    dedup_window_t *free_w = NULL;
+
+    for( int i = 0; i < CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        if( !parked[i].valid )
+        {
+            free_w = free_w ? free_w : &parked[i];
+        }
+        else if( !memcmp( parked[i].mac, mac, 6 ) )
+        {
+            window_merge( &parked[i], high, seen );
+            return;
+        }
+    }
+    if( !free_w )
+    {
+        free_w = &parked[park_next];
+        park_next = ( park_next + 1 ) % CONFIG_MESH_ROUTE_TABLE_SIZE;
+    }
+    memcpy( free_w->mac, mac, 6 );
+    free_w->valid = true;
+    free_w->high = high;
+    free_w->seen = seen;
+}
+
+/**
+ * Gives node index window 'w' to 'mac', with the parked numbers of
+ * 'mac' if there are any; called with dedup_lock held
+ */
+static void window_claim( dedup_window_t *w, const uint8_t mac[6] )
+{
+    memcpy( w->mac, mac, 6 );
+    w->valid = true;
+    w->high = 0;
+    w->seen = 0;
+    for( int i = 0; i < CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        if( parked[i].valid && !memcmp( parked[i].mac, mac, 6 ) )
+        {
+            w->high = parked[i].high;
+            w->seen = parked[i].seen;
+            parked[i].valid = false;
+            return;
+        }
+    }
+}
+
+/**
+ * Window of the node index of 'mac', claimed for it if it held another
+ * node's; called with dedup_lock held
+ */
+static dedup_window_t *window_of( int index, const uint8_t mac[6] )
+{
+    dedup_window_t *w = &windows[index];
+
+    if( !w->valid || memcmp( w->mac, mac, 6 ) )
+    {
+        window_claim( w, mac );
+    }
+    return w;
+}
+
+bool dedup_is_new( const uint8_t mac[6], uint32_t seq )
+{
+    int index = node_registry_lookup( mac, NULL, 0 );
+    bool fresh = true;
+
+    portENTER_CRITICAL( &dedup_lock );
+    stats.checked++;
+    if( index < 0 )
+    {
+        stats.untracked++;
+    }
+    else if( window_has( window_of( index, mac ), seq ) )
+    {
+        stats.duplicates++;
+        fresh = false;
+    }
+    portEXIT_CRITICAL( &dedup_lock );
+    return fresh;
+}
+
+void dedup_commit( const uint8_t mac[6], uint32_t seq )
+{
+    int index = node_registry_lookup( mac, NULL, 0 );
+
+    if( index < 0 )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &dedup_lock );
+    window_add( window_of( index, mac ), seq );
+    portEXIT_CRITICAL( &dedup_lock );
+}
+
+void dedup_park( int node_index )
+{
+    dedup_window_t *w;
+
+    if( node_index < 0 || node_index >= CONFIG_MESH_ROUTE_TABLE_SIZE )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &dedup_lock );
+    w = &windows[node_index];
+    if( w->valid && w->seen )
+    {
+        window_park( w->mac, w->high, w->seen );
+    }
+    w->valid = false;
+    portEXIT_CRITICAL( &dedup_lock );
+}
+
+/**
+ * Starts part 'part' of 'parts' in state_msg
+ */
+static int state_begin( int part, int parts )
+{
+    return snprintf( state_msg, DEDUP_PART_SIZE, "{\"root\":\"%s\",\"part\":%d,\"parts\":%d,\"nodes\":[",
+                     NODE_ID, part, parts );
+}
+
+/**
+ * Appends one window to state_msg
+ */
+static int state_put( int len, const dedup_window_t *w )
+{
+    return len + snprintf( state_msg + len, DEDUP_PART_SIZE - len,
+                           "%s\"%02x%02x%02x%02x%02x%02x:%08x:%016llx\"",
+                           state_msg[len - 1] == '[' ? "" : ",",
+                           w->mac[0], w->mac[1], w->mac[2], w->mac[3], w->mac[4], w->mac[5],
+                           w->high, (unsigned long long)w->seen );
+}
+
+/**
+ * Closes state_msg and posts it as part 'part', waiting for the outbox
+ * to drain when it is full; false if it could not be posted
+ */
+static bool state_send( int part, int len )
+{
+    char topic[MQTT_OUTBOX_TOPIC_MAX];
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    len += snprintf( state_msg + len, DEDUP_PART_SIZE - len, "]}" );
+    snprintf( topic, sizeof( topic ), DEDUP_STATE_TOPIC "/%d", part );
+    for( int tries = 0; err == ESP_ERR_NO_MEM && tries < DEDUP_POST_RETRIES; tries++ )
+    {
+        if( tries )
+        {
+            vTaskDelay( DEDUP_POST_RETRY_MS / portTICK_PERIOD_MS );
+        }
+        err = mqtt_outbox_post( topic, state_msg, len );
+    }
+    if( err != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Could not queue part %d of the window state (0x%x)", part, err );
+        return false;
+    }
+    return true;
+}
+
+void dedup_publish_state( void )
+{
+    dedup_window_t w;
+    int windows_valid = 0;
+    int parts;
+    int stale;
+    int part = 0;
+    int in_part = 0;
+    bool ok = true;
+    int len;
+
+    /**
+     * Nothing reaches the broker while it is away; the outbox is left to
+     * the readings
+     */
+    if( !mqtt_app_connected() )
+    {
+        return;
+    }
+
+    /**
+     * A publish already running sends the same windows
+     */
+    if( __atomic_test_and_set( &state_publishing, __ATOMIC_ACQUIRE ) )
+    {
+        return;
+    }
+
+    for( int i = 0; i < 2 * CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        portENTER_CRITICAL( &dedup_lock );
+        w = i < CONFIG_MESH_ROUTE_TABLE_SIZE ? windows[i] : parked[i - CONFIG_MESH_ROUTE_TABLE_SIZE];
+        portEXIT_CRITICAL( &dedup_lock );
+        windows_valid += w.valid && w.seen;
+    }
+    parts = windows_valid ? ( windows_valid + DEDUP_PART_WINDOWS - 1 ) / DEDUP_PART_WINDOWS : 1;
+
+    len = state_begin( part, parts );
+    for( int i = 0; ok && i < 2 * CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        portENTER_CRITICAL( &dedup_lock );
+        w = i < CONFIG_MESH_ROUTE_TABLE_SIZE ? windows[i] : parked[i - CONFIG_MESH_ROUTE_TABLE_SIZE];
+        portEXIT_CRITICAL( &dedup_lock );
+        if( !w.valid || !w.seen )
+        {
+            continue;
+        }
+        if( in_part == DEDUP_PART_WINDOWS )
+        {
+            /**
+             * Windows taken since they were counted go out next time
+             */
+            if( part + 1 == parts )
+            {
+                break;
+            }
+            ok = state_send( part++, len );
+            len = state_begin( part, parts );
+            in_part = 0;
+        }
+        len = state_put( len, &w );
+        in_part++;
+    }
+
+    /**
+     * The last part with windows, then empty ones over the parts left by
+     * an earlier, longer publish
+     */
+    portENTER_CRITICAL( &dedup_lock );
+    stale = state_parts > parts ? state_parts : parts;
+    portEXIT_CRITICAL( &dedup_lock );
+    for( ; ok && part < stale; part++ )
+    {
+        ok = state_send( part, len );
+        len = state_begin( part + 1, parts );
+    }
+    if( ok )
+    {
+        portENTER_CRITICAL( &dedup_lock );
+        state_parts = parts;
+        portEXIT_CRITICAL( &dedup_lock );
+    }
+
+    __atomic_clear( &state_publishing, __ATOMIC_RELEASE );
+}
+
+void dedup_request_publish( void )
+{
+    __atomic_store_n( &state_requested, true, __ATOMIC_RELEASE );
+}
+
+bool dedup_publish_requested( void )
+{
+    return __atomic_exchange_n( &state_requested, false, __ATOMIC_ACQ_REL );
+}
+
+/**
+ * Merges the window of 'mac' read back from the broker
+ */
+static void state_merge( const uint8_t mac[6], uint32_t high, uint64_t seen )
+{
+    int index = node_registry_lookup( mac, NULL, 0 );
+
+    portENTER_CRITICAL( &dedup_lock );
+    stats.restored++;
+    if( index < 0 )
+    {
+        window_park( mac, high, seen );
+    }
+    else
+    {
+        window_merge( window_of( index, mac ), high, seen );
+    }
+    portEXIT_CRITICAL( &dedup_lock );
+}
+
+bool dedup_restore( const char *data, size_t len, size_t offset, size_t total )
+{
+    unsigned int m[6];
+    unsigned int high;
+    unsigned long long seen;
+    uint8_t mac[6];
+    const char *p;
+    int part = -1;
+    int parts = 0;
+    int restored = 0;
+    int missing = 0;
+
+    if( total >= DEDUP_PART_SIZE || offset + len > total )
+    {
+        if( offset == 0 )
+        {
+            ESP_LOGW( TAG, "Window state part of %u bytes does not fit, not restored", (unsigned)total );
+        }
+        return false;
+    }
+    memcpy( state_rx + offset, data, len );
+    if( offset + len < total )
+    {
+        return false;
+    }
+    state_rx[total] = '\0';
+
+    p = strstr( state_rx, "\"part\":" );
+    if( p )
+    {
+        part = atoi( p + strlen( "\"part\":" ) );
+    }
+    p = strstr( state_rx, "\"parts\":" );
+    if( p )
+    {
+        parts = atoi( p + strlen( "\"parts\":" ) );
+    }
+    p = strstr( state_rx, "\"nodes\":[" );
+    if( part < 0 || parts <= 0 || !p )
+    {
+        return false;
+    }
+    p += strlen( "\"nodes\":[" );
+    while( ( p = strchr( p, '"' ) ) != NULL )
+    {
+        if( sscanf( p, "\"%2x%2x%2x%2x%2x%2x:%8x:%16llx\"",
+                    &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &high, &seen ) == 8 )
+        {
+            for( int i = 0; i < 6; i++ )
+            {
+                mac[i] = (uint8_t)m[i];
+            }
+            state_merge( mac, high, seen );
+            restored++;
+        }
+        p = strchr( p + 1, '"' );
+        if( !p )
+        {
+            break;
+        }
+        p++;
+    }
+
+    /**
+     * Parts past the ones of this node's table are read but cannot be
+     * counted; the publish after the restore overwrites all of them
+     */
+    portENTER_CRITICAL( &dedup_lock );
+    if( part < DEDUP_STATE_PARTS )
+    {
+        state_rx_seen[part] = true;
+    }
+    if( part + 1 > state_parts )
+    {
+        state_parts = part + 1 < DEDUP_STATE_PARTS ? part + 1 : DEDUP_STATE_PARTS;
+    }
+    for( int i = 0; i < parts && i < DEDUP_STATE_PARTS; i++ )
+    {
+        missing += !state_rx_seen[i];
+    }
+    portEXIT_CRITICAL( &dedup_lock );
+
+    ESP_LOGI( TAG, "Restored %d sequence windows from part %d of %d", restored, part, parts );
+    return !missing;
+}
+
+void dedup_get_stats( dedup_stats_t *out )
+{
+    portENTER_CRITICAL( &dedup_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &dedup_lock );
+}
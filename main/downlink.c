@@ -0,0 +1,513 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+/**
+ * Drivers;
+ */
+#include "driver/gpio.h"
+
+#include "esp_log.h"
+
+/**
+ * Mesh Net;
+ */
+#include "esp_mesh.h"
+
+#include "downlink.h"
+#include "app.h"
+#include "node_registry.h"
+#include "mesh_fanout.h"
+#include "tx_queue.h"
+#include "mqtt_app.h"
+#include "metrics.h"
+#include "registration.h"
+#include "liveness.h"
+#include "frag.h"
+#include "mesh.h"
+#include "boot_trace.h"
+#include "task_layout.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "downlink: ";
+
+#define DOWNLINK_PREFIX     "cmd/"
+#define DOWNLINK_NAME_MAX   ( 32 )
+#define DOWNLINK_RSP_SIZE   ( 96 )
+#define DOWNLINK_TARGET_MAX ( 24 )
+#define DOWNLINK_DIAG_SIZE  ( 768 )
+
+typedef enum {
+    DL_TARGET_NODE = 0,
+    DL_TARGET_GROUP,
+    DL_TARGET_ALL,
+} dl_target_t;
+
+/**
+ * A resolved command waiting for a transmit slot; the payload is already
+ * encoded, so the queue bounds all downlink memory
+ */
+typedef struct {
+    uint8_t     target;
+    mesh_addr_t to;
+    uint16_t    len;
+    uint8_t     payload[MESH_PROTO_MAX_PAYLOAD];
+} downlink_cmd_t;
+
+static QueueHandle_t commands = NULL;
+static uint16_t next_seq = 0;
+
+static downlink_stats_t stats = { 0, };
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Commands every node understands
+ */
+typedef downlink_status_t (*downlink_handler_t)( const uint8_t *args, size_t len );
+
+static downlink_status_t cmd_led( const uint8_t *args, size_t len )
+{
+    if( len != 1 || ( args[0] != '0' && args[0] != '1' ) )
+    {
+        return DOWNLINK_BAD_ARGS;
+    }
+    gpio_set_level( LED_BUILDING, args[0] - '0' );
+    return DOWNLINK_OK;
+}
+
+static downlink_status_t cmd_ping( const uint8_t *args, size_t len )
+{
+    return DOWNLINK_OK;
+}
+
+/**
+ * On the root: every node announces itself again; elsewhere: this node does
+ */
+static downlink_status_t cmd_reregister( const uint8_t *args, size_t len )
+{
+    if( esp_mesh_is_root() )
+    {
+        registration_request_sweep( true );
+    }
+    else
+    {
+        registration_restart();
+    }
+    return DOWNLINK_OK;
+}
+
+/**
+ * Diagnostics document: sent to the root as one large message, published
+ * there on ESP-diag/<id>; the root publishes its own directly
+ */
+static downlink_status_t cmd_diag( const uint8_t *args, size_t len )
+{
+    static char diag[DOWNLINK_DIAG_SIZE];
+    mesh_payload_metrics_t snap;
+    tx_queue_stats_t txq;
+    registration_stats_t reg;
+    liveness_stats_t live;
+    frag_stats_t frag;
+    mesh_addr_t parent;
+    int n;
+
+    metrics_snapshot( &snap );
+    tx_queue_get_stats( &txq );
+    registration_get_stats( &reg );
+    liveness_get_stats( &live );
+    frag_get_stats( &frag );
+    if( !mesh_app_get_parent( &parent ) )
+    {
+        memset( &parent, 0, sizeof( parent ) );
+    }
+    n = snprintf( diag, sizeof( diag ),
+                  "{\"id\":\"%s\",\"up\":%u,\"layer\":%d,\"parent\":\""MACSTR"\",\"heap\":%u,\"heap_min\":%u,"
+                  "\"mesh\":{\"rx\":%u,\"rx_bytes\":%u,\"tx\":%u,\"tx_bytes\":%u,\"rx_err\":%u,\"tx_err\":%u},"
+                  "\"txq\":{\"sent\":%u,\"err\":%u,\"free\":%u,\"dropped\":%u},"
+                  "\"reg\":{\"announced\":%u,\"retries\":%u,\"acked\":%u,\"restarts\":%u},"
+                  "\"live\":{\"sent\":%u,\"merged\":%u},"
+                  "\"frag\":{\"sent\":%u,\"failed\":%u,\"resent\":%u,\"rx\":%u,\"timeouts\":%u},"
+                  "\"boot\":",
+                  NODE_ID, snap.uptime_s, esp_mesh_get_layer(), MAC2STR( parent.addr ),
+                  snap.free_heap, snap.min_free_heap,
+                  snap.rx_frames, snap.rx_bytes, snap.tx_frames, snap.tx_bytes, snap.rx_errors, snap.tx_errors,
+                  txq.sent, txq.send_errors, txq.free_slots, snap.txq_dropped,
+                  reg.announced, reg.retries, reg.acked, reg.restarts,
+                  live.sent, live.merged,
+                  frag.tx_done, frag.tx_failed, frag.tx_resent, frag.rx_messages, frag.rx_timeouts );
+    n += boot_trace_json( diag + n, sizeof( diag ) - n );
+    n += snprintf( diag + n, sizeof( diag ) - n, "}" );
+    if( n >= sizeof( diag ) )
+    {
+        n = sizeof( diag ) - 1;
+    }
+
+    if( esp_mesh_is_root() )
+    {
+        char topic[24];
+        snprintf( topic, sizeof( topic ), "ESP-diag/%s", NODE_ID );
+        mqtt_app_publish( topic, diag );
+    }
+    else if( frag_send( NULL, FRAG_KIND_DIAG, diag, n ) != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Diagnostics not sent, a large message is still in flight" );
+    }
+    return DOWNLINK_OK;
+}
+
+static const struct {
+    const char         *name;
+    downlink_handler_t  handler;
+} handlers[] = {
+    { "led",        cmd_led },
+    { "ping",       cmd_ping },
+    { "reregister", cmd_reregister },
+    { "diag",       cmd_diag },
+};
+
+static downlink_status_t downlink_execute( const char *name, size_t name_len, const uint8_t *args, size_t args_len )
+{
+    for( int i = 0; i < sizeof( handlers ) / sizeof( handlers[0] ); i++ )
+    {
+        if( strlen( handlers[i].name ) == name_len && memcmp( handlers[i].name, name, name_len ) == 0 )
+        {
+            return handlers[i].handler( args, args_len );
+        }
+    }
+    return DOWNLINK_UNKNOWN_CMD;
+}
+
+static const char *status_str( downlink_status_t status )
+{
+    switch( status )
+    {
+        case DOWNLINK_OK:           return "ok";
+        case DOWNLINK_UNKNOWN_CMD:  return "unknown_command";
+        case DOWNLINK_BAD_ARGS:     return "bad_args";
+        default:                    return "error";
+    }
+}
+
+/**
+ * Publishes {"seq":..,"cmd":"..","status":".."} on rsp/<target>; 'name'
+ * may be NULL
+ */
+static void downlink_respond( const char *target, uint16_t seq, const char *name, int name_len,
+                              const char *status )
+{
+    char topic[4 + DOWNLINK_TARGET_MAX];
+    char msg[DOWNLINK_RSP_SIZE];
+
+    snprintf( topic, sizeof( topic ), "rsp/%s", target );
+    if( name )
+    {
+        snprintf( msg, sizeof( msg ), "{\"seq\":%u,\"cmd\":\"%.*s\",\"status\":\"%s\"}",
+                  seq, name_len, name, status );
+    }
+    else
+    {
+        snprintf( msg, sizeof( msg ), "{\"seq\":%u,\"status\":\"%s\"}", seq, status );
+    }
+    mqtt_app_publish( topic, msg );
+}
+
+static void count( uint32_t *counter )
+{
+    portENTER_CRITICAL( &stats_lock );
+    (*counter)++;
+    portEXIT_CRITICAL( &stats_lock );
+}
+
+/**
+ * Command names end up in JSON responses, so only plain characters pass
+ */
+static bool name_valid( const char *name, int len )
+{
+    if( len <= 0 || len > DOWNLINK_NAME_MAX )
+    {
+        return false;
+    }
+    for( int i = 0; i < len; i++ )
+    {
+        char c = name[i];
+        if( !( ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) ||
+               c == '_' || c == '-' || c == '/' ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t downlink_start( void )
+{
+    TaskHandle_t task;
+
+    if( commands )
+    {
+        return ESP_OK;
+    }
+
+    commands = xQueueCreate( CONFIG_APP_DOWNLINK_QUEUE_LEN, sizeof( downlink_cmd_t ) );
+    if( !commands )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if( task_layout_create( TASK_LAYOUT_DOWNLINK, task_downlink, "task_downlink", NULL, &task ) != pdPASS )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    metrics_register_task( task );
+    return ESP_OK;
+}
+
+void downlink_post( const char *topic, int topic_len, const char *data, int data_len )
+{
+    downlink_cmd_t cmd;
+    mesh_payload_command_t payload;
+    char target[DOWNLINK_TARGET_MAX];
+    const char *p = topic + strlen( DOWNLINK_PREFIX );
+    const char *end = topic + topic_len;
+    const char *slash;
+    uint16_t seq = next_seq++;
+
+    count( &stats.received );
+    if( !commands || topic_len <= strlen( DOWNLINK_PREFIX ) ||
+        memcmp( topic, DOWNLINK_PREFIX, strlen( DOWNLINK_PREFIX ) ) != 0 )
+    {
+        count( &stats.rejected );
+        return;
+    }
+
+    /**
+     * cmd/<target>/<name>; the group target takes one more level
+     */
+    slash = memchr( p, '/', end - p );
+    if( slash && slash - p == 5 && memcmp( p, "group", 5 ) == 0 )
+    {
+        slash = memchr( slash + 1, '/', end - slash - 1 );
+    }
+    if( !slash || slash - p >= sizeof( target ) )
+    {
+        count( &stats.rejected );
+        ESP_LOGW( TAG, "bad command topic %.*s", topic_len, topic );
+        return;
+    }
+    memcpy( target, p, slash - p );
+    target[slash - p] = '\0';
+    payload.seq = seq;
+    payload.name = slash + 1;
+    payload.name_len = end - slash - 1;
+    payload.args = (const uint8_t *)data;
+    payload.args_len = data_len;
+
+    if( !name_valid( payload.name, payload.name_len ) )
+    {
+        count( &stats.rejected );
+        downlink_respond( target, seq, NULL, 0, "bad_topic" );
+        return;
+    }
+
+    if( strcmp( target, "all" ) == 0 )
+    {
+        cmd.target = DL_TARGET_ALL;
+    }
+    else if( strncmp( target, "group/", 6 ) == 0 )
+    {
+        int group = atoi( target + 6 );
+        if( group < 1 || group > 254 )
+        {
+            count( &stats.rejected );
+            downlink_respond( target, seq, payload.name, payload.name_len, "bad_topic" );
+            return;
+        }
+        cmd.target = DL_TARGET_GROUP;
+        mesh_fanout_group_addr( (uint8_t)group, &cmd.to );
+    }
+    else if( strcmp( target, NODE_ID ) == 0 )
+    {
+        /**
+         * Addressed to the root itself
+         */
+        downlink_status_t status = downlink_execute( payload.name, payload.name_len, payload.args, payload.args_len );
+        downlink_respond( target, seq, payload.name, payload.name_len, status_str( status ) );
+        count( &stats.acked );
+        return;
+    }
+    else
+    {
+        cmd.target = DL_TARGET_NODE;
+        if( strlen( target ) >= NODE_ID_LEN || node_registry_find_id( target, cmd.to.addr ) < 0 )
+        {
+            count( &stats.rejected );
+            downlink_respond( target, seq, payload.name, payload.name_len, "unknown_node" );
+            return;
+        }
+    }
+
+    int len = mesh_proto_put_command( &payload, cmd.payload, sizeof( cmd.payload ) );
+    if( len < 0 )
+    {
+        count( &stats.rejected );
+        downlink_respond( target, seq, payload.name, payload.name_len, "too_long" );
+        return;
+    }
+    cmd.len = len;
+
+    if( xQueueSend( commands, &cmd, 0 ) != pdTRUE )
+    {
+        count( &stats.rejected );
+        downlink_respond( target, seq, payload.name, payload.name_len, "busy" );
+    }
+}
+
+/**
+ * Sender task callback: reports whether the mesh took the command
+ */
+static void on_command_sent( const tx_frame_t *frame, esp_err_t err, void *arg )
+{
+    mesh_frame_t decoded;
+    mesh_payload_command_t cmd;
+    char target[DOWNLINK_TARGET_MAX];
+
+    if( mesh_proto_decode( frame->data, frame->len, &decoded ) != 0 ||
+        mesh_proto_get_command( &decoded, &cmd ) != 0 )
+    {
+        return;
+    }
+
+    switch( (dl_target_t)(uintptr_t)arg )
+    {
+        case DL_TARGET_ALL:
+            strlcpy( target, "all", sizeof( target ) );
+            break;
+        case DL_TARGET_GROUP:
+            snprintf( target, sizeof( target ), "group/%u", frame->to.addr[5] );
+            break;
+        case DL_TARGET_NODE:
+        default:
+            if( node_registry_lookup( frame->to.addr, target, sizeof( target ) ) < 0 )
+            {
+                snprintf( target, sizeof( target ), MACSTR, MAC2STR( frame->to.addr ) );
+            }
+            break;
+    }
+
+    count( err == ESP_OK ? &stats.sent : &stats.failed );
+    downlink_respond( target, cmd.seq, cmd.name, cmd.name_len, err == ESP_OK ? "sent" : "failed" );
+}
+
+void task_downlink( void *pvParameter )
+{
+    downlink_cmd_t cmd;
+    tx_frame_t *frame;
+
+    for( ;; )
+    {
+        xQueueReceive( commands, &cmd, portMAX_DELAY );
+
+        /**
+         * Only this task waits for a slot; the MQTT task never does
+         */
+        frame = tx_queue_alloc( TX_PRIO_CONTROL, TX_POLICY_BLOCK, portMAX_DELAY );
+        if( !frame )
+        {
+            continue;
+        }
+        int len = app_frame_build( MESH_MSG_COMMAND, cmd.payload, cmd.len, 0, frame->data, sizeof( frame->data ) );
+        if( len < 0 )
+        {
+            tx_queue_release( frame );
+            continue;
+        }
+        frame->len = len;
+        switch( cmd.target )
+        {
+            case DL_TARGET_ALL:
+                frame->dest = TX_DEST_ALL;
+                break;
+            case DL_TARGET_GROUP:
+                frame->dest = TX_DEST_ADDR;
+                frame->to = cmd.to;
+                frame->flag = MESH_DATA_P2P | MESH_DATA_GROUP;
+                break;
+            case DL_TARGET_NODE:
+            default:
+                frame->dest = TX_DEST_ADDR;
+                frame->to = cmd.to;
+                break;
+        }
+        frame->done = on_command_sent;
+        frame->arg = (void *)(uintptr_t)cmd.target;
+        tx_queue_submit( frame );
+    }
+
+    vTaskDelete(NULL);
+}
+
+void downlink_node_handle( const mesh_frame_t *frame )
+{
+    mesh_payload_command_t cmd;
+    mesh_payload_cmd_ack_t ack;
+    uint8_t payload[MESH_PAYLOAD_CMD_ACK_SIZE];
+
+    if( mesh_proto_get_command( frame, &cmd ) != 0 )
+    {
+        return;
+    }
+    ack.seq = cmd.seq;
+    ack.status = downlink_execute( cmd.name, cmd.name_len, cmd.args, cmd.args_len );
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "command %.*s (seq %u): %s", cmd.name_len, cmd.name, cmd.seq, status_str( ack.status ) );
+    #endif
+
+    tx_frame_t *reply = tx_queue_alloc( TX_PRIO_CONTROL, TX_POLICY_DROP_NEW, 0 );
+    if( !reply )
+    {
+        return;
+    }
+    mesh_proto_put_cmd_ack( &ack, payload, sizeof( payload ) );
+    int len = app_frame_build( MESH_MSG_CMD_ACK, payload, sizeof( payload ), 0, reply->data, sizeof( reply->data ) );
+    if( len < 0 )
+    {
+        tx_queue_release( reply );
+        return;
+    }
+    reply->len = len;
+    tx_queue_submit( reply );
+}
+
+void downlink_root_handle_ack( const mesh_frame_t *frame )
+{
+    mesh_payload_cmd_ack_t ack;
+    char id[NODE_ID_LEN];
+
+    if( mesh_proto_get_cmd_ack( frame, &ack ) != 0 )
+    {
+        return;
+    }
+    snprintf( id, sizeof( id ), "%u", frame->node_id );
+    count( &stats.acked );
+    downlink_respond( id, ack.seq, NULL, 0, status_str( ack.status ) );
+}
+
+void downlink_get_stats( downlink_stats_t *out )
+{
+    portENTER_CRITICAL( &stats_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &stats_lock );
+}
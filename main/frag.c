@@ -0,0 +1,649 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+/**
+ * Mesh Net;
+ */
+#include "esp_mesh.h"
+
+#include "frag.h"
+#include "app.h"
+#include "tx_queue.h"
+#include "metrics.h"
+#include "frame_pool.h"
+#include "task_layout.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "frag: ";
+
+#if CONFIG_APP_FRAG_MAX_MSG > MESH_FRAG_MAX_COUNT * FRAG_CHUNK
+#error "CONFIG_APP_FRAG_MAX_MSG needs more than MESH_FRAG_MAX_COUNT fragments"
+#endif
+
+/**
+ * Fragments of the message in the transmit queue at once, so a large
+ * message never takes every bulk slot
+ */
+#define FRAG_TX_WINDOW      ( 4 )
+
+/**
+ * How long task_frag waits for a transmit slot before trying again
+ */
+#define FRAG_SLOT_WAIT_MS   ( 50 )
+
+typedef enum {
+    FRAG_IDLE = 0,
+    FRAG_FILLING,           /* frag_send() is copying the message */
+    FRAG_SENDING,
+} frag_state_t;
+
+typedef enum {
+    FRAG_RX_FREE = 0,
+    FRAG_RX_BUSY,           /* reassembling */
+    FRAG_RX_DONE,           /* delivered; kept to answer late polls */
+} frag_rx_state_t;
+
+/**
+ * One reassembly context
+ */
+typedef struct {
+    uint8_t  state;
+    uint8_t  mac[6];
+    uint16_t node_id;
+    uint16_t msg_id;
+    uint16_t count;
+    uint16_t chunk;
+    uint8_t  kind;
+    uint32_t total;
+    uint64_t received;
+    int64_t  touched_us;
+    uint8_t  data[CONFIG_APP_FRAG_MAX_MSG];
+} frag_rx_t;
+
+/**
+ * The message being sent; the fragments in the transmit queue point
+ * into tx_buf, so it is only reused once all of them are gone
+ */
+static frag_tx_t tx;
+static uint8_t tx_buf[CONFIG_APP_FRAG_MAX_MSG];
+static uint8_t tx_state = FRAG_IDLE;
+static uint8_t tx_kind;
+static bool tx_to_root;
+static mesh_addr_t tx_to;
+static int tx_queued = 0;
+static frag_tx_result_t tx_result = FRAG_TX_PENDING;
+static uint16_t next_msg_id = 0;
+static int64_t tx_start_us;
+
+static frag_rx_t rx_pool[CONFIG_APP_FRAG_RX_CONTEXTS];
+static SemaphoreHandle_t rx_mutex = NULL;
+static SemaphoreHandle_t wake = NULL;
+static frag_handler_t deliver = NULL;
+
+static frag_stats_t stats = { 0, };
+static portMUX_TYPE frag_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint64_t frag_mask( uint16_t count )
+{
+    return count >= 64 ? UINT64_MAX : ( 1ULL << count ) - 1;
+}
+
+void frag_tx_start( frag_tx_t *tx, uint16_t msg_id, uint32_t total )
+{
+    tx->msg_id = msg_id;
+    tx->count = ( total + FRAG_CHUNK - 1 ) / FRAG_CHUNK;
+    tx->total = total;
+    tx->acked = 0;
+    tx->round = frag_mask( tx->count );
+    tx->retries = 0;
+    tx->deadline_us = INT64_MAX;
+    tx->sent = 0;
+}
+
+int frag_tx_next( const frag_tx_t *tx )
+{
+    if( !tx->round )
+    {
+        return -1;
+    }
+    for( int i = 0; i < tx->count; i++ )
+    {
+        if( tx->round & ( 1ULL << i ) )
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint8_t frag_tx_sent( frag_tx_t *tx, int index, int64_t now_us )
+{
+    tx->round &= ~( 1ULL << index );
+    tx->sent++;
+    if( tx->round )
+    {
+        return 0;
+    }
+    tx->deadline_us = now_us + CONFIG_APP_FRAG_RETRY_MS * 1000LL;
+    return MESH_FRAG_POLL;
+}
+
+frag_tx_result_t frag_tx_ack( frag_tx_t *tx, const mesh_payload_frag_ack_t *ack, int64_t now_us )
+{
+    uint64_t all = frag_mask( tx->count );
+
+    if( ack->msg_id != tx->msg_id || ack->count != tx->count )
+    {
+        return FRAG_TX_PENDING;
+    }
+    if( ack->status == MESH_FRAG_TOO_BIG )
+    {
+        return FRAG_TX_FAILED;
+    }
+
+    /**
+     * No room at the receiver: ask again after the retry time, which
+     * counts as an unanswered poll
+     */
+    if( ack->status == MESH_FRAG_BUSY )
+    {
+        tx->round = 0;
+        tx->deadline_us = now_us + CONFIG_APP_FRAG_RETRY_MS * 1000LL;
+        return FRAG_TX_PENDING;
+    }
+
+    tx->acked |= ack->received & all;
+    tx->round &= ~tx->acked;
+    if( tx->acked == all )
+    {
+        return FRAG_TX_DONE;
+    }
+    if( !tx->round )
+    {
+        tx->round = all & ~tx->acked;
+        tx->retries = 0;
+        tx->deadline_us = INT64_MAX;
+    }
+    return FRAG_TX_PENDING;
+}
+
+frag_tx_result_t frag_tx_timeout( frag_tx_t *tx, int64_t now_us )
+{
+    uint64_t missing = frag_mask( tx->count ) & ~tx->acked;
+
+    if( tx->round || now_us < tx->deadline_us )
+    {
+        return FRAG_TX_PENDING;
+    }
+    if( tx->retries >= CONFIG_APP_FRAG_RETRIES )
+    {
+        return FRAG_TX_FAILED;
+    }
+    tx->retries++;
+    tx->round = missing & ( ~missing + 1 );
+    tx->deadline_us = INT64_MAX;
+    return FRAG_TX_PENDING;
+}
+
+esp_err_t frag_send( const uint8_t *mac, uint8_t kind, const void *data, size_t len )
+{
+    if( !wake )
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if( len == 0 || len > CONFIG_APP_FRAG_MAX_MSG )
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    portENTER_CRITICAL( &frag_lock );
+    if( tx_state != FRAG_IDLE || tx_queued )
+    {
+        portEXIT_CRITICAL( &frag_lock );
+        return ESP_ERR_INVALID_STATE;
+    }
+    tx_state = FRAG_FILLING;
+    portEXIT_CRITICAL( &frag_lock );
+
+    memcpy( tx_buf, data, len );
+    tx_kind = kind;
+    tx_to_root = mac == NULL;
+    if( mac )
+    {
+        memcpy( tx_to.addr, mac, 6 );
+    }
+    tx_start_us = esp_timer_get_time();
+
+    portENTER_CRITICAL( &frag_lock );
+    frag_tx_start( &tx, next_msg_id++, len );
+    tx_result = FRAG_TX_PENDING;
+    tx_state = FRAG_SENDING;
+    stats.tx_messages++;
+    portEXIT_CRITICAL( &frag_lock );
+
+    xSemaphoreGive( wake );
+    return ESP_OK;
+}
+
+void frag_handle_ack( const mesh_frame_t *frame )
+{
+    mesh_payload_frag_ack_t ack;
+
+    if( mesh_proto_get_frag_ack( frame, &ack ) != 0 )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &frag_lock );
+    if( tx_state == FRAG_SENDING && tx_result == FRAG_TX_PENDING )
+    {
+        tx_result = frag_tx_ack( &tx, &ack, esp_timer_get_time() );
+    }
+    portEXIT_CRITICAL( &frag_lock );
+
+    xSemaphoreGive( wake );
+}
+
+/**
+ * Sender task callback: the fragment left the transmit queue
+ */
+static void on_fragment_sent( const tx_frame_t *frame, esp_err_t err, void *arg )
+{
+    portENTER_CRITICAL( &frag_lock );
+    tx_queued--;
+    portEXIT_CRITICAL( &frag_lock );
+
+    xSemaphoreGive( wake );
+}
+
+/**
+ * Queues the next fragment of the round; false when there is none or
+ * no transmit slot came free
+ */
+static bool frag_send_next( void )
+{
+    uint8_t payload[MESH_PAYLOAD_FRAGMENT_HDR];
+    mesh_payload_fragment_t frag;
+    bool ready;
+    int index;
+
+    portENTER_CRITICAL( &frag_lock );
+    ready = tx_result == FRAG_TX_PENDING && tx_queued < FRAG_TX_WINDOW && frag_tx_next( &tx ) >= 0;
+    portEXIT_CRITICAL( &frag_lock );
+    if( !ready )
+    {
+        return false;
+    }
+
+    tx_frame_t *frame = tx_queue_alloc( TX_PRIO_BULK, TX_POLICY_BLOCK, FRAG_SLOT_WAIT_MS / portTICK_PERIOD_MS );
+    if( !frame )
+    {
+        return false;
+    }
+
+    portENTER_CRITICAL( &frag_lock );
+    index = tx_result == FRAG_TX_PENDING && tx_queued < FRAG_TX_WINDOW ? frag_tx_next( &tx ) : -1;
+    if( index >= 0 )
+    {
+        frag.flags = frag_tx_sent( &tx, index, esp_timer_get_time() );
+        tx_queued++;
+        stats.tx_fragments++;
+    }
+    portEXIT_CRITICAL( &frag_lock );
+
+    if( index < 0 )
+    {
+        tx_queue_release( frame );
+        return false;
+    }
+
+    frag.msg_id = tx.msg_id;
+    frag.index = index;
+    frag.count = tx.count;
+    frag.chunk = FRAG_CHUNK;
+    frag.total = tx.total;
+    frag.kind = tx_kind;
+    frag.data_len = index == tx.count - 1 ? tx.total - index * FRAG_CHUNK : FRAG_CHUNK;
+    mesh_proto_put_fragment( &frag, payload, sizeof( payload ) );
+    int len = app_frame_build( MESH_MSG_FRAGMENT, payload, sizeof( payload ), 0, frame->data, sizeof( frame->data ) );
+    if( len < 0 || mesh_proto_add_tail( frame->data, len, frag.data_len ) != 0 )
+    {
+        /* a lost fragment is picked up by the next poll */
+        tx_queue_release( frame );
+        portENTER_CRITICAL( &frag_lock );
+        tx_queued--;
+        portEXIT_CRITICAL( &frag_lock );
+        return true;
+    }
+    frame->len = len;
+    frame->tail = &tx_buf[index * FRAG_CHUNK];
+    frame->tail_len = frag.data_len;
+    if( !tx_to_root )
+    {
+        frame->dest = TX_DEST_ADDR;
+        frame->to = tx_to;
+    }
+    frame->done = on_fragment_sent;
+    tx_queue_submit( frame );
+    return true;
+}
+
+/**
+ * The message was acknowledged in full or given up
+ */
+static void frag_finish( frag_tx_result_t result )
+{
+    uint32_t ms = (uint32_t)( ( esp_timer_get_time() - tx_start_us ) / 1000 );
+
+    portENTER_CRITICAL( &frag_lock );
+    if( result == FRAG_TX_DONE )
+    {
+        stats.tx_done++;
+    }
+    else
+    {
+        stats.tx_failed++;
+    }
+    stats.tx_resent += tx.sent > tx.count ? tx.sent - tx.count : 0;
+    tx_state = FRAG_IDLE;
+    portEXIT_CRITICAL( &frag_lock );
+
+    if( result == FRAG_TX_DONE )
+    {
+        #ifdef DEBUG
+            ESP_LOGI( TAG, "Message %u: %u bytes in %u fragments (%u sent) in %u ms",
+                      tx.msg_id, tx.total, tx.count, tx.sent, ms );
+        #endif
+    }
+    else
+    {
+        ESP_LOGW( TAG, "Message %u (%u bytes) given up after %u ms, %u of %u fragments confirmed",
+                  tx.msg_id, tx.total, ms, (unsigned)__builtin_popcountll( tx.acked ), tx.count );
+    }
+}
+
+/**
+ * Fragmentation Task: sends the message one round at a time and polls
+ * again when the answer is overdue
+ */
+static void task_frag( void *pvParameter )
+{
+    TickType_t wait = portMAX_DELAY;
+    frag_tx_result_t result;
+    int64_t deadline;
+    int64_t now;
+    bool more;
+
+    for( ;; )
+    {
+        xSemaphoreTake( wake, wait );
+
+        portENTER_CRITICAL( &frag_lock );
+        if( tx_state == FRAG_SENDING && tx_result == FRAG_TX_PENDING )
+        {
+            tx_result = frag_tx_timeout( &tx, esp_timer_get_time() );
+        }
+        result = tx_state == FRAG_SENDING ? tx_result : FRAG_TX_PENDING;
+        portEXIT_CRITICAL( &frag_lock );
+
+        if( result != FRAG_TX_PENDING )
+        {
+            frag_finish( result );
+        }
+
+        more = tx_state == FRAG_SENDING;
+        while( more && frag_send_next() )
+        {
+        }
+
+        /**
+         * Woken by a sent fragment, an ack, a slot wait or the deadline
+         */
+        portENTER_CRITICAL( &frag_lock );
+        deadline = tx_state == FRAG_SENDING ? tx.deadline_us : INT64_MAX;
+        more = tx_state == FRAG_SENDING && tx.round && tx_queued < FRAG_TX_WINDOW;
+        portEXIT_CRITICAL( &frag_lock );
+
+        now = esp_timer_get_time();
+        if( more )
+        {
+            wait = FRAG_SLOT_WAIT_MS / portTICK_PERIOD_MS;
+        }
+        else if( deadline == INT64_MAX )
+        {
+            wait = portMAX_DELAY;
+        }
+        else
+        {
+            wait = deadline > now ? (TickType_t)( ( deadline - now ) / 1000 / portTICK_PERIOD_MS + 1 ) : 0;
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+/**
+ * Answers the sender of 'frame' with what this side holds of 'msg_id'
+ */
+static void frag_reply( const mesh_frame_t *frame, uint16_t msg_id, uint16_t count,
+                        mesh_frag_status_t status, uint64_t received )
+{
+    uint8_t payload[MESH_PAYLOAD_FRAG_ACK_SIZE];
+    mesh_payload_frag_ack_t ack = {
+        .msg_id = msg_id,
+        .count = count,
+        .status = status,
+        .received = received,
+    };
+
+    /**
+     * A lost answer only costs the sender a poll, so this never waits
+     */
+    tx_frame_t *reply = tx_queue_alloc( TX_PRIO_CONTROL, TX_POLICY_DROP_NEW, 0 );
+    if( !reply )
+    {
+        return;
+    }
+    mesh_proto_put_frag_ack( &ack, payload, sizeof( payload ) );
+    int len = app_frame_build( MESH_MSG_FRAG_ACK, payload, sizeof( payload ), 0, reply->data, sizeof( reply->data ) );
+    if( len < 0 )
+    {
+        tx_queue_release( reply );
+        return;
+    }
+    reply->len = len;
+    if( esp_mesh_is_root() )
+    {
+        reply->dest = TX_DEST_ADDR;
+        memcpy( reply->to.addr, frame->mac, 6 );
+    }
+    tx_queue_submit( reply );
+}
+
+/**
+ * Context of the message 'frag' belongs to, or a fresh one for it:
+ * a free one first, then the oldest delivered one. Contexts left
+ * incomplete for CONFIG_APP_FRAG_RX_TIMEOUT_MS are freed on the way.
+ */
+static frag_rx_t *frag_rx_find( const mesh_frame_t *frame, const mesh_payload_fragment_t *frag, int64_t now )
+{
+    frag_rx_t *spare = NULL;
+
+    for( int i = 0; i < CONFIG_APP_FRAG_RX_CONTEXTS; i++ )
+    {
+        frag_rx_t *ctx = &rx_pool[i];
+
+        if( ctx->state == FRAG_RX_BUSY && now - ctx->touched_us > CONFIG_APP_FRAG_RX_TIMEOUT_MS * 1000LL )
+        {
+            ctx->state = FRAG_RX_FREE;
+            stats.rx_timeouts++;
+            ESP_LOGW( TAG, "Message %u from "MACSTR" timed out, %u of %u fragments",
+                      ctx->msg_id, MAC2STR( ctx->mac ), (unsigned)__builtin_popcountll( ctx->received ), ctx->count );
+        }
+        if( ctx->state != FRAG_RX_FREE && ctx->msg_id == frag->msg_id && memcmp( ctx->mac, frame->mac, 6 ) == 0 )
+        {
+            return ctx;
+        }
+        if( ctx->state == FRAG_RX_FREE )
+        {
+            if( !spare || spare->state != FRAG_RX_FREE )
+            {
+                spare = ctx;
+            }
+        }
+        else if( ctx->state == FRAG_RX_DONE &&
+                 ( !spare || ( spare->state == FRAG_RX_DONE && ctx->touched_us < spare->touched_us ) ) )
+        {
+            spare = ctx;
+        }
+    }
+    if( spare )
+    {
+        spare->state = FRAG_RX_BUSY;
+        memcpy( spare->mac, frame->mac, 6 );
+        spare->node_id = frame->node_id;
+        spare->msg_id = frag->msg_id;
+        spare->count = frag->count;
+        spare->chunk = frag->chunk;
+        spare->kind = frag->kind;
+        spare->total = frag->total;
+        spare->received = 0;
+    }
+    return spare;
+}
+
+void frag_receive( const mesh_frame_t *frame )
+{
+    mesh_payload_fragment_t frag;
+    uint64_t all;
+    uint64_t bit;
+    uint32_t offset;
+    bool complete = false;
+
+    if( !rx_mutex || mesh_proto_get_fragment( frame, &frag ) != 0 )
+    {
+        return;
+    }
+    if( frag.total > CONFIG_APP_FRAG_MAX_MSG )
+    {
+        frag_reply( frame, frag.msg_id, frag.count, MESH_FRAG_TOO_BIG, 0 );
+        return;
+    }
+
+    /**
+     * Fragments must tile the message exactly
+     */
+    offset = (uint32_t)frag.index * frag.chunk;
+    if( frag.count != ( frag.total + frag.chunk - 1 ) / frag.chunk ||
+        frag.data_len != ( frag.index == frag.count - 1 ? frag.total - offset : frag.chunk ) )
+    {
+        #ifdef DEBUG
+            ESP_LOGI( TAG, "Malformed fragment %u/%u of message %u", frag.index, frag.count, frag.msg_id );
+        #endif
+        return;
+    }
+    all = frag_mask( frag.count );
+    bit = 1ULL << frag.index;
+
+    xSemaphoreTake( rx_mutex, portMAX_DELAY );
+    frag_rx_t *ctx = frag_rx_find( frame, &frag, esp_timer_get_time() );
+    if( !ctx )
+    {
+        stats.rx_busy++;
+        xSemaphoreGive( rx_mutex );
+        frag_reply( frame, frag.msg_id, frag.count, MESH_FRAG_BUSY, 0 );
+        return;
+    }
+    if( ctx->count != frag.count || ctx->chunk != frag.chunk || ctx->total != frag.total )
+    {
+        xSemaphoreGive( rx_mutex );
+        return;
+    }
+
+    ctx->touched_us = esp_timer_get_time();
+    stats.rx_fragments++;
+    if( ctx->received & bit )
+    {
+        stats.rx_duplicates++;
+    }
+    else
+    {
+        memcpy( &ctx->data[offset], frag.data, frag.data_len );
+        frame_pool_count_copy( frag.data_len );
+        ctx->received |= bit;
+        complete = ctx->received == all;
+    }
+
+    if( complete )
+    {
+        ctx->state = FRAG_RX_DONE;
+        stats.rx_messages++;
+        if( deliver )
+        {
+            deliver( ctx->mac, ctx->node_id, ctx->kind, ctx->data, ctx->total );
+        }
+    }
+    uint64_t received = ctx->received;
+    xSemaphoreGive( rx_mutex );
+
+    /**
+     * Completion is always reported, a gap only when asked; a poll for a
+     * delivered message means the sender missed the last answer
+     */
+    if( complete || ( frag.flags & MESH_FRAG_POLL ) )
+    {
+        frag_reply( frame, frag.msg_id, frag.count, MESH_FRAG_OK, received );
+    }
+}
+
+esp_err_t frag_start( frag_handler_t handler )
+{
+    TaskHandle_t task;
+
+    if( wake )
+    {
+        return ESP_OK;
+    }
+    deliver = handler;
+
+    /**
+     * A rebooted sender must not reuse the id of a message the receiver
+     * still remembers as delivered
+     */
+    next_msg_id = (uint16_t)esp_random();
+    rx_mutex = xSemaphoreCreateMutex();
+    wake = xSemaphoreCreateBinary();
+    if( !rx_mutex || !wake )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if( task_layout_create( TASK_LAYOUT_FRAG, task_frag, "task_frag", NULL, &task ) != pdPASS )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    metrics_register_task( task );
+    return ESP_OK;
+}
+
+void frag_get_stats( frag_stats_t *out )
+{
+    portENTER_CRITICAL( &frag_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &frag_lock );
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_log.h"
+#include "esp_mesh.h"
+
+#include "frame_pool.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "frame_pool: ";
+
+#if CONFIG_APP_FRAME_POOL_BUF_SIZE < MESH_MPS
+#error "CONFIG_APP_FRAME_POOL_BUF_SIZE must hold a MESH_MPS frame"
+#endif
+
+/**
+ * Buffer pool and its free list, as in tx_queue
+ */
+static frame_buf_t bufs[CONFIG_APP_FRAME_POOL_BUFS];
+static QueueHandle_t free_bufs = NULL;
+
+static frame_pool_stats_t stats = { 0, };
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t frame_pool_init( void )
+{
+    if( free_bufs )
+    {
+        return ESP_OK;
+    }
+
+    free_bufs = xQueueCreate( CONFIG_APP_FRAME_POOL_BUFS, sizeof( frame_buf_t * ) );
+    if( !free_bufs )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    for( int i = 0; i < CONFIG_APP_FRAME_POOL_BUFS; i++ )
+    {
+        frame_buf_t *buf = &bufs[i];
+        xQueueSend( free_bufs, &buf, 0 );
+    }
+    return ESP_OK;
+}
+
+frame_buf_t *frame_pool_alloc( TickType_t wait )
+{
+    frame_buf_t *buf = NULL;
+
+    if( !free_bufs )
+    {
+        return NULL;
+    }
+    if( xQueueReceive( free_bufs, &buf, 0 ) != pdTRUE )
+    {
+        portENTER_CRITICAL( &pool_lock );
+        stats.exhausted++;
+        portEXIT_CRITICAL( &pool_lock );
+
+        if( !wait || xQueueReceive( free_bufs, &buf, wait ) != pdTRUE )
+        {
+            #ifdef DEBUG
+                ESP_LOGI( TAG, "No frame buffer free" );
+            #endif
+            return NULL;
+        }
+    }
+
+    buf->len = 0;
+    buf->refs = 1;
+    portENTER_CRITICAL( &pool_lock );
+    stats.allocs++;
+    stats.in_use++;
+    if( stats.in_use > stats.peak )
+    {
+        stats.peak = stats.in_use;
+    }
+    portEXIT_CRITICAL( &pool_lock );
+    return buf;
+}
+
+void frame_pool_ref( frame_buf_t *buf )
+{
+    portENTER_CRITICAL( &pool_lock );
+    buf->refs++;
+    portEXIT_CRITICAL( &pool_lock );
+}
+
+void frame_pool_release( frame_buf_t *buf )
+{
+    bool last;
+
+    portENTER_CRITICAL( &pool_lock );
+    last = --buf->refs == 0;
+    if( last )
+    {
+        stats.in_use--;
+    }
+    portEXIT_CRITICAL( &pool_lock );
+
+    if( last )
+    {
+        xQueueSend( free_bufs, &buf, 0 );
+    }
+}
+
+uint32_t frame_pool_available( void )
+{
+    return free_bufs ? uxQueueMessagesWaiting( free_bufs ) : 0;
+}
+
+void frame_pool_count_copy( size_t len )
+{
+    portENTER_CRITICAL( &pool_lock );
+    stats.copies++;
+    stats.copied_bytes += len;
+    portEXIT_CRITICAL( &pool_lock );
+}
+
+void frame_pool_get_stats( frame_pool_stats_t *out )
+{
+    portENTER_CRITICAL( &pool_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &pool_lock );
+}
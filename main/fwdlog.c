@@ -0,0 +1,484 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "esp_crc.h"
+#include "esp_log.h"
+
+#include "fwdlog.h"
+#include "mesh_proto.h"
+#include "metrics.h"
+#include "frame_pool.h"
+#include "task_layout.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "fwdlog: ";
+
+static fwdlog_stats_t stats = { 0, };
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_APP_FWDLOG_ENABLE
+
+#define FWDLOG_LABEL        "fwdlog"
+#define FWDLOG_SUBTYPE      ( 0x40 )
+#define FWDLOG_MAGIC        ( 0x4c445746 )     /* "FWDL" */
+
+/**
+ * Each sector holds FWDLOG_SLOTS fixed-size slots; slot 0 is the
+ * sector header, the others one record each
+ */
+#define FWDLOG_SECTOR       ( SPI_FLASH_SEC_SIZE )
+#define FWDLOG_SLOT         ( 128 )
+#define FWDLOG_SLOTS        ( FWDLOG_SECTOR / FWDLOG_SLOT )
+
+/**
+ * Record states; flash bits only go from 1 to 0 without an erase, so a
+ * record is written VALID and later marked DONE by rewriting one byte
+ */
+#define STATE_EMPTY         ( 0xff )
+#define STATE_VALID         ( 0xfe )
+#define STATE_DONE          ( 0xf0 )
+
+/**
+ * On-flash layouts, only ever read back by this firmware
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t epoch;         /* increases with every sector opened */
+} fwdlog_sector_t;
+
+typedef struct {
+    uint8_t  state;
+    uint8_t  len;
+    uint16_t reserved;
+    uint32_t crc;           /* over lseq and the frame */
+    uint32_t lseq;          /* log sequence number */
+} fwdlog_rec_t;
+
+#define FWDLOG_REC_HDR      ( sizeof( fwdlog_rec_t ) )
+
+/**
+ * Frames waiting to be written, filled by fwdlog_append()
+ */
+typedef struct {
+    uint8_t len;
+    uint8_t data[MESH_PROTO_FRAME_MAX];
+} fwdlog_staged_t;
+
+static fwdlog_staged_t staged[CONFIG_APP_FWDLOG_RAM_SLOTS];
+static uint32_t staged_in = 0;
+static uint32_t staged_out = 0;
+static portMUX_TYPE staged_lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t wake = NULL;
+
+/**
+ * Ring state, owned by task_fwdlog once started. Positions are slot
+ * indexes over the whole partition; 'tail' == 'head' means empty.
+ */
+static const esp_partition_t *part = NULL;
+static uint32_t sectors;
+static uint32_t head;
+static uint32_t tail;
+static uint32_t epoch;
+static uint32_t lseq;
+static fwdlog_replay_t replay_fn = NULL;
+
+static size_t slot_offset( uint32_t slot )
+{
+    return (size_t)slot * FWDLOG_SLOT;
+}
+
+static uint32_t slot_next( uint32_t slot )
+{
+    return ( slot + 1 ) % ( sectors * FWDLOG_SLOTS );
+}
+
+static uint32_t rec_crc( const fwdlog_rec_t *rec, const uint8_t *data )
+{
+    uint32_t crc = esp_crc32_le( 0, (const uint8_t *)&rec->lseq, sizeof( rec->lseq ) );
+    return esp_crc32_le( crc, data, rec->len );
+}
+
+static void stats_count( uint32_t *counter, uint32_t n )
+{
+    portENTER_CRITICAL( &stats_lock );
+    *counter += n;
+    portEXIT_CRITICAL( &stats_lock );
+}
+
+static bool sector_read( uint32_t sector, fwdlog_sector_t *hdr )
+{
+    return esp_partition_read( part, sector * FWDLOG_SECTOR, hdr, sizeof( *hdr ) ) == ESP_OK &&
+           hdr->magic == FWDLOG_MAGIC;
+}
+
+static bool rec_empty( const fwdlog_rec_t *rec )
+{
+    return rec->state == STATE_EMPTY && rec->len == 0xff;
+}
+
+/**
+ * Erases the sector 'head' points at and makes it the write sector;
+ * records it still held that were never replayed are lost
+ */
+static esp_err_t sector_open( void )
+{
+    uint32_t sector = head / FWDLOG_SLOTS;
+    fwdlog_sector_t hdr = { .magic = FWDLOG_MAGIC };
+    fwdlog_rec_t rec;
+    uint32_t lost = 0;
+
+    if( tail != head && tail / FWDLOG_SLOTS == sector )
+    {
+        for( uint32_t slot = tail; slot / FWDLOG_SLOTS == sector; slot = slot_next( slot ) )
+        {
+            if( slot % FWDLOG_SLOTS &&
+                esp_partition_read( part, slot_offset( slot ), &rec, FWDLOG_REC_HDR ) == ESP_OK &&
+                rec.state == STATE_VALID )
+            {
+                lost++;
+            }
+        }
+        /**
+         * First record slot, not the header: a tail on a header slot
+         * would read as an empty log once head gets there
+         */
+        tail = ( ( sector + 1 ) % sectors ) * FWDLOG_SLOTS + 1;
+        portENTER_CRITICAL( &stats_lock );
+        stats.dropped += lost;
+        stats.backlog -= lost;
+        portEXIT_CRITICAL( &stats_lock );
+        ESP_LOGW( TAG, "Log full, %u records overwritten", (unsigned)lost );
+    }
+
+    esp_err_t err = esp_partition_erase_range( part, sector * FWDLOG_SECTOR, FWDLOG_SECTOR );
+    if( err != ESP_OK )
+    {
+        return err;
+    }
+    stats_count( &stats.erases, 1 );
+
+    hdr.epoch = ++epoch;
+    err = esp_partition_write( part, sector * FWDLOG_SECTOR, &hdr, sizeof( hdr ) );
+    if( tail == head )
+    {
+        tail = slot_next( head );
+    }
+    head = slot_next( head );
+    return err;
+}
+
+static esp_err_t log_write( const fwdlog_staged_t *frame )
+{
+    uint8_t buf[FWDLOG_SLOT];
+    fwdlog_rec_t rec = {
+        .state = STATE_VALID,
+        .len = frame->len,
+        .reserved = 0xffff,
+        .lseq = lseq,
+    };
+    esp_err_t err;
+
+    if( head % FWDLOG_SLOTS == 0 && ( err = sector_open() ) != ESP_OK )
+    {
+        return err;
+    }
+    rec.crc = rec_crc( &rec, frame->data );
+    memcpy( buf, &rec, FWDLOG_REC_HDR );
+    memcpy( &buf[FWDLOG_REC_HDR], frame->data, frame->len );
+
+    /**
+     * Only the used part of the slot is programmed, in 4-byte words
+     */
+    err = esp_partition_write( part, slot_offset( head ), buf, ( FWDLOG_REC_HDR + frame->len + 3 ) & ~3 );
+    head = slot_next( head );
+    lseq++;
+    if( err != ESP_OK )
+    {
+        return err;
+    }
+    portENTER_CRITICAL( &stats_lock );
+    stats.stored++;
+    stats.backlog++;
+    portEXIT_CRITICAL( &stats_lock );
+    return ESP_OK;
+}
+
+/**
+ * Replays up to CONFIG_APP_FWDLOG_REPLAY_BATCH records from the tail
+ */
+static void log_replay( void )
+{
+    uint8_t data[MESH_PROTO_FRAME_MAX];
+    fwdlog_rec_t rec;
+    uint8_t done = STATE_DONE;
+    int sent = 0;
+
+    while( tail != head && sent < CONFIG_APP_FWDLOG_REPLAY_BATCH )
+    {
+        if( tail % FWDLOG_SLOTS == 0 )
+        {
+            tail = slot_next( tail );
+            continue;
+        }
+        if( esp_partition_read( part, slot_offset( tail ), &rec, FWDLOG_REC_HDR ) != ESP_OK )
+        {
+            return;
+        }
+        if( rec.state != STATE_VALID )
+        {
+            tail = slot_next( tail );
+            continue;
+        }
+        if( rec.len > sizeof( data ) ||
+            esp_partition_read( part, slot_offset( tail ) + FWDLOG_REC_HDR, data, rec.len ) != ESP_OK ||
+            rec_crc( &rec, data ) != rec.crc )
+        {
+            portENTER_CRITICAL( &stats_lock );
+            stats.corrupt++;
+            stats.backlog--;
+            portEXIT_CRITICAL( &stats_lock );
+        }
+        else if( !replay_fn( data, rec.len ) )
+        {
+            return;
+        }
+        else
+        {
+            portENTER_CRITICAL( &stats_lock );
+            stats.replayed++;
+            stats.backlog--;
+            portEXIT_CRITICAL( &stats_lock );
+            sent++;
+        }
+        esp_partition_write( part, slot_offset( tail ), &done, 1 );
+        tail = slot_next( tail );
+    }
+}
+
+/**
+ * Finds the write position (first empty slot of the newest sector) and
+ * the oldest record not replayed yet
+ */
+static void log_mount( void )
+{
+    fwdlog_sector_t hdr;
+    fwdlog_rec_t rec;
+    uint32_t newest = 0;
+    bool found = false;
+    bool have_tail = false;
+
+    epoch = 0;
+    for( uint32_t s = 0; s < sectors; s++ )
+    {
+        if( sector_read( s, &hdr ) && ( !found || hdr.epoch > epoch ) )
+        {
+            newest = s;
+            epoch = hdr.epoch;
+            found = true;
+        }
+    }
+
+    /**
+     * Blank partition: the first write opens sector 0
+     */
+    head = 0;
+    tail = 0;
+    lseq = 0;
+    if( !found )
+    {
+        return;
+    }
+
+    head = ( ( newest + 1 ) % sectors ) * FWDLOG_SLOTS;
+    for( uint32_t slot = 1; slot < FWDLOG_SLOTS; slot++ )
+    {
+        if( esp_partition_read( part, newest * FWDLOG_SECTOR + slot * FWDLOG_SLOT, &rec, FWDLOG_REC_HDR ) == ESP_OK &&
+            rec_empty( &rec ) )
+        {
+            head = newest * FWDLOG_SLOTS + slot;
+            break;
+        }
+    }
+    tail = head;
+
+    /**
+     * Oldest sector first: the ring order after the newest one
+     */
+    for( uint32_t k = 1; k <= sectors; k++ )
+    {
+        uint32_t s = ( newest + k ) % sectors;
+        if( !sector_read( s, &hdr ) )
+        {
+            continue;
+        }
+        for( uint32_t slot = 1; slot < FWDLOG_SLOTS; slot++ )
+        {
+            uint32_t index = s * FWDLOG_SLOTS + slot;
+            if( index == head ||
+                esp_partition_read( part, slot_offset( index ), &rec, FWDLOG_REC_HDR ) != ESP_OK ||
+                rec_empty( &rec ) )
+            {
+                break;
+            }
+            if( rec.lseq >= lseq )
+            {
+                lseq = rec.lseq + 1;
+            }
+            if( rec.state == STATE_VALID )
+            {
+                if( !have_tail )
+                {
+                    tail = index;
+                    have_tail = true;
+                }
+                stats.backlog++;
+            }
+        }
+    }
+}
+
+esp_err_t fwdlog_start( fwdlog_replay_t replay )
+{
+    TaskHandle_t task;
+
+    if( wake )
+    {
+        return ESP_OK;
+    }
+    part = esp_partition_find_first( ESP_PARTITION_TYPE_DATA, FWDLOG_SUBTYPE, FWDLOG_LABEL );
+    if( !part || part->size < 2 * FWDLOG_SECTOR )
+    {
+        ESP_LOGW( TAG, "No \"%s\" partition, outages are not logged", FWDLOG_LABEL );
+        return ESP_ERR_NOT_FOUND;
+    }
+    sectors = part->size / FWDLOG_SECTOR;
+    replay_fn = replay;
+    log_mount();
+    ESP_LOGI( TAG, "%u sectors, %u records to replay", (unsigned)sectors, (unsigned)stats.backlog );
+
+    wake = xSemaphoreCreateBinary();
+    if( !wake )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if( task_layout_create( TASK_LAYOUT_FWDLOG, task_fwdlog, "task_fwdlog", NULL, &task ) != pdPASS )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    metrics_register_task( task );
+    return ESP_OK;
+}
+
+esp_err_t fwdlog_append( const uint8_t *frame, size_t len )
+{
+    fwdlog_staged_t *slot = NULL;
+
+    if( !wake )
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if( len > MESH_PROTO_FRAME_MAX )
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    portENTER_CRITICAL( &staged_lock );
+    if( staged_in - staged_out < CONFIG_APP_FWDLOG_RAM_SLOTS )
+    {
+        slot = &staged[staged_in % CONFIG_APP_FWDLOG_RAM_SLOTS];
+        slot->len = (uint8_t)len;
+        memcpy( slot->data, frame, len );
+        staged_in++;
+    }
+    portEXIT_CRITICAL( &staged_lock );
+
+    if( !slot )
+    {
+        stats_count( &stats.dropped, 1 );
+        return ESP_ERR_NO_MEM;
+    }
+    frame_pool_count_copy( len );
+    stats_count( &stats.appended, 1 );
+    xSemaphoreGive( wake );
+    return ESP_OK;
+}
+
+/**
+ * Log Task: the only one touching the partition
+ */
+void task_fwdlog( void *pvParameter )
+{
+    TickType_t interval = CONFIG_APP_FWDLOG_REPLAY_INTERVAL_MS / portTICK_PERIOD_MS;
+    TickType_t last_replay = xTaskGetTickCount();
+    fwdlog_staged_t frame;
+    bool more;
+
+    for( ;; )
+    {
+        xSemaphoreTake( wake, interval );
+
+        /**
+         * Copied out so the flash write happens outside the lock
+         */
+        do
+        {
+            portENTER_CRITICAL( &staged_lock );
+            more = staged_out != staged_in;
+            if( more )
+            {
+                frame = staged[staged_out % CONFIG_APP_FWDLOG_RAM_SLOTS];
+                staged_out++;
+            }
+            portEXIT_CRITICAL( &staged_lock );
+
+            if( more && log_write( &frame ) != ESP_OK )
+            {
+                stats_count( &stats.dropped, 1 );
+            }
+        } while( more );
+
+        if( tail != head && xTaskGetTickCount() - last_replay >= interval )
+        {
+            last_replay = xTaskGetTickCount();
+            log_replay();
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+#else
+
+esp_err_t fwdlog_start( fwdlog_replay_t replay )
+{
+    return ESP_OK;
+}
+
+esp_err_t fwdlog_append( const uint8_t *frame, size_t len )
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
+
+void fwdlog_get_stats( fwdlog_stats_t *out )
+{
+    portENTER_CRITICAL( &stats_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &stats_lock );
+}
@@ -1,18 +1,20 @@
 #ifndef __APPS_H__
 #define __APPS_H__
-typedef struct 
-{
-    char* id;
-    char* ssid
-} nodeEsp;
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_mesh.h"
+#include "frame_pool.h"
 
 void mqtt_start();
-void public_disconnect_msg(char* );
-void send_connect_msg();
+void public_disconnect_msg(const uint8_t *mac);
+void app_root_handle_frame( const mesh_addr_t *from, frame_buf_t *fb, mesh_proto_t proto );
+int app_frame_build( uint8_t type, const uint8_t *payload, uint16_t payload_len,
+                     int64_t event_us, uint8_t *buf, size_t size );
 
 void gpios_setup( void );
 void task_mesh_tx( void *pvParameter );
 void task_mesh_rx ( void *pvParameter );
+void task_stats( void *pvParameter );
 void task_app_create( void );
 
 #endif
\ No newline at end of file
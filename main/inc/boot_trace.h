@@ -0,0 +1,35 @@
+#ifndef __BOOT_TRACE_H__
+#define __BOOT_TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Boot milestones, each stamped once with the time since reset (ms)
+ */
+typedef enum {
+    BOOT_APP_START = 0,     /* app_main() entered */
+    BOOT_NVS_READY,
+    BOOT_WIFI_STARTED,
+    BOOT_MESH_STARTED,
+    BOOT_PARENT_CONNECTED,  /* first parent; the router for the root */
+    BOOT_MQTT_CONNECTED,    /* root only */
+    BOOT_FIRST_TX,          /* first frame accepted by the mesh stack */
+    BOOT_FIRST_PUBLISH,     /* root only: first MQTT publish */
+    BOOT_STAGE_MAX
+} boot_stage_t;
+
+void boot_mark( boot_stage_t stage );
+
+/**
+ * Time the stage was reached, 0 if it was not (yet)
+ */
+uint32_t boot_stage_ms( boot_stage_t stage );
+
+/**
+ * Writes {"<stage>":ms,...} for the stages reached; returns the length
+ * as snprintf() does
+ */
+int boot_trace_json( char *buf, size_t size );
+
+#endif
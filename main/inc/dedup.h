@@ -0,0 +1,96 @@
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Duplicate uplink suppression on the root.
+ *
+ * Every frame a node builds carries the next value of a per-node
+ * sequence number that never goes back: it starts each boot at the boot
+ * count (kept in NVS) times 2^DEDUP_BOOT_SHIFT. The root keeps, for each
+ * node index, the highest sequence number seen and a bitmap of the
+ * DEDUP_WINDOW numbers below it; a reading, summary or alert whose
+ * number is already in the window is dropped before it is published.
+ * A number goes into the window only once its frame was handed on, so
+ * a frame dropped on the way comes through when the node retries it or
+ * the fwdlog replays it.
+ *
+ * Numbers further behind than the window (a replay of an old backlog)
+ * are let through and counted, the backend drops those by id and seq;
+ * a jump back of more than DEDUP_RESTART_GAP is a node whose NVS was
+ * erased and restarts its window.
+ *
+ * The windows survive a root handover through the broker: the root
+ * publishes them, retained, in parts on DEDUP_STATE_TOPIC "/<part>" with
+ * its stats, and right after it is asked to yield; a new root reads them back
+ * once when it connects. The windows of nodes that are not registered (yet) are
+ * parked until they register, so memory stays at two windows per
+ * CONFIG_MESH_ROUTE_TABLE_SIZE node.
+ */
+#define DEDUP_STATE_TOPIC   "ESP-state/dedup"
+#define DEDUP_STATE_FILTER  DEDUP_STATE_TOPIC "/+"
+#define DEDUP_WINDOW        ( 64 )
+#define DEDUP_BOOT_SHIFT    ( 24 )
+#define DEDUP_RESTART_GAP   ( 1UL << ( DEDUP_BOOT_SHIFT - 1 ) )
+
+typedef struct {
+    uint32_t checked;
+    uint32_t duplicates;    /* dropped */
+    uint32_t stale;         /* behind the window, let through */
+    uint32_t restarts;      /* windows restarted by a jump back */
+    uint32_t untracked;     /* sender not registered, let through */
+    uint32_t restored;      /* windows read back from the broker */
+} dedup_stats_t;
+
+/**
+ * Node: first sequence number of this boot; bumps the boot count on the
+ * first call only. Called once at startup, before any task sends.
+ */
+uint32_t dedup_seq_start( void );
+
+/**
+ * Root: false if 'seq' from 'mac' is a duplicate; records nothing
+ */
+bool dedup_is_new( const uint8_t mac[6], uint32_t seq );
+
+/**
+ * Root: records 'seq' from 'mac', once its frame was queued for publish
+ */
+void dedup_commit( const uint8_t mac[6], uint32_t seq );
+
+/**
+ * Root: parks the window of a node index that is being released, for
+ * when the node registers again
+ */
+void dedup_park( int node_index );
+
+/**
+ * Root: publishes every window under DEDUP_STATE_TOPIC; may wait for
+ * room in the MQTT outbox, so only task_stats calls it
+ */
+void dedup_publish_state( void );
+
+/**
+ * Root, from the mesh event handler: asks task_stats to publish the
+ * windows on its next tick, without waiting
+ */
+void dedup_request_publish( void );
+
+/**
+ * True once, if a publish was asked for since the last call
+ */
+bool dedup_publish_requested( void );
+
+/**
+ * Root, from the MQTT event task: takes one chunk of a part under
+ * DEDUP_STATE_TOPIC at 'offset' of 'total' bytes; true once every part
+ * was read
+ */
+bool dedup_restore( const char *data, size_t len, size_t offset, size_t total );
+
+void dedup_get_stats( dedup_stats_t *stats );
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __DOWNLINK_H__
+#define __DOWNLINK_H__
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "mesh_proto.h"
+
+/**
+ * MQTT to mesh commands. The root subscribes to:
+ *
+ *   cmd/<node_id>/<name>       one node, resolved through the registry id index
+ *   cmd/group/<1-254>/<name>   nodes built with that CONFIG_APP_NODE_GROUP
+ *   cmd/all/<name>             every node
+ *
+ * The MQTT payload is passed to the command as its arguments. Results
+ * go to rsp/<node_id>, rsp/group/<n> or rsp/all as
+ * {"seq":..,"cmd":"..","status":".."}: "sent" or "failed" once the root
+ * handed the command to the mesh (or "busy", "unknown_node",
+ * "too_long", "bad_topic" if it never did), then one "ok",
+ * "unknown_command" or "bad_args" per node that executed it.
+ */
+#define DOWNLINK_TOPIC_FILTER   "cmd/#"
+
+typedef enum {
+    DOWNLINK_OK = 0,
+    DOWNLINK_UNKNOWN_CMD,
+    DOWNLINK_BAD_ARGS,
+} downlink_status_t;
+
+typedef struct {
+    uint32_t received;
+    uint32_t rejected;      /* bad topic, unknown node, too long or busy */
+    uint32_t sent;
+    uint32_t failed;
+    uint32_t acked;
+} downlink_stats_t;
+
+/**
+ * Root: creates the command queue and task_downlink
+ */
+esp_err_t downlink_start( void );
+
+/**
+ * Root, from the MQTT event task: resolves the target and queues the
+ * command. Never blocks; a full queue is reported as "busy".
+ */
+void downlink_post( const char *topic, int topic_len, const char *data, int data_len );
+
+/**
+ * Node: executes a MESH_MSG_COMMAND and acknowledges it to the root
+ */
+void downlink_node_handle( const mesh_frame_t *frame );
+
+/**
+ * Root: reports a MESH_MSG_CMD_ACK on the response topic
+ */
+void downlink_root_handle_ack( const mesh_frame_t *frame );
+
+void downlink_get_stats( downlink_stats_t *stats );
+
+/**
+ * Moves queued commands into the transmit queue, waiting for free slots
+ */
+void task_downlink( void *pvParameter );
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef __FRAG_H__
+#define __FRAG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+#include "mesh_proto.h"
+
+/**
+ * Messages larger than one frame (up to CONFIG_APP_FRAG_MAX_MSG bytes).
+ *
+ * A message is cut into MESH_MSG_FRAGMENT frames of MESH_MPS bytes, sent
+ * by task_frag one round at a time with MESH_FRAG_POLL on the last
+ * fragment of the round. The receiver answers a poll, and the fragment
+ * that completes the message, with a MESH_MSG_FRAG_ACK bitmap of what it
+ * holds; the next round carries only the fragments still missing. A
+ * round left unanswered for CONFIG_APP_FRAG_RETRY_MS is followed by the
+ * first missing fragment alone as a new poll, at most
+ * CONFIG_APP_FRAG_RETRIES times in a row.
+ *
+ * The receiver reassembles into one of CONFIG_APP_FRAG_RX_CONTEXTS
+ * buffers; one untouched for CONFIG_APP_FRAG_RX_TIMEOUT_MS is given up.
+ * Nodes send to the root and the root to nodes; one message at a time.
+ */
+#define FRAG_CHUNK  ( MESH_MPS - MESH_PROTO_HDR_SIZE - MESH_PAYLOAD_FRAGMENT_HDR )
+
+/**
+ * What a message holds, carried in every fragment
+ */
+typedef enum {
+    FRAG_KIND_DIAG  = 1,    /* node diagnostics (JSON), published on ESP-diag/<id> */
+    FRAG_KIND_BENCH = 2,    /* host simulator throughput benchmark, dropped on arrival */
+} frag_kind_t;
+
+typedef enum {
+    FRAG_TX_PENDING = 0,
+    FRAG_TX_DONE,
+    FRAG_TX_FAILED,
+} frag_tx_result_t;
+
+/**
+ * Sender state machine; all times are esp_timer_get_time() microseconds.
+ */
+typedef struct {
+    uint16_t msg_id;
+    uint16_t count;
+    uint32_t total;
+    uint64_t acked;         /* fragments the receiver confirmed */
+    uint64_t round;         /* fragments of this round still to send */
+    uint8_t  retries;       /* unanswered polls in a row */
+    int64_t  deadline_us;   /* answer to the round's poll due */
+    uint32_t sent;          /* fragments sent, retransmissions included */
+} frag_tx_t;
+
+typedef struct {
+    uint32_t tx_messages;
+    uint32_t tx_done;
+    uint32_t tx_failed;
+    uint32_t tx_fragments;
+    uint32_t tx_resent;     /* fragments sent more than once */
+    uint32_t rx_messages;
+    uint32_t rx_fragments;
+    uint32_t rx_duplicates;
+    uint32_t rx_timeouts;   /* contexts given up incomplete */
+    uint32_t rx_busy;       /* messages turned away, no context free */
+} frag_stats_t;
+
+/**
+ * A reassembled message; 'data' is only valid during the call
+ */
+typedef void (*frag_handler_t)( const uint8_t mac[6], uint16_t node_id, uint8_t kind,
+                                const uint8_t *data, size_t len );
+
+/**
+ * Starts a message of 'total' bytes: every fragment in the first round
+ */
+void frag_tx_start( frag_tx_t *tx, uint16_t msg_id, uint32_t total );
+
+/**
+ * Index of the next fragment of this round, -1 if the round is sent
+ */
+int frag_tx_next( const frag_tx_t *tx );
+
+/**
+ * Records fragment 'index' as sent; returns the MESH_FRAG_POLL flag if it
+ * was the last one of the round, which arms the answer deadline
+ */
+uint8_t frag_tx_sent( frag_tx_t *tx, int index, int64_t now_us );
+
+/**
+ * Takes the receiver's answer; a poll answer starts the next round
+ */
+frag_tx_result_t frag_tx_ack( frag_tx_t *tx, const mesh_payload_frag_ack_t *ack, int64_t now_us );
+
+/**
+ * Polls again once the answer is overdue; fails after
+ * CONFIG_APP_FRAG_RETRIES unanswered polls
+ */
+frag_tx_result_t frag_tx_timeout( frag_tx_t *tx, int64_t now_us );
+
+/**
+ * Creates the reassembly lock and task_frag; 'handler' gets every
+ * message reassembled here
+ */
+esp_err_t frag_start( frag_handler_t handler );
+
+/**
+ * Copies 'len' bytes for 'mac' (NULL: the root) and returns at once.
+ * ESP_ERR_INVALID_STATE while the previous message is still in flight,
+ * ESP_ERR_INVALID_SIZE above CONFIG_APP_FRAG_MAX_MSG.
+ */
+esp_err_t frag_send( const uint8_t *mac, uint8_t kind, const void *data, size_t len );
+
+/**
+ * Takes a MESH_MSG_FRAGMENT, on the root or a node
+ */
+void frag_receive( const mesh_frame_t *frame );
+
+/**
+ * Takes a MESH_MSG_FRAG_ACK for the message being sent
+ */
+void frag_handle_ack( const mesh_frame_t *frame );
+
+void frag_get_stats( frag_stats_t *stats );
+
+#endif
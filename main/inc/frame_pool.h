@@ -0,0 +1,79 @@
+#ifndef __FRAME_POOL_H__
+#define __FRAME_POOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/**
+ * Reference-counted frame buffers (CONFIG_APP_FRAME_POOL_BUFS of
+ * CONFIG_APP_FRAME_POOL_BUF_SIZE bytes).
+ *
+ * task_mesh_rx receives every frame straight into a pool buffer and the
+ * root decodes it there; a summary or alert is then written over the
+ * frame it came from, and the batcher writes its publish into a buffer
+ * of its own. The MQTT outbox takes a reference instead of a copy and
+ * drops it once the message is published, so a payload exists once
+ * from the radio to the MQTT client. A buffer goes back to the pool when
+ * its last reference is released.
+ *
+ * Copies that remain (outbox arena, reassembly, store-and-forward log,
+ * MQTT client) are counted with frame_pool_count_copy().
+ */
+#define FRAME_POOL_BUF_SIZE ( CONFIG_APP_FRAME_POOL_BUF_SIZE )
+
+/**
+ * Free buffers the outbox leaves to the receive path: below this it
+ * copies instead of holding a reference, so a stalled broker cannot
+ * starve task_mesh_rx
+ */
+#define FRAME_POOL_RESERVE  ( 2 )
+
+typedef struct {
+    uint16_t len;
+    uint8_t  refs;
+    uint8_t  data[FRAME_POOL_BUF_SIZE];
+} frame_buf_t;
+
+typedef struct {
+    uint32_t allocs;
+    uint32_t exhausted;     /* allocations that found the pool empty */
+    uint32_t in_use;
+    uint32_t peak;          /* most buffers in use at once */
+    uint32_t copies;        /* payload copies along the frame path */
+    uint64_t copied_bytes;
+} frame_pool_stats_t;
+
+esp_err_t frame_pool_init( void );
+
+/**
+ * Takes a buffer holding one reference, waiting up to 'wait' ticks;
+ * NULL if none came free
+ */
+frame_buf_t *frame_pool_alloc( TickType_t wait );
+
+/**
+ * Adds a reference for another stage
+ */
+void frame_pool_ref( frame_buf_t *buf );
+
+/**
+ * Drops a reference; the last one returns the buffer to the pool
+ */
+void frame_pool_release( frame_buf_t *buf );
+
+/**
+ * Buffers not in use
+ */
+uint32_t frame_pool_available( void );
+
+/**
+ * Accounts one copy of 'len' payload bytes
+ */
+void frame_pool_count_copy( size_t len );
+
+void frame_pool_get_stats( frame_pool_stats_t *stats );
+
+#endif
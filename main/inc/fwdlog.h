@@ -0,0 +1,59 @@
+#ifndef __FWDLOG_H__
+#define __FWDLOG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * Store-and-forward log (CONFIG_APP_FWDLOG_ENABLE).
+ *
+ * Mesh frames that cannot be delivered (no parent, router or broker
+ * away) are appended to a RAM staging ring and written by task_fwdlog
+ * to an append-only ring of records in the "fwdlog" data partition.
+ * Sectors are reused strictly in turn, so every sector wears evenly;
+ * when the ring is full the oldest sector is erased and its records are
+ * counted as dropped. A record is marked replayed in place, so the
+ * backlog survives a reboot.
+ *
+ * Once the link is back task_fwdlog replays at most
+ * CONFIG_APP_FWDLOG_REPLAY_BATCH records every
+ * CONFIG_APP_FWDLOG_REPLAY_INTERVAL_MS through the replay callback. The
+ * frames keep their node id and sequence number, so the backend can
+ * drop the ones it already has.
+ */
+
+/**
+ * Takes one logged frame (which it may modify); returns false if it
+ * cannot take it now, which ends the replay round
+ */
+typedef bool (*fwdlog_replay_t)( uint8_t *frame, size_t len );
+
+typedef struct {
+    uint32_t appended;      /* frames accepted into the staging ring */
+    uint32_t stored;        /* records written to flash */
+    uint32_t replayed;
+    uint32_t dropped;       /* staging ring full, or overwritten before replay */
+    uint32_t corrupt;       /* torn or unreadable records skipped */
+    uint32_t erases;
+    uint32_t backlog;       /* records waiting for replay */
+} fwdlog_stats_t;
+
+/**
+ * Mounts the partition, recovers the backlog and creates task_fwdlog
+ */
+esp_err_t fwdlog_start( fwdlog_replay_t replay );
+
+/**
+ * Queues a frame for the log; copies it and never blocks, so it can be
+ * called from the send path
+ */
+esp_err_t fwdlog_append( const uint8_t *frame, size_t len );
+
+void fwdlog_get_stats( fwdlog_stats_t *stats );
+
+void task_fwdlog( void *pvParameter );
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __INPUT_EVENTS_H__
+#define __INPUT_EVENTS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+
+/**
+ * Input sources feeding the event queue
+ */
+typedef enum {
+    INPUT_SRC_BUTTON = 0,
+    INPUT_SRC_SENSOR,       /* sampler alert, value is the sample */
+    INPUT_SRC_SUMMARY,      /* sampler window closed */
+    INPUT_SRC_WAKE,         /* no input, task_mesh_tx has work to poll */
+    INPUT_SRC_MAX
+} input_source_t;
+
+/**
+ * One input event, timestamped where it was raised (ISR or task)
+ */
+typedef struct {
+    uint8_t source;
+    uint8_t level;
+    int32_t value;
+    int64_t timestamp_us;
+} input_event_t;
+
+/**
+ * Input-to-send latency, in microseconds
+ */
+typedef struct {
+    uint32_t count;
+    int64_t  total_us;
+    int64_t  max_us;
+    uint32_t dropped;       /* events lost to a full queue */
+} input_latency_t;
+
+esp_err_t input_events_init( void );
+
+/**
+ * Installs an edge interrupt on 'gpio' (already configured as an input).
+ * Edges closer than 'debounce_ms' to the last accepted one are ignored.
+ */
+esp_err_t input_events_add_gpio( gpio_num_t gpio, input_source_t source,
+                                 gpio_int_type_t edge, uint32_t debounce_ms );
+
+/**
+ * Posts an event from task context, e.g. a sampled sensor value
+ */
+esp_err_t input_events_post( input_source_t source, int32_t value );
+
+/**
+ * Blocks up to 'timeout' for the next event
+ */
+bool input_events_wait( input_event_t *event, TickType_t timeout );
+
+/**
+ * Records the time from the event timestamp to now; call once the
+ * frame it produced has been sent
+ */
+void input_latency_record( int64_t timestamp_us );
+void input_latency_get( input_latency_t *out );
+
+#endif
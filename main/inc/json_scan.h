@@ -0,0 +1,45 @@
+#ifndef __JSON_SCAN_H__
+#define __JSON_SCAN_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * In-place scanner for the flat JSON objects sent by older firmware,
+ * e.g. {"Topic":"Send-Data","Data":156}. Values are reported as slices of
+ * the input buffer: nothing is allocated, copied or unescaped, and the
+ * input does not have to be NUL-terminated.
+ */
+typedef struct {
+    const char *key;        /* in: member name to look for */
+    const char *value;      /* out: start of the value, NULL if absent */
+    size_t      value_len;  /* out: length, without quotes for strings */
+    bool        is_string;  /* out: the value was a JSON string */
+} json_field_t;
+
+/**
+ * Scans the top-level object in 'buf' once, filling every field whose key
+ * matches. Nested objects and arrays are skipped. Returns the number of
+ * fields found, or -1 if the input is not a well-formed object.
+ */
+int json_scan( const char *buf, size_t len, json_field_t *fields, int count );
+
+/**
+ * True if the field is a string equal to 's'
+ */
+bool json_field_eq( const json_field_t *field, const char *s );
+
+/**
+ * Copies the field value into 'out' as a NUL-terminated string,
+ * truncating if needed. Returns false if the field is absent.
+ */
+bool json_field_copy( const json_field_t *field, char *out, size_t size );
+
+/**
+ * Parses an integer value (bare or quoted). Returns false if the field
+ * is absent or not an integer.
+ */
+bool json_field_int( const json_field_t *field, int32_t *out );
+
+#endif
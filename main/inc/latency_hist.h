@@ -0,0 +1,29 @@
+#ifndef __LATENCY_HIST_H__
+#define __LATENCY_HIST_H__
+
+#include <stdint.h>
+
+/**
+ * Compact log-scale latency histogram: two buckets per power of two
+ * starting at 256 us, so 32 buckets span 256 us .. ~16 s with at most
+ * ~41% relative error. Counters are 16 bits; when one saturates every
+ * bucket is halved, which also ages out old samples.
+ */
+#define LATENCY_HIST_BUCKETS    ( 32 )
+
+typedef struct {
+    uint16_t bucket[LATENCY_HIST_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+} latency_hist_t;
+
+void latency_hist_reset( latency_hist_t *hist );
+void latency_hist_add( latency_hist_t *hist, uint32_t us );
+
+/**
+ * Upper bound of the bucket holding the given percentile (0-100),
+ * 0 if the histogram is empty
+ */
+uint32_t latency_hist_percentile( const latency_hist_t *hist, int percentile );
+
+#endif
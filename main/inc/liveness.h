@@ -0,0 +1,65 @@
+#ifndef __LIVENESS_H__
+#define __LIVENESS_H__
+
+#include <stdint.h>
+
+#include "mesh_proto.h"
+
+/**
+ * Node liveness from aggregated heartbeats (CONFIG_APP_HEARTBEAT_PERIOD_S).
+ *
+ * Every registered node owns one bit of a heartbeat bitmap: the node
+ * index the root handed out in its Connect-Mesh ack. Once per period a
+ * node sends its parent one MESH_MSG_HEARTBEAT holding its own bit ORed
+ * with the bitmaps its children sent since the last one, so each link
+ * carries one frame per period whatever the size of the subtree. Deeper
+ * layers send earlier in the period, so one pass reaches the root.
+ *
+ * The root keeps a timer per node on a one-second timer wheel, re-armed
+ * by every bit it sees. A node whose timer runs out after
+ * CONFIG_APP_LIVENESS_TIMEOUT_S is published on ESP-disconnect, and on
+ * ESP-connect when its bit comes back; every CONFIG_APP_FLEET_PERIOD_S
+ * the counts and the offline ids go to ESP-fleet.
+ */
+
+typedef struct {
+    uint32_t sent;          /* node: heartbeats sent to the parent */
+    uint32_t merged;        /* node: child heartbeats folded into the next one */
+    uint32_t received;      /* root: heartbeats taken */
+    uint32_t stale;         /* heartbeats from another root session */
+    uint32_t went_offline;
+    uint32_t came_online;
+    uint16_t online;
+    uint16_t offline;
+} liveness_stats_t;
+
+/**
+ * Node: folds a child's MESH_MSG_HEARTBEAT into the next one sent
+ */
+void liveness_node_merge( const mesh_frame_t *frame );
+
+/**
+ * Root: takes a MESH_MSG_HEARTBEAT from a direct child
+ */
+void liveness_root_handle( const mesh_frame_t *frame );
+
+/**
+ * Root: node 'index' registered; it is online and its timer starts
+ * without a transition being published
+ */
+void liveness_arm( int index );
+
+/**
+ * Root: node 'index' left the registry; its timer is dropped
+ */
+void liveness_forget( int index );
+
+/**
+ * Called by task_stats every second: a node sends its heartbeat on its
+ * slot of the period, the root expires timers and publishes ESP-fleet
+ */
+void liveness_tick( uint32_t elapsed_s );
+
+void liveness_get_stats( liveness_stats_t *stats );
+
+#endif
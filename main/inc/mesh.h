@@ -1,7 +1,29 @@
 #ifndef __MESH_H__
 #define __MESH_H__
 
+#include <stdbool.h>
+
+#include "esp_mesh.h"
+
+#include "mesh_cache.h"
+
 void mesh_app_start( void ); 
 
+/**
+ * Connected to a parent and, on the root, the router's network is reachable
+ */
+bool mesh_app_is_connected( void );
+
+/**
+ * Whether this boot used the cached parent (CONFIG_APP_FAST_REJOIN)
+ */
+mesh_rejoin_t mesh_app_get_rejoin( void );
+
+/**
+ * Mesh (station) address of the parent; false on the root or while
+ * disconnected
+ */
+bool mesh_app_get_parent( mesh_addr_t *parent );
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef __MESH_CACHE_H__
+#define __MESH_CACHE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Last good mesh position, kept in NVS so a reboot can go straight back
+ * to the same parent on the same channel instead of scanning
+ */
+typedef struct {
+    uint8_t channel;
+    uint8_t layer;          /* 1: this node was the root, parent is the router */
+    uint8_t parent[6];      /* parent BSSID */
+    uint8_t root[6];        /* root address, informational */
+} mesh_cache_t;
+
+/**
+ * How this boot joined the mesh
+ */
+typedef enum {
+    MESH_REJOIN_SCAN = 0,   /* no cache: full scan and vote */
+    MESH_REJOIN_CACHED,     /* cached parent tried first */
+    MESH_REJOIN_FALLBACK,   /* cached parent failed, rescanned */
+} mesh_rejoin_t;
+
+/**
+ * True if a complete cache was found
+ */
+bool mesh_cache_load( mesh_cache_t *cache );
+
+/**
+ * Record a new parent / root; NVS is only written when a value changed
+ */
+void mesh_cache_set_parent( uint8_t channel, const uint8_t parent[6], uint8_t layer );
+void mesh_cache_set_root( const uint8_t root[6] );
+
+void mesh_cache_clear( void );
+
+const char *mesh_rejoin_name( mesh_rejoin_t rejoin );
+
+#endif
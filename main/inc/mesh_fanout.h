@@ -0,0 +1,39 @@
+#ifndef __MESH_FANOUT_H__
+#define __MESH_FANOUT_H__
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_mesh.h"
+
+/**
+ * Outcome of one root-to-nodes broadcast
+ */
+typedef struct {
+    int     targets;        /* nodes addressed, the root excluded */
+    int     sent;           /* accepted by esp_mesh_send() */
+    int     failed;         /* rejected by esp_mesh_send() */
+    int64_t elapsed_us;     /* time spent issuing the sends */
+} mesh_fanout_result_t;
+
+/**
+ * Joins the broadcast group, and the command group CONFIG_APP_NODE_GROUP
+ * when set; every node calls this once the mesh is up so that a single
+ * MESH_DATA_GROUP send from the root reaches it.
+ */
+esp_err_t mesh_fanout_join( void );
+
+/**
+ * Multicast address of command group 'group' (1-254)
+ */
+void mesh_fanout_group_addr( uint8_t group, mesh_addr_t *addr );
+
+/**
+ * Sends 'data' from the root to every other node, either as one group
+ * send (CONFIG_MESH_FANOUT_GROUP) or as one unicast per routing table
+ * entry. Fills 'result' (may be NULL) and returns ESP_OK only if no
+ * send failed.
+ */
+esp_err_t mesh_fanout_send( const mesh_data_t *data, mesh_fanout_result_t *result );
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef __MESH_PROTO_H__
+#define __MESH_PROTO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Binary mesh frame (sent as MESH_PROTO_BIN), all fields little-endian:
+ *
+ *  0     1      2         4        10    14          18      19      20    22
+ *  +-----+------+---------+--------+-----+-----------+-------+-------+-----+---------+
+ *  | ver | type | node_id | mac[6] | seq | origin_ts | layer | flags | len | payload |
+ *  +-----+------+---------+--------+-----+-----------+-------+-------+-----+---------+
+ *
+ * origin_ts is the low 32 bits of the mesh TSF time (us) at which the
+ * reading was taken; TSF is synchronised along the tree, so the root can
+ * subtract it from its own TSF to get end-to-end latency.
+ * Version 1 frames (16-byte header, no origin_ts/layer/flags) are still
+ * decoded, with those fields zeroed.
+ *
+ * The codec has no dependency on ESP-IDF so it can also be built on the host.
+ */
+#define MESH_PROTO_VERSION      ( 2 )
+#define MESH_PROTO_HDR_SIZE     ( 22 )
+#define MESH_PROTO_HDR_SIZE_V1  ( 16 )
+#define MESH_PROTO_MAX_PAYLOAD  ( 78 )
+#define MESH_PROTO_FRAME_MAX    ( MESH_PROTO_HDR_SIZE + MESH_PROTO_MAX_PAYLOAD )
+
+/**
+ * Header flags
+ */
+#define MESH_FLAG_REPLAY        ( 0x01 )    /* resent from the store-and-forward log */
+
+/**
+ * Message types
+ */
+typedef enum {
+    MESH_MSG_CONNECT = 1,   /* node announces itself to the root, no payload */
+    MESH_MSG_DATA    = 2,   /* node reading, payload: mesh_payload_data_t */
+    MESH_MSG_METRICS = 3,   /* node health snapshot, payload: mesh_payload_metrics_t */
+    MESH_MSG_COMMAND = 4,   /* root to node command, payload: mesh_payload_command_t */
+    MESH_MSG_CMD_ACK = 5,   /* node result of a command, payload: mesh_payload_cmd_ack_t */
+    MESH_MSG_SUMMARY = 6,   /* node sampling window, payload: mesh_payload_summary_t */
+    MESH_MSG_ALERT   = 7,   /* node threshold/rate alert, payload: mesh_payload_alert_t */
+    MESH_MSG_CONNECT_ACK = 8,   /* root to node, announcement taken, payload: mesh_payload_connect_ack_t */
+    MESH_MSG_REREGISTER  = 9,   /* root to all, announce again, payload: mesh_payload_reregister_t */
+    MESH_MSG_HEARTBEAT   = 10,  /* node to parent, live subtree, payload: mesh_payload_heartbeat_t */
+    MESH_MSG_FRAGMENT    = 11,  /* piece of a large message, payload: mesh_payload_fragment_t */
+    MESH_MSG_FRAG_ACK    = 12,  /* fragments received so far, payload: mesh_payload_frag_ack_t */
+    MESH_MSG_TOPOLOGY    = 13,  /* node position and parent link, payload: mesh_payload_topology_t */
+} mesh_msg_type_t;
+
+/**
+ * Decoded view of a frame; payload points into the buffer it was decoded from
+ */
+typedef struct {
+    uint8_t         version;
+    uint8_t         type;
+    uint16_t        node_id;
+    uint8_t         mac[6];
+    uint32_t        seq;
+    uint32_t        origin_ts;
+    uint8_t         layer;
+    uint8_t         flags;
+    uint16_t        payload_len;
+    const uint8_t  *payload;
+} mesh_frame_t;
+
+/**
+ * Typed payloads
+ */
+typedef struct {
+    int32_t value;
+} mesh_payload_data_t;
+
+#define MESH_PAYLOAD_DATA_SIZE  ( 4 )
+
+/**
+ * Health snapshot; error and event counters saturate at 0xffff.
+ * Firmware before the boot fields sends the first 42 bytes only; they
+ * decode as 0.
+ */
+typedef struct {
+    uint32_t uptime_s;
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    uint32_t rx_frames;
+    uint32_t rx_bytes;
+    uint32_t tx_frames;
+    uint32_t tx_bytes;
+    uint16_t rx_errors;
+    uint16_t tx_errors;
+    uint16_t parent_disconnects;
+    uint16_t root_switches;
+    uint16_t min_stack_free;    /* smallest stack high-water mark, bytes */
+    uint16_t txq_depth;         /* frames waiting in the transmit queue */
+    uint16_t txq_dropped;
+    uint32_t boot_connected_ms; /* boot to first parent */
+    uint32_t boot_first_tx_ms;  /* boot to first frame sent */
+    uint8_t  rejoin;            /* mesh_rejoin_t */
+} mesh_payload_metrics_t;
+
+#define MESH_PAYLOAD_METRICS_SIZE       ( 51 )
+#define MESH_PAYLOAD_METRICS_SIZE_MIN   ( 42 )
+
+/**
+ * Command: seq u16, name length u8, name, then the arguments up to the
+ * end of the payload; name and args point into the decoded buffer
+ */
+typedef struct {
+    uint16_t        seq;
+    uint8_t         name_len;
+    const char     *name;
+    uint16_t        args_len;
+    const uint8_t  *args;
+} mesh_payload_command_t;
+
+#define MESH_PAYLOAD_COMMAND_HDR    ( 3 )
+
+typedef struct {
+    uint16_t seq;
+    uint8_t  status;
+} mesh_payload_cmd_ack_t;
+
+#define MESH_PAYLOAD_CMD_ACK_SIZE   ( 3 )
+
+/**
+ * Aggregate of one sampling window; origin_ts of the frame is the time
+ * the window closed
+ */
+typedef struct {
+    uint32_t window_ms;
+    uint32_t count;
+    int32_t  min;
+    int32_t  max;
+    int32_t  mean;
+    int32_t  last;
+} mesh_payload_summary_t;
+
+#define MESH_PAYLOAD_SUMMARY_SIZE   ( 24 )
+
+typedef enum {
+    MESH_ALERT_HIGH = 1,    /* value reached the high threshold */
+    MESH_ALERT_LOW  = 2,    /* value reached the low threshold */
+    MESH_ALERT_RATE = 3,    /* value moved by more than the allowed delta */
+} mesh_alert_kind_t;
+
+/**
+ * 'ref' is the crossed threshold, or the previous sample for MESH_ALERT_RATE
+ */
+typedef struct {
+    uint8_t kind;
+    int32_t value;
+    int32_t ref;
+} mesh_payload_alert_t;
+
+#define MESH_PAYLOAD_ALERT_SIZE     ( 9 )
+
+typedef enum {
+    MESH_REG_OK   = 0,
+    MESH_REG_FULL = 1,      /* registry full; the node must not retry */
+} mesh_reg_status_t;
+
+/**
+ * 'seq' is the sequence number of the MESH_MSG_CONNECT being acknowledged.
+ * 'slot' is the node's bit in heartbeat bitmaps, valid for frames of the
+ * root session 'epoch'; an ack without them (5 bytes) decodes as
+ * MESH_SLOT_NONE, epoch 0.
+ */
+#define MESH_SLOT_NONE  ( 0xffff )
+
+typedef struct {
+    uint32_t seq;
+    uint8_t  status;
+    uint16_t slot;
+    uint8_t  epoch;
+} mesh_payload_connect_ack_t;
+
+#define MESH_PAYLOAD_CONNECT_ACK_SIZE       ( 8 )
+#define MESH_PAYLOAD_CONNECT_ACK_SIZE_MIN   ( 5 )
+
+/**
+ * Nodes announce again at a random time within 'window_ms'; without
+ * MESH_REREGISTER_ALL a node already registered with the sender keeps
+ * quiet
+ */
+#define MESH_REREGISTER_ALL     ( 0x01 )
+
+typedef struct {
+    uint32_t window_ms;
+    uint8_t  flags;
+} mesh_payload_reregister_t;
+
+#define MESH_PAYLOAD_REREGISTER_SIZE    ( 5 )
+
+/**
+ * Heartbeat: root session epoch u8, then a bitmap up to the end of the
+ * payload with bit 'slot' (LSB first) set for every live node of the
+ * sender's subtree, itself included; bitmap points into the decoded buffer
+ */
+typedef struct {
+    uint8_t         epoch;
+    uint8_t         bitmap_len;
+    const uint8_t  *bitmap;
+} mesh_payload_heartbeat_t;
+
+#define MESH_PAYLOAD_HEARTBEAT_HDR  ( 1 )
+#define MESH_HEARTBEAT_SLOTS        ( ( MESH_PROTO_MAX_PAYLOAD - MESH_PAYLOAD_HEARTBEAT_HDR ) * 8 )
+
+/**
+ * Fragment of a message of 'total' bytes cut into 'count' pieces of
+ * 'chunk' bytes (the last one shorter): msg_id u16, index u16, count u16,
+ * chunk u16, total u32, kind u8, flags u8, then the data up to the end of
+ * the payload. The data follows the header in the same frame, so these
+ * frames are longer than MESH_PROTO_FRAME_MAX: the header is encoded as
+ * a short frame and mesh_proto_add_tail() accounts for the data sent
+ * after it. data points into the decoded buffer.
+ */
+#define MESH_FRAG_MAX_COUNT     ( 64 )
+#define MESH_FRAG_POLL          ( 0x01 )    /* receiver answers with a MESH_MSG_FRAG_ACK */
+
+typedef struct {
+    uint16_t        msg_id;
+    uint16_t        index;
+    uint16_t        count;
+    uint16_t        chunk;
+    uint32_t        total;
+    uint8_t         kind;
+    uint8_t         flags;
+    uint16_t        data_len;
+    const uint8_t  *data;
+} mesh_payload_fragment_t;
+
+#define MESH_PAYLOAD_FRAGMENT_HDR   ( 14 )
+
+typedef enum {
+    MESH_FRAG_OK   = 0,
+    MESH_FRAG_BUSY = 1,     /* no reassembly context free; try again later */
+    MESH_FRAG_TOO_BIG = 2,  /* message longer than the receiver takes */
+} mesh_frag_status_t;
+
+/**
+ * Bit 'index' (LSB first) of 'received' is set for every fragment of
+ * message 'msg_id' the receiver holds; all 'count' bits set means done
+ */
+typedef struct {
+    uint16_t msg_id;
+    uint16_t count;
+    uint8_t  status;
+    uint64_t received;
+} mesh_payload_frag_ack_t;
+
+#define MESH_PAYLOAD_FRAG_ACK_SIZE  ( 13 )
+
+/**
+ * Position of the sender in the tree and the state of its link to the
+ * parent; the layer is the one in the frame header. 'parent' is the
+ * parent's station address (the router's BSSID on the root), 'subtree'
+ * the nodes below the sender, 'tx_pending' the frames queued for the
+ * parent. Rates are the sender's own mesh traffic, bytes/s, since its
+ * previous report.
+ */
+typedef struct {
+    uint8_t  parent[6];
+    uint8_t  children;
+    uint16_t subtree;
+    int8_t   rssi;
+    uint16_t tx_pending;
+    uint32_t tx_bps;
+    uint32_t rx_bps;
+} mesh_payload_topology_t;
+
+#define MESH_PAYLOAD_TOPOLOGY_SIZE  ( 20 )
+
+/**
+ * Writes 'frame' into 'buf'. Returns the number of bytes written or -1
+ * if the buffer is too small or the payload too long.
+ */
+int mesh_proto_encode( const mesh_frame_t *frame, uint8_t *buf, size_t size );
+
+/**
+ * Parses 'len' bytes of 'buf' into 'frame' without copying the payload.
+ * Returns 0 on success, -1 on a short, truncated or foreign-version frame.
+ */
+int mesh_proto_decode( const uint8_t *buf, size_t len, mesh_frame_t *frame );
+
+/**
+ * ORs 'flags' into the header of an encoded frame. Returns -1 if 'buf'
+ * does not hold a current-version frame.
+ */
+int mesh_proto_set_flags( uint8_t *buf, size_t len, uint8_t flags );
+
+/**
+ * Adds 'tail_len' bytes, sent right after the encoded frame, to its
+ * payload length; used for fragment data. Returns -1 if 'buf' does not
+ * hold a current-version frame or the length overflows.
+ */
+int mesh_proto_add_tail( uint8_t *buf, size_t len, uint16_t tail_len );
+
+int mesh_proto_put_data( const mesh_payload_data_t *data, uint8_t *buf, size_t size );
+int mesh_proto_get_data( const mesh_frame_t *frame, mesh_payload_data_t *data );
+int mesh_proto_put_metrics( const mesh_payload_metrics_t *metrics, uint8_t *buf, size_t size );
+int mesh_proto_get_metrics( const mesh_frame_t *frame, mesh_payload_metrics_t *metrics );
+int mesh_proto_put_command( const mesh_payload_command_t *cmd, uint8_t *buf, size_t size );
+int mesh_proto_get_command( const mesh_frame_t *frame, mesh_payload_command_t *cmd );
+int mesh_proto_put_cmd_ack( const mesh_payload_cmd_ack_t *ack, uint8_t *buf, size_t size );
+int mesh_proto_get_cmd_ack( const mesh_frame_t *frame, mesh_payload_cmd_ack_t *ack );
+int mesh_proto_put_summary( const mesh_payload_summary_t *summary, uint8_t *buf, size_t size );
+int mesh_proto_get_summary( const mesh_frame_t *frame, mesh_payload_summary_t *summary );
+int mesh_proto_put_alert( const mesh_payload_alert_t *alert, uint8_t *buf, size_t size );
+int mesh_proto_get_alert( const mesh_frame_t *frame, mesh_payload_alert_t *alert );
+int mesh_proto_put_connect_ack( const mesh_payload_connect_ack_t *ack, uint8_t *buf, size_t size );
+int mesh_proto_get_connect_ack( const mesh_frame_t *frame, mesh_payload_connect_ack_t *ack );
+int mesh_proto_put_reregister( const mesh_payload_reregister_t *req, uint8_t *buf, size_t size );
+int mesh_proto_get_reregister( const mesh_frame_t *frame, mesh_payload_reregister_t *req );
+int mesh_proto_put_heartbeat( const mesh_payload_heartbeat_t *beat, uint8_t *buf, size_t size );
+int mesh_proto_get_heartbeat( const mesh_frame_t *frame, mesh_payload_heartbeat_t *beat );
+int mesh_proto_put_fragment( const mesh_payload_fragment_t *frag, uint8_t *buf, size_t size );
+int mesh_proto_get_fragment( const mesh_frame_t *frame, mesh_payload_fragment_t *frag );
+int mesh_proto_put_frag_ack( const mesh_payload_frag_ack_t *ack, uint8_t *buf, size_t size );
+int mesh_proto_get_frag_ack( const mesh_frame_t *frame, mesh_payload_frag_ack_t *ack );
+int mesh_proto_put_topology( const mesh_payload_topology_t *topo, uint8_t *buf, size_t size );
+int mesh_proto_get_topology( const mesh_frame_t *frame, mesh_payload_topology_t *topo );
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "mesh_proto.h"
+
+/**
+ * Runtime health counters. Updates are single relaxed atomic adds, so
+ * they are safe and cheap from any task on either core.
+ */
+typedef enum {
+    METRIC_MESH_RX_FRAMES = 0,
+    METRIC_MESH_RX_BYTES,
+    METRIC_MESH_RX_ERRORS,
+    METRIC_MESH_TX_FRAMES,
+    METRIC_MESH_TX_BYTES,
+    METRIC_MESH_TX_ERRORS,
+    METRIC_MQTT_PUBLISHES,
+    METRIC_MQTT_ACKS,
+    METRIC_MQTT_ERRORS,
+    METRIC_MQTT_DISCONNECTS,
+    METRIC_EVT_PARENT_DISCONNECTED,
+    METRIC_EVT_ROOT_SWITCH,
+    METRIC_EVT_LAYER_CHANGE,
+    METRIC_EVT_CHILD_CONNECTED,
+    METRIC_EVT_CHILD_DISCONNECTED,
+    METRIC_EVT_NO_PARENT_FOUND,
+    METRIC_COUNT
+} metric_id_t;
+
+extern uint32_t metrics_counters[METRIC_COUNT];
+
+static inline void metrics_add( metric_id_t id, uint32_t n )
+{
+    __atomic_fetch_add( &metrics_counters[id], n, __ATOMIC_RELAXED );
+}
+
+static inline void metrics_inc( metric_id_t id )
+{
+    metrics_add( id, 1 );
+}
+
+static inline uint32_t metrics_get( metric_id_t id )
+{
+    return __atomic_load_n( &metrics_counters[id], __ATOMIC_RELAXED );
+}
+
+/**
+ * Adds a task to the stack high-water mark report
+ */
+void metrics_register_task( TaskHandle_t task );
+
+/**
+ * Fills the compact snapshot nodes report to the root
+ */
+void metrics_snapshot( mesh_payload_metrics_t *snap );
+
+/**
+ * Root: stores the snapshot last reported by node 'node_index'
+ */
+void metrics_store( int node_index, const mesh_payload_metrics_t *snap );
+
+/**
+ * Root: drops the snapshot of a newly assigned node index
+ */
+void metrics_forget( int node_index );
+
+/**
+ * Root: publishes its own counters on "ESP-stats/health", the last
+ * snapshot of every node on "ESP-stats/health/nodes" and the fleet
+ * aggregate on "ESP-stats/health/fleet"
+ */
+void metrics_publish( void );
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __MQTT_APP_H__
+#define __MQTT_APP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void mqtt_app_start( void );
+
+/**
+ * Queues a string for 'topic' in the outbox; never blocks on the broker
+ */
+void mqtt_app_publish( const char *topic, const char *publish_string );
+
+/**
+ * Hands a message to the MQTT client right away; only called by the
+ * outbox publisher task. Returns the msg_id or -1.
+ */
+int mqtt_app_client_publish( const char *topic, const char *data, size_t len, int qos, bool retain );
+
+bool mqtt_app_connected( void );
+
+#endif
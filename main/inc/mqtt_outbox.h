@@ -0,0 +1,64 @@
+#ifndef __MQTT_OUTBOX_H__
+#define __MQTT_OUTBOX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#include "frame_pool.h"
+
+/**
+ * Bounded MQTT outbox: producers (mesh receive, stats) post a copy of
+ * the message, or a reference to the frame buffer holding it, and return
+ * at once; task_mqtt_publisher hands messages to
+ * the MQTT client in order, waiting out broker reconnects. QoS, retain
+ * and coalescing come from a per-topic policy table.
+ */
+#define MQTT_OUTBOX_TOPIC_MAX   ( 64 )
+
+/**
+ * Longest payload mqtt_outbox_post() copies into the arena; a block,
+ * header included, may take at most half of it
+ */
+#define MQTT_OUTBOX_PAYLOAD_MAX ( CONFIG_APP_MQTT_OUTBOX_ARENA_SIZE / 2 - 8 )
+
+typedef struct {
+    uint32_t depth;
+    uint32_t peak_depth;
+    uint32_t posted;
+    uint32_t published;
+    uint32_t coalesced;     /* replaced a queued value of a state topic */
+    uint32_t downgraded;    /* sent at QoS 0 above the high-water mark */
+    uint32_t dropped;       /* outbox full or out of memory */
+    uint32_t errors;        /* rejected by the MQTT client */
+    uint32_t by_ref;        /* payloads held in a frame buffer instead of copied */
+    uint32_t arena_peak;    /* most arena bytes in use at once */
+    uint32_t latency_p50_us;
+    uint32_t latency_p99_us;
+    uint32_t latency_max_us;
+} mqtt_outbox_stats_t;
+
+esp_err_t mqtt_outbox_init( void );
+
+/**
+ * Copies 'len' bytes of 'data' for 'topic'. Never blocks; returns
+ * ESP_ERR_NO_MEM when the message had to be dropped.
+ */
+esp_err_t mqtt_outbox_post( const char *topic, const char *data, size_t len );
+
+/**
+ * Same, for 'len' bytes of 'data' inside 'buf': the outbox takes its own
+ * reference instead of a copy (the caller still releases its one).
+ * Copies after all when fewer than FRAME_POOL_RESERVE buffers are free.
+ */
+esp_err_t mqtt_outbox_post_buf( const char *topic, frame_buf_t *buf, const char *data, size_t len );
+
+void mqtt_outbox_get_stats( mqtt_outbox_stats_t *stats );
+
+/**
+ * The single consumer
+ */
+void task_mqtt_publisher( void *pvParameter );
+
+#endif
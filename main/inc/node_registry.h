@@ -0,0 +1,75 @@
+#ifndef __NODE_REGISTRY_H__
+#define __NODE_REGISTRY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sdkconfig.h"
+
+/**
+ * Root-side table of connected nodes, keyed by the 6-byte mesh address.
+ * Open addressing with linear probing; the capacity is the next power of
+ * two holding twice CONFIG_MESH_ROUTE_TABLE_SIZE so the load factor stays
+ * at or below 0.5.
+ *
+ * Each registered node also gets a dense node index in
+ * [0, CONFIG_MESH_ROUTE_TABLE_SIZE), stable while it stays registered,
+ * so other modules can keep per-node state in plain arrays.
+ *
+ * A second table of the same capacity indexes the slots by node id,
+ * for MQTT commands addressed by id.
+ */
+#if   CONFIG_MESH_ROUTE_TABLE_SIZE <= 16
+#define NODE_REGISTRY_CAPACITY  ( 32 )
+#elif CONFIG_MESH_ROUTE_TABLE_SIZE <= 32
+#define NODE_REGISTRY_CAPACITY  ( 64 )
+#elif CONFIG_MESH_ROUTE_TABLE_SIZE <= 64
+#define NODE_REGISTRY_CAPACITY  ( 128 )
+#elif CONFIG_MESH_ROUTE_TABLE_SIZE <= 128
+#define NODE_REGISTRY_CAPACITY  ( 256 )
+#elif CONFIG_MESH_ROUTE_TABLE_SIZE <= 256
+#define NODE_REGISTRY_CAPACITY  ( 512 )
+#else
+#define NODE_REGISTRY_CAPACITY  ( 1024 )
+#endif
+
+#define NODE_ID_LEN             ( 8 )
+
+void node_registry_init( void );
+
+/**
+ * Inserts the node or refreshes its id. Returns the node index, or -1
+ * when CONFIG_MESH_ROUTE_TABLE_SIZE nodes are already registered.
+ * 'created' (may be NULL) tells whether the index was newly assigned,
+ * i.e. per-node state kept elsewhere must be reset.
+ */
+int node_registry_upsert( const uint8_t mac[6], const char *id, bool *created );
+
+/**
+ * Returns the node index and copies its id into 'id' (when not NULL),
+ * or -1 if the node is unknown.
+ */
+int node_registry_lookup( const uint8_t mac[6], char *id, size_t id_len );
+
+/**
+ * Removes the node, copying its id into 'id' (when not NULL) first.
+ * Returns the released node index or -1 if the node is unknown.
+ */
+int node_registry_remove( const uint8_t mac[6], char *id, size_t id_len );
+
+/**
+ * Lookup by node id; copies the address into 'mac' (when not NULL).
+ * Returns the node index or -1 if no registered node has that id.
+ */
+int node_registry_find_id( const char *id, uint8_t mac[6] );
+
+/**
+ * Reverse lookup by node index; 'mac' and 'id' may be NULL.
+ * Returns false if no node holds the index.
+ */
+bool node_registry_get( int index, uint8_t mac[6], char *id, size_t id_len );
+
+int node_registry_count( void );
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef __REGISTRATION_H__
+#define __REGISTRATION_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_mesh.h"
+
+#include "mesh_proto.h"
+
+/**
+ * Node registration (Connect-Mesh) with acknowledgements.
+ *
+ * A node announces itself with MESH_MSG_CONNECT at a random time within
+ * a window, then waits for the root's MESH_MSG_CONNECT_ACK. A missing ack
+ * is retried after CONFIG_APP_REG_ACK_TIMEOUT_MS, doubling up to
+ * CONFIG_APP_REG_BACKOFF_MAX_MS, each wait cut randomly by up to half so
+ * retries of nodes that lost the same burst spread out.
+ *
+ * The window is CONFIG_APP_REG_SLOT_MS per node in the mesh, at least
+ * CONFIG_APP_REG_JITTER_MS, so after a root change the new root sees the
+ * announcements at a steady rate rather than all at once. A node starts
+ * over on a new parent, a new root address and MESH_EVENT_ROOT_SWITCH_ACK;
+ * a root that took over from another one, or is asked to over MQTT
+ * (cmd/<root id>/reregister), broadcasts MESH_MSG_REREGISTER.
+ */
+
+typedef enum {
+    REG_UNREGISTERED = 0,   /* announcement scheduled, not sent */
+    REG_WAIT_ACK,
+    REG_REGISTERED,
+} reg_phase_t;
+
+/**
+ * Per-node state machine; all times are esp_timer_get_time() microseconds.
+ */
+typedef struct {
+    uint8_t  phase;
+    bool     sent;          /* an announcement went out since the reset */
+    uint32_t first_seq;     /* seq of that announcement; later acks also count */
+    uint32_t backoff_ms;    /* next ack wait before the random cut */
+    int64_t  next_us;       /* announcement or retry due */
+} reg_state_t;
+
+typedef struct {
+    uint32_t announced;
+    uint32_t retries;
+    uint32_t acked;
+    uint32_t restarts;
+    uint32_t acks_sent;     /* root */
+    uint32_t sweeps;        /* root */
+} registration_stats_t;
+
+/**
+ * Schedules the first announcement at a random time within 'window_ms'
+ */
+void reg_reset( reg_state_t *reg, int64_t now_us, uint32_t window_ms );
+
+/**
+ * True once an announcement (first one or a retry) should go out
+ */
+bool reg_due( const reg_state_t *reg, int64_t now_us );
+
+/**
+ * Records an announcement with sequence number 'seq' and arms the ack wait
+ */
+void reg_sent( reg_state_t *reg, int64_t now_us, uint32_t seq );
+
+/**
+ * Takes an ack; returns true if it completed the registration
+ */
+bool reg_ack( reg_state_t *reg, uint32_t seq );
+
+/**
+ * Announcement window for a mesh of 'nodes' nodes
+ */
+uint32_t registration_window_ms( int nodes );
+
+/**
+ * Node: announce again within the window for the current mesh size.
+ * A pending first announcement is kept, so back-to-back triggers
+ * (new parent, then new root) cost one announcement. Any context.
+ */
+void registration_restart( void );
+
+bool registration_is_registered( void );
+
+/**
+ * Node: the heartbeat slot and root session the last ack assigned;
+ * false while not registered or the root gave no slot
+ */
+bool registration_get_slot( uint16_t *slot, uint8_t *epoch );
+
+/**
+ * Root: this root's session epoch, random and never 0, stamped into
+ * every ack so slots handed out by a previous root are told apart
+ */
+uint8_t registration_epoch( void );
+
+/**
+ * Node: takes a MESH_MSG_CONNECT_ACK or MESH_MSG_REREGISTER from 'from'
+ */
+void registration_node_handle( const mesh_addr_t *from, const mesh_frame_t *frame );
+
+/**
+ * Root: acknowledges a MESH_MSG_CONNECT, handing out heartbeat 'slot'
+ * (MESH_SLOT_NONE if there is none)
+ */
+void registration_root_ack( const mesh_frame_t *frame, mesh_reg_status_t status, uint16_t slot );
+
+/**
+ * Root: queues a MESH_MSG_REREGISTER broadcast; 'all' also reaches the
+ * nodes that registered with this root already
+ */
+void registration_request_sweep( bool all );
+
+/**
+ * Called by task_mesh_tx: sends the due announcement on a node, the
+ * requested sweep on the root. Returns how long (ms) until it wants to
+ * be called again.
+ */
+uint32_t registration_poll( void );
+
+void registration_get_stats( registration_stats_t *stats );
+
+#endif
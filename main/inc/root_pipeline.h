@@ -0,0 +1,85 @@
+#ifndef __ROOT_PIPELINE_H__
+#define __ROOT_PIPELINE_H__
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_mesh.h"
+#include "freertos/FreeRTOS.h"
+
+#include "frame_pool.h"
+
+/**
+ * Root frame pipeline, three stages joined by bounded queues:
+ *
+ *   receive   task_mesh_rx drains every frame already pending in the
+ *             mesh stack (up to CONFIG_APP_ROOT_RX_BATCH) without going
+ *             back to sleep; its queue is the stack's receive queue
+ *   route     CONFIG_APP_ROOT_WORKERS task_root_worker tasks decode and
+ *             route frames (app_root_handle_frame); a node's frames
+ *             always go to the same worker, so they stay in order
+ *   publish   the MQTT outbox and task_mqtt_publisher
+ *
+ * Between receive and route every node (by MAC, through its registry
+ * index; unregistered senders share one) has a token bucket of
+ * CONFIG_APP_ROOT_NODE_RATE frames/s and CONFIG_APP_ROOT_NODE_BURST
+ * frames, and a queue of CONFIG_APP_ROOT_FLOW_LEN frames. Frames over
+ * either are dropped and counted. Each worker serves the queues of its
+ * nodes round robin, one frame per node per round, so a flooding node
+ * gets no more frames routed than any other node with frames queued.
+ *
+ * A frame travels as a reference to its frame buffer. Every stage keeps
+ * its queue depth and service time; the publish stage's are in
+ * mqtt_outbox_stats_t.
+ */
+typedef struct {
+    uint32_t frames;
+    uint32_t depth;         /* frames queued for the stage now */
+    uint32_t peak_depth;
+    uint32_t dropped;       /* stage queue full */
+    uint64_t busy_us;       /* total service time */
+    uint32_t max_us;        /* longest single service */
+} root_stage_stats_t;
+
+typedef struct {
+    root_stage_stats_t rx;  /* service: one batch, from the first frame to the last hand-over */
+    uint32_t batches;
+    uint32_t batch_max;
+    root_stage_stats_t route;
+    uint32_t limited;       /* over a node's rate */
+    uint32_t flow_full;     /* over a node's queue */
+} root_pipeline_stats_t;
+
+/**
+ * Creates the worker queues and tasks
+ */
+esp_err_t root_pipeline_start( void );
+
+/**
+ * Queues 'fb' for the worker of 'from', waiting up to 'wait' ticks for
+ * room; the pipeline takes its own reference. ESP_ERR_INVALID_STATE
+ * when the node is over its rate or queue, ESP_ERR_TIMEOUT when there
+ * was no room.
+ */
+esp_err_t root_pipeline_submit( const mesh_addr_t *from, frame_buf_t *fb, mesh_proto_t proto, TickType_t wait );
+
+/**
+ * Resets the bucket and counters of a newly assigned node index
+ */
+void root_pipeline_forget( int node_index );
+
+/**
+ * Publishes the overload counters, and the nodes dropped since the last
+ * call, on "ESP-stats/overload"
+ */
+void root_pipeline_publish_overload( void );
+
+/**
+ * Accounts a receive batch of 'frames' taking 'us', with 'pending'
+ * frames still in the mesh stack after it
+ */
+void root_pipeline_rx_done( uint32_t frames, uint32_t us, uint32_t pending );
+
+void root_pipeline_get_stats( root_pipeline_stats_t *stats );
+
+#endif
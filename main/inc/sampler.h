@@ -0,0 +1,52 @@
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "mesh_proto.h"
+
+/**
+ * Sensor sampling engine. task_sampler reads the sensor at
+ * CONFIG_APP_SAMPLE_RATE_HZ and folds every sample into the aggregates
+ * of the current window (count, min, max, mean, last) in fixed memory.
+ *
+ * Every CONFIG_APP_SAMPLE_WINDOW_S the window is closed and an
+ * INPUT_SRC_SUMMARY event is posted; a sample reaching a threshold or
+ * moving by more than CONFIG_APP_SAMPLE_DELTA_MAX posts an
+ * INPUT_SRC_SENSOR event at once. task_mesh_tx collects the pending
+ * summary or alert and sends it, so raw samples never reach the mesh.
+ */
+typedef int32_t (*sampler_read_t)( void );
+
+typedef struct {
+    uint32_t samples;
+    uint32_t windows;
+    uint32_t alerts;
+    uint32_t overruns;      /* summaries or alerts replaced before they were sent */
+} sampler_stats_t;
+
+/**
+ * Starts task_sampler on 'read'; with CONFIG_APP_SAMPLE_RATE_HZ 0 the
+ * sensor is only read on demand by sampler_last()
+ */
+esp_err_t sampler_start( sampler_read_t read );
+
+/**
+ * Latest sample, or a fresh reading when the sampler is not running
+ */
+int32_t sampler_last( void );
+
+/**
+ * Take the pending summary / alert; false if there is none
+ */
+bool sampler_take_summary( mesh_payload_summary_t *summary );
+bool sampler_take_alert( mesh_payload_alert_t *alert );
+
+void sampler_get_stats( sampler_stats_t *stats );
+
+void task_sampler( void *pvParameter );
+
+#endif
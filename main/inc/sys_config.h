@@ -2,9 +2,11 @@
 #define _SYSCONFIG__H
 
 /**
- * NODE_ID
+ * NODE_ID; the host simulator gives every virtual node its own
  */
+#ifndef NODE_ID
 #define NODE_ID "1"
+#endif
 
 /**
  * GPIOs defs
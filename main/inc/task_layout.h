@@ -0,0 +1,66 @@
+#ifndef __TASK_LAYOUT_H__
+#define __TASK_LAYOUT_H__
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/**
+ * Core, priority and stack of every application task, from the "Task
+ * layout" menu. A core of -1 leaves the task to the scheduler.
+ *
+ * The default layout keeps core 0 for the network side (Wi-Fi/mesh,
+ * lwIP, the MQTT client and task_mqtt_publisher, which writes to its
+ * socket) and moves mesh receive, the root's frame handling and the
+ * other application tasks, the root's decode/route workers among them,
+ * to core 1.
+ */
+typedef enum {
+    TASK_LAYOUT_MESH_RX = 0,
+    TASK_LAYOUT_MESH_SENDER,
+    TASK_LAYOUT_MESH_TX,
+    TASK_LAYOUT_STATS,
+    TASK_LAYOUT_MQTT_PUBLISHER,
+    TASK_LAYOUT_SAMPLER,
+    TASK_LAYOUT_FRAG,
+    TASK_LAYOUT_DOWNLINK,
+    TASK_LAYOUT_FWDLOG,
+    TASK_LAYOUT_MESH_REJOIN,
+    TASK_LAYOUT_ROOT_WORKER,    /* every task_root_worker */
+    TASK_LAYOUT_COUNT
+} task_layout_id_t;
+
+/**
+ * The MQTT client task is created by esp-mqtt: its priority and stack
+ * go into esp_mqtt_client_config_t, its core is the ESP-MQTT component
+ * option (MQTT_TASK_CORE_SELECTION_ENABLED)
+ */
+#define TASK_LAYOUT_MQTT_CLIENT_PRIO    ( CONFIG_APP_TASK_MQTT_CLIENT_PRIO )
+#define TASK_LAYOUT_MQTT_CLIENT_STACK   ( CONFIG_APP_TASK_MQTT_CLIENT_STACK )
+
+/**
+ * Per-core load from the FreeRTOS run-time counters: a sample holds the
+ * idle task counters of every core; two samples give the busy share of
+ * each core in between. All zero without
+ * CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+ */
+typedef struct {
+    uint32_t total;
+    uint32_t idle[portNUM_PROCESSORS];
+} task_cpu_sample_t;
+
+/**
+ * xTaskCreatePinnedToCore() with the configured layout of 'id'
+ */
+BaseType_t task_layout_create( task_layout_id_t id, TaskFunction_t fn, const char *name,
+                               void *param, TaskHandle_t *task );
+
+void task_layout_cpu_sample( task_cpu_sample_t *sample );
+
+/**
+ * Busy percentage of 'core' between two samples
+ */
+uint32_t task_layout_cpu_busy( const task_cpu_sample_t *prev, const task_cpu_sample_t *now, int core );
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include <stdint.h>
+
+#include "mesh_proto.h"
+
+/**
+ * Tree shape and link quality for capacity planning.
+ *
+ * Every node reports its parent, layer, direct children, subtree size,
+ * parent RSSI, frames queued for the parent and its own tx/rx rate every
+ * CONFIG_APP_TOPO_PERIOD_S (MESH_MSG_TOPOLOGY). The root keeps the last
+ * report of every node index and adds, per node, the rate its uplink
+ * carries for its whole subtree ("load") and the median latency the hop
+ * to its parent adds ("hop").
+ *
+ * Every CONFIG_APP_TOPO_PERIOD_S the root publishes on "ESP-topo" the
+ * nodes whose parent, layer or children changed, whose RSSI moved by
+ * CONFIG_APP_TOPO_RSSI_DELTA dB or whose rates moved by
+ * CONFIG_APP_TOPO_RATE_DELTA_PCT percent since they were last published,
+ * and the ids that left; every CONFIG_APP_TOPO_FULL_EVERY publishes all
+ * of them. A message (split when long) is
+ *
+ *   {"ver":n,"full":false,"layers":[nodes in layer 1,..],"gone":["id",..],
+ *    "nodes":[{"id":"..","p":"<parent id or MAC>","l":layer,"c":children,
+ *    "s":subtree,"rssi":dBm,"q":tx_pending,"tx":B/s,"rx":B/s,"load":B/s,"hop":us},..]}
+ *
+ * where "gone" applies before "nodes"; the parts after the first carry
+ * "ver", "full" and "nodes" only. The root itself is in the graph
+ * under its own id, its parent being the router's BSSID.
+ */
+
+/**
+ * Fills this node's report; the rates cover the time since the
+ * previous call
+ */
+void topology_snapshot( mesh_payload_topology_t *topo );
+
+/**
+ * Root: stores the report of node 'node_index' from 'frame'
+ */
+void topology_store( int node_index, const mesh_frame_t *frame );
+
+/**
+ * Root: drops the report of a released or newly assigned node index;
+ * a node already published is listed as gone
+ */
+void topology_forget( int node_index );
+
+/**
+ * Root: publishes the changes since the last call, or everything
+ */
+void topology_publish( void );
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef __TRACE_STATS_H__
+#define __TRACE_STATS_H__
+
+#include <stdint.h>
+
+/**
+ * End-to-end latency tracing: nodes stamp each reading with the mesh
+ * TSF time, the root measures the age of the reading when it hands it
+ * to MQTT and keeps per-node and per-layer histograms.
+ */
+
+/**
+ * Low 32 bits of the mesh TSF time, in microseconds
+ */
+uint32_t trace_now( void );
+
+/**
+ * Converts a local esp_timer_get_time() timestamp (0: now) to trace time
+ */
+uint32_t trace_stamp( int64_t local_us );
+
+/**
+ * Local esp_timer_get_time() time of a trace timestamp; now if the
+ * timestamp is missing or the sender was not synchronised
+ */
+int64_t trace_to_local( uint32_t origin_ts );
+
+/**
+ * Root: records the latency of a reading from node 'node_index'
+ * (-1 if unregistered) that entered the mesh at 'layer'
+ */
+void trace_stats_record( int node_index, uint8_t layer, uint32_t origin_ts );
+
+/**
+ * Root: clears the histogram of a newly assigned node index
+ */
+void trace_stats_forget( int node_index );
+
+/**
+ * Root: median latency of node 'node_index' so far, 0 without samples
+ */
+uint32_t trace_stats_node_p50( int node_index );
+
+/**
+ * Root: publishes p50/p95/p99 per layer on "ESP-stats/latency" and per
+ * node on "ESP-stats/latency/nodes"
+ */
+void trace_stats_publish( void );
+
+#endif
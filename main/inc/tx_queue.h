@@ -0,0 +1,110 @@
+#ifndef __TX_QUEUE_H__
+#define __TX_QUEUE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_mesh.h"
+#include "freertos/FreeRTOS.h"
+
+#include "mesh_proto.h"
+
+/**
+ * Bounded multi-producer transmit queue: producers fill preallocated
+ * frame slots and one sender task (task_mesh_sender) drains them,
+ * highest priority class first.
+ */
+#define TX_FRAME_MAX    ( MESH_PROTO_FRAME_MAX )
+
+typedef enum {
+    TX_PRIO_CONTROL = 0,    /* registration, acks, commands */
+    TX_PRIO_TELEMETRY,      /* sensor readings */
+    TX_PRIO_BULK,           /* stats, logs, replays */
+    TX_PRIO_MAX
+} tx_prio_t;
+
+/**
+ * What a producer wants when every slot is taken
+ */
+typedef enum {
+    TX_POLICY_DROP_NEW = 0, /* fail the new frame */
+    TX_POLICY_DROP_OLDEST,  /* recycle the oldest queued frame of the same class */
+    TX_POLICY_BLOCK,        /* wait up to the given timeout for a slot */
+} tx_policy_t;
+
+typedef enum {
+    TX_DEST_ROOT = 0,       /* esp_mesh_send( NULL, ... ) */
+    TX_DEST_ADDR,           /* unicast to 'to' */
+    TX_DEST_ALL,            /* root broadcast through mesh_fanout */
+} tx_dest_t;
+
+typedef struct tx_frame tx_frame_t;
+
+/**
+ * Called from the sender task once the frame has been handed to the
+ * mesh stack (or failed), or from a producer's tx_queue_alloc() when the
+ * frame is recycled under TX_POLICY_DROP_OLDEST (err ESP_ERR_TIMEOUT).
+ * The slot is reused right after it returns.
+ */
+typedef void (*tx_done_cb_t)( const tx_frame_t *frame, esp_err_t err, void *arg );
+
+struct tx_frame {
+    tx_dest_t       dest;
+    mesh_addr_t     to;
+    mesh_proto_t    proto;
+    int             flag;
+    uint8_t         prio;
+    bool            persist;    /* kept in the fwdlog if it cannot be sent */
+    uint16_t        len;
+    int64_t         stamp_us;   /* input event time, for latency accounting */
+    tx_done_cb_t    done;
+    void           *arg;
+    const uint8_t  *tail;       /* sent after data, up to MESH_MPS in all; must outlive the frame */
+    uint16_t        tail_len;
+    uint8_t         data[TX_FRAME_MAX];
+};
+
+typedef struct {
+    uint32_t depth[TX_PRIO_MAX];
+    uint32_t enqueued[TX_PRIO_MAX];
+    uint32_t dropped[TX_PRIO_MAX];
+    uint32_t sent;
+    uint32_t send_errors;
+    uint32_t free_slots;
+} tx_queue_stats_t;
+
+esp_err_t tx_queue_init( void );
+
+/**
+ * Takes a free slot for class 'prio', applying 'policy' when the pool is
+ * exhausted. The slot comes back zeroed apart from 'prio' and with
+ * proto MESH_PROTO_BIN, flag MESH_DATA_P2P, dest TX_DEST_ROOT.
+ * Returns NULL when the frame has to be dropped.
+ */
+tx_frame_t *tx_queue_alloc( tx_prio_t prio, tx_policy_t policy, TickType_t timeout );
+
+/**
+ * Queues a slot obtained from tx_queue_alloc()
+ */
+void tx_queue_submit( tx_frame_t *frame );
+
+/**
+ * Returns an unused slot obtained from tx_queue_alloc()
+ */
+void tx_queue_release( tx_frame_t *frame );
+
+/**
+ * Copies 'len' bytes into a new slot and queues it for the root
+ */
+esp_err_t tx_queue_send_to_root( const uint8_t *data, uint16_t len, tx_prio_t prio,
+                                 tx_policy_t policy, TickType_t timeout );
+
+void tx_queue_get_stats( tx_queue_stats_t *stats );
+
+/**
+ * The single consumer
+ */
+void task_mesh_sender( void *pvParameter );
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __UPLINK_BATCH_H__
+#define __UPLINK_BATCH_H__
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * Root: collects node readings and publishes them together on
+ * "ESP-batch" once CONFIG_APP_BATCH_MAX_RECORDS are queued or the
+ * oldest one is CONFIG_APP_BATCH_WINDOW_MS old:
+ *
+ *   {"t0":<root uptime ms>,"r":[[node_id,seq,t-t0 ms,value],...]}
+ *
+ * With CONFIG_APP_BATCH_ENABLE off every reading goes straight out on
+ * "ESP-send", as before.
+ */
+typedef struct {
+    uint32_t batches;
+    uint32_t records;
+    uint32_t dropped;
+} uplink_batch_stats_t;
+
+esp_err_t uplink_batch_init( void );
+
+/**
+ * 'sampled_us' is the esp_timer_get_time() time the reading was taken at.
+ * ESP_OK once the reading is queued, ESP_ERR_NO_MEM when it was dropped.
+ */
+esp_err_t uplink_batch_add( uint16_t node_id, uint32_t seq, int64_t sampled_us, int32_t value );
+
+/**
+ * Publishes whatever is queued
+ */
+void uplink_batch_flush( void );
+
+/**
+ * Publishes the batch if its window closed; task_mesh_tx calls it on
+ * every wake-up, and the window timer wakes it
+ */
+void uplink_batch_poll( void );
+
+void uplink_batch_get_stats( uplink_batch_stats_t *stats );
+
+#endif
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+/**
+ * Drivers;
+ */
+#include "driver/gpio.h"
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "input_events.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "input: ";
+
+#define INPUT_QUEUE_LEN     ( 16 )
+#define INPUT_GPIO_MAX      ( 4 )
+
+/**
+ * Per-pin ISR context
+ */
+typedef struct {
+    gpio_num_t gpio;
+    uint8_t    source;
+    int64_t    debounce_us;
+    int64_t    last_us;
+} input_gpio_t;
+
+static QueueHandle_t input_queue = NULL;
+static input_gpio_t input_gpios[INPUT_GPIO_MAX];
+static int input_gpio_count = 0;
+
+static input_latency_t latency = { 0, };
+static portMUX_TYPE latency_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Edge ISR: debounce on the timestamp of the last accepted edge and
+ * hand the event to the waiting task.
+ */
+static void IRAM_ATTR input_gpio_isr( void *arg )
+{
+    input_gpio_t *pin = (input_gpio_t *)arg;
+    BaseType_t woken = pdFALSE;
+    int64_t now = esp_timer_get_time();
+
+    if( now - pin->last_us < pin->debounce_us )
+    {
+        return;
+    }
+    pin->last_us = now;
+
+    input_event_t event = {
+        .source = pin->source,
+        .level = gpio_get_level( pin->gpio ),
+        .value = 0,
+        .timestamp_us = now,
+    };
+    if( xQueueSendFromISR( input_queue, &event, &woken ) != pdTRUE )
+    {
+        portENTER_CRITICAL_ISR( &latency_lock );
+        latency.dropped++;
+        portEXIT_CRITICAL_ISR( &latency_lock );
+    }
+    if( woken )
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+esp_err_t input_events_init( void )
+{
+    if( input_queue )
+    {
+        return ESP_OK;
+    }
+    input_queue = xQueueCreate( INPUT_QUEUE_LEN, sizeof( input_event_t ) );
+    if( !input_queue )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return gpio_install_isr_service( 0 );
+}
+
+esp_err_t input_events_add_gpio( gpio_num_t gpio, input_source_t source,
+                                 gpio_int_type_t edge, uint32_t debounce_ms )
+{
+    if( !input_queue || input_gpio_count >= INPUT_GPIO_MAX )
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    input_gpio_t *pin = &input_gpios[input_gpio_count++];
+    pin->gpio = gpio;
+    pin->source = source;
+    pin->debounce_us = (int64_t)debounce_ms * 1000;
+    pin->last_us = -pin->debounce_us;
+
+    gpio_set_intr_type( gpio, edge );
+    return gpio_isr_handler_add( gpio, input_gpio_isr, pin );
+}
+
+esp_err_t input_events_post( input_source_t source, int32_t value )
+{
+    input_event_t event = {
+        .source = source,
+        .level = 0,
+        .value = value,
+        .timestamp_us = esp_timer_get_time(),
+    };
+
+    if( !input_queue || xQueueSend( input_queue, &event, 0 ) != pdTRUE )
+    {
+        portENTER_CRITICAL( &latency_lock );
+        latency.dropped++;
+        portEXIT_CRITICAL( &latency_lock );
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+bool input_events_wait( input_event_t *event, TickType_t timeout )
+{
+    if( !input_queue )
+    {
+        vTaskDelay( timeout );
+        return false;
+    }
+    return xQueueReceive( input_queue, event, timeout ) == pdTRUE;
+}
+
+void input_latency_record( int64_t timestamp_us )
+{
+    int64_t elapsed = esp_timer_get_time() - timestamp_us;
+
+    portENTER_CRITICAL( &latency_lock );
+    latency.count++;
+    latency.total_us += elapsed;
+    if( elapsed > latency.max_us )
+    {
+        latency.max_us = elapsed;
+    }
+    portEXIT_CRITICAL( &latency_lock );
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "input-to-send %lld us (avg %lld, max %lld, n=%u)",
+                  (long long)elapsed, (long long)( latency.total_us / latency.count ),
+                  (long long)latency.max_us, latency.count );
+    #endif
+}
+
+void input_latency_get( input_latency_t *out )
+{
+    portENTER_CRITICAL( &latency_lock );
+    *out = latency;
+    portEXIT_CRITICAL( &latency_lock );
+}
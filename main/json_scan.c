@@ -0,0 +1,255 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "json_scan.h"
+
+static const char *skip_ws( const char *p, const char *end )
+{
+    while( p < end && ( *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' ) )
+    {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * 'p' points just past the opening quote; returns the closing quote
+ * or NULL if the string is not terminated inside the buffer.
+ */
+static const char *skip_string( const char *p, const char *end )
+{
+    while( p < end )
+    {
+        if( *p == '\\' )
+        {
+            p += 2;
+            continue;
+        }
+        if( *p == '"' )
+        {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ * Skips a nested object or array starting at 'p'; returns the position
+ * after its closing bracket or NULL if unbalanced.
+ */
+static const char *skip_nested( const char *p, const char *end )
+{
+    int depth = 0;
+
+    while( p < end )
+    {
+        switch( *p )
+        {
+            case '"':
+                p = skip_string( p + 1, end );
+                if( !p )
+                {
+                    return NULL;
+                }
+                break;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if( --depth == 0 )
+                {
+                    return p + 1;
+                }
+                break;
+            default:
+                break;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+int json_scan( const char *buf, size_t len, json_field_t *fields, int count )
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    int found = 0;
+
+    for( int i = 0; i < count; i++ )
+    {
+        fields[i].value = NULL;
+        fields[i].value_len = 0;
+        fields[i].is_string = false;
+    }
+
+    p = skip_ws( p, end );
+    if( p >= end || *p != '{' )
+    {
+        return -1;
+    }
+    p = skip_ws( p + 1, end );
+    if( p < end && *p == '}' )
+    {
+        return 0;
+    }
+
+    while( p < end )
+    {
+        /**
+         * "key"
+         */
+        if( *p != '"' )
+        {
+            return -1;
+        }
+        const char *key = p + 1;
+        p = skip_string( key, end );
+        if( !p )
+        {
+            return -1;
+        }
+        size_t key_len = p - key;
+
+        p = skip_ws( p + 1, end );
+        if( p >= end || *p != ':' )
+        {
+            return -1;
+        }
+        p = skip_ws( p + 1, end );
+        if( p >= end )
+        {
+            return -1;
+        }
+
+        /**
+         * value
+         */
+        const char *value = p;
+        size_t value_len;
+        bool is_string = false;
+
+        if( *p == '"' )
+        {
+            value = p + 1;
+            p = skip_string( value, end );
+            if( !p )
+            {
+                return -1;
+            }
+            value_len = p - value;
+            is_string = true;
+            p++;
+        }
+        else if( *p == '{' || *p == '[' )
+        {
+            p = skip_nested( p, end );
+            if( !p )
+            {
+                return -1;
+            }
+            value_len = p - value;
+        }
+        else
+        {
+            while( p < end && *p != ',' && *p != '}' && *p != ' ' &&
+                   *p != '\t' && *p != '\r' && *p != '\n' )
+            {
+                p++;
+            }
+            value_len = p - value;
+            if( value_len == 0 )
+            {
+                return -1;
+            }
+        }
+
+        for( int i = 0; i < count; i++ )
+        {
+            if( !fields[i].value && strlen( fields[i].key ) == key_len &&
+                memcmp( fields[i].key, key, key_len ) == 0 )
+            {
+                fields[i].value = value;
+                fields[i].value_len = value_len;
+                fields[i].is_string = is_string;
+                found++;
+                break;
+            }
+        }
+
+        p = skip_ws( p, end );
+        if( p >= end )
+        {
+            return -1;
+        }
+        if( *p == '}' )
+        {
+            return found;
+        }
+        if( *p != ',' )
+        {
+            return -1;
+        }
+        p = skip_ws( p + 1, end );
+    }
+    return -1;
+}
+
+bool json_field_eq( const json_field_t *field, const char *s )
+{
+    return field->value && field->is_string && strlen( s ) == field->value_len &&
+           memcmp( field->value, s, field->value_len ) == 0;
+}
+
+bool json_field_copy( const json_field_t *field, char *out, size_t size )
+{
+    if( !field->value || size == 0 )
+    {
+        return false;
+    }
+    size_t n = field->value_len < size - 1 ? field->value_len : size - 1;
+    memcpy( out, field->value, n );
+    out[n] = '\0';
+    return true;
+}
+
+bool json_field_int( const json_field_t *field, int32_t *out )
+{
+    const char *p = field->value;
+    const char *end;
+    bool negative = false;
+    int64_t v = 0;
+
+    if( !p || field->value_len == 0 )
+    {
+        return false;
+    }
+    end = p + field->value_len;
+    if( *p == '-' )
+    {
+        negative = true;
+        p++;
+    }
+    if( p >= end )
+    {
+        return false;
+    }
+    for( ; p < end; p++ )
+    {
+        if( *p < '0' || *p > '9' )
+        {
+            return false;
+        }
+        v = v * 10 + ( *p - '0' );
+        if( v > INT32_MAX )
+        {
+            return false;
+        }
+    }
+    *out = (int32_t)( negative ? -v : v );
+    return true;
+}
@@ -0,0 +1,82 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "latency_hist.h"
+
+#define HIST_BASE_SHIFT     ( 8 )   /* first bucket: < 256 us */
+
+/**
+ * Bucket 2k covers [2^(k+8), 1.5 * 2^(k+8)), bucket 2k+1 the rest of
+ * the octave; values below 256 us land in bucket 0.
+ */
+static int bucket_of( uint32_t us )
+{
+    if( us < ( 1u << HIST_BASE_SHIFT ) )
+    {
+        return 0;
+    }
+
+    int msb = 31 - __builtin_clz( us );
+    int half = ( us >> ( msb - 1 ) ) & 1;
+    int b = 2 * ( msb - HIST_BASE_SHIFT ) + half + 1;
+
+    return b < LATENCY_HIST_BUCKETS ? b : LATENCY_HIST_BUCKETS - 1;
+}
+
+static uint32_t bucket_upper( int b )
+{
+    if( b == 0 )
+    {
+        return 1u << HIST_BASE_SHIFT;
+    }
+    int octave = ( b - 1 ) / 2 + HIST_BASE_SHIFT;
+    return ( b - 1 ) % 2 ? ( 1u << ( octave + 1 ) ) : ( 3u << ( octave - 1 ) );
+}
+
+void latency_hist_reset( latency_hist_t *hist )
+{
+    memset( hist, 0, sizeof( *hist ) );
+}
+
+void latency_hist_add( latency_hist_t *hist, uint32_t us )
+{
+    int b = bucket_of( us );
+
+    if( hist->bucket[b] == UINT16_MAX )
+    {
+        hist->count = 0;
+        for( int i = 0; i < LATENCY_HIST_BUCKETS; i++ )
+        {
+            hist->bucket[i] >>= 1;
+            hist->count += hist->bucket[i];
+        }
+    }
+    hist->bucket[b]++;
+    hist->count++;
+    if( us > hist->max_us )
+    {
+        hist->max_us = us;
+    }
+}
+
+uint32_t latency_hist_percentile( const latency_hist_t *hist, int percentile )
+{
+    if( hist->count == 0 )
+    {
+        return 0;
+    }
+
+    uint32_t target = ( (uint64_t)hist->count * percentile + 99 ) / 100;
+    uint32_t seen = 0;
+
+    for( int b = 0; b < LATENCY_HIST_BUCKETS; b++ )
+    {
+        seen += hist->bucket[b];
+        if( seen >= target && seen > 0 )
+        {
+            uint32_t upper = bucket_upper( b );
+            return upper < hist->max_us ? upper : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+
+/**
+ * Mesh Net;
+ */
+#include "esp_mesh.h"
+
+#include "liveness.h"
+#include "app.h"
+#include "mesh.h"
+#include "registration.h"
+#include "node_registry.h"
+#include "tx_queue.h"
+#include "mqtt_app.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "liveness: ";
+
+/**
+ * One bit per node index
+ */
+#define LIVENESS_SLOTS          ( CONFIG_MESH_ROUTE_TABLE_SIZE )
+#define LIVENESS_BITMAP_SIZE    ( ( LIVENESS_SLOTS + 7 ) / 8 )
+
+#if LIVENESS_SLOTS > MESH_HEARTBEAT_SLOTS
+#error "CONFIG_MESH_ROUTE_TABLE_SIZE does not fit in a heartbeat bitmap"
+#endif
+
+/**
+ * Timer wheel of one-second buckets; a deadline further out than the
+ * wheel simply stays in its bucket for more turns
+ */
+#define WHEEL_SIZE              ( 64 )
+#define WHEEL_MASK              ( WHEEL_SIZE - 1 )
+
+/**
+ * Offline ids listed in one ESP-fleet message
+ */
+#define LIVENESS_FLEET_IDS      ( 16 )
+#define LIVENESS_FLEET_SIZE     ( 64 + LIVENESS_FLEET_IDS * ( NODE_ID_LEN + 3 ) )
+
+typedef enum {
+    LIVE_UNUSED = 0,        /* no registered node holds the index */
+    LIVE_ONLINE,            /* timer armed */
+    LIVE_OFFLINE,
+} live_state_t;
+
+/**
+ * Wheel links are node index + 1, 0 ending the list, so the zeroed
+ * table is an empty wheel
+ */
+typedef struct {
+    uint16_t next;
+    uint16_t prev;
+    uint32_t deadline_s;
+    uint8_t  state;
+} live_node_t;
+
+/**
+ * Root: the table, the wheel and its clock
+ */
+static live_node_t table[LIVENESS_SLOTS];
+static uint16_t wheel[WHEEL_SIZE];
+static uint32_t now_s = 0;
+static uint16_t expired[LIVENESS_SLOTS];
+static char fleet_msg[LIVENESS_FLEET_SIZE];
+
+/**
+ * Node: bitmaps of the children since the last heartbeat
+ */
+static uint8_t subtree[LIVENESS_BITMAP_SIZE];
+
+static liveness_stats_t stats = { 0, };
+static portMUX_TYPE live_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void timer_unlink( int index )
+{
+    live_node_t *node = &table[index];
+
+    if( node->prev )
+    {
+        table[node->prev - 1].next = node->next;
+    }
+    else
+    {
+        wheel[node->deadline_s & WHEEL_MASK] = node->next;
+    }
+    if( node->next )
+    {
+        table[node->next - 1].prev = node->prev;
+    }
+    node->next = node->prev = 0;
+}
+
+/**
+ * (Re)starts the timer of 'index' and marks it online; returns the
+ * previous state
+ */
+static live_state_t timer_arm( int index )
+{
+    live_node_t *node = &table[index];
+    live_state_t was = node->state;
+    uint32_t bucket;
+
+    if( was == LIVE_ONLINE )
+    {
+        timer_unlink( index );
+    }
+    node->deadline_s = now_s + CONFIG_APP_LIVENESS_TIMEOUT_S;
+    node->state = LIVE_ONLINE;
+    bucket = node->deadline_s & WHEEL_MASK;
+    node->prev = 0;
+    node->next = wheel[bucket];
+    if( wheel[bucket] )
+    {
+        table[wheel[bucket] - 1].prev = index + 1;
+    }
+    wheel[bucket] = index + 1;
+    return was;
+}
+
+static void liveness_publish( int index, const char *topic )
+{
+    char id[NODE_ID_LEN];
+
+    if( node_registry_get( index, NULL, id, sizeof( id ) ) )
+    {
+        mqtt_app_publish( topic, id );
+    }
+}
+
+void liveness_arm( int index )
+{
+    if( index < 0 || index >= LIVENESS_SLOTS )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &live_lock );
+    timer_arm( index );
+    portEXIT_CRITICAL( &live_lock );
+}
+
+void liveness_forget( int index )
+{
+    if( index < 0 || index >= LIVENESS_SLOTS )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &live_lock );
+    if( table[index].state == LIVE_ONLINE )
+    {
+        timer_unlink( index );
+    }
+    table[index].state = LIVE_UNUSED;
+    portEXIT_CRITICAL( &live_lock );
+}
+
+void liveness_root_handle( const mesh_frame_t *frame )
+{
+    mesh_payload_heartbeat_t beat;
+    int len;
+
+    if( mesh_proto_get_heartbeat( frame, &beat ) != 0 )
+    {
+        return;
+    }
+    if( beat.epoch != registration_epoch() )
+    {
+        portENTER_CRITICAL( &live_lock );
+        stats.stale++;
+        portEXIT_CRITICAL( &live_lock );
+        return;
+    }
+
+    len = beat.bitmap_len < LIVENESS_BITMAP_SIZE ? beat.bitmap_len : LIVENESS_BITMAP_SIZE;
+    for( int byte = 0; byte < len; byte++ )
+    {
+        for( int bit = 0; bit < 8; bit++ )
+        {
+            int index = byte * 8 + bit;
+            live_state_t was = LIVE_UNUSED;
+
+            if( !( beat.bitmap[byte] & ( 1 << bit ) ) || index >= LIVENESS_SLOTS )
+            {
+                continue;
+            }
+
+            /**
+             * A bit for an index no node holds comes from a node the
+             * registry already dropped; it registers again
+             */
+            portENTER_CRITICAL( &live_lock );
+            if( table[index].state != LIVE_UNUSED )
+            {
+                was = timer_arm( index );
+                if( was == LIVE_OFFLINE )
+                {
+                    stats.came_online++;
+                }
+            }
+            portEXIT_CRITICAL( &live_lock );
+
+            if( was == LIVE_OFFLINE )
+            {
+                liveness_publish( index, "ESP-connect" );
+            }
+        }
+    }
+
+    portENTER_CRITICAL( &live_lock );
+    stats.received++;
+    portEXIT_CRITICAL( &live_lock );
+}
+
+/**
+ * Root: ESP-fleet, the online and offline counts and the first
+ * LIVENESS_FLEET_IDS offline ids
+ */
+static void liveness_publish_fleet( void )
+{
+    char id[NODE_ID_LEN];
+    int online = 0;
+    int offline = 0;
+    int listed = 0;
+    int len;
+
+    len = snprintf( fleet_msg, sizeof( fleet_msg ), "{\"epoch\":%u,\"offline_ids\":[", registration_epoch() );
+    for( int i = 0; i < LIVENESS_SLOTS; i++ )
+    {
+        uint8_t state;
+
+        portENTER_CRITICAL( &live_lock );
+        state = table[i].state;
+        portEXIT_CRITICAL( &live_lock );
+
+        online += state == LIVE_ONLINE;
+        if( state != LIVE_OFFLINE )
+        {
+            continue;
+        }
+        offline++;
+        if( listed < LIVENESS_FLEET_IDS && node_registry_get( i, NULL, id, sizeof( id ) ) )
+        {
+            len += snprintf( fleet_msg + len, sizeof( fleet_msg ) - len, "%s\"%s\"", listed ? "," : "", id );
+            listed++;
+        }
+    }
+    snprintf( fleet_msg + len, sizeof( fleet_msg ) - len, "],\"more\":%d,\"online\":%d,\"offline\":%d}",
+              offline - listed, online, offline );
+    mqtt_app_publish( "ESP-fleet", fleet_msg );
+}
+
+static void liveness_root_tick( uint32_t elapsed_s )
+{
+    int count = 0;
+
+    portENTER_CRITICAL( &live_lock );
+    now_s++;
+    uint16_t link = wheel[now_s & WHEEL_MASK];
+    while( link )
+    {
+        int index = link - 1;
+        link = table[index].next;
+        if( (int32_t)( table[index].deadline_s - now_s ) <= 0 )
+        {
+            timer_unlink( index );
+            table[index].state = LIVE_OFFLINE;
+            expired[count++] = index;
+        }
+    }
+    stats.went_offline += count;
+    portEXIT_CRITICAL( &live_lock );
+
+    for( int i = 0; i < count; i++ )
+    {
+        liveness_publish( expired[i], "ESP-disconnect" );
+    }
+    #ifdef DEBUG
+        if( count )
+        {
+            ESP_LOGI( TAG, "%d node(s) missed their heartbeats", count );
+        }
+    #endif
+
+    if( elapsed_s % CONFIG_APP_FLEET_PERIOD_S == 0 )
+    {
+        liveness_publish_fleet();
+    }
+}
+
+void liveness_node_merge( const mesh_frame_t *frame )
+{
+    mesh_payload_heartbeat_t beat;
+    uint16_t slot;
+    uint8_t epoch;
+    int len;
+
+    if( mesh_proto_get_heartbeat( frame, &beat ) != 0 )
+    {
+        return;
+    }
+    registration_get_slot( &slot, &epoch );
+
+    len = beat.bitmap_len < LIVENESS_BITMAP_SIZE ? beat.bitmap_len : LIVENESS_BITMAP_SIZE;
+    portENTER_CRITICAL( &live_lock );
+    if( epoch == 0 || beat.epoch != epoch )
+    {
+        stats.stale++;
+    }
+    else
+    {
+        for( int i = 0; i < len; i++ )
+        {
+            subtree[i] |= beat.bitmap[i];
+        }
+        stats.merged++;
+    }
+    portEXIT_CRITICAL( &live_lock );
+}
+
+/**
+ * Node: sends its own bit and its subtree's on this layer's second of
+ * the period
+ */
+static void liveness_node_tick( uint32_t elapsed_s )
+{
+    uint8_t bitmap[LIVENESS_BITMAP_SIZE];
+    uint8_t payload[MESH_PROTO_MAX_PAYLOAD];
+    mesh_payload_heartbeat_t beat;
+    mesh_addr_t parent;
+    uint16_t slot;
+    int layer = esp_mesh_get_layer();
+    int len;
+
+    if( layer < 2 || layer > CONFIG_MESH_MAX_LAYER ||
+        elapsed_s % CONFIG_APP_HEARTBEAT_PERIOD_S !=
+        (uint32_t)( CONFIG_MESH_MAX_LAYER - layer ) * CONFIG_APP_HEARTBEAT_PERIOD_S / CONFIG_MESH_MAX_LAYER )
+    {
+        return;
+    }
+
+    portENTER_CRITICAL( &live_lock );
+    memcpy( bitmap, subtree, sizeof( bitmap ) );
+    memset( subtree, 0, sizeof( subtree ) );
+    portEXIT_CRITICAL( &live_lock );
+
+    if( !registration_get_slot( &slot, &beat.epoch ) || !mesh_app_is_connected() )
+    {
+        return;
+    }
+    if( slot < LIVENESS_SLOTS )
+    {
+        bitmap[slot / 8] |= 1 << ( slot % 8 );
+    }
+
+    /**
+     * Trailing zero bytes are left out
+     */
+    beat.bitmap_len = sizeof( bitmap );
+    while( beat.bitmap_len && !bitmap[beat.bitmap_len - 1] )
+    {
+        beat.bitmap_len--;
+    }
+    beat.bitmap = bitmap;
+
+    tx_frame_t *frame = tx_queue_alloc( TX_PRIO_CONTROL, TX_POLICY_DROP_NEW, 0 );
+    if( !frame )
+    {
+        return;
+    }
+    mesh_proto_put_heartbeat( &beat, payload, sizeof( payload ) );
+    len = app_frame_build( MESH_MSG_HEARTBEAT, payload, MESH_PAYLOAD_HEARTBEAT_HDR + beat.bitmap_len, 0,
+                           frame->data, sizeof( frame->data ) );
+    if( len < 0 )
+    {
+        tx_queue_release( frame );
+        return;
+    }
+    frame->len = len;
+
+    /**
+     * TX_DEST_ROOT for a child of the root, the parent for the rest
+     */
+    if( layer > 2 && mesh_app_get_parent( &parent ) )
+    {
+        frame->dest = TX_DEST_ADDR;
+        frame->to = parent;
+    }
+    tx_queue_submit( frame );
+
+    portENTER_CRITICAL( &live_lock );
+    stats.sent++;
+    portEXIT_CRITICAL( &live_lock );
+}
+
+void liveness_tick( uint32_t elapsed_s )
+{
+    if( esp_mesh_is_root() )
+    {
+        liveness_root_tick( elapsed_s );
+    }
+    else
+    {
+        liveness_node_tick( elapsed_s );
+    }
+}
+
+void liveness_get_stats( liveness_stats_t *out )
+{
+    portENTER_CRITICAL( &live_lock );
+    *out = stats;
+    out->online = out->offline = 0;
+    for( int i = 0; i < LIVENESS_SLOTS; i++ )
+    {
+        out->online += table[i].state == LIVE_ONLINE;
+        out->offline += table[i].state == LIVE_OFFLINE;
+    }
+    portEXIT_CRITICAL( &live_lock );
+}
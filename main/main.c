@@ -46,6 +46,11 @@
  */
 #include "sys_config.h"
 
+/**
+ * Boot timing
+ */
+#include "boot_trace.h"
+
 /**
  * Constants;
  */
@@ -63,6 +68,7 @@ void app_main( void );
 
 void app_main( void )
 {
+    boot_mark( BOOT_APP_START );
      
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES) {
@@ -70,6 +76,7 @@ void app_main( void )
       ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    boot_mark( BOOT_NVS_READY );
 
     /**
      * Inicializa GPIOs;
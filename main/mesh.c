@@ -61,11 +61,33 @@
  * App;
  */
 #include "app.h"
+#include "mesh.h"
 
 /**
-* Json
-*/
-#include "cJSON.h"
+ * Health counters
+ */
+#include "metrics.h"
+
+/**
+ * Fast rejoin and boot timing
+ */
+#include "mesh_cache.h"
+#include "boot_trace.h"
+
+/**
+ * Acknowledged Connect-Mesh
+ */
+#include "registration.h"
+
+/**
+ * Core, priority and stack of the tasks
+ */
+#include "task_layout.h"
+
+/**
+ * Sequence windows handed to the next root
+ */
+#include "dedup.h"
 
 /**
  * Overloads sdkconfig file;
@@ -78,20 +100,20 @@
  * Global defs
  */
 char mac_address_root_str[50];
-mesh_addr_t route_table[CONFIG_MESH_ROUTE_TABLE_SIZE];
 
 static const char *TAG = "mesh";
 static const uint8_t MESH_ID[6] = { 0x77, 0x77, 0x77, 0x77, 0x77, 0x77 };
 
 static bool is_mesh_connected = false;
+static bool is_tods_reachable = true;
+static mesh_rejoin_t rejoin = MESH_REJOIN_SCAN;
 static mesh_addr_t mesh_parent_addr;
+static mesh_addr_t mesh_root_addr;      /* all zero until the first MESH_EVENT_ROOT_ADDRESS */
 static int mesh_layer = -1;
 
 EventGroupHandle_t wifi_event_group;
 const int CONNECTED_BIT = BIT0;
 
-#define TX_SIZE          (100)
-static uint8_t tx_buf[TX_SIZE] = { 0, };
 /**
  * Function prototypes
  */
@@ -142,6 +164,7 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "<MESH_EVENT_CHILD_CONNECTED>aid:%d, "MACSTR"",
                  child_connected->aid,
                  MAC2STR(child_connected->mac));
+        metrics_inc(METRIC_EVT_CHILD_CONNECTED);
     }
     break;
     case MESH_EVENT_CHILD_DISCONNECTED: {
@@ -149,9 +172,8 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "<MESH_EVENT_CHILD_DISCONNECTED>aid:%d, "MACSTR"",
                  child_disconnected->aid,
                  MAC2STR(child_disconnected->mac));
-        char* mac_id[20];
-        snprintf( mac_id, sizeof( mac_id ), ""MACSTR"", MAC2STR( child_disconnected->mac ) );
-        public_disconnect_msg(mac_id);
+        metrics_inc(METRIC_EVT_CHILD_DISCONNECTED);
+        public_disconnect_msg(child_disconnected->mac);
     }
     break;
     case MESH_EVENT_ROUTING_TABLE_ADD: {
@@ -172,6 +194,7 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         mesh_event_no_parent_found_t *no_parent = (mesh_event_no_parent_found_t *)event_data;
         ESP_LOGI(TAG, "<MESH_EVENT_NO_PARENT_FOUND>scan times:%d",
                  no_parent->scan_times);
+        metrics_inc(METRIC_EVT_NO_PARENT_FOUND);
     }
     /* TODO handler for the failure */
     break;
@@ -186,6 +209,17 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
                  esp_mesh_is_root() ? "<ROOT>" :
                  (mesh_layer == 2) ? "<layer2>" : "", MAC2STR(id.addr));
         last_layer = mesh_layer;
+        is_mesh_connected = true;
+        boot_mark(BOOT_PARENT_CONNECTED);
+#if CONFIG_APP_FAST_REJOIN
+        mesh_cache_set_parent(connected->connected.channel, connected->connected.bssid, mesh_layer);
+#endif
+        /**
+         * A new parent means a new route to the root: announce again
+         */
+        if (!esp_mesh_is_root()) {
+            registration_restart();
+        }
         if (esp_mesh_is_root()) 
         {
             /**
@@ -211,8 +245,9 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(TAG,
                  "<MESH_EVENT_PARENT_DISCONNECTED>reason:%d",
                  disconnected->reason);
+        is_mesh_connected = false;
         mesh_layer = esp_mesh_get_layer();
-    
+        metrics_inc(METRIC_EVT_PARENT_DISCONNECTED);
     }
     break;
 
@@ -227,6 +262,7 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
                  esp_mesh_is_root() ? "<ROOT>" :
                  (mesh_layer == 2) ? "<layer2>" : "");
         last_layer = mesh_layer;
+        metrics_inc(METRIC_EVT_LAYER_CHANGE);
     }
     break;
     /**
@@ -236,6 +272,23 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         mesh_event_root_address_t *root_addr = (mesh_event_root_address_t *)event_data;
         ESP_LOGI(TAG, "<MESH_EVENT_ROOT_ADDRESS>root address:"MACSTR"",
                  MAC2STR(root_addr->addr));
+#if CONFIG_APP_FAST_REJOIN
+        mesh_cache_set_root(root_addr->addr);
+#endif
+        /**
+         * A different root has an empty registry: nodes announce again,
+         * and a root that took over asks the ones that missed the change
+         */
+        if (memcmp(mesh_root_addr.addr, root_addr->addr, 6) != 0) {
+            static const uint8_t none[6] = { 0, };
+            bool took_over = memcmp(mesh_root_addr.addr, none, 6) != 0;
+            memcpy(mesh_root_addr.addr, root_addr->addr, 6);
+            if (!esp_mesh_is_root()) {
+                registration_restart();
+            } else if (took_over) {
+                registration_request_sweep(false);
+            }
+        }
         /**
          * Storage ROOT Address event
          */
@@ -273,6 +326,11 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
                  "<MESH_EVENT_ROOT_SWITCH_REQ>reason:%d, rc_addr:"MACSTR"",
                  switch_req->reason,
                  MAC2STR( switch_req->rc_addr.addr));
+        // the next root reads the sequence windows back from the broker;
+        // task_stats publishes them, the event loop must not wait on the outbox
+        if (esp_mesh_is_root()) {
+            dedup_request_publish();
+        }
     }
     break;
     /**
@@ -283,6 +341,12 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
         mesh_layer = esp_mesh_get_layer();
         esp_mesh_get_parent_bssid(&mesh_parent_addr);
         ESP_LOGI(TAG, "<MESH_EVENT_ROOT_SWITCH_ACK>layer:%d, parent:"MACSTR"", mesh_layer, MAC2STR(mesh_parent_addr.addr));
+        metrics_inc(METRIC_EVT_ROOT_SWITCH);
+        if (esp_mesh_is_root()) {
+            registration_request_sweep(false);
+        } else {
+            registration_restart();
+        }
     }
     break;
     /**
@@ -293,6 +357,7 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
     case MESH_EVENT_TODS_STATE: {
         mesh_event_toDS_state_t *toDs_state = (mesh_event_toDS_state_t *)event_data;
         ESP_LOGI(TAG, "<MESH_EVENT_TODS_REACHABLE>state:%d", *toDs_state);
+        is_tods_reachable = (*toDs_state == MESH_TODS_REACHABLE);
     }
     break;
     /**
@@ -316,6 +381,9 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
                  MAC2STR(root_conflict->addr),
                  root_conflict->rssi,
                  root_conflict->capacity);
+        if (esp_mesh_is_root()) {
+            dedup_request_publish();
+        }
     }
     break;
     /**
@@ -371,6 +439,92 @@ void mesh_event_handler(void *arg, esp_event_base_t event_base,
     }
 }
 
+bool mesh_app_is_connected( void )
+{
+    return is_mesh_connected && ( !esp_mesh_is_root() || is_tods_reachable );
+}
+
+bool mesh_app_get_parent( mesh_addr_t *parent )
+{
+    if( !is_mesh_connected || esp_mesh_is_root() )
+    {
+        return false;
+    }
+
+    /**
+     * mesh_parent_addr is the parent's softAP BSSID, which the ESP32
+     * derives as its station address + 1
+     */
+    memcpy( parent->addr, mesh_parent_addr.addr, 6 );
+    parent->addr[5]--;
+    return true;
+}
+
+mesh_rejoin_t mesh_app_get_rejoin( void )
+{
+    return rejoin;
+}
+
+#if CONFIG_APP_FAST_REJOIN
+/**
+ * Fast rejoin watchdog: if the cached parent did not take us back in
+ * time, forget it and restart the mesh with a full scan
+ */
+static void task_mesh_rejoin( void *pvParameter )
+{
+    mesh_cfg_t cfg;
+
+    vTaskDelay( CONFIG_APP_REJOIN_TIMEOUT_MS / portTICK_PERIOD_MS );
+    if( !is_mesh_connected )
+    {
+        ESP_LOGW( TAG, "Cached parent not reachable, rescanning" );
+        rejoin = MESH_REJOIN_FALLBACK;
+        mesh_cache_clear();
+        if( esp_mesh_stop() == ESP_OK && esp_mesh_get_config( &cfg ) == ESP_OK )
+        {
+            cfg.channel = CONFIG_MESH_CHANNEL;
+            cfg.allow_channel_switch = false;
+            esp_mesh_set_config( &cfg );
+            esp_mesh_start();
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+/**
+ * Points the mesh at the cached parent: the router for a former root,
+ * the same mesh node otherwise
+ */
+static void mesh_rejoin_start( const mesh_cache_t *cache )
+{
+    wifi_config_t parent;
+    mesh_addr_t mesh_id;
+    bool was_root = cache->layer == MESH_ROOT_LAYER;
+
+    memset( &parent, 0, sizeof( parent ) );
+    memcpy( mesh_id.addr, MESH_ID, 6 );
+    if( was_root )
+    {
+        strlcpy( (char *)parent.sta.ssid, WIFI_SSID, sizeof( parent.sta.ssid ) );
+        strlcpy( (char *)parent.sta.password, WIFI_PASSWORD, sizeof( parent.sta.password ) );
+    }
+    memcpy( parent.sta.bssid, cache->parent, 6 );
+    parent.sta.bssid_set = true;
+    parent.sta.channel = cache->channel;
+
+    ESP_LOGI( TAG, "Rejoining "MACSTR" on channel %u as %s, layer %u",
+              MAC2STR( cache->parent ), cache->channel, was_root ? "root" : "node", cache->layer );
+    if( esp_mesh_set_parent( &parent, &mesh_id, was_root ? MESH_ROOT : MESH_NODE, cache->layer ) != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Parent hint rejected, scanning on channel %u", cache->channel );
+    }
+    rejoin = MESH_REJOIN_CACHED;
+    if( task_layout_create( TASK_LAYOUT_MESH_REJOIN, task_mesh_rejoin, "task_mesh_rejoin", NULL, NULL ) != pdPASS )
+    {
+        ESP_LOGW( TAG, "No rejoin watchdog, staying on channel %u", cache->channel );
+    }
+}
+#endif
 
 /**
  * Mesh stack init
@@ -407,6 +561,7 @@ void mesh_app_start( void )
     ESP_ERROR_CHECK( esp_wifi_init( &config ) );
     ESP_ERROR_CHECK( esp_wifi_set_storage( WIFI_STORAGE_FLASH ) );
     ESP_ERROR_CHECK( esp_wifi_start() );
+    boot_mark( BOOT_WIFI_STARTED );
 
     /**
      * Mesh init
@@ -435,6 +590,21 @@ void mesh_app_start( void )
      */
     cfg.channel = CONFIG_MESH_CHANNEL;
 
+#if CONFIG_APP_FAST_REJOIN
+    /**
+     * A cached position skips the all-channel scan: the mesh starts on
+     * the channel it last worked on, still free to follow the root to
+     * another one
+     */
+    mesh_cache_t cache;
+    bool cached = mesh_cache_load( &cache );
+    if( cached )
+    {
+        cfg.channel = cache.channel;
+        cfg.allow_channel_switch = true;
+    }
+#endif
+
     /**
      * Defines the ssid and password that will be used for communication between nodes
      * Mesh network; This SSID and PASSWORD is that of YOUR ROUTER FROM YOUR HOME or COMPANY;
@@ -467,5 +637,13 @@ void mesh_app_start( void )
      * Mesh start;
      */
     ESP_ERROR_CHECK(esp_mesh_start());
+    boot_mark( BOOT_MESH_STARTED );
+
+#if CONFIG_APP_FAST_REJOIN
+    if( cached )
+    {
+        mesh_rejoin_start( &cache );
+    }
+#endif
 
 }
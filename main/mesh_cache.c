@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "nvs.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+
+#include "mesh_cache.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "mesh_cache: ";
+
+#define MESH_CACHE_NAMESPACE    "mesh_cache"
+#define MESH_CACHE_KEY          "topo"
+#define MESH_CACHE_VERSION      ( 1 )
+
+/**
+ * Stored blob; 'valid' flags which parts have been seen
+ */
+typedef struct {
+    uint8_t      version;
+    uint8_t      valid;
+    mesh_cache_t cache;
+} mesh_cache_blob_t;
+
+#define CACHE_HAS_PARENT    ( 0x01 )
+#define CACHE_HAS_ROOT      ( 0x02 )
+
+/**
+ * Copy of what NVS holds, so unchanged values are not rewritten
+ */
+static mesh_cache_blob_t stored = { 0, };
+static bool stored_loaded = false;
+
+static void cache_read( void )
+{
+    nvs_handle_t nvs;
+    size_t size = sizeof( stored );
+
+    if( stored_loaded )
+    {
+        return;
+    }
+    stored_loaded = true;
+    if( nvs_open( MESH_CACHE_NAMESPACE, NVS_READONLY, &nvs ) != ESP_OK )
+    {
+        return;
+    }
+    if( nvs_get_blob( nvs, MESH_CACHE_KEY, &stored, &size ) != ESP_OK ||
+        size != sizeof( stored ) || stored.version != MESH_CACHE_VERSION )
+    {
+        memset( &stored, 0, sizeof( stored ) );
+    }
+    nvs_close( nvs );
+}
+
+static void cache_write( void )
+{
+    nvs_handle_t nvs;
+    esp_err_t err;
+
+    stored.version = MESH_CACHE_VERSION;
+    err = nvs_open( MESH_CACHE_NAMESPACE, NVS_READWRITE, &nvs );
+    if( err == ESP_OK )
+    {
+        err = nvs_set_blob( nvs, MESH_CACHE_KEY, &stored, sizeof( stored ) );
+        if( err == ESP_OK )
+        {
+            err = nvs_commit( nvs );
+        }
+        nvs_close( nvs );
+    }
+    if( err != ESP_OK )
+    {
+        ESP_LOGW( TAG, "Could not save the mesh cache (0x%x)", err );
+    }
+}
+
+bool mesh_cache_load( mesh_cache_t *cache )
+{
+    cache_read();
+    if( !( stored.valid & CACHE_HAS_PARENT ) || stored.cache.channel == 0 )
+    {
+        return false;
+    }
+    *cache = stored.cache;
+    return true;
+}
+
+void mesh_cache_set_parent( uint8_t channel, const uint8_t parent[6], uint8_t layer )
+{
+    cache_read();
+    if( ( stored.valid & CACHE_HAS_PARENT ) && stored.cache.channel == channel &&
+        stored.cache.layer == layer && memcmp( stored.cache.parent, parent, 6 ) == 0 )
+    {
+        return;
+    }
+    stored.cache.channel = channel;
+    stored.cache.layer = layer;
+    memcpy( stored.cache.parent, parent, 6 );
+    stored.valid |= CACHE_HAS_PARENT;
+    cache_write();
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "parent "MACSTR" on channel %u, layer %u", MAC2STR( parent ), channel, layer );
+    #endif
+}
+
+void mesh_cache_set_root( const uint8_t root[6] )
+{
+    cache_read();
+    if( ( stored.valid & CACHE_HAS_ROOT ) && memcmp( stored.cache.root, root, 6 ) == 0 )
+    {
+        return;
+    }
+    memcpy( stored.cache.root, root, 6 );
+    stored.valid |= CACHE_HAS_ROOT;
+    cache_write();
+}
+
+void mesh_cache_clear( void )
+{
+    nvs_handle_t nvs;
+
+    memset( &stored, 0, sizeof( stored ) );
+    stored_loaded = true;
+    if( nvs_open( MESH_CACHE_NAMESPACE, NVS_READWRITE, &nvs ) == ESP_OK )
+    {
+        nvs_erase_key( nvs, MESH_CACHE_KEY );
+        nvs_commit( nvs );
+        nvs_close( nvs );
+    }
+}
+
+const char *mesh_rejoin_name( mesh_rejoin_t rejoin )
+{
+    switch( rejoin )
+    {
+        case MESH_REJOIN_CACHED:    return "cache";
+        case MESH_REJOIN_FALLBACK:  return "fallback";
+        case MESH_REJOIN_SCAN:
+        default:                    return "scan";
+    }
+}
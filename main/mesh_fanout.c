@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * ESP
+ */
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+/**
+ * Mesh Net;
+ */
+#include "esp_mesh.h"
+
+#include "mesh_fanout.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "fanout: ";
+
+/**
+ * Group address every node joins; locally administered multicast MAC
+ */
+static const mesh_addr_t FANOUT_GROUP = { .addr = { 0x01, 0x00, 0x5e, 0x77, 0x77, 0x01 } };
+
+#if !CONFIG_MESH_FANOUT_GROUP
+static mesh_addr_t fanout_table[CONFIG_MESH_ROUTE_TABLE_SIZE];
+#endif
+
+void mesh_fanout_group_addr( uint8_t group, mesh_addr_t *addr )
+{
+    *addr = FANOUT_GROUP;
+    addr->addr[4] = 0x78;
+    addr->addr[5] = group;
+}
+
+esp_err_t mesh_fanout_join( void )
+{
+    mesh_addr_t groups[2] = { FANOUT_GROUP };
+    int count = 1;
+
+    if( CONFIG_APP_NODE_GROUP )
+    {
+        mesh_fanout_group_addr( CONFIG_APP_NODE_GROUP, &groups[count++] );
+    }
+    if( esp_mesh_is_my_group( &groups[count - 1] ) )
+    {
+        return ESP_OK;
+    }
+    return esp_mesh_set_group_id( groups, count );
+}
+
+esp_err_t mesh_fanout_send( const mesh_data_t *data, mesh_fanout_result_t *result )
+{
+    mesh_fanout_result_t res = { 0, };
+    int64_t start = esp_timer_get_time();
+
+#if CONFIG_MESH_FANOUT_GROUP
+    /**
+     * One send; the mesh stack replicates it down the tree
+     */
+    res.targets = esp_mesh_get_routing_table_size() - 1;
+    if( res.targets > 0 )
+    {
+        esp_err_t err = esp_mesh_send( &FANOUT_GROUP, data, MESH_DATA_P2P | MESH_DATA_GROUP, NULL, 0 );
+        if( err == ESP_OK )
+        {
+            res.sent = res.targets;
+        }
+        else
+        {
+            res.failed = res.targets;
+            ESP_LOGW( TAG, "group send failed: 0x%x", err );
+        }
+    }
+#else
+    /**
+     * One unicast per routing table entry, skipping ourselves by
+     * comparing binary addresses
+     */
+    uint8_t self[6];
+    int size = 0;
+
+    esp_efuse_mac_get_default( self );
+    esp_mesh_get_routing_table( fanout_table, sizeof( fanout_table ), &size );
+    for( int i = 0; i < size; i++ )
+    {
+        if( memcmp( fanout_table[i].addr, self, 6 ) == 0 )
+        {
+            continue;
+        }
+        res.targets++;
+        if( esp_mesh_send( &fanout_table[i], data, MESH_DATA_P2P, NULL, 0 ) == ESP_OK )
+        {
+            res.sent++;
+        }
+        else
+        {
+            res.failed++;
+        }
+    }
+#endif
+
+    res.elapsed_us = esp_timer_get_time() - start;
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "fan-out to %d nodes: %d sent, %d failed in %lld us",
+                  res.targets, res.sent, res.failed, (long long)res.elapsed_us );
+    #endif
+
+    if( result )
+    {
+        *result = res;
+    }
+    return res.failed ? ESP_FAIL : ESP_OK;
+}
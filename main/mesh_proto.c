@@ -0,0 +1,518 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "mesh_proto.h"
+
+/**
+ * Little-endian helpers; the frame is never cast onto a struct so the
+ * layout does not depend on compiler packing or host endianness.
+ */
+static void put_u16( uint8_t *p, uint16_t v )
+{
+    p[0] = (uint8_t)( v );
+    p[1] = (uint8_t)( v >> 8 );
+}
+
+static void put_u32( uint8_t *p, uint32_t v )
+{
+    p[0] = (uint8_t)( v );
+    p[1] = (uint8_t)( v >> 8 );
+    p[2] = (uint8_t)( v >> 16 );
+    p[3] = (uint8_t)( v >> 24 );
+}
+
+static uint16_t get_u16( const uint8_t *p )
+{
+    return (uint16_t)( p[0] | ( p[1] << 8 ) );
+}
+
+static uint32_t get_u32( const uint8_t *p )
+{
+    return (uint32_t)p[0] | ( (uint32_t)p[1] << 8 ) |
+           ( (uint32_t)p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+int mesh_proto_encode( const mesh_frame_t *frame, uint8_t *buf, size_t size )
+{
+    size_t total = MESH_PROTO_HDR_SIZE + frame->payload_len;
+
+    if( frame->payload_len > MESH_PROTO_MAX_PAYLOAD || total > size )
+    {
+        return -1;
+    }
+
+    buf[0] = MESH_PROTO_VERSION;
+    buf[1] = frame->type;
+    put_u16( &buf[2], frame->node_id );
+    memcpy( &buf[4], frame->mac, 6 );
+    put_u32( &buf[10], frame->seq );
+    put_u32( &buf[14], frame->origin_ts );
+    buf[18] = frame->layer;
+    buf[19] = frame->flags;
+    put_u16( &buf[20], frame->payload_len );
+    if( frame->payload_len )
+    {
+        memcpy( &buf[MESH_PROTO_HDR_SIZE], frame->payload, frame->payload_len );
+    }
+    return (int)total;
+}
+
+int mesh_proto_decode( const uint8_t *buf, size_t len, mesh_frame_t *frame )
+{
+    size_t hdr;
+
+    if( len < MESH_PROTO_HDR_SIZE_V1 )
+    {
+        return -1;
+    }
+    switch( buf[0] )
+    {
+        case 1:
+            hdr = MESH_PROTO_HDR_SIZE_V1;
+            break;
+        case MESH_PROTO_VERSION:
+            hdr = MESH_PROTO_HDR_SIZE;
+            break;
+        default:
+            return -1;
+    }
+    if( len < hdr )
+    {
+        return -1;
+    }
+
+    frame->version = buf[0];
+    frame->type = buf[1];
+    frame->node_id = get_u16( &buf[2] );
+    memcpy( frame->mac, &buf[4], 6 );
+    frame->seq = get_u32( &buf[10] );
+    if( hdr == MESH_PROTO_HDR_SIZE_V1 )
+    {
+        frame->origin_ts = 0;
+        frame->layer = 0;
+        frame->flags = 0;
+        frame->payload_len = get_u16( &buf[14] );
+    }
+    else
+    {
+        frame->origin_ts = get_u32( &buf[14] );
+        frame->layer = buf[18];
+        frame->flags = buf[19];
+        frame->payload_len = get_u16( &buf[20] );
+    }
+    if( frame->payload_len > len - hdr )
+    {
+        return -1;
+    }
+    frame->payload = &buf[hdr];
+    return 0;
+}
+
+int mesh_proto_set_flags( uint8_t *buf, size_t len, uint8_t flags )
+{
+    if( len < MESH_PROTO_HDR_SIZE || buf[0] != MESH_PROTO_VERSION )
+    {
+        return -1;
+    }
+    buf[19] |= flags;
+    return 0;
+}
+
+int mesh_proto_add_tail( uint8_t *buf, size_t len, uint16_t tail_len )
+{
+    uint32_t total;
+
+    if( len < MESH_PROTO_HDR_SIZE || buf[0] != MESH_PROTO_VERSION )
+    {
+        return -1;
+    }
+    total = (uint32_t)get_u16( &buf[20] ) + tail_len;
+    if( total > 0xffff )
+    {
+        return -1;
+    }
+    put_u16( &buf[20], (uint16_t)total );
+    return 0;
+}
+
+int mesh_proto_put_data( const mesh_payload_data_t *data, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_DATA_SIZE )
+    {
+        return -1;
+    }
+    put_u32( buf, (uint32_t)data->value );
+    return MESH_PAYLOAD_DATA_SIZE;
+}
+
+int mesh_proto_get_data( const mesh_frame_t *frame, mesh_payload_data_t *data )
+{
+    if( frame->type != MESH_MSG_DATA || frame->payload_len < MESH_PAYLOAD_DATA_SIZE )
+    {
+        return -1;
+    }
+    data->value = (int32_t)get_u32( frame->payload );
+    return 0;
+}
+
+int mesh_proto_put_metrics( const mesh_payload_metrics_t *metrics, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_METRICS_SIZE )
+    {
+        return -1;
+    }
+    put_u32( &buf[0], metrics->uptime_s );
+    put_u32( &buf[4], metrics->free_heap );
+    put_u32( &buf[8], metrics->min_free_heap );
+    put_u32( &buf[12], metrics->rx_frames );
+    put_u32( &buf[16], metrics->rx_bytes );
+    put_u32( &buf[20], metrics->tx_frames );
+    put_u32( &buf[24], metrics->tx_bytes );
+    put_u16( &buf[28], metrics->rx_errors );
+    put_u16( &buf[30], metrics->tx_errors );
+    put_u16( &buf[32], metrics->parent_disconnects );
+    put_u16( &buf[34], metrics->root_switches );
+    put_u16( &buf[36], metrics->min_stack_free );
+    put_u16( &buf[38], metrics->txq_depth );
+    put_u16( &buf[40], metrics->txq_dropped );
+    put_u32( &buf[42], metrics->boot_connected_ms );
+    put_u32( &buf[46], metrics->boot_first_tx_ms );
+    buf[50] = metrics->rejoin;
+    return MESH_PAYLOAD_METRICS_SIZE;
+}
+
+int mesh_proto_get_metrics( const mesh_frame_t *frame, mesh_payload_metrics_t *metrics )
+{
+    const uint8_t *p = frame->payload;
+
+    if( frame->type != MESH_MSG_METRICS || frame->payload_len < MESH_PAYLOAD_METRICS_SIZE_MIN )
+    {
+        return -1;
+    }
+    metrics->uptime_s = get_u32( &p[0] );
+    metrics->free_heap = get_u32( &p[4] );
+    metrics->min_free_heap = get_u32( &p[8] );
+    metrics->rx_frames = get_u32( &p[12] );
+    metrics->rx_bytes = get_u32( &p[16] );
+    metrics->tx_frames = get_u32( &p[20] );
+    metrics->tx_bytes = get_u32( &p[24] );
+    metrics->rx_errors = get_u16( &p[28] );
+    metrics->tx_errors = get_u16( &p[30] );
+    metrics->parent_disconnects = get_u16( &p[32] );
+    metrics->root_switches = get_u16( &p[34] );
+    metrics->min_stack_free = get_u16( &p[36] );
+    metrics->txq_depth = get_u16( &p[38] );
+    metrics->txq_dropped = get_u16( &p[40] );
+    metrics->boot_connected_ms = 0;
+    metrics->boot_first_tx_ms = 0;
+    metrics->rejoin = 0;
+    if( frame->payload_len >= MESH_PAYLOAD_METRICS_SIZE )
+    {
+        metrics->boot_connected_ms = get_u32( &p[42] );
+        metrics->boot_first_tx_ms = get_u32( &p[46] );
+        metrics->rejoin = p[50];
+    }
+    return 0;
+}
+
+int mesh_proto_put_command( const mesh_payload_command_t *cmd, uint8_t *buf, size_t size )
+{
+    size_t total = MESH_PAYLOAD_COMMAND_HDR + cmd->name_len + cmd->args_len;
+
+    if( total > size || total > MESH_PROTO_MAX_PAYLOAD )
+    {
+        return -1;
+    }
+    put_u16( &buf[0], cmd->seq );
+    buf[2] = cmd->name_len;
+    memcpy( &buf[MESH_PAYLOAD_COMMAND_HDR], cmd->name, cmd->name_len );
+    if( cmd->args_len )
+    {
+        memcpy( &buf[MESH_PAYLOAD_COMMAND_HDR + cmd->name_len], cmd->args, cmd->args_len );
+    }
+    return (int)total;
+}
+
+int mesh_proto_get_command( const mesh_frame_t *frame, mesh_payload_command_t *cmd )
+{
+    const uint8_t *p = frame->payload;
+
+    if( frame->type != MESH_MSG_COMMAND || frame->payload_len < MESH_PAYLOAD_COMMAND_HDR ||
+        frame->payload_len < MESH_PAYLOAD_COMMAND_HDR + p[2] )
+    {
+        return -1;
+    }
+    cmd->seq = get_u16( &p[0] );
+    cmd->name_len = p[2];
+    cmd->name = (const char *)&p[MESH_PAYLOAD_COMMAND_HDR];
+    cmd->args_len = frame->payload_len - MESH_PAYLOAD_COMMAND_HDR - cmd->name_len;
+    cmd->args = &p[MESH_PAYLOAD_COMMAND_HDR + cmd->name_len];
+    return 0;
+}
+
+int mesh_proto_put_cmd_ack( const mesh_payload_cmd_ack_t *ack, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_CMD_ACK_SIZE )
+    {
+        return -1;
+    }
+    put_u16( &buf[0], ack->seq );
+    buf[2] = ack->status;
+    return MESH_PAYLOAD_CMD_ACK_SIZE;
+}
+
+int mesh_proto_get_cmd_ack( const mesh_frame_t *frame, mesh_payload_cmd_ack_t *ack )
+{
+    if( frame->type != MESH_MSG_CMD_ACK || frame->payload_len < MESH_PAYLOAD_CMD_ACK_SIZE )
+    {
+        return -1;
+    }
+    ack->seq = get_u16( &frame->payload[0] );
+    ack->status = frame->payload[2];
+    return 0;
+}
+
+int mesh_proto_put_summary( const mesh_payload_summary_t *summary, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_SUMMARY_SIZE )
+    {
+        return -1;
+    }
+    put_u32( &buf[0], summary->window_ms );
+    put_u32( &buf[4], summary->count );
+    put_u32( &buf[8], (uint32_t)summary->min );
+    put_u32( &buf[12], (uint32_t)summary->max );
+    put_u32( &buf[16], (uint32_t)summary->mean );
+    put_u32( &buf[20], (uint32_t)summary->last );
+    return MESH_PAYLOAD_SUMMARY_SIZE;
+}
+
+int mesh_proto_get_summary( const mesh_frame_t *frame, mesh_payload_summary_t *summary )
+{
+    const uint8_t *p = frame->payload;
+
+    if( frame->type != MESH_MSG_SUMMARY || frame->payload_len < MESH_PAYLOAD_SUMMARY_SIZE )
+    {
+        return -1;
+    }
+    summary->window_ms = get_u32( &p[0] );
+    summary->count = get_u32( &p[4] );
+    summary->min = (int32_t)get_u32( &p[8] );
+    summary->max = (int32_t)get_u32( &p[12] );
+    summary->mean = (int32_t)get_u32( &p[16] );
+    summary->last = (int32_t)get_u32( &p[20] );
+    return 0;
+}
+
+int mesh_proto_put_alert( const mesh_payload_alert_t *alert, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_ALERT_SIZE )
+    {
+        return -1;
+    }
+    buf[0] = alert->kind;
+    put_u32( &buf[1], (uint32_t)alert->value );
+    put_u32( &buf[5], (uint32_t)alert->ref );
+    return MESH_PAYLOAD_ALERT_SIZE;
+}
+
+int mesh_proto_get_alert( const mesh_frame_t *frame, mesh_payload_alert_t *alert )
+{
+    const uint8_t *p = frame->payload;
+
+    if( frame->type != MESH_MSG_ALERT || frame->payload_len < MESH_PAYLOAD_ALERT_SIZE )
+    {
+        return -1;
+    }
+    alert->kind = p[0];
+    alert->value = (int32_t)get_u32( &p[1] );
+    alert->ref = (int32_t)get_u32( &p[5] );
+    return 0;
+}
+
+int mesh_proto_put_connect_ack( const mesh_payload_connect_ack_t *ack, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_CONNECT_ACK_SIZE )
+    {
+        return -1;
+    }
+    put_u32( &buf[0], ack->seq );
+    buf[4] = ack->status;
+    put_u16( &buf[5], ack->slot );
+    buf[7] = ack->epoch;
+    return MESH_PAYLOAD_CONNECT_ACK_SIZE;
+}
+
+int mesh_proto_get_connect_ack( const mesh_frame_t *frame, mesh_payload_connect_ack_t *ack )
+{
+    const uint8_t *p = frame->payload;
+
+    if( frame->type != MESH_MSG_CONNECT_ACK || frame->payload_len < MESH_PAYLOAD_CONNECT_ACK_SIZE_MIN )
+    {
+        return -1;
+    }
+    ack->seq = get_u32( &p[0] );
+    ack->status = p[4];
+    ack->slot = MESH_SLOT_NONE;
+    ack->epoch = 0;
+    if( frame->payload_len >= MESH_PAYLOAD_CONNECT_ACK_SIZE )
+    {
+        ack->slot = get_u16( &p[5] );
+        ack->epoch = p[7];
+    }
+    return 0;
+}
+
+int mesh_proto_put_reregister( const mesh_payload_reregister_t *req, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_REREGISTER_SIZE )
+    {
+        return -1;
+    }
+    put_u32( &buf[0], req->window_ms );
+    buf[4] = req->flags;
+    return MESH_PAYLOAD_REREGISTER_SIZE;
+}
+
+int mesh_proto_get_reregister( const mesh_frame_t *frame, mesh_payload_reregister_t *req )
+{
+    if( frame->type != MESH_MSG_REREGISTER || frame->payload_len < MESH_PAYLOAD_REREGISTER_SIZE )
+    {
+        return -1;
+    }
+    req->window_ms = get_u32( &frame->payload[0] );
+    req->flags = frame->payload[4];
+    return 0;
+}
+
+int mesh_proto_put_heartbeat( const mesh_payload_heartbeat_t *beat, uint8_t *buf, size_t size )
+{
+    size_t total = MESH_PAYLOAD_HEARTBEAT_HDR + beat->bitmap_len;
+
+    if( total > size || total > MESH_PROTO_MAX_PAYLOAD )
+    {
+        return -1;
+    }
+    buf[0] = beat->epoch;
+    memcpy( &buf[MESH_PAYLOAD_HEARTBEAT_HDR], beat->bitmap, beat->bitmap_len );
+    return (int)total;
+}
+
+int mesh_proto_get_heartbeat( const mesh_frame_t *frame, mesh_payload_heartbeat_t *beat )
+{
+    if( frame->type != MESH_MSG_HEARTBEAT || frame->payload_len < MESH_PAYLOAD_HEARTBEAT_HDR )
+    {
+        return -1;
+    }
+    beat->epoch = frame->payload[0];
+    beat->bitmap_len = frame->payload_len - MESH_PAYLOAD_HEARTBEAT_HDR;
+    beat->bitmap = &frame->payload[MESH_PAYLOAD_HEARTBEAT_HDR];
+    return 0;
+}
+
+/**
+ * Header only; the data is appended with mesh_proto_add_tail()
+ */
+int mesh_proto_put_fragment( const mesh_payload_fragment_t *frag, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_FRAGMENT_HDR )
+    {
+        return -1;
+    }
+    put_u16( &buf[0], frag->msg_id );
+    put_u16( &buf[2], frag->index );
+    put_u16( &buf[4], frag->count );
+    put_u16( &buf[6], frag->chunk );
+    put_u32( &buf[8], frag->total );
+    buf[12] = frag->kind;
+    buf[13] = frag->flags;
+    return MESH_PAYLOAD_FRAGMENT_HDR;
+}
+
+int mesh_proto_get_fragment( const mesh_frame_t *frame, mesh_payload_fragment_t *frag )
+{
+    const uint8_t *p = frame->payload;
+
+    if( frame->type != MESH_MSG_FRAGMENT || frame->payload_len < MESH_PAYLOAD_FRAGMENT_HDR )
+    {
+        return -1;
+    }
+    frag->msg_id = get_u16( &p[0] );
+    frag->index = get_u16( &p[2] );
+    frag->count = get_u16( &p[4] );
+    frag->chunk = get_u16( &p[6] );
+    frag->total = get_u32( &p[8] );
+    frag->kind = p[12];
+    frag->flags = p[13];
+    frag->data_len = frame->payload_len - MESH_PAYLOAD_FRAGMENT_HDR;
+    frag->data = &p[MESH_PAYLOAD_FRAGMENT_HDR];
+    if( frag->count == 0 || frag->count > MESH_FRAG_MAX_COUNT || frag->index >= frag->count || frag->chunk == 0 )
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int mesh_proto_put_frag_ack( const mesh_payload_frag_ack_t *ack, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_FRAG_ACK_SIZE )
+    {
+        return -1;
+    }
+    put_u16( &buf[0], ack->msg_id );
+    put_u16( &buf[2], ack->count );
+    buf[4] = ack->status;
+    put_u32( &buf[5], (uint32_t)ack->received );
+    put_u32( &buf[9], (uint32_t)( ack->received >> 32 ) );
+    return MESH_PAYLOAD_FRAG_ACK_SIZE;
+}
+
+int mesh_proto_get_frag_ack( const mesh_frame_t *frame, mesh_payload_frag_ack_t *ack )
+{
+    const uint8_t *p = frame->payload;
+
+    if( frame->type != MESH_MSG_FRAG_ACK || frame->payload_len < MESH_PAYLOAD_FRAG_ACK_SIZE )
+    {
+        return -1;
+    }
+    ack->msg_id = get_u16( &p[0] );
+    ack->count = get_u16( &p[2] );
+    ack->status = p[4];
+    ack->received = (uint64_t)get_u32( &p[5] ) | ( (uint64_t)get_u32( &p[9] ) << 32 );
+    return 0;
+}
+
+int mesh_proto_put_topology( const mesh_payload_topology_t *topo, uint8_t *buf, size_t size )
+{
+    if( size < MESH_PAYLOAD_TOPOLOGY_SIZE )
+    {
+        return -1;
+    }
+    memcpy( &buf[0], topo->parent, 6 );
+    buf[6] = topo->children;
+    put_u16( &buf[7], topo->subtree );
+    buf[9] = (uint8_t)topo->rssi;
+    put_u16( &buf[10], topo->tx_pending );
+    put_u32( &buf[12], topo->tx_bps );
+    put_u32( &buf[16], topo->rx_bps );
+    return MESH_PAYLOAD_TOPOLOGY_SIZE;
+}
+
+int mesh_proto_get_topology( const mesh_frame_t *frame, mesh_payload_topology_t *topo )
+{
+    const uint8_t *p = frame->payload;
+
+    if( frame->type != MESH_MSG_TOPOLOGY || frame->payload_len < MESH_PAYLOAD_TOPOLOGY_SIZE )
+    {
+        return -1;
+    }
+    memcpy( topo->parent, &p[0], 6 );
+    topo->children = p[6];
+    topo->subtree = get_u16( &p[7] );
+    topo->rssi = (int8_t)p[9];
+    topo->tx_pending = get_u16( &p[10] );
+    topo->tx_bps = get_u32( &p[12] );
+    topo->rx_bps = get_u32( &p[16] );
+    return 0;
+}
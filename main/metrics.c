@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "metrics.h"
+#include "tx_queue.h"
+#include "node_registry.h"
+#include "mqtt_app.h"
+#include "mqtt_outbox.h"
+#include "uplink_batch.h"
+#include "downlink.h"
+#include "sampler.h"
+#include "fwdlog.h"
+#include "registration.h"
+#include "liveness.h"
+#include "frag.h"
+#include "frame_pool.h"
+#include "task_layout.h"
+#include "root_pipeline.h"
+#include "dedup.h"
+#include "boot_trace.h"
+#include "mesh.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "metrics: ";
+
+#define METRICS_TOPIC       "ESP-stats/health"
+#define METRICS_NODES_TOPIC "ESP-stats/health/nodes"
+#define METRICS_FLEET_TOPIC "ESP-stats/health/fleet"
+#define METRICS_MAX_TASKS   ( 14 )
+#define METRICS_MSG_SIZE    ( 1920 )
+
+/**
+ * A node that missed three reports is left out of the fleet totals
+ */
+#define METRICS_STALE_US    ( 3LL * CONFIG_APP_METRICS_PERIOD_S * 1000 * 1000 )
+
+uint32_t metrics_counters[METRIC_COUNT];
+
+static TaskHandle_t tasks[METRICS_MAX_TASKS];
+static int task_count = 0;
+
+/**
+ * Root: last snapshot of every node, by node index
+ */
+typedef struct {
+    int64_t                 received_us;    /* 0: never reported */
+    mesh_payload_metrics_t  snap;
+} node_metrics_t;
+
+static node_metrics_t nodes[CONFIG_MESH_ROUTE_TABLE_SIZE];
+static portMUX_TYPE nodes_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static char metrics_msg[METRICS_MSG_SIZE];
+
+/**
+ * Run-time counters at the previous self report, for the per-core load
+ */
+static task_cpu_sample_t cpu_prev;
+
+void metrics_register_task( TaskHandle_t task )
+{
+    if( task && task_count < METRICS_MAX_TASKS )
+    {
+        tasks[task_count++] = task;
+    }
+}
+
+static uint16_t sat16( uint32_t v )
+{
+    return v > 0xffff ? 0xffff : (uint16_t)v;
+}
+
+void metrics_snapshot( mesh_payload_metrics_t *snap )
+{
+    tx_queue_stats_t txq;
+    uint32_t stack_free = 0xffff;
+
+    tx_queue_get_stats( &txq );
+    for( int i = 0; i < task_count; i++ )
+    {
+        uint32_t free = uxTaskGetStackHighWaterMark( tasks[i] );
+        if( free < stack_free )
+        {
+            stack_free = free;
+        }
+    }
+
+    snap->uptime_s = (uint32_t)( esp_timer_get_time() / 1000000 );
+    snap->free_heap = esp_get_free_heap_size();
+    snap->min_free_heap = esp_get_minimum_free_heap_size();
+    snap->rx_frames = metrics_get( METRIC_MESH_RX_FRAMES );
+    snap->rx_bytes = metrics_get( METRIC_MESH_RX_BYTES );
+    snap->tx_frames = metrics_get( METRIC_MESH_TX_FRAMES );
+    snap->tx_bytes = metrics_get( METRIC_MESH_TX_BYTES );
+    snap->rx_errors = sat16( metrics_get( METRIC_MESH_RX_ERRORS ) );
+    snap->tx_errors = sat16( metrics_get( METRIC_MESH_TX_ERRORS ) );
+    snap->parent_disconnects = sat16( metrics_get( METRIC_EVT_PARENT_DISCONNECTED ) );
+    snap->root_switches = sat16( metrics_get( METRIC_EVT_ROOT_SWITCH ) );
+    snap->min_stack_free = (uint16_t)stack_free;
+    snap->txq_depth = 0;
+    snap->txq_dropped = 0;
+    snap->boot_connected_ms = boot_stage_ms( BOOT_PARENT_CONNECTED );
+    snap->boot_first_tx_ms = boot_stage_ms( BOOT_FIRST_TX );
+    snap->rejoin = (uint8_t)mesh_app_get_rejoin();
+    for( int p = 0; p < TX_PRIO_MAX; p++ )
+    {
+        snap->txq_depth += txq.depth[p];
+        snap->txq_dropped = sat16( snap->txq_dropped + txq.dropped[p] );
+    }
+}
+
+void metrics_store( int node_index, const mesh_payload_metrics_t *snap )
+{
+    if( node_index < 0 || node_index >= CONFIG_MESH_ROUTE_TABLE_SIZE )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &nodes_lock );
+    nodes[node_index].snap = *snap;
+    nodes[node_index].received_us = esp_timer_get_time();
+    portEXIT_CRITICAL( &nodes_lock );
+}
+
+void metrics_forget( int node_index )
+{
+    if( node_index < 0 || node_index >= CONFIG_MESH_ROUTE_TABLE_SIZE )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &nodes_lock );
+    nodes[node_index].received_us = 0;
+    portEXIT_CRITICAL( &nodes_lock );
+}
+
+/**
+ * Root's own counters, in full
+ */
+static void metrics_publish_self( void )
+{
+    mesh_payload_metrics_t snap;
+    mqtt_outbox_stats_t outbox;
+    uplink_batch_stats_t batch;
+    downlink_stats_t downlink;
+    sampler_stats_t sampler;
+    fwdlog_stats_t fwdlog;
+    registration_stats_t reg;
+    liveness_stats_t live;
+    frag_stats_t frag;
+    frame_pool_stats_t pool;
+    task_cpu_sample_t cpu;
+    root_pipeline_stats_t pipe;
+    dedup_stats_t dedup;
+    int len;
+
+    metrics_snapshot( &snap );
+    mqtt_outbox_get_stats( &outbox );
+    uplink_batch_get_stats( &batch );
+    downlink_get_stats( &downlink );
+    sampler_get_stats( &sampler );
+    fwdlog_get_stats( &fwdlog );
+    registration_get_stats( &reg );
+    liveness_get_stats( &live );
+    frag_get_stats( &frag );
+    frame_pool_get_stats( &pool );
+    task_layout_cpu_sample( &cpu );
+    root_pipeline_get_stats( &pipe );
+    dedup_get_stats( &dedup );
+    len = snprintf( metrics_msg, METRICS_MSG_SIZE,
+                    "{\"id\":\"%s\",\"up\":%u,\"heap\":%u,\"heap_min\":%u,"
+                    "\"mesh\":{\"rx\":%u,\"rx_bytes\":%u,\"rx_err\":%u,\"tx\":%u,\"tx_bytes\":%u,\"tx_err\":%u},"
+                    "\"mqtt\":{\"pub\":%u,\"ack\":%u,\"err\":%u,\"disc\":%u},"
+                    "\"events\":{\"parent_disc\":%u,\"root_switch\":%u,\"layer_change\":%u,"
+                    "\"child_conn\":%u,\"child_disc\":%u,\"no_parent\":%u},"
+                    "\"txq\":{\"depth\":%u,\"dropped\":%u},"
+                    "\"outbox\":{\"depth\":%u,\"peak\":%u,\"pub\":%u,\"coalesced\":%u,\"downgraded\":%u,"
+                    "\"dropped\":%u,\"err\":%u,\"by_ref\":%u,\"arena_peak\":%u,\"p50\":%u,\"p99\":%u,\"max\":%u},"
+                    "\"pipe\":{\"batches\":%u,\"batch_max\":%u,\"rx_pending_peak\":%u,\"rx_max_us\":%u,"
+                    "\"route\":%u,\"route_depth\":%u,\"route_peak\":%u,\"route_dropped\":%u,\"route_us\":%u,\"route_max_us\":%u,"
+                    "\"limited\":%u,\"flow_full\":%u},"
+                    "\"pool\":{\"in_use\":%u,\"peak\":%u,\"exhausted\":%u,\"copies\":%u},"
+                    "\"dedup\":{\"checked\":%u,\"dup\":%u,\"stale\":%u,\"restarts\":%u,\"untracked\":%u,\"restored\":%u},"
+                    "\"batch\":{\"batches\":%u,\"records\":%u,\"dropped\":%u},"
+                    "\"downlink\":{\"received\":%u,\"rejected\":%u,\"sent\":%u,\"failed\":%u,\"acked\":%u},"
+                    "\"reg\":{\"acks\":%u,\"sweeps\":%u},"
+                    "\"live\":{\"online\":%u,\"offline\":%u,\"beats\":%u,\"stale\":%u},"
+                    "\"frag\":{\"rx\":%u,\"dup\":%u,\"timeouts\":%u,\"busy\":%u},"
+                    "\"sampler\":{\"samples\":%u,\"windows\":%u,\"alerts\":%u,\"overruns\":%u},"
+                    "\"fwdlog\":{\"backlog\":%u,\"stored\":%u,\"replayed\":%u,\"dropped\":%u,\"corrupt\":%u,\"erases\":%u},"
+                    "\"rejoin\":\"%s\",\"boot\":",
+                    NODE_ID, snap.uptime_s, snap.free_heap, snap.min_free_heap,
+                    snap.rx_frames, snap.rx_bytes, metrics_get( METRIC_MESH_RX_ERRORS ),
+                    snap.tx_frames, snap.tx_bytes, metrics_get( METRIC_MESH_TX_ERRORS ),
+                    metrics_get( METRIC_MQTT_PUBLISHES ), metrics_get( METRIC_MQTT_ACKS ),
+                    metrics_get( METRIC_MQTT_ERRORS ), metrics_get( METRIC_MQTT_DISCONNECTS ),
+                    metrics_get( METRIC_EVT_PARENT_DISCONNECTED ), metrics_get( METRIC_EVT_ROOT_SWITCH ),
+                    metrics_get( METRIC_EVT_LAYER_CHANGE ), metrics_get( METRIC_EVT_CHILD_CONNECTED ),
+                    metrics_get( METRIC_EVT_CHILD_DISCONNECTED ), metrics_get( METRIC_EVT_NO_PARENT_FOUND ),
+                    snap.txq_depth, snap.txq_dropped,
+                    outbox.depth, outbox.peak_depth, outbox.published, outbox.coalesced, outbox.downgraded,
+                    outbox.dropped, outbox.errors, outbox.by_ref, outbox.arena_peak, outbox.latency_p50_us, outbox.latency_p99_us,
+                    outbox.latency_max_us,
+                    pipe.batches, pipe.batch_max, pipe.rx.peak_depth, pipe.rx.max_us,
+                    pipe.route.frames, pipe.route.depth, pipe.route.peak_depth, pipe.route.dropped,
+                    (unsigned)( pipe.route.busy_us / ( pipe.route.frames ? pipe.route.frames : 1 ) ), pipe.route.max_us,
+                    pipe.limited, pipe.flow_full,
+                    pool.in_use, pool.peak, pool.exhausted, pool.copies,
+                    dedup.checked, dedup.duplicates, dedup.stale, dedup.restarts, dedup.untracked, dedup.restored,
+                    batch.batches, batch.records, batch.dropped,
+                    downlink.received, downlink.rejected, downlink.sent, downlink.failed, downlink.acked,
+                    reg.acks_sent, reg.sweeps,
+                    live.online, live.offline, live.received, live.stale,
+                    frag.rx_messages, frag.rx_duplicates, frag.rx_timeouts, frag.rx_busy,
+                    sampler.samples, sampler.windows, sampler.alerts, sampler.overruns,
+                    fwdlog.backlog, fwdlog.stored, fwdlog.replayed, fwdlog.dropped, fwdlog.corrupt, fwdlog.erases,
+                    mesh_rejoin_name( snap.rejoin ) );
+    len += boot_trace_json( metrics_msg + len, METRICS_MSG_SIZE - len );
+    len += snprintf( metrics_msg + len, METRICS_MSG_SIZE - len, ",\"cpu\":[" );
+    for( int core = 0; core < portNUM_PROCESSORS; core++ )
+    {
+        len += snprintf( metrics_msg + len, METRICS_MSG_SIZE - len, "%s%u", core ? "," : "",
+                         (unsigned)task_layout_cpu_busy( &cpu_prev, &cpu, core ) );
+    }
+    cpu_prev = cpu;
+    len += snprintf( metrics_msg + len, METRICS_MSG_SIZE - len, "],\"stacks\":[" );
+
+    for( int i = 0; i < task_count && len < METRICS_MSG_SIZE - 48; i++ )
+    {
+        len += snprintf( metrics_msg + len, METRICS_MSG_SIZE - len, "%s{\"task\":\"%s\",\"free\":%u}",
+                         i ? "," : "", pcTaskGetTaskName( tasks[i] ),
+                         (unsigned)uxTaskGetStackHighWaterMark( tasks[i] ) );
+    }
+    snprintf( metrics_msg + len, METRICS_MSG_SIZE - len, "]}" );
+    mqtt_app_publish( METRICS_TOPIC, metrics_msg );
+}
+
+void metrics_publish( void )
+{
+    node_metrics_t node;
+    char id[NODE_ID_LEN];
+    char heap_min_id[NODE_ID_LEN] = "";
+    char stack_min_id[NODE_ID_LEN] = "";
+    uint32_t heap_min = UINT32_MAX;
+    uint32_t stack_min = UINT32_MAX;
+    uint32_t reporting = 0, stale = 0;
+    uint32_t rx = 0, tx = 0, tx_err = 0, parent_disc = 0, txq_dropped = 0;
+    uint32_t cached = 0, boot_conn_max = 0, boot_tx_max = 0;
+    int64_t now = esp_timer_get_time();
+    int len;
+
+    metrics_publish_self();
+
+    /**
+     * Per node, split over as many messages as needed, while the fleet
+     * totals are accumulated
+     */
+    len = snprintf( metrics_msg, METRICS_MSG_SIZE, "{\"nodes\":[" );
+    for( int i = 0; i < CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        if( !node_registry_get( i, NULL, id, sizeof( id ) ) )
+        {
+            continue;
+        }
+        portENTER_CRITICAL( &nodes_lock );
+        node = nodes[i];
+        portEXIT_CRITICAL( &nodes_lock );
+        if( node.received_us == 0 )
+        {
+            continue;
+        }
+        if( now - node.received_us > METRICS_STALE_US )
+        {
+            stale++;
+            continue;
+        }
+
+        reporting++;
+        rx += node.snap.rx_frames;
+        tx += node.snap.tx_frames;
+        tx_err += node.snap.tx_errors;
+        parent_disc += node.snap.parent_disconnects;
+        txq_dropped += node.snap.txq_dropped;
+        cached += node.snap.rejoin == MESH_REJOIN_CACHED;
+        if( node.snap.boot_connected_ms > boot_conn_max )
+        {
+            boot_conn_max = node.snap.boot_connected_ms;
+        }
+        if( node.snap.boot_first_tx_ms > boot_tx_max )
+        {
+            boot_tx_max = node.snap.boot_first_tx_ms;
+        }
+        if( node.snap.min_free_heap < heap_min )
+        {
+            heap_min = node.snap.min_free_heap;
+            strlcpy( heap_min_id, id, sizeof( heap_min_id ) );
+        }
+        if( node.snap.min_stack_free < stack_min )
+        {
+            stack_min = node.snap.min_stack_free;
+            strlcpy( stack_min_id, id, sizeof( stack_min_id ) );
+        }
+
+        if( len > METRICS_MSG_SIZE - 256 )
+        {
+            snprintf( metrics_msg + len, METRICS_MSG_SIZE - len, "]}" );
+            mqtt_app_publish( METRICS_NODES_TOPIC, metrics_msg );
+            len = snprintf( metrics_msg, METRICS_MSG_SIZE, "{\"nodes\":[" );
+        }
+        len += snprintf( metrics_msg + len, METRICS_MSG_SIZE - len,
+                         "%s{\"id\":\"%s\",\"up\":%u,\"heap\":%u,\"heap_min\":%u,\"stack_min\":%u,"
+                         "\"tx_err\":%u,\"parent_disc\":%u,\"txq\":%u,"
+                         "\"rejoin\":\"%s\",\"boot_conn\":%u,\"boot_tx\":%u}",
+                         metrics_msg[len - 1] == '[' ? "" : ",", id, node.snap.uptime_s,
+                         node.snap.free_heap, node.snap.min_free_heap, node.snap.min_stack_free,
+                         node.snap.tx_errors, node.snap.parent_disconnects, node.snap.txq_depth,
+                         mesh_rejoin_name( node.snap.rejoin ), node.snap.boot_connected_ms,
+                         node.snap.boot_first_tx_ms );
+    }
+    if( metrics_msg[len - 1] != '[' )
+    {
+        snprintf( metrics_msg + len, METRICS_MSG_SIZE - len, "]}" );
+        mqtt_app_publish( METRICS_NODES_TOPIC, metrics_msg );
+    }
+
+    /**
+     * Fleet aggregate, with the nodes closest to running out of memory
+     */
+    len = snprintf( metrics_msg, METRICS_MSG_SIZE,
+                    "{\"fleet\":{\"nodes\":%u,\"stale\":%u,\"rx\":%u,\"tx\":%u,\"tx_err\":%u,"
+                    "\"parent_disc\":%u,\"txq_dropped\":%u,\"rejoin_cached\":%u,"
+                    "\"boot_conn_max\":%u,\"boot_tx_max\":%u",
+                    reporting, stale, rx, tx, tx_err, parent_disc, txq_dropped,
+                    cached, boot_conn_max, boot_tx_max );
+    if( reporting )
+    {
+        snprintf( metrics_msg + len, METRICS_MSG_SIZE - len,
+                  ",\"heap_min\":{\"id\":\"%s\",\"bytes\":%u},\"stack_min\":{\"id\":\"%s\",\"bytes\":%u}}}",
+                  heap_min_id, heap_min, stack_min_id, stack_min );
+    }
+    else
+    {
+        snprintf( metrics_msg + len, METRICS_MSG_SIZE - len, "}}" );
+    }
+    mqtt_app_publish( METRICS_FLEET_TOPIC, metrics_msg );
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "health published (%u nodes reporting, %u stale)", reporting, stale );
+    #endif
+}
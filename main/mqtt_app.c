@@ -10,17 +10,32 @@
 #include "sys_config.h"
 
 #include "mqtt_client.h"
+#include "mqtt_app.h"
+#include "mqtt_outbox.h"
+#include "downlink.h"
+#include "dedup.h"
+#include "metrics.h"
+#include "boot_trace.h"
+#include "task_layout.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 static const char *TAG = "mesh_mqtt";
 static esp_mqtt_client_handle_t s_client = NULL;
-void mqtt_app_publish(char* , char *);
+static volatile bool s_connected = false;
+static bool s_state_rx = false;         // the data event continues a part of the dedup state
 
 static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
 {
     switch (event->event_id) {
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-            if (esp_mqtt_client_subscribe(s_client, "/topic", 0) < 0) {
+            s_connected = true;
+            boot_mark(BOOT_MQTT_CONNECTED);
+            // the retained sequence windows of the previous root come back once
+            if (esp_mqtt_client_subscribe(s_client, DOWNLINK_TOPIC_FILTER, 1) < 0 ||
+                esp_mqtt_client_subscribe(s_client, DEDUP_STATE_FILTER, 1) < 0) {
                 // Disconnect to retry the subscribe after auto-reconnect timeout
                 esp_mqtt_client_disconnect(s_client);
             }
@@ -28,7 +43,8 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
             break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
-            
+            s_connected = false;
+            metrics_inc(METRIC_MQTT_DISCONNECTS);
             break;
 
         case MQTT_EVENT_SUBSCRIBED:
@@ -39,14 +55,31 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
             break;
         case MQTT_EVENT_PUBLISHED:
             ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+            metrics_inc(METRIC_MQTT_ACKS);
             break;
         case MQTT_EVENT_DATA:
             ESP_LOGI(TAG, "MQTT_EVENT_DATA");
             ESP_LOGI(TAG, "TOPIC=%.*s", event->topic_len, event->topic);
             ESP_LOGI(TAG, "DATA=%.*s", event->data_len, event->data);
+            if (event->current_data_offset == 0) {
+                s_state_rx = event->topic_len > strlen(DEDUP_STATE_TOPIC "/") &&
+                             !strncmp(event->topic, DEDUP_STATE_TOPIC "/", strlen(DEDUP_STATE_TOPIC "/"));
+            }
+            if (s_state_rx) {
+                if (dedup_restore(event->data, event->data_len, event->current_data_offset, event->total_data_len)) {
+                    // own publishes would come back otherwise
+                    esp_mqtt_client_unsubscribe(s_client, DEDUP_STATE_FILTER);
+                }
+                break;
+            }
+            // commands fit in one mesh frame, so they always arrive unfragmented
+            if (event->current_data_offset == 0 && event->data_len == event->total_data_len) {
+                downlink_post(event->topic, event->topic_len, event->data, event->data_len);
+            }
             break;
         case MQTT_EVENT_ERROR:
             ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+            metrics_inc(METRIC_MQTT_ERRORS);
             break;
         default:
             ESP_LOGI(TAG, "Other event id:%d", event->event_id);
@@ -60,16 +93,50 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     mqtt_event_handler_cb(event_data);
 }
 
-void mqtt_app_publish(char* topic, char *publish_string)
+void mqtt_app_publish(const char* topic, const char *publish_string)
 {
-    if (s_client) {
-        int msg_id = esp_mqtt_client_publish(s_client, topic, publish_string, 0, 1, 0);
-        ESP_LOGI(TAG, "sent publish returned msg_id=%d", msg_id);
+    if (mqtt_outbox_post(topic, publish_string, strlen(publish_string)) != ESP_OK) {
+        ESP_LOGW(TAG, "outbox full, dropped publish on %s", topic);
+    }
+}
+
+int mqtt_app_client_publish(const char *topic, const char *data, size_t len, int qos, bool retain)
+{
+    if (!s_client) {
+        return -1;
+    }
+    /* the client copies the payload into its own outbox */
+    frame_pool_count_copy(len);
+    int msg_id = esp_mqtt_client_publish(s_client, topic, data, len, qos, retain);
+    metrics_inc(msg_id < 0 ? METRIC_MQTT_ERRORS : METRIC_MQTT_PUBLISHES);
+    if (msg_id >= 0) {
+        boot_mark(BOOT_FIRST_PUBLISH);
     }
+    return msg_id;
+}
+
+bool mqtt_app_connected(void)
+{
+    return s_connected;
 }
 
 void mqtt_app_start(void)
 {
+    TaskHandle_t task;
+
+    // MESH_EVENT_ROOT_ADDRESS is raised again on every root change
+    if (s_client) {
+        return;
+    }
+
+    ESP_ERROR_CHECK(mqtt_outbox_init());
+    ESP_ERROR_CHECK(downlink_start());
+    if (task_layout_create(TASK_LAYOUT_MQTT_PUBLISHER, task_mqtt_publisher, "task_mqtt_publisher", NULL, &task) != pdPASS) {
+        ESP_LOGE(TAG, "task_mqtt_publisher NOT ALLOCATED");
+        return;
+    }
+    metrics_register_task(task);
+
     esp_mqtt_client_config_t mqtt_cfg = {
             .host = "192.168.137.1",
             .port = 1883,
@@ -79,7 +146,9 @@ void mqtt_app_start(void)
             .lwt_msg_len = 0,
             .lwt_qos = 1,
             .lwt_retain = 1,
-            .keepalive = 10
+            .keepalive = 10,
+            .task_prio = TASK_LAYOUT_MQTT_CLIENT_PRIO,
+            .task_stack = TASK_LAYOUT_MQTT_CLIENT_STACK
     };
 
     s_client = esp_mqtt_client_init(&mqtt_cfg);
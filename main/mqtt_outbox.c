@@ -0,0 +1,460 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "mqtt_outbox.h"
+#include "mqtt_app.h"
+#include "latency_hist.h"
+#include "dedup.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "outbox: ";
+
+#define OUTBOX_HWM              ( CONFIG_APP_MQTT_OUTBOX_LEN * CONFIG_APP_MQTT_OUTBOX_HWM_PCT / 100 )
+#define OUTBOX_RECONNECT_POLL_MS ( 100 )
+
+/**
+ * Per-topic publish policy; a topic ending in "/#" covers every topic
+ * below it. Such an entry cannot coalesce, as its topics share one
+ * queued value.
+ */
+typedef struct {
+    const char *topic;
+    uint8_t     qos;
+    bool        retain;
+    bool        coalesce;   /* state topic: only the latest queued value is sent */
+    bool        downgrade;  /* may go out at QoS 0 above the high-water mark */
+} outbox_policy_t;
+
+static const outbox_policy_t policies[] = {
+    { "ESP-connect",             1, false, false, false },
+    { "ESP-disconnect",          1, false, false, false },
+    { "ESP-send",                1, false, false, true  },
+    { "ESP-batch",               1, false, false, true  },
+    { "ESP-summary",             1, false, false, true  },
+    { "ESP-alert",               1, false, false, false },
+    { "ESP-fleet",               0, true,  true,  false },
+    { "ESP-stats/latency",       0, true,  true,  false },
+    { "ESP-stats/latency/nodes", 0, false, false, false },
+    { "ESP-stats/health",        0, true,  true,  false },
+    { "ESP-stats/health/nodes",  0, false, false, false },
+    { "ESP-stats/health/fleet",  0, true,  true,  false },
+    { DEDUP_STATE_TOPIC "/#",    1, true,  false, false },
+};
+
+#define OUTBOX_POLICIES ( sizeof( policies ) / sizeof( policies[0] ) )
+
+static const outbox_policy_t default_policy = { NULL, 1, false, false, true };
+
+typedef struct {
+    const outbox_policy_t  *policy;
+    int                     index;      /* into policies[], -1 for the default */
+    char                    topic[MQTT_OUTBOX_TOPIC_MAX];
+    char                   *payload;
+    frame_buf_t            *buf;        /* holds the payload if set, else the arena does */
+    size_t                  len;
+    int64_t                 queued_us;
+} outbox_msg_t;
+
+/**
+ * Slot pool and FIFO, as in tx_queue
+ */
+static outbox_msg_t slots[CONFIG_APP_MQTT_OUTBOX_LEN];
+static QueueHandle_t free_slots = NULL;
+static QueueHandle_t ready = NULL;
+
+/**
+ * Queued message of each coalescing topic, NULL once the publisher took it
+ */
+static outbox_msg_t *coalesced[OUTBOX_POLICIES];
+
+static mqtt_outbox_stats_t stats = { 0, };
+static latency_hist_t latency;
+static portMUX_TYPE outbox_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Payload arena: payloads range from a few bytes to a whole stats
+ * report, so they are carved in order out of one static ring instead of
+ * the heap. Blocks are released mostly in order; one released early (a
+ * coalesced value) is reclaimed once the blocks before it are.
+ */
+#define ARENA_ALIGN         ( 4 )
+#define ARENA_HDR           ( sizeof( arena_hdr_t ) )
+#define ARENA_FREE          ( 0x8000 )  /* size flag: released */
+
+#if CONFIG_APP_MQTT_OUTBOX_ARENA_SIZE % ARENA_ALIGN
+#error "CONFIG_APP_MQTT_OUTBOX_ARENA_SIZE must be a multiple of 4"
+#endif
+
+typedef struct {
+    uint16_t size;          /* whole block, header included; 0: wrap to the start */
+    uint16_t reserved;
+} arena_hdr_t;
+
+static uint8_t arena[CONFIG_APP_MQTT_OUTBOX_ARENA_SIZE] __attribute__(( aligned( ARENA_ALIGN ) ));
+static size_t arena_head = 0;       /* next block */
+static size_t arena_tail = 0;       /* oldest block still held */
+static size_t arena_used = 0;       /* bytes between tail and head, skipped ends included */
+
+/**
+ * Returns a block for 'len' payload bytes or NULL if the ring is full;
+ * called with outbox_lock held
+ */
+static char *arena_alloc( size_t len )
+{
+    size_t need = ( ARENA_HDR + len + ARENA_ALIGN - 1 ) & ~( ARENA_ALIGN - 1 );
+    size_t end = sizeof( arena ) - arena_head;
+    arena_hdr_t *hdr;
+
+    if( need > sizeof( arena ) / 2 )
+    {
+        return NULL;
+    }
+    if( !arena_used )
+    {
+        arena_head = arena_tail = 0;
+    }
+    else if( arena_head <= arena_tail )
+    {
+        /**
+         * Free space is the gap up to the tail (none when head meets it)
+         */
+        if( arena_head == arena_tail || arena_tail - arena_head < need )
+        {
+            return NULL;
+        }
+    }
+    else if( end < need )
+    {
+        /**
+         * Too little room before the end: skip it and start over at 0
+         */
+        if( arena_tail < need )
+        {
+            return NULL;
+        }
+        ( (arena_hdr_t *)&arena[arena_head] )->size = 0;
+        arena_used += end;
+        arena_head = 0;
+    }
+
+    hdr = (arena_hdr_t *)&arena[arena_head];
+    hdr->size = (uint16_t)need;
+    arena_head = ( arena_head + need ) % sizeof( arena );
+    arena_used += need;
+    if( arena_used > stats.arena_peak )
+    {
+        stats.arena_peak = arena_used;
+    }
+    return (char *)( hdr + 1 );
+}
+
+/**
+ * Releases a block and reclaims every released block at the tail;
+ * called with outbox_lock held
+ */
+static void arena_free( char *payload )
+{
+    arena_hdr_t *hdr = (arena_hdr_t *)payload - 1;
+
+    hdr->size |= ARENA_FREE;
+    while( arena_used )
+    {
+        hdr = (arena_hdr_t *)&arena[arena_tail];
+        if( hdr->size == 0 )
+        {
+            arena_used -= sizeof( arena ) - arena_tail;
+            arena_tail = 0;
+            continue;
+        }
+        if( !( hdr->size & ARENA_FREE ) )
+        {
+            break;
+        }
+        arena_used -= hdr->size & ~ARENA_FREE;
+        arena_tail = ( arena_tail + ( hdr->size & ~ARENA_FREE ) ) % sizeof( arena );
+    }
+}
+
+esp_err_t mqtt_outbox_init( void )
+{
+    if( ready )
+    {
+        return ESP_OK;
+    }
+
+    free_slots = xQueueCreate( CONFIG_APP_MQTT_OUTBOX_LEN, sizeof( outbox_msg_t * ) );
+    ready = xQueueCreate( CONFIG_APP_MQTT_OUTBOX_LEN, sizeof( outbox_msg_t * ) );
+    if( !free_slots || !ready )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    for( int i = 0; i < CONFIG_APP_MQTT_OUTBOX_LEN; i++ )
+    {
+        outbox_msg_t *msg = &slots[i];
+        xQueueSend( free_slots, &msg, 0 );
+    }
+    latency_hist_reset( &latency );
+    return ESP_OK;
+}
+
+static int policy_find( const char *topic )
+{
+    for( int i = 0; i < OUTBOX_POLICIES; i++ )
+    {
+        size_t len = strlen( policies[i].topic );
+
+        if( strcmp( policies[i].topic, topic ) == 0 ||
+            ( len >= 2 && strcmp( policies[i].topic + len - 2, "/#" ) == 0 &&
+              strncmp( policies[i].topic, topic, len - 1 ) == 0 ) )
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void outbox_count_drop( void )
+{
+    portENTER_CRITICAL( &outbox_lock );
+    stats.dropped++;
+    portEXIT_CRITICAL( &outbox_lock );
+}
+
+/**
+ * Gives back a payload: the frame buffer reference, or the arena block
+ */
+static void outbox_payload_free( char *payload, frame_buf_t *buf )
+{
+    if( buf )
+    {
+        frame_pool_release( buf );
+        return;
+    }
+    portENTER_CRITICAL( &outbox_lock );
+    arena_free( payload );
+    portEXIT_CRITICAL( &outbox_lock );
+}
+
+/**
+ * Queues a payload the outbox already owns, or coalesces it into the
+ * queued value of its topic; on failure the payload is given back
+ */
+static esp_err_t outbox_enqueue( const char *topic, char *payload, frame_buf_t *buf, size_t len )
+{
+    outbox_msg_t *msg;
+    char *old = NULL;
+    frame_buf_t *old_buf = NULL;
+    int index = policy_find( topic );
+
+    /**
+     * State topic with a value still queued: overwrite it in place
+     */
+    if( index >= 0 && policies[index].coalesce )
+    {
+        portENTER_CRITICAL( &outbox_lock );
+        msg = coalesced[index];
+        if( msg )
+        {
+            old = msg->payload;
+            old_buf = msg->buf;
+            msg->payload = payload;
+            msg->buf = buf;
+            msg->len = len;
+            msg->queued_us = esp_timer_get_time();
+            stats.coalesced++;
+            stats.posted++;
+        }
+        portEXIT_CRITICAL( &outbox_lock );
+        if( msg )
+        {
+            outbox_payload_free( old, old_buf );
+            return ESP_OK;
+        }
+    }
+
+    if( xQueueReceive( free_slots, &msg, 0 ) != pdTRUE )
+    {
+        outbox_payload_free( payload, buf );
+        outbox_count_drop();
+        return ESP_ERR_NO_MEM;
+    }
+    msg->policy = index >= 0 ? &policies[index] : &default_policy;
+    msg->index = index;
+    strlcpy( msg->topic, topic, sizeof( msg->topic ) );
+    msg->payload = payload;
+    msg->buf = buf;
+    msg->len = len;
+    msg->queued_us = esp_timer_get_time();
+
+    /**
+     * Published before the message becomes visible to the publisher,
+     * so it can never be overwritten after it was taken
+     */
+    portENTER_CRITICAL( &outbox_lock );
+    if( msg->policy->coalesce )
+    {
+        coalesced[index] = msg;
+    }
+    stats.posted++;
+    portEXIT_CRITICAL( &outbox_lock );
+
+    xQueueSend( ready, &msg, 0 );
+
+    UBaseType_t depth = uxQueueMessagesWaiting( ready );
+    portENTER_CRITICAL( &outbox_lock );
+    if( depth > stats.peak_depth )
+    {
+        stats.peak_depth = depth;
+    }
+    portEXIT_CRITICAL( &outbox_lock );
+    return ESP_OK;
+}
+
+esp_err_t mqtt_outbox_post( const char *topic, const char *data, size_t len )
+{
+    char *payload;
+
+    if( !ready )
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if( strlen( topic ) >= MQTT_OUTBOX_TOPIC_MAX )
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    portENTER_CRITICAL( &outbox_lock );
+    payload = arena_alloc( len );
+    portEXIT_CRITICAL( &outbox_lock );
+    if( !payload )
+    {
+        outbox_count_drop();
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy( payload, data, len );
+    frame_pool_count_copy( len );
+    return outbox_enqueue( topic, payload, NULL, len );
+}
+
+esp_err_t mqtt_outbox_post_buf( const char *topic, frame_buf_t *buf, const char *data, size_t len )
+{
+    if( frame_pool_available() < FRAME_POOL_RESERVE )
+    {
+        return mqtt_outbox_post( topic, data, len );
+    }
+    if( !ready )
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if( strlen( topic ) >= MQTT_OUTBOX_TOPIC_MAX )
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    frame_pool_ref( buf );
+    portENTER_CRITICAL( &outbox_lock );
+    stats.by_ref++;
+    portEXIT_CRITICAL( &outbox_lock );
+    return outbox_enqueue( topic, (char *)data, buf, len );
+}
+
+void mqtt_outbox_get_stats( mqtt_outbox_stats_t *out )
+{
+    portENTER_CRITICAL( &outbox_lock );
+    *out = stats;
+    out->latency_p50_us = latency_hist_percentile( &latency, 50 );
+    out->latency_p99_us = latency_hist_percentile( &latency, 99 );
+    out->latency_max_us = latency.max_us;
+    portEXIT_CRITICAL( &outbox_lock );
+
+    out->depth = ready ? uxQueueMessagesWaiting( ready ) : 0;
+}
+
+/**
+ * Publisher Task: the only caller of esp_mqtt_client_publish(), so a
+ * slow broker or a reconnect only ever stalls this task
+ */
+void task_mqtt_publisher( void *pvParameter )
+{
+    outbox_msg_t *msg;
+    char *payload;
+    frame_buf_t *buf;
+    size_t len;
+    int qos;
+    int msg_id;
+
+    for( ;; )
+    {
+        xQueueReceive( ready, &msg, portMAX_DELAY );
+
+        /**
+         * Detach the payload so producers stop coalescing into this slot
+         */
+        portENTER_CRITICAL( &outbox_lock );
+        if( msg->index >= 0 && coalesced[msg->index] == msg )
+        {
+            coalesced[msg->index] = NULL;
+        }
+        payload = msg->payload;
+        buf = msg->buf;
+        len = msg->len;
+        portEXIT_CRITICAL( &outbox_lock );
+
+        /**
+         * Hold on to the message while the broker is away; new ones keep
+         * queuing behind it until the outbox is full
+         */
+        while( !mqtt_app_connected() )
+        {
+            vTaskDelay( OUTBOX_RECONNECT_POLL_MS / portTICK_PERIOD_MS );
+        }
+
+        qos = msg->policy->qos;
+        if( qos > 0 && msg->policy->downgrade && uxQueueMessagesWaiting( ready ) + 1 >= OUTBOX_HWM )
+        {
+            qos = 0;
+            portENTER_CRITICAL( &outbox_lock );
+            stats.downgraded++;
+            portEXIT_CRITICAL( &outbox_lock );
+        }
+
+        msg_id = mqtt_app_client_publish( msg->topic, payload, len, qos, msg->policy->retain );
+
+        portENTER_CRITICAL( &outbox_lock );
+        if( msg_id < 0 )
+        {
+            stats.errors++;
+        }
+        else
+        {
+            stats.published++;
+        }
+        latency_hist_add( &latency, (uint32_t)( esp_timer_get_time() - msg->queued_us ) );
+        portEXIT_CRITICAL( &outbox_lock );
+
+        #ifdef DEBUG
+            ESP_LOGI( TAG, "%s: %u bytes, qos %d, msg_id %d", msg->topic, (unsigned)len, qos, msg_id );
+        #endif
+
+        outbox_payload_free( payload, buf );
+        xQueueSend( free_slots, &msg, 0 );
+    }
+
+    vTaskDelete(NULL);
+}
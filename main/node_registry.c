@@ -0,0 +1,346 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "node_registry.h"
+
+/**
+ * Slot states; removed slots become tombstones so the probe chains of
+ * other nodes stay intact and their slot indices never move.
+ */
+#define SLOT_EMPTY      ( 0 )
+#define SLOT_USED       ( 1 )
+#define SLOT_DELETED    ( 2 )
+
+typedef struct {
+    uint8_t  mac[6];
+    uint8_t  state;
+    uint16_t index;
+    char     id[NODE_ID_LEN];
+} node_slot_t;
+
+static node_slot_t slots[NODE_REGISTRY_CAPACITY];
+static int node_count = 0;
+
+/**
+ * Id index: slot number of each node, probed by id hash, with the same
+ * tombstone scheme
+ */
+#define ID_EMPTY        ( -1 )
+#define ID_DELETED      ( -2 )
+
+static int16_t id_table[NODE_REGISTRY_CAPACITY];
+
+/**
+ * Dense node indices: a stack of free ones and the slot holding each
+ * assigned one (-1 when free)
+ */
+static uint16_t free_index[CONFIG_MESH_ROUTE_TABLE_SIZE];
+static int free_top = 0;
+static int16_t index_slot[CONFIG_MESH_ROUTE_TABLE_SIZE];
+
+/**
+ * Accessed from task_mesh_rx and from the mesh event handler
+ */
+static portMUX_TYPE registry_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * FNV-1a over the address; the OUI bytes are shared by every node,
+ * so all six bytes are mixed rather than just the leading ones.
+ */
+static uint32_t mac_hash( const uint8_t mac[6] )
+{
+    uint32_t h = 2166136261u;
+    for( int i = 0; i < 6; i++ )
+    {
+        h ^= mac[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t id_hash( const char *id )
+{
+    uint32_t h = 2166136261u;
+    for( int i = 0; i < NODE_ID_LEN && id[i]; i++ )
+    {
+        h ^= (uint8_t)id[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * Returns the id_table position pointing at a node with 'id', or -1.
+ * When 'free_pos' is given it receives the first reusable position.
+ */
+static int id_probe( const char *id, int *free_pos )
+{
+    uint32_t pos = id_hash( id ) & ( NODE_REGISTRY_CAPACITY - 1 );
+    int first_free = -1;
+
+    for( int n = 0; n < NODE_REGISTRY_CAPACITY; n++ )
+    {
+        int16_t slot = id_table[pos];
+        if( slot == ID_EMPTY )
+        {
+            if( first_free < 0 )
+            {
+                first_free = pos;
+            }
+            break;
+        }
+        if( slot == ID_DELETED )
+        {
+            if( first_free < 0 )
+            {
+                first_free = pos;
+            }
+        }
+        else if( strncmp( slots[slot].id, id, NODE_ID_LEN ) == 0 )
+        {
+            return pos;
+        }
+        pos = ( pos + 1 ) & ( NODE_REGISTRY_CAPACITY - 1 );
+    }
+    if( free_pos )
+    {
+        *free_pos = first_free;
+    }
+    return -1;
+}
+
+/**
+ * Points the id of slot 'idx' at it; a node re-using an id takes it over
+ */
+static void id_insert( int idx )
+{
+    int free_pos = -1;
+    int pos = id_probe( slots[idx].id, &free_pos );
+
+    if( pos < 0 )
+    {
+        pos = free_pos;
+    }
+    if( pos >= 0 )
+    {
+        id_table[pos] = idx;
+    }
+}
+
+static void id_erase( int idx )
+{
+    int pos = id_probe( slots[idx].id, NULL );
+
+    if( pos < 0 || id_table[pos] != idx )
+    {
+        return;
+    }
+    id_table[pos] = ID_DELETED;
+    while( id_table[pos] == ID_DELETED &&
+           id_table[( pos + 1 ) & ( NODE_REGISTRY_CAPACITY - 1 )] == ID_EMPTY )
+    {
+        id_table[pos] = ID_EMPTY;
+        pos = ( pos - 1 ) & ( NODE_REGISTRY_CAPACITY - 1 );
+    }
+}
+
+/**
+ * Returns the slot holding 'mac', or -1. When 'free_slot' is given it
+ * receives the first reusable slot along the probe chain (or -1).
+ */
+static int probe( const uint8_t mac[6], int *free_slot )
+{
+    uint32_t idx = mac_hash( mac ) & ( NODE_REGISTRY_CAPACITY - 1 );
+    int first_free = -1;
+
+    for( int n = 0; n < NODE_REGISTRY_CAPACITY; n++ )
+    {
+        node_slot_t *slot = &slots[idx];
+        if( slot->state == SLOT_EMPTY )
+        {
+            if( first_free < 0 )
+            {
+                first_free = idx;
+            }
+            break;
+        }
+        if( slot->state == SLOT_DELETED )
+        {
+            if( first_free < 0 )
+            {
+                first_free = idx;
+            }
+        }
+        else if( memcmp( slot->mac, mac, 6 ) == 0 )
+        {
+            return idx;
+        }
+        idx = ( idx + 1 ) & ( NODE_REGISTRY_CAPACITY - 1 );
+    }
+    if( free_slot )
+    {
+        *free_slot = first_free;
+    }
+    return -1;
+}
+
+void node_registry_init( void )
+{
+    portENTER_CRITICAL( &registry_lock );
+    memset( slots, 0, sizeof( slots ) );
+    memset( id_table, 0xff, sizeof( id_table ) );
+    node_count = 0;
+    for( int i = 0; i < CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        free_index[i] = CONFIG_MESH_ROUTE_TABLE_SIZE - 1 - i;
+        index_slot[i] = -1;
+    }
+    free_top = CONFIG_MESH_ROUTE_TABLE_SIZE;
+    portEXIT_CRITICAL( &registry_lock );
+}
+
+int node_registry_upsert( const uint8_t mac[6], const char *id, bool *created )
+{
+    int free_slot = -1;
+    int index = -1;
+    bool is_new = false;
+
+    portENTER_CRITICAL( &registry_lock );
+    int idx = probe( mac, &free_slot );
+    if( idx < 0 && free_slot >= 0 && free_top > 0 )
+    {
+        idx = free_slot;
+        memcpy( slots[idx].mac, mac, 6 );
+        slots[idx].state = SLOT_USED;
+        slots[idx].index = free_index[--free_top];
+        index_slot[slots[idx].index] = idx;
+        node_count++;
+        is_new = true;
+    }
+    if( idx >= 0 )
+    {
+        if( is_new || strncmp( slots[idx].id, id, NODE_ID_LEN ) != 0 )
+        {
+            if( !is_new )
+            {
+                id_erase( idx );
+            }
+            strlcpy( slots[idx].id, id, NODE_ID_LEN );
+            id_insert( idx );
+        }
+        index = slots[idx].index;
+    }
+    portEXIT_CRITICAL( &registry_lock );
+
+    if( created )
+    {
+        *created = is_new;
+    }
+    return index;
+}
+
+int node_registry_lookup( const uint8_t mac[6], char *id, size_t id_len )
+{
+    portENTER_CRITICAL( &registry_lock );
+    int idx = probe( mac, NULL );
+    int index = idx >= 0 ? slots[idx].index : -1;
+    if( idx >= 0 && id )
+    {
+        strlcpy( id, slots[idx].id, id_len );
+    }
+    portEXIT_CRITICAL( &registry_lock );
+    return index;
+}
+
+int node_registry_remove( const uint8_t mac[6], char *id, size_t id_len )
+{
+    int index = -1;
+
+    portENTER_CRITICAL( &registry_lock );
+    int idx = probe( mac, NULL );
+    if( idx >= 0 )
+    {
+        if( id )
+        {
+            strlcpy( id, slots[idx].id, id_len );
+        }
+        index = slots[idx].index;
+        id_erase( idx );
+        index_slot[index] = -1;
+        free_index[free_top++] = index;
+        slots[idx].state = SLOT_DELETED;
+        node_count--;
+
+        /**
+         * A tombstone followed by an empty slot ends no probe chain,
+         * so trailing tombstones are cleared to keep misses short.
+         */
+        int i = idx;
+        while( slots[i].state == SLOT_DELETED &&
+               slots[( i + 1 ) & ( NODE_REGISTRY_CAPACITY - 1 )].state == SLOT_EMPTY )
+        {
+            slots[i].state = SLOT_EMPTY;
+            i = ( i - 1 ) & ( NODE_REGISTRY_CAPACITY - 1 );
+        }
+    }
+    portEXIT_CRITICAL( &registry_lock );
+    return index;
+}
+
+int node_registry_find_id( const char *id, uint8_t mac[6] )
+{
+    int index = -1;
+
+    portENTER_CRITICAL( &registry_lock );
+    int pos = id_probe( id, NULL );
+    if( pos >= 0 )
+    {
+        int idx = id_table[pos];
+        index = slots[idx].index;
+        if( mac )
+        {
+            memcpy( mac, slots[idx].mac, 6 );
+        }
+    }
+    portEXIT_CRITICAL( &registry_lock );
+    return index;
+}
+
+bool node_registry_get( int index, uint8_t mac[6], char *id, size_t id_len )
+{
+    bool found = false;
+
+    if( index < 0 || index >= CONFIG_MESH_ROUTE_TABLE_SIZE )
+    {
+        return false;
+    }
+
+    portENTER_CRITICAL( &registry_lock );
+    int idx = index_slot[index];
+    if( idx >= 0 )
+    {
+        if( mac )
+        {
+            memcpy( mac, slots[idx].mac, 6 );
+        }
+        if( id )
+        {
+            strlcpy( id, slots[idx].id, id_len );
+        }
+        found = true;
+    }
+    portEXIT_CRITICAL( &registry_lock );
+    return found;
+}
+
+int node_registry_count( void )
+{
+    return node_count;
+}
@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+/**
+ * Mesh Net;
+ */
+#include "esp_mesh.h"
+
+#include "registration.h"
+#include "app.h"
+#include "mesh.h"
+#include "tx_queue.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "registration: ";
+
+/**
+ * How long to wait before trying again when the transmit queue had no
+ * control slot for an announcement
+ */
+#define REG_BUSY_RETRY_MS   ( 100 )
+
+/**
+ * Longest task_mesh_tx sleep asked for while nothing is scheduled
+ */
+#define REG_IDLE_MS         ( 1000 )
+
+/**
+ * This node's registration, the root that acknowledged it and the
+ * sweep the root still has to send
+ */
+static reg_state_t self = { .phase = REG_UNREGISTERED, .next_us = INT64_MAX };
+static uint8_t acked_by[6];
+static uint16_t self_slot = MESH_SLOT_NONE;
+static uint8_t self_epoch = 0;
+static uint8_t root_epoch = 0;
+static bool sweep_pending = false;
+static bool sweep_all = false;
+
+static registration_stats_t stats = { 0, };
+static portMUX_TYPE reg_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void reg_reset( reg_state_t *reg, int64_t now_us, uint32_t window_ms )
+{
+    reg->phase = REG_UNREGISTERED;
+    reg->sent = false;
+    reg->backoff_ms = CONFIG_APP_REG_ACK_TIMEOUT_MS;
+    reg->next_us = now_us + (int64_t)( esp_random() % ( window_ms + 1 ) ) * 1000;
+}
+
+bool reg_due( const reg_state_t *reg, int64_t now_us )
+{
+    return reg->phase != REG_REGISTERED && now_us >= reg->next_us;
+}
+
+void reg_sent( reg_state_t *reg, int64_t now_us, uint32_t seq )
+{
+    uint32_t wait = reg->backoff_ms / 2 + esp_random() % ( reg->backoff_ms / 2 + 1 );
+
+    if( !reg->sent )
+    {
+        reg->sent = true;
+        reg->first_seq = seq;
+    }
+    reg->phase = REG_WAIT_ACK;
+    reg->next_us = now_us + (int64_t)wait * 1000;
+    reg->backoff_ms = reg->backoff_ms * 2 < CONFIG_APP_REG_BACKOFF_MAX_MS ?
+                      reg->backoff_ms * 2 : CONFIG_APP_REG_BACKOFF_MAX_MS;
+}
+
+bool reg_ack( reg_state_t *reg, uint32_t seq )
+{
+    /**
+     * The ack of an earlier attempt arriving after its retry was sent
+     * still completes the registration
+     */
+    if( reg->phase != REG_WAIT_ACK || (int32_t)( seq - reg->first_seq ) < 0 )
+    {
+        return false;
+    }
+    reg->phase = REG_REGISTERED;
+    reg->next_us = INT64_MAX;
+    return true;
+}
+
+uint32_t registration_window_ms( int nodes )
+{
+    uint32_t window = (uint32_t)( nodes > 0 ? nodes : 0 ) * CONFIG_APP_REG_SLOT_MS;
+
+    return window > CONFIG_APP_REG_JITTER_MS ? window : CONFIG_APP_REG_JITTER_MS;
+}
+
+/**
+ * Starts over unless the first announcement is still to be sent
+ */
+static void registration_restart_window( uint32_t window_ms )
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL( &reg_lock );
+    if( self.phase != REG_UNREGISTERED || self.sent || self.next_us == INT64_MAX )
+    {
+        reg_reset( &self, now, window_ms );
+        stats.restarts++;
+    }
+    portEXIT_CRITICAL( &reg_lock );
+}
+
+void registration_restart( void )
+{
+    registration_restart_window( registration_window_ms( esp_mesh_get_total_node_num() ) );
+}
+
+bool registration_is_registered( void )
+{
+    return self.phase == REG_REGISTERED;
+}
+
+bool registration_get_slot( uint16_t *slot, uint8_t *epoch )
+{
+    bool valid;
+
+    portENTER_CRITICAL( &reg_lock );
+    valid = self.phase == REG_REGISTERED && self_slot != MESH_SLOT_NONE;
+    *slot = self_slot;
+    *epoch = self_epoch;
+    portEXIT_CRITICAL( &reg_lock );
+    return valid;
+}
+
+uint8_t registration_epoch( void )
+{
+    while( root_epoch == 0 )
+    {
+        root_epoch = (uint8_t)esp_random();
+    }
+    return root_epoch;
+}
+
+void registration_node_handle( const mesh_addr_t *from, const mesh_frame_t *frame )
+{
+    mesh_payload_connect_ack_t ack;
+    mesh_payload_reregister_t req;
+    bool done;
+    bool skip;
+
+    if( mesh_proto_get_connect_ack( frame, &ack ) == 0 )
+    {
+        portENTER_CRITICAL( &reg_lock );
+        done = reg_ack( &self, ack.seq );
+        if( done )
+        {
+            memcpy( acked_by, from->addr, 6 );
+            self_slot = ack.slot;
+            self_epoch = ack.epoch;
+            stats.acked++;
+        }
+        portEXIT_CRITICAL( &reg_lock );
+
+        if( done && ack.status != MESH_REG_OK )
+        {
+            ESP_LOGW( TAG, "Root "MACSTR" could not register this node (status %u)",
+                      MAC2STR( from->addr ), ack.status );
+        }
+        #ifdef DEBUG
+        else if( done )
+        {
+            ESP_LOGI( TAG, "Registered with root "MACSTR" (seq %u)", MAC2STR( from->addr ), ack.seq );
+        }
+        #endif
+        return;
+    }
+
+    if( mesh_proto_get_reregister( frame, &req ) == 0 )
+    {
+        portENTER_CRITICAL( &reg_lock );
+        skip = !( req.flags & MESH_REREGISTER_ALL ) && self.phase == REG_REGISTERED &&
+               memcmp( acked_by, from->addr, 6 ) == 0;
+        portEXIT_CRITICAL( &reg_lock );
+
+        if( !skip )
+        {
+            registration_restart_window( req.window_ms );
+        }
+    }
+}
+
+void registration_root_ack( const mesh_frame_t *frame, mesh_reg_status_t status, uint16_t slot )
+{
+    uint8_t payload[MESH_PAYLOAD_CONNECT_ACK_SIZE];
+    mesh_payload_connect_ack_t ack = {
+        .seq = frame->seq,
+        .status = status,
+        .slot = slot,
+        .epoch = registration_epoch(),
+    };
+
+    portENTER_CRITICAL( &reg_lock );
+    stats.acks_sent++;
+    portEXIT_CRITICAL( &reg_lock );
+
+    /**
+     * A lost ack only costs the node a retry, so this never waits
+     */
+    tx_frame_t *reply = tx_queue_alloc( TX_PRIO_CONTROL, TX_POLICY_DROP_NEW, 0 );
+    if( !reply )
+    {
+        return;
+    }
+    mesh_proto_put_connect_ack( &ack, payload, sizeof( payload ) );
+    int len = app_frame_build( MESH_MSG_CONNECT_ACK, payload, sizeof( payload ), 0, reply->data, sizeof( reply->data ) );
+    if( len < 0 )
+    {
+        tx_queue_release( reply );
+        return;
+    }
+    reply->len = len;
+    reply->dest = TX_DEST_ADDR;
+    memcpy( reply->to.addr, frame->mac, 6 );
+    tx_queue_submit( reply );
+}
+
+void registration_request_sweep( bool all )
+{
+    portENTER_CRITICAL( &reg_lock );
+    sweep_pending = true;
+    sweep_all = sweep_all || all;
+    portEXIT_CRITICAL( &reg_lock );
+}
+
+/**
+ * Root: broadcasts the pending MESH_MSG_REREGISTER
+ */
+static void registration_send_sweep( void )
+{
+    uint8_t payload[MESH_PAYLOAD_REREGISTER_SIZE];
+    mesh_payload_reregister_t req;
+
+    tx_frame_t *frame = tx_queue_alloc( TX_PRIO_CONTROL, TX_POLICY_DROP_NEW, 0 );
+    if( !frame )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &reg_lock );
+    req.flags = sweep_all ? MESH_REREGISTER_ALL : 0;
+    sweep_pending = false;
+    sweep_all = false;
+    stats.sweeps++;
+    portEXIT_CRITICAL( &reg_lock );
+
+    req.window_ms = registration_window_ms( esp_mesh_get_routing_table_size() );
+    mesh_proto_put_reregister( &req, payload, sizeof( payload ) );
+    int len = app_frame_build( MESH_MSG_REREGISTER, payload, sizeof( payload ), 0, frame->data, sizeof( frame->data ) );
+    if( len < 0 )
+    {
+        tx_queue_release( frame );
+        return;
+    }
+    frame->len = len;
+    frame->dest = TX_DEST_ALL;
+    tx_queue_submit( frame );
+
+    ESP_LOGI( TAG, "Re-registration sweep over %u ms%s", req.window_ms, req.flags ? " (all nodes)" : "" );
+}
+
+/**
+ * Node: sends the due announcement
+ */
+static void registration_send_connect( int64_t now )
+{
+    mesh_frame_t sent;
+
+    tx_frame_t *frame = tx_queue_alloc( TX_PRIO_CONTROL, TX_POLICY_DROP_NEW, 0 );
+    if( !frame )
+    {
+        portENTER_CRITICAL( &reg_lock );
+        self.next_us = now + REG_BUSY_RETRY_MS * 1000;
+        portEXIT_CRITICAL( &reg_lock );
+        return;
+    }
+    int len = app_frame_build( MESH_MSG_CONNECT, NULL, 0, 0, frame->data, sizeof( frame->data ) );
+    if( len < 0 || mesh_proto_decode( frame->data, len, &sent ) != 0 )
+    {
+        tx_queue_release( frame );
+        return;
+    }
+
+    portENTER_CRITICAL( &reg_lock );
+    if( self.sent )
+    {
+        stats.retries++;
+    }
+    stats.announced++;
+    reg_sent( &self, now, sent.seq );
+    portEXIT_CRITICAL( &reg_lock );
+
+    /**
+     * TX_DEST_ROOT: a NULL destination routes the frame to the root
+     */
+    frame->len = len;
+    tx_queue_submit( frame );
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "NON-ROOT sends Connect-Mesh (seq %u) to ROOT", sent.seq );
+    #endif
+}
+
+uint32_t registration_poll( void )
+{
+    int64_t now = esp_timer_get_time();
+    int64_t next;
+
+    if( esp_mesh_is_root() )
+    {
+        if( sweep_pending )
+        {
+            registration_send_sweep();
+        }
+        return REG_IDLE_MS;
+    }
+
+    /**
+     * Without a parent the announcement waits; the next
+     * MESH_EVENT_PARENT_CONNECTED starts over anyway
+     */
+    if( !mesh_app_is_connected() )
+    {
+        return REG_IDLE_MS;
+    }
+    if( reg_due( &self, now ) )
+    {
+        registration_send_connect( now );
+    }
+
+    portENTER_CRITICAL( &reg_lock );
+    next = self.phase == REG_REGISTERED ? INT64_MAX : self.next_us;
+    portEXIT_CRITICAL( &reg_lock );
+
+    if( next - now >= REG_IDLE_MS * 1000LL )
+    {
+        return REG_IDLE_MS;
+    }
+    return next > now ? (uint32_t)( ( next - now ) / 1000 ) : 0;
+}
+
+void registration_get_stats( registration_stats_t *out )
+{
+    portENTER_CRITICAL( &reg_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &reg_lock );
+}
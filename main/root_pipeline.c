@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "root_pipeline.h"
+#include "app.h"
+#include "metrics.h"
+#include "mqtt_app.h"
+#include "node_registry.h"
+#include "task_layout.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "root_pipeline: ";
+
+#define OVERLOAD_TOPIC      "ESP-stats/overload"
+#define OVERLOAD_MSG_SIZE   ( 512 )
+
+/**
+ * One flow per node index, and one shared by senders not registered yet
+ */
+#define ROOT_FLOWS          ( CONFIG_MESH_ROUTE_TABLE_SIZE + 1 )
+#define ROOT_FLOW_UNKNOWN   ( CONFIG_MESH_ROUTE_TABLE_SIZE )
+#define ROOT_ITEMS          ( CONFIG_APP_ROOT_QUEUE_LEN * CONFIG_APP_ROOT_WORKERS )
+
+/**
+ * Deficit round robin in frames: decoding and routing cost about the
+ * same for any frame, so every frame is charged one and a flow with
+ * frames queued gets one through per round
+ */
+#define DRR_QUANTUM         ( 1 )
+#define DRR_FRAME_COST      ( 1 )
+
+/**
+ * Token bucket, in thousandths of a frame. The flow of unregistered
+ * senders carries every node's Connect-Mesh after a root change, so it
+ * gets the rate and burst of the whole table and half the queue.
+ */
+#define TOKEN_FRAME         ( 1000 )
+#define FLOW_SCALE( f )     ( (f) == ROOT_FLOW_UNKNOWN ? CONFIG_MESH_ROUTE_TABLE_SIZE : 1 )
+#define FLOW_RATE( f )      ( CONFIG_APP_ROOT_NODE_RATE * FLOW_SCALE( f ) )
+#define FLOW_TOKENS( f )    ( CONFIG_APP_ROOT_NODE_BURST * TOKEN_FRAME * FLOW_SCALE( f ) )
+#define FLOW_LEN( f )       ( (f) == ROOT_FLOW_UNKNOWN ? ( ROOT_ITEMS + 1 ) / 2 : CONFIG_APP_ROOT_FLOW_LEN )
+
+#define ITEM_NONE           ( -1 )      /* no item, or no flow */
+
+typedef struct {
+    mesh_addr_t  from;
+    frame_buf_t *fb;
+    mesh_proto_t proto;
+    int16_t      next;
+} root_item_t;
+
+typedef struct {
+    int16_t  head;          /* queued frames, ITEM_NONE when empty */
+    int16_t  tail;
+    int16_t  next_active;   /* in its worker's round */
+    uint8_t  queued;
+    bool     active;
+    int32_t  deficit;
+    int32_t  tokens;
+    int64_t  refill_us;
+    uint32_t limited;       /* over the rate, dropped */
+    uint32_t full;          /* over APP_ROOT_FLOW_LEN, dropped */
+} root_flow_t;
+
+/**
+ * A worker serves its flows round-robin; a flow always goes to the same
+ * worker, so a node's frames stay in order
+ */
+typedef struct {
+    SemaphoreHandle_t work;     /* one count per queued frame */
+    int16_t head;               /* round of active flows */
+    int16_t tail;
+    bool    turn;               /* the head flow got its quantum */
+} root_worker_t;
+
+static root_item_t items[ROOT_ITEMS];
+static int16_t free_items = ITEM_NONE;
+static SemaphoreHandle_t free_count = NULL;
+
+static root_flow_t flows[ROOT_FLOWS];
+static root_worker_t workers[CONFIG_APP_ROOT_WORKERS];
+static bool started = false;
+
+static root_pipeline_stats_t stats = { 0, };
+
+/**
+ * Published overload counters, for the deltas
+ */
+static uint32_t limited_sent[ROOT_FLOWS];
+static uint32_t full_sent[ROOT_FLOWS];
+static char overload_msg[OVERLOAD_MSG_SIZE];
+
+static portMUX_TYPE pipeline_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void stage_account( root_stage_stats_t *stage, uint32_t frames, uint32_t us )
+{
+    stage->frames += frames;
+    stage->busy_us += us;
+    if( us > stage->max_us )
+    {
+        stage->max_us = us;
+    }
+}
+
+static void flow_reset( int f, int64_t now )
+{
+    root_flow_t *flow = &flows[f];
+
+    flow->tokens = FLOW_TOKENS( f );
+    flow->refill_us = now;
+    flow->limited = 0;
+    flow->full = 0;
+}
+
+/**
+ * Takes a token for one frame; false if the flow is over its rate.
+ * Called with pipeline_lock held.
+ */
+static bool flow_admit( int f, int64_t now )
+{
+    root_flow_t *flow = &flows[f];
+    int64_t refill = ( now - flow->refill_us ) * FLOW_RATE( f ) / 1000;
+
+    if( refill > 0 )
+    {
+        flow->tokens = refill >= FLOW_TOKENS( f ) - flow->tokens ? FLOW_TOKENS( f ) : flow->tokens + (int32_t)refill;
+        flow->refill_us = now;
+    }
+    if( flow->tokens < TOKEN_FRAME )
+    {
+        return false;
+    }
+    flow->tokens -= TOKEN_FRAME;
+    return true;
+}
+
+/**
+ * Next frame of worker 'w' by deficit round robin; ITEM_NONE if none.
+ * Called with pipeline_lock held.
+ */
+static int drr_next( root_worker_t *w )
+{
+    while( w->head != ITEM_NONE )
+    {
+        root_flow_t *flow = &flows[w->head];
+        int item = flow->head;
+
+        if( !w->turn )
+        {
+            flow->deficit += DRR_QUANTUM;
+            w->turn = true;
+        }
+        if( DRR_FRAME_COST <= flow->deficit )
+        {
+            flow->deficit -= DRR_FRAME_COST;
+            flow->head = items[item].next;
+            flow->queued--;
+            if( flow->head == ITEM_NONE )
+            {
+                /**
+                 * An idle flow keeps no credit
+                 */
+                flow->tail = ITEM_NONE;
+                flow->deficit = 0;
+                flow->active = false;
+                w->head = flow->next_active;
+                if( w->head == ITEM_NONE )
+                {
+                    w->tail = ITEM_NONE;
+                }
+                w->turn = false;
+            }
+            return item;
+        }
+
+        /**
+         * Out of credit: to the back of the round
+         */
+        int f = w->head;
+        w->head = flow->next_active;
+        flow->next_active = ITEM_NONE;
+        if( w->head == ITEM_NONE )
+        {
+            w->head = f;
+        }
+        else
+        {
+            flows[w->tail].next_active = f;
+        }
+        w->tail = f;
+        w->turn = false;
+    }
+    return ITEM_NONE;
+}
+
+/**
+ * Decode/route worker
+ */
+static void task_root_worker( void *pvParameter )
+{
+    root_worker_t *w = (root_worker_t *)pvParameter;
+    root_item_t item;
+    int index;
+    int64_t start;
+
+    for( ;; )
+    {
+        xSemaphoreTake( w->work, portMAX_DELAY );
+
+        portENTER_CRITICAL( &pipeline_lock );
+        index = drr_next( w );
+        if( index != ITEM_NONE )
+        {
+            item = items[index];
+            items[index].next = free_items;
+            free_items = index;
+        }
+        portEXIT_CRITICAL( &pipeline_lock );
+        if( index == ITEM_NONE )
+        {
+            continue;
+        }
+        xSemaphoreGive( free_count );
+
+        start = esp_timer_get_time();
+        app_root_handle_frame( &item.from, item.fb, item.proto );
+        frame_pool_release( item.fb );
+
+        portENTER_CRITICAL( &pipeline_lock );
+        stats.route.depth--;
+        stage_account( &stats.route, 1, (uint32_t)( esp_timer_get_time() - start ) );
+        portEXIT_CRITICAL( &pipeline_lock );
+    }
+}
+
+esp_err_t root_pipeline_start( void )
+{
+    TaskHandle_t task;
+    char name[16];
+    int64_t now = esp_timer_get_time();
+
+    if( started )
+    {
+        return ESP_OK;
+    }
+
+    for( int i = 0; i < ROOT_ITEMS; i++ )
+    {
+        items[i].next = i + 1 < ROOT_ITEMS ? i + 1 : ITEM_NONE;
+    }
+    free_items = 0;
+    for( int f = 0; f < ROOT_FLOWS; f++ )
+    {
+        flows[f].head = flows[f].tail = flows[f].next_active = ITEM_NONE;
+        flow_reset( f, now );
+    }
+    free_count = xSemaphoreCreateCounting( ROOT_ITEMS, ROOT_ITEMS );
+    if( !free_count )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for( int i = 0; i < CONFIG_APP_ROOT_WORKERS; i++ )
+    {
+        workers[i].head = workers[i].tail = ITEM_NONE;
+        workers[i].work = xSemaphoreCreateCounting( ROOT_ITEMS, 0 );
+        if( !workers[i].work )
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        snprintf( name, sizeof( name ), "task_root_w%d", i );
+        if( task_layout_create( TASK_LAYOUT_ROOT_WORKER, task_root_worker, name, &workers[i], &task ) != pdPASS )
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        metrics_register_task( task );
+    }
+    started = true;
+    return ESP_OK;
+}
+
+esp_err_t root_pipeline_submit( const mesh_addr_t *from, frame_buf_t *fb, mesh_proto_t proto, TickType_t wait )
+{
+    int node = node_registry_lookup( from->addr, NULL, 0 );
+    int f = node >= 0 ? node : ROOT_FLOW_UNKNOWN;
+    root_flow_t *flow = &flows[f];
+    root_worker_t *w = &workers[f % CONFIG_APP_ROOT_WORKERS];
+    int64_t now = esp_timer_get_time();
+    esp_err_t err = ESP_OK;
+    int index;
+
+    if( !started )
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /**
+     * Over its rate, or with its share of the queue taken: dropped here,
+     * so a flooding node costs the others neither a slot nor a wait
+     */
+    portENTER_CRITICAL( &pipeline_lock );
+    if( !flow_admit( f, now ) )
+    {
+        flow->limited++;
+        stats.limited++;
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else if( flow->queued >= FLOW_LEN( f ) )
+    {
+        flow->full++;
+        stats.flow_full++;
+        err = ESP_ERR_INVALID_STATE;
+    }
+    portEXIT_CRITICAL( &pipeline_lock );
+    if( err != ESP_OK )
+    {
+        return err;
+    }
+
+    if( xSemaphoreTake( free_count, wait ) != pdTRUE )
+    {
+        portENTER_CRITICAL( &pipeline_lock );
+        stats.route.dropped++;
+        portEXIT_CRITICAL( &pipeline_lock );
+        #ifdef DEBUG
+            ESP_LOGI( TAG, "Route queues full, frame dropped" );
+        #endif
+        return ESP_ERR_TIMEOUT;
+    }
+
+    frame_pool_ref( fb );
+    portENTER_CRITICAL( &pipeline_lock );
+    index = free_items;
+    free_items = items[index].next;
+    items[index].from = *from;
+    items[index].fb = fb;
+    items[index].proto = proto;
+    items[index].next = ITEM_NONE;
+    if( flow->tail == ITEM_NONE )
+    {
+        flow->head = index;
+    }
+    else
+    {
+        items[flow->tail].next = index;
+    }
+    flow->tail = index;
+    flow->queued++;
+    if( !flow->active )
+    {
+        flow->active = true;
+        flow->next_active = ITEM_NONE;
+        if( w->tail == ITEM_NONE )
+        {
+            w->head = f;
+        }
+        else
+        {
+            flows[w->tail].next_active = f;
+        }
+        w->tail = f;
+    }
+    stats.route.depth++;
+    if( stats.route.depth > stats.route.peak_depth )
+    {
+        stats.route.peak_depth = stats.route.depth;
+    }
+    portEXIT_CRITICAL( &pipeline_lock );
+
+    xSemaphoreGive( w->work );
+    return ESP_OK;
+}
+
+void root_pipeline_forget( int node_index )
+{
+    if( node_index < 0 || node_index >= CONFIG_MESH_ROUTE_TABLE_SIZE )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &pipeline_lock );
+    flow_reset( node_index, esp_timer_get_time() );
+    limited_sent[node_index] = 0;
+    full_sent[node_index] = 0;
+    portEXIT_CRITICAL( &pipeline_lock );
+}
+
+void root_pipeline_rx_done( uint32_t frames, uint32_t us, uint32_t pending )
+{
+    portENTER_CRITICAL( &pipeline_lock );
+    stage_account( &stats.rx, frames, us );
+    stats.rx.depth = pending;
+    if( pending > stats.rx.peak_depth )
+    {
+        stats.rx.peak_depth = pending;
+    }
+    stats.batches++;
+    if( frames > stats.batch_max )
+    {
+        stats.batch_max = frames;
+    }
+    portEXIT_CRITICAL( &pipeline_lock );
+}
+
+void root_pipeline_get_stats( root_pipeline_stats_t *out )
+{
+    portENTER_CRITICAL( &pipeline_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &pipeline_lock );
+}
+
+void root_pipeline_publish_overload( void )
+{
+    root_pipeline_stats_t totals;
+    uint32_t limited;
+    uint32_t full;
+    char id[NODE_ID_LEN];
+    int len;
+
+    root_pipeline_get_stats( &totals );
+    len = snprintf( overload_msg, OVERLOAD_MSG_SIZE, "{\"limited\":%u,\"flow_full\":%u,\"dropped\":%u,\"nodes\":[",
+                    totals.limited, totals.flow_full, totals.route.dropped );
+    for( int f = 0; f < ROOT_FLOWS; f++ )
+    {
+        portENTER_CRITICAL( &pipeline_lock );
+        limited = flows[f].limited - limited_sent[f];
+        full = flows[f].full - full_sent[f];
+        limited_sent[f] = flows[f].limited;
+        full_sent[f] = flows[f].full;
+        portEXIT_CRITICAL( &pipeline_lock );
+        if( !limited && !full )
+        {
+            continue;
+        }
+        if( f == ROOT_FLOW_UNKNOWN )
+        {
+            strlcpy( id, "?", sizeof( id ) );
+        }
+        else if( !node_registry_get( f, NULL, id, sizeof( id ) ) )
+        {
+            continue;
+        }
+        if( len > OVERLOAD_MSG_SIZE - 64 )
+        {
+            snprintf( overload_msg + len, OVERLOAD_MSG_SIZE - len, "]}" );
+            mqtt_app_publish( OVERLOAD_TOPIC, overload_msg );
+            len = snprintf( overload_msg, OVERLOAD_MSG_SIZE, "{\"nodes\":[" );
+        }
+        len += snprintf( overload_msg + len, OVERLOAD_MSG_SIZE - len, "%s{\"id\":\"%s\",\"limited\":%u,\"flow_full\":%u}",
+                         overload_msg[len - 1] == '[' ? "" : ",", id, limited, full );
+    }
+    snprintf( overload_msg + len, OVERLOAD_MSG_SIZE - len, "]}" );
+    mqtt_app_publish( OVERLOAD_TOPIC, overload_msg );
+}
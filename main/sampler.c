@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "sampler.h"
+#include "input_events.h"
+#include "metrics.h"
+#include "task_layout.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "sampler: ";
+
+static sampler_read_t read_fn = NULL;
+static volatile bool running = false;
+static volatile int32_t last_sample = 0;
+
+/**
+ * One pending summary and one pending alert for task_mesh_tx; a newer
+ * one replaces a value it has not taken yet
+ */
+static mesh_payload_summary_t pending_summary;
+static bool summary_ready = false;
+static mesh_payload_alert_t pending_alert;
+static bool alert_ready = false;
+
+static sampler_stats_t stats = { 0, };
+static portMUX_TYPE sampler_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_APP_SAMPLER_ENABLE
+
+#define SAMPLE_PERIOD_MS    ( 1000 / CONFIG_APP_SAMPLE_RATE_HZ )
+#define SAMPLE_WINDOW_US    ( (int64_t)CONFIG_APP_SAMPLE_WINDOW_S * 1000 * 1000 )
+#define SAMPLE_HOLDOFF_US   ( (int64_t)CONFIG_APP_SAMPLE_ALERT_HOLDOFF_MS * 1000 )
+
+/**
+ * Running aggregates of the current window
+ */
+typedef struct {
+    uint32_t count;
+    int32_t  min;
+    int32_t  max;
+    int32_t  last;
+    int64_t  sum;
+    int64_t  start_us;
+} sampler_window_t;
+
+/**
+ * Threshold state; an alert fires on entering HIGH or LOW and re-arms
+ * once the value is back by CONFIG_APP_SAMPLE_HYSTERESIS
+ */
+typedef enum {
+    LEVEL_NORMAL = 0,
+    LEVEL_HIGH,
+    LEVEL_LOW,
+} sampler_level_t;
+
+static void window_reset( sampler_window_t *window, int64_t now )
+{
+    memset( window, 0, sizeof( *window ) );
+    window->start_us = now;
+}
+
+static void window_add( sampler_window_t *window, int32_t value )
+{
+    if( window->count == 0 || value < window->min )
+    {
+        window->min = value;
+    }
+    if( window->count == 0 || value > window->max )
+    {
+        window->max = value;
+    }
+    window->last = value;
+    window->sum += value;
+    window->count++;
+}
+
+static void window_close( const sampler_window_t *window, int64_t now )
+{
+    mesh_payload_summary_t summary = {
+        .window_ms = (uint32_t)( ( now - window->start_us ) / 1000 ),
+        .count = window->count,
+        .min = window->min,
+        .max = window->max,
+        .mean = (int32_t)( window->sum / window->count ),
+        .last = window->last,
+    };
+
+    portENTER_CRITICAL( &sampler_lock );
+    if( summary_ready )
+    {
+        stats.overruns++;
+    }
+    pending_summary = summary;
+    summary_ready = true;
+    stats.windows++;
+    portEXIT_CRITICAL( &sampler_lock );
+
+    input_events_post( INPUT_SRC_SUMMARY, summary.mean );
+}
+
+static void sampler_raise( uint8_t kind, int32_t value, int32_t ref )
+{
+    mesh_payload_alert_t alert = {
+        .kind = kind,
+        .value = value,
+        .ref = ref,
+    };
+
+    portENTER_CRITICAL( &sampler_lock );
+    if( alert_ready )
+    {
+        stats.overruns++;
+    }
+    pending_alert = alert;
+    alert_ready = true;
+    stats.alerts++;
+    portEXIT_CRITICAL( &sampler_lock );
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "Alert %u: %d (ref %d)", kind, value, ref );
+    #endif
+    input_events_post( INPUT_SRC_SENSOR, value );
+}
+
+/**
+ * Sampling Task: the only place the sensor is read periodically
+ */
+void task_sampler( void *pvParameter )
+{
+    TickType_t period = SAMPLE_PERIOD_MS / portTICK_PERIOD_MS;
+    TickType_t wake = xTaskGetTickCount();
+    sampler_window_t window;
+    sampler_level_t level = LEVEL_NORMAL;
+    int64_t last_rate_us = 0;
+    int32_t prev = 0;
+    bool have_prev = false;
+
+    /**
+     * Rates above the tick rate run at one sample per tick
+     */
+    if( period == 0 )
+    {
+        period = 1;
+    }
+    window_reset( &window, esp_timer_get_time() );
+
+    for( ;; )
+    {
+        vTaskDelayUntil( &wake, period );
+
+        int32_t value = read_fn();
+        int64_t now = esp_timer_get_time();
+
+        last_sample = value;
+        window_add( &window, value );
+        portENTER_CRITICAL( &sampler_lock );
+        stats.samples++;
+        portEXIT_CRITICAL( &sampler_lock );
+
+        if( level != LEVEL_HIGH && value >= CONFIG_APP_SAMPLE_THRESHOLD_HIGH )
+        {
+            level = LEVEL_HIGH;
+            sampler_raise( MESH_ALERT_HIGH, value, CONFIG_APP_SAMPLE_THRESHOLD_HIGH );
+        }
+        else if( level != LEVEL_LOW && value <= CONFIG_APP_SAMPLE_THRESHOLD_LOW )
+        {
+            level = LEVEL_LOW;
+            sampler_raise( MESH_ALERT_LOW, value, CONFIG_APP_SAMPLE_THRESHOLD_LOW );
+        }
+        else
+        {
+            if( ( level == LEVEL_HIGH && value < CONFIG_APP_SAMPLE_THRESHOLD_HIGH - CONFIG_APP_SAMPLE_HYSTERESIS ) ||
+                ( level == LEVEL_LOW && value > CONFIG_APP_SAMPLE_THRESHOLD_LOW + CONFIG_APP_SAMPLE_HYSTERESIS ) )
+            {
+                level = LEVEL_NORMAL;
+            }
+
+            int64_t delta = (int64_t)value - prev;
+            if( CONFIG_APP_SAMPLE_DELTA_MAX > 0 && have_prev &&
+                ( delta > CONFIG_APP_SAMPLE_DELTA_MAX || delta < -CONFIG_APP_SAMPLE_DELTA_MAX ) &&
+                now - last_rate_us >= SAMPLE_HOLDOFF_US )
+            {
+                last_rate_us = now;
+                sampler_raise( MESH_ALERT_RATE, value, prev );
+            }
+        }
+        prev = value;
+        have_prev = true;
+
+        if( now - window.start_us >= SAMPLE_WINDOW_US )
+        {
+            window_close( &window, now );
+            window_reset( &window, now );
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+#endif
+
+esp_err_t sampler_start( sampler_read_t read )
+{
+    read_fn = read;
+
+#if CONFIG_APP_SAMPLER_ENABLE
+    TaskHandle_t task;
+
+    if( running )
+    {
+        return ESP_OK;
+    }
+    if( task_layout_create( TASK_LAYOUT_SAMPLER, task_sampler, "task_sampler", NULL, &task ) != pdPASS )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    metrics_register_task( task );
+    running = true;
+#endif
+    return ESP_OK;
+}
+
+int32_t sampler_last( void )
+{
+    if( running )
+    {
+        return last_sample;
+    }
+    return read_fn ? read_fn() : 0;
+}
+
+bool sampler_take_summary( mesh_payload_summary_t *summary )
+{
+    bool taken;
+
+    portENTER_CRITICAL( &sampler_lock );
+    taken = summary_ready;
+    if( taken )
+    {
+        *summary = pending_summary;
+        summary_ready = false;
+    }
+    portEXIT_CRITICAL( &sampler_lock );
+    return taken;
+}
+
+bool sampler_take_alert( mesh_payload_alert_t *alert )
+{
+    bool taken;
+
+    portENTER_CRITICAL( &sampler_lock );
+    taken = alert_ready;
+    if( taken )
+    {
+        *alert = pending_alert;
+        alert_ready = false;
+    }
+    portEXIT_CRITICAL( &sampler_lock );
+    return taken;
+}
+
+void sampler_get_stats( sampler_stats_t *out )
+{
+    portENTER_CRITICAL( &sampler_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &sampler_lock );
+}
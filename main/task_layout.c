@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+
+#include "task_layout.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "task_layout: ";
+
+typedef struct {
+    uint32_t stack;
+    UBaseType_t prio;
+    int8_t core;
+} task_layout_t;
+
+static const task_layout_t layout[TASK_LAYOUT_COUNT] = {
+    [TASK_LAYOUT_MESH_RX]        = { CONFIG_APP_TASK_MESH_RX_STACK, CONFIG_APP_TASK_MESH_RX_PRIO, CONFIG_APP_TASK_MESH_RX_CORE },
+    [TASK_LAYOUT_MESH_SENDER]    = { CONFIG_APP_TASK_MESH_SENDER_STACK, CONFIG_APP_TASK_MESH_SENDER_PRIO, CONFIG_APP_TASK_MESH_SENDER_CORE },
+    [TASK_LAYOUT_MESH_TX]        = { CONFIG_APP_TASK_MESH_TX_STACK, CONFIG_APP_TASK_MESH_TX_PRIO, CONFIG_APP_TASK_MESH_TX_CORE },
+    [TASK_LAYOUT_STATS]          = { CONFIG_APP_TASK_STATS_STACK, CONFIG_APP_TASK_STATS_PRIO, CONFIG_APP_TASK_STATS_CORE },
+    [TASK_LAYOUT_MQTT_PUBLISHER] = { CONFIG_APP_TASK_MQTT_PUBLISHER_STACK, CONFIG_APP_TASK_MQTT_PUBLISHER_PRIO, CONFIG_APP_TASK_MQTT_PUBLISHER_CORE },
+    [TASK_LAYOUT_SAMPLER]        = { CONFIG_APP_TASK_SAMPLER_STACK, CONFIG_APP_TASK_SAMPLER_PRIO, CONFIG_APP_TASK_SAMPLER_CORE },
+    [TASK_LAYOUT_FRAG]           = { CONFIG_APP_TASK_FRAG_STACK, CONFIG_APP_TASK_FRAG_PRIO, CONFIG_APP_TASK_FRAG_CORE },
+    [TASK_LAYOUT_DOWNLINK]       = { CONFIG_APP_TASK_DOWNLINK_STACK, CONFIG_APP_TASK_DOWNLINK_PRIO, CONFIG_APP_TASK_DOWNLINK_CORE },
+    [TASK_LAYOUT_FWDLOG]         = { CONFIG_APP_TASK_FWDLOG_STACK, CONFIG_APP_TASK_FWDLOG_PRIO, CONFIG_APP_TASK_FWDLOG_CORE },
+    [TASK_LAYOUT_MESH_REJOIN]    = { CONFIG_APP_TASK_MESH_REJOIN_STACK, CONFIG_APP_TASK_MESH_REJOIN_PRIO, CONFIG_APP_TASK_MESH_REJOIN_CORE },
+    [TASK_LAYOUT_ROOT_WORKER]    = { CONFIG_APP_TASK_ROOT_WORKER_STACK, CONFIG_APP_TASK_ROOT_WORKER_PRIO, CONFIG_APP_TASK_ROOT_WORKER_CORE },
+};
+
+BaseType_t task_layout_create( task_layout_id_t id, TaskFunction_t fn, const char *name,
+                               void *param, TaskHandle_t *task )
+{
+    const task_layout_t *l = &layout[id];
+    BaseType_t core = l->core < 0 || l->core >= portNUM_PROCESSORS ? tskNO_AFFINITY : l->core;
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "%s: core %d, priority %u, stack %u", name, l->core, (unsigned)l->prio, (unsigned)l->stack );
+    #endif
+    return xTaskCreatePinnedToCore( fn, name, l->stack, param, l->prio, task, core );
+}
+
+void task_layout_cpu_sample( task_cpu_sample_t *sample )
+{
+    memset( sample, 0, sizeof( *sample ) );
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    /**
+     * Room for a few tasks created while this one allocates
+     */
+    UBaseType_t n = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *status = malloc( n * sizeof( TaskStatus_t ) );
+
+    if( !status )
+    {
+        return;
+    }
+    n = uxTaskGetSystemState( status, n, &sample->total );
+    for( UBaseType_t i = 0; i < n; i++ )
+    {
+        for( int core = 0; core < portNUM_PROCESSORS; core++ )
+        {
+            if( status[i].xHandle == xTaskGetIdleTaskHandleForCPU( core ) )
+            {
+                sample->idle[core] = status[i].ulRunTimeCounter;
+            }
+        }
+    }
+    free( status );
+#endif
+}
+
+uint32_t task_layout_cpu_busy( const task_cpu_sample_t *prev, const task_cpu_sample_t *now, int core )
+{
+    /**
+     * Unsigned differences stay right across one counter wrap
+     */
+    uint32_t total = now->total - prev->total;
+    uint32_t idle = now->idle[core] - prev->idle[core];
+
+    if( !total || idle > total )
+    {
+        return 0;
+    }
+    return 100 - (uint32_t)( (uint64_t)idle * 100 / total );
+}
@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+
+/**
+ * Mesh Net;
+ */
+#include "esp_mesh.h"
+
+#include "topology.h"
+#include "metrics.h"
+#include "mesh.h"
+#include "mqtt_app.h"
+#include "node_registry.h"
+#include "trace_stats.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "topology: ";
+
+#define TOPO_TOPIC          "ESP-topo"
+#define TOPO_MSG_SIZE       ( 1024 )
+#define TOPO_ENTRY_MAX      ( 192 )     /* room kept for one node entry */
+
+/**
+ * The nodes by node index, then the root itself
+ */
+#define TOPO_SELF           ( CONFIG_MESH_ROUTE_TABLE_SIZE )
+#define TOPO_NODES          ( CONFIG_MESH_ROUTE_TABLE_SIZE + 1 )
+#define TOPO_NONE           ( -1 )
+
+/**
+ * A node that missed three reports leaves the graph
+ */
+#define TOPO_STALE_US       ( 3LL * CONFIG_APP_TOPO_PERIOD_S * 1000 * 1000 )
+
+/**
+ * Rates below this (bytes/s) are too small for their changes to matter
+ */
+#define TOPO_RATE_FLOOR     ( 100 )
+
+typedef struct {
+    int64_t  received_us;       /* 0: no report */
+    uint8_t  mac[6];
+    uint8_t  layer;
+    char     id[NODE_ID_LEN];
+    mesh_payload_topology_t topo;
+} topo_node_t;
+
+/**
+ * What the last message said about a node, for the deltas
+ */
+typedef struct {
+    bool     published;
+    uint8_t  parent[6];
+    uint8_t  layer;
+    uint8_t  children;
+    int8_t   rssi;
+    uint32_t tx_bps;
+    uint32_t rx_bps;
+    uint32_t load_bps;
+} topo_published_t;
+
+static topo_node_t nodes[CONFIG_MESH_ROUTE_TABLE_SIZE];
+static topo_published_t published[TOPO_NODES];
+
+/**
+ * Ids published and released since the last message; when more leave
+ * than fit, the next message is a full one
+ */
+static char gone[CONFIG_MESH_ROUTE_TABLE_SIZE][NODE_ID_LEN];
+static int gone_count = 0;
+static bool gone_lost = false;
+
+static portMUX_TYPE topo_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Publisher state, only touched by task_stats
+ */
+static topo_node_t view[TOPO_NODES];
+static int16_t parent_of[TOPO_NODES];
+static uint32_t load[TOPO_NODES];
+static uint32_t publishes = 0;
+static char topo_msg[TOPO_MSG_SIZE];
+
+/**
+ * Own counters at the previous report, for the rates
+ */
+static int64_t report_prev_us = 0;
+static uint32_t tx_prev = 0;
+static uint32_t rx_prev = 0;
+
+void topology_snapshot( mesh_payload_topology_t *topo )
+{
+    wifi_ap_record_t ap;
+    wifi_sta_list_t children;
+    mesh_tx_pending_t pending;
+    mesh_addr_t parent;
+    int64_t now = esp_timer_get_time();
+    uint32_t tx = metrics_get( METRIC_MESH_TX_BYTES );
+    uint32_t rx = metrics_get( METRIC_MESH_RX_BYTES );
+    int64_t elapsed = now - report_prev_us;
+
+    memset( topo, 0, sizeof( *topo ) );
+    if( esp_mesh_is_root() ? esp_mesh_get_parent_bssid( &parent ) == ESP_OK : mesh_app_get_parent( &parent ) )
+    {
+        memcpy( topo->parent, parent.addr, 6 );
+    }
+    if( esp_wifi_ap_get_sta_list( &children ) == ESP_OK )
+    {
+        topo->children = (uint8_t)children.num;
+    }
+    topo->subtree = (uint16_t)( esp_mesh_get_routing_table_size() - 1 );
+    if( esp_wifi_sta_get_ap_info( &ap ) == ESP_OK )
+    {
+        topo->rssi = (int8_t)ap.rssi;
+    }
+    if( esp_mesh_get_tx_pending( &pending ) == ESP_OK )
+    {
+        topo->tx_pending = (uint16_t)pending.to_parent;
+    }
+    if( elapsed > 0 )
+    {
+        topo->tx_bps = (uint32_t)( (uint64_t)( tx - tx_prev ) * 1000000 / elapsed );
+        topo->rx_bps = (uint32_t)( (uint64_t)( rx - rx_prev ) * 1000000 / elapsed );
+    }
+    report_prev_us = now;
+    tx_prev = tx;
+    rx_prev = rx;
+}
+
+void topology_store( int node_index, const mesh_frame_t *frame )
+{
+    mesh_payload_topology_t topo;
+    char id[NODE_ID_LEN];
+
+    if( node_index < 0 || node_index >= CONFIG_MESH_ROUTE_TABLE_SIZE ||
+        mesh_proto_get_topology( frame, &topo ) != 0 ||
+        !node_registry_get( node_index, NULL, id, sizeof( id ) ) )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &topo_lock );
+    nodes[node_index].received_us = esp_timer_get_time();
+    memcpy( nodes[node_index].mac, frame->mac, 6 );
+    nodes[node_index].layer = frame->layer;
+    memcpy( nodes[node_index].id, id, sizeof( id ) );
+    nodes[node_index].topo = topo;
+    portEXIT_CRITICAL( &topo_lock );
+}
+
+/**
+ * Lists a published node as gone; called with topo_lock held
+ */
+static void topo_gone( int i )
+{
+    if( !published[i].published )
+    {
+        return;
+    }
+    published[i].published = false;
+    if( gone_count < CONFIG_MESH_ROUTE_TABLE_SIZE )
+    {
+        memcpy( gone[gone_count++], nodes[i].id, NODE_ID_LEN );
+    }
+    else
+    {
+        gone_lost = true;
+    }
+}
+
+void topology_forget( int node_index )
+{
+    if( node_index < 0 || node_index >= CONFIG_MESH_ROUTE_TABLE_SIZE )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &topo_lock );
+    topo_gone( node_index );
+    nodes[node_index].received_us = 0;
+    portEXIT_CRITICAL( &topo_lock );
+}
+
+static bool rate_moved( uint32_t now, uint32_t then )
+{
+    uint32_t diff = now > then ? now - then : then - now;
+    uint32_t base = then > TOPO_RATE_FLOOR ? then : TOPO_RATE_FLOOR;
+
+    return (uint64_t)diff * 100 > (uint64_t)base * CONFIG_APP_TOPO_RATE_DELTA_PCT;
+}
+
+static bool topo_changed( int i )
+{
+    const topo_published_t *pub = &published[i];
+    const mesh_payload_topology_t *topo = &view[i].topo;
+    int rssi_diff = topo->rssi - pub->rssi;
+
+    return !pub->published || memcmp( pub->parent, topo->parent, 6 ) ||
+           pub->layer != view[i].layer || pub->children != topo->children ||
+           rssi_diff >= CONFIG_APP_TOPO_RSSI_DELTA || -rssi_diff >= CONFIG_APP_TOPO_RSSI_DELTA ||
+           rate_moved( topo->tx_bps, pub->tx_bps ) || rate_moved( topo->rx_bps, pub->rx_bps ) ||
+           rate_moved( load[i], pub->load_bps );
+}
+
+/**
+ * Median latency the hop from node 'i' to its parent adds
+ */
+static uint32_t topo_hop_us( int i )
+{
+    uint32_t own = trace_stats_node_p50( i );
+    uint32_t above = parent_of[i] >= 0 && parent_of[i] != TOPO_SELF ? trace_stats_node_p50( parent_of[i] ) : 0;
+
+    return own > above ? own - above : 0;
+}
+
+/**
+ * Starts a message; 'layers' adds the node count per layer
+ */
+static int topo_begin( bool full, bool layers )
+{
+    int count[CONFIG_MESH_MAX_LAYER + 1] = { 0, };
+    int len;
+
+    len = snprintf( topo_msg, TOPO_MSG_SIZE, "{\"ver\":%u,\"full\":%s", publishes, full ? "true" : "false" );
+    if( layers )
+    {
+        for( int i = 0; i < TOPO_NODES; i++ )
+        {
+            if( view[i].received_us && view[i].layer <= CONFIG_MESH_MAX_LAYER )
+            {
+                count[view[i].layer]++;
+            }
+        }
+        len += snprintf( topo_msg + len, TOPO_MSG_SIZE - len, ",\"layers\":[" );
+        for( int l = 1; l <= CONFIG_MESH_MAX_LAYER; l++ )
+        {
+            len += snprintf( topo_msg + len, TOPO_MSG_SIZE - len, "%s%d", l > 1 ? "," : "", count[l] );
+        }
+        len += snprintf( topo_msg + len, TOPO_MSG_SIZE - len, "]" );
+    }
+    return len;
+}
+
+/**
+ * Appends node 'i' and records it as published
+ */
+static int topo_append( int len, int i )
+{
+    const mesh_payload_topology_t *topo = &view[i].topo;
+    topo_published_t *pub = &published[i];
+    char parent[18];
+
+    if( parent_of[i] == TOPO_SELF )
+    {
+        strlcpy( parent, NODE_ID, sizeof( parent ) );
+    }
+    else if( parent_of[i] >= 0 )
+    {
+        strlcpy( parent, view[parent_of[i]].id, sizeof( parent ) );
+    }
+    else
+    {
+        snprintf( parent, sizeof( parent ), MACSTR, MAC2STR( topo->parent ) );
+    }
+    len += snprintf( topo_msg + len, TOPO_MSG_SIZE - len,
+                     "%s{\"id\":\"%s\",\"p\":\"%s\",\"l\":%u,\"c\":%u,\"s\":%u,\"rssi\":%d,\"q\":%u,"
+                     "\"tx\":%u,\"rx\":%u,\"load\":%u,\"hop\":%u}",
+                     topo_msg[len - 1] == '[' ? "" : ",", view[i].id, parent, view[i].layer, topo->children,
+                     topo->subtree, topo->rssi, topo->tx_pending, topo->tx_bps, topo->rx_bps, load[i],
+                     i == TOPO_SELF ? 0 : topo_hop_us( i ) );
+
+    portENTER_CRITICAL( &topo_lock );
+    pub->published = true;
+    memcpy( pub->parent, topo->parent, 6 );
+    pub->layer = view[i].layer;
+    pub->children = topo->children;
+    pub->rssi = topo->rssi;
+    pub->tx_bps = topo->tx_bps;
+    pub->rx_bps = topo->rx_bps;
+    pub->load_bps = load[i];
+    portEXIT_CRITICAL( &topo_lock );
+    return len;
+}
+
+void topology_publish( void )
+{
+    uint8_t self_mac[6];
+    int64_t now = esp_timer_get_time();
+    bool full;
+    int sent = 0;
+    int len;
+
+    /**
+     * The root's own place in the graph
+     */
+    esp_efuse_mac_get_default( self_mac );
+    view[TOPO_SELF].layer = (uint8_t)esp_mesh_get_layer();
+    topology_snapshot( &view[TOPO_SELF].topo );
+
+    /**
+     * Fresh reports only; the stale ones leave the graph
+     */
+    portENTER_CRITICAL( &topo_lock );
+    for( int i = 0; i < CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        if( nodes[i].received_us && now - nodes[i].received_us > TOPO_STALE_US )
+        {
+            topo_gone( i );
+            nodes[i].received_us = 0;
+        }
+        view[i] = nodes[i];
+    }
+    view[TOPO_SELF].received_us = now;
+    memcpy( view[TOPO_SELF].mac, self_mac, 6 );
+    strlcpy( view[TOPO_SELF].id, NODE_ID, sizeof( view[TOPO_SELF].id ) );
+    publishes++;
+    full = gone_lost || publishes % CONFIG_APP_TOPO_FULL_EVERY == 1 || CONFIG_APP_TOPO_FULL_EVERY == 1;
+    gone_lost = false;
+    portEXIT_CRITICAL( &topo_lock );
+
+    /**
+     * Parent of every node, then the rate each uplink carries for its
+     * subtree; the walk is bounded so a stale loop cannot hang it
+     */
+    for( int i = 0; i < TOPO_NODES; i++ )
+    {
+        int p;
+
+        parent_of[i] = TOPO_NONE;
+        load[i] = 0;
+        if( !view[i].received_us || i == TOPO_SELF )
+        {
+            continue;
+        }
+        if( !memcmp( view[i].topo.parent, self_mac, 6 ) )
+        {
+            parent_of[i] = TOPO_SELF;
+        }
+        else if( ( p = node_registry_lookup( view[i].topo.parent, NULL, 0 ) ) >= 0 && view[p].received_us )
+        {
+            parent_of[i] = p;
+        }
+    }
+    for( int i = 0; i < TOPO_NODES; i++ )
+    {
+        if( !view[i].received_us )
+        {
+            continue;
+        }
+        load[i] += view[i].topo.tx_bps;
+        for( int p = parent_of[i], hops = 0; p >= 0 && hops < CONFIG_MESH_MAX_LAYER; p = parent_of[p], hops++ )
+        {
+            load[p] += view[i].topo.tx_bps;
+        }
+    }
+
+    len = topo_begin( full, true );
+    len += snprintf( topo_msg + len, TOPO_MSG_SIZE - len, ",\"gone\":[" );
+    portENTER_CRITICAL( &topo_lock );
+    while( gone_count && len < TOPO_MSG_SIZE - TOPO_ENTRY_MAX - NODE_ID_LEN )
+    {
+        gone_count--;
+        sent++;
+        len += snprintf( topo_msg + len, TOPO_MSG_SIZE - len, "%s\"%s\"",
+                         topo_msg[len - 1] == '[' ? "" : ",", gone[gone_count] );
+    }
+    portEXIT_CRITICAL( &topo_lock );
+    len += snprintf( topo_msg + len, TOPO_MSG_SIZE - len, "],\"nodes\":[" );
+
+    for( int i = 0; i < TOPO_NODES; i++ )
+    {
+        if( !view[i].received_us || ( !full && !topo_changed( i ) ) )
+        {
+            continue;
+        }
+        if( len > TOPO_MSG_SIZE - TOPO_ENTRY_MAX )
+        {
+            snprintf( topo_msg + len, TOPO_MSG_SIZE - len, "]}" );
+            mqtt_app_publish( TOPO_TOPIC, topo_msg );
+            len = topo_begin( full, false );
+            len += snprintf( topo_msg + len, TOPO_MSG_SIZE - len, ",\"nodes\":[" );
+        }
+        len = topo_append( len, i );
+        sent++;
+    }
+    if( sent || full )
+    {
+        snprintf( topo_msg + len, TOPO_MSG_SIZE - len, "]}" );
+        mqtt_app_publish( TOPO_TOPIC, topo_msg );
+    }
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "topology %u published (%s)", publishes, full ? "full" : "delta" );
+    #endif
+}
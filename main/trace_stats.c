@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+/**
+ * Mesh Net;
+ */
+#include "esp_mesh.h"
+
+#include "trace_stats.h"
+#include "latency_hist.h"
+#include "node_registry.h"
+#include "mqtt_app.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "trace: ";
+
+#define TRACE_TOPIC         "ESP-stats/latency"
+#define TRACE_NODES_TOPIC   "ESP-stats/latency/nodes"
+#define TRACE_MAX_AGE_US    ( 60u * 1000 * 1000 )
+#define TRACE_MSG_SIZE      ( 512 )
+
+static latency_hist_t node_hist[CONFIG_MESH_ROUTE_TABLE_SIZE];
+static latency_hist_t layer_hist[CONFIG_MESH_MAX_LAYER + 1];
+static uint32_t skewed = 0;
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static char trace_msg[TRACE_MSG_SIZE];
+
+uint32_t trace_now( void )
+{
+    return (uint32_t)esp_mesh_get_tsf_time();
+}
+
+uint32_t trace_stamp( int64_t local_us )
+{
+    if( local_us == 0 )
+    {
+        return trace_now();
+    }
+    return trace_now() - (uint32_t)( esp_timer_get_time() - local_us );
+}
+
+int64_t trace_to_local( uint32_t origin_ts )
+{
+    uint32_t age = trace_now() - origin_ts;
+    int64_t now = esp_timer_get_time();
+
+    if( origin_ts == 0 || age > TRACE_MAX_AGE_US )
+    {
+        return now;
+    }
+    return now - age;
+}
+
+void trace_stats_record( int node_index, uint8_t layer, uint32_t origin_ts )
+{
+    /**
+     * Unsigned difference handles TSF wrap-around; anything older than
+     * a minute means the sender's TSF was not synchronised yet
+     */
+    uint32_t latency = trace_now() - origin_ts;
+
+    portENTER_CRITICAL( &trace_lock );
+    if( origin_ts == 0 || latency > TRACE_MAX_AGE_US )
+    {
+        skewed++;
+    }
+    else
+    {
+        if( node_index >= 0 && node_index < CONFIG_MESH_ROUTE_TABLE_SIZE )
+        {
+            latency_hist_add( &node_hist[node_index], latency );
+        }
+        if( layer <= CONFIG_MESH_MAX_LAYER )
+        {
+            latency_hist_add( &layer_hist[layer], latency );
+        }
+    }
+    portEXIT_CRITICAL( &trace_lock );
+}
+
+void trace_stats_forget( int node_index )
+{
+    if( node_index < 0 || node_index >= CONFIG_MESH_ROUTE_TABLE_SIZE )
+    {
+        return;
+    }
+    portENTER_CRITICAL( &trace_lock );
+    latency_hist_reset( &node_hist[node_index] );
+    portEXIT_CRITICAL( &trace_lock );
+}
+
+uint32_t trace_stats_node_p50( int node_index )
+{
+    latency_hist_t hist;
+
+    if( node_index < 0 || node_index >= CONFIG_MESH_ROUTE_TABLE_SIZE )
+    {
+        return 0;
+    }
+    portENTER_CRITICAL( &trace_lock );
+    hist = node_hist[node_index];
+    portEXIT_CRITICAL( &trace_lock );
+    return hist.count ? latency_hist_percentile( &hist, 50 ) : 0;
+}
+
+/**
+ * Appends one {"...":..,"n":..,"p50":..} entry; returns the new length
+ */
+static int trace_append( int len, const char *label, const latency_hist_t *hist )
+{
+    return len + snprintf( trace_msg + len, TRACE_MSG_SIZE - len,
+                           "%s{%s,\"n\":%u,\"p50\":%u,\"p95\":%u,\"p99\":%u,\"max\":%u}",
+                           trace_msg[len - 1] == '[' ? "" : ",", label, hist->count,
+                           latency_hist_percentile( hist, 50 ), latency_hist_percentile( hist, 95 ),
+                           latency_hist_percentile( hist, 99 ), hist->max_us );
+}
+
+void trace_stats_publish( void )
+{
+    latency_hist_t hist;
+    char label[32];
+    char id[NODE_ID_LEN];
+    int len;
+
+    /**
+     * Per layer, in one message
+     */
+    len = snprintf( trace_msg, TRACE_MSG_SIZE, "{\"layers\":[" );
+    for( int l = 1; l <= CONFIG_MESH_MAX_LAYER; l++ )
+    {
+        portENTER_CRITICAL( &trace_lock );
+        hist = layer_hist[l];
+        portEXIT_CRITICAL( &trace_lock );
+        if( hist.count == 0 )
+        {
+            continue;
+        }
+        snprintf( label, sizeof( label ), "\"layer\":%d", l );
+        len = trace_append( len, label, &hist );
+    }
+    snprintf( trace_msg + len, TRACE_MSG_SIZE - len, "],\"skewed\":%u}", skewed );
+    mqtt_app_publish( TRACE_TOPIC, trace_msg );
+
+    /**
+     * Per node, split over as many messages as needed
+     */
+    len = snprintf( trace_msg, TRACE_MSG_SIZE, "{\"nodes\":[" );
+    for( int i = 0; i < CONFIG_MESH_ROUTE_TABLE_SIZE; i++ )
+    {
+        if( !node_registry_get( i, NULL, id, sizeof( id ) ) )
+        {
+            continue;
+        }
+        portENTER_CRITICAL( &trace_lock );
+        hist = node_hist[i];
+        portEXIT_CRITICAL( &trace_lock );
+        if( hist.count == 0 )
+        {
+            continue;
+        }
+        if( len > TRACE_MSG_SIZE - 96 )
+        {
+            snprintf( trace_msg + len, TRACE_MSG_SIZE - len, "]}" );
+            mqtt_app_publish( TRACE_NODES_TOPIC, trace_msg );
+            len = snprintf( trace_msg, TRACE_MSG_SIZE, "{\"nodes\":[" );
+        }
+        snprintf( label, sizeof( label ), "\"id\":\"%s\"", id );
+        len = trace_append( len, label, &hist );
+    }
+    if( trace_msg[len - 1] != '[' )
+    {
+        snprintf( trace_msg + len, TRACE_MSG_SIZE - len, "]}" );
+        mqtt_app_publish( TRACE_NODES_TOPIC, trace_msg );
+    }
+
+    #ifdef DEBUG
+        ESP_LOGI( TAG, "latency stats published (%u skewed samples)", skewed );
+    #endif
+}
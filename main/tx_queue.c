@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+
+#include "esp_log.h"
+
+/**
+ * Mesh Net;
+ */
+#include "esp_mesh.h"
+
+#include "tx_queue.h"
+#include "mesh_fanout.h"
+#include "mesh.h"
+#include "fwdlog.h"
+#include "boot_trace.h"
+#include "metrics.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "txq: ";
+
+/**
+ * Slot pool plus one FIFO of slot pointers per class. Every FIFO can
+ * hold the whole pool, so submitting never fails or blocks; only
+ * taking a slot can.
+ */
+static tx_frame_t tx_slots[CONFIG_APP_TX_QUEUE_SLOTS];
+static QueueHandle_t free_slots = NULL;
+static QueueHandle_t ready[TX_PRIO_MAX];
+static SemaphoreHandle_t pending = NULL;
+
+/**
+ * A frame with a tail (fragment data) is put together here, the one
+ * place a full MESH_MPS frame exists on the send side
+ */
+static uint8_t send_buf[MESH_MPS];
+
+static tx_queue_stats_t stats = { 0, };
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t tx_queue_init( void )
+{
+    if( free_slots )
+    {
+        return ESP_OK;
+    }
+
+    free_slots = xQueueCreate( CONFIG_APP_TX_QUEUE_SLOTS, sizeof( tx_frame_t * ) );
+    pending = xSemaphoreCreateCounting( 2 * CONFIG_APP_TX_QUEUE_SLOTS, 0 );
+    if( !free_slots || !pending )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    for( int p = 0; p < TX_PRIO_MAX; p++ )
+    {
+        ready[p] = xQueueCreate( CONFIG_APP_TX_QUEUE_SLOTS, sizeof( tx_frame_t * ) );
+        if( !ready[p] )
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    for( int i = 0; i < CONFIG_APP_TX_QUEUE_SLOTS; i++ )
+    {
+        tx_frame_t *frame = &tx_slots[i];
+        xQueueSend( free_slots, &frame, 0 );
+    }
+    return ESP_OK;
+}
+
+tx_frame_t *tx_queue_alloc( tx_prio_t prio, tx_policy_t policy, TickType_t timeout )
+{
+    tx_frame_t *frame = NULL;
+
+    if( !free_slots )
+    {
+        return NULL;
+    }
+
+    if( xQueueReceive( free_slots, &frame, policy == TX_POLICY_BLOCK ? timeout : 0 ) != pdTRUE )
+    {
+        /**
+         * Pool exhausted: either recycle the oldest frame of this class
+         * or refuse the new one
+         */
+        bool recycled = policy == TX_POLICY_DROP_OLDEST &&
+                        xQueueReceive( ready[prio], &frame, 0 ) == pdTRUE;
+
+        portENTER_CRITICAL( &stats_lock );
+        stats.dropped[prio]++;
+        portEXIT_CRITICAL( &stats_lock );
+
+        if( !recycled )
+        {
+            return NULL;
+        }
+        if( frame->persist )
+        {
+            fwdlog_append( frame->data, frame->len );
+        }
+        if( frame->done )
+        {
+            frame->done( frame, ESP_ERR_TIMEOUT, frame->arg );
+        }
+    }
+
+    memset( frame, 0, offsetof( tx_frame_t, data ) );
+    frame->dest = TX_DEST_ROOT;
+    frame->proto = MESH_PROTO_BIN;
+    frame->flag = MESH_DATA_P2P;
+    frame->prio = prio;
+    return frame;
+}
+
+void tx_queue_submit( tx_frame_t *frame )
+{
+    xQueueSend( ready[frame->prio], &frame, 0 );
+
+    portENTER_CRITICAL( &stats_lock );
+    stats.enqueued[frame->prio]++;
+    portEXIT_CRITICAL( &stats_lock );
+
+    xSemaphoreGive( pending );
+}
+
+void tx_queue_release( tx_frame_t *frame )
+{
+    xQueueSend( free_slots, &frame, 0 );
+}
+
+esp_err_t tx_queue_send_to_root( const uint8_t *data, uint16_t len, tx_prio_t prio,
+                                 tx_policy_t policy, TickType_t timeout )
+{
+    if( len > TX_FRAME_MAX )
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    tx_frame_t *frame = tx_queue_alloc( prio, policy, timeout );
+    if( !frame )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy( frame->data, data, len );
+    frame->len = len;
+    tx_queue_submit( frame );
+    return ESP_OK;
+}
+
+void tx_queue_get_stats( tx_queue_stats_t *out )
+{
+    portENTER_CRITICAL( &stats_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &stats_lock );
+
+    for( int p = 0; p < TX_PRIO_MAX; p++ )
+    {
+        out->depth[p] = ready[p] ? uxQueueMessagesWaiting( ready[p] ) : 0;
+    }
+    out->free_slots = free_slots ? uxQueueMessagesWaiting( free_slots ) : 0;
+}
+
+/**
+ * Sender Task: drains the control class first, then telemetry, then bulk
+ */
+void task_mesh_sender( void *pvParameter )
+{
+    tx_frame_t *frame;
+    mesh_data_t data;
+    esp_err_t err;
+
+    for( ;; )
+    {
+        xSemaphoreTake( pending, portMAX_DELAY );
+
+        frame = NULL;
+        for( int p = 0; p < TX_PRIO_MAX && !frame; p++ )
+        {
+            if( xQueueReceive( ready[p], &frame, 0 ) != pdTRUE )
+            {
+                frame = NULL;
+            }
+        }
+
+        /**
+         * The frame this wake-up was for got recycled by a producer
+         */
+        if( !frame )
+        {
+            continue;
+        }
+
+        /**
+         * Without a parent the send can only fail; frames worth keeping
+         * go to the log and are replayed once the mesh is back
+         */
+        if( frame->persist && !mesh_app_is_connected() && fwdlog_append( frame->data, frame->len ) == ESP_OK )
+        {
+            if( frame->done )
+            {
+                frame->done( frame, ESP_ERR_MESH_DISCONNECTED, frame->arg );
+            }
+            tx_queue_release( frame );
+            continue;
+        }
+
+        data.data = frame->data;
+        data.size = frame->len;
+        if( frame->tail_len )
+        {
+            if( frame->len + frame->tail_len > sizeof( send_buf ) )
+            {
+                if( frame->done )
+                {
+                    frame->done( frame, ESP_ERR_INVALID_SIZE, frame->arg );
+                }
+                tx_queue_release( frame );
+                continue;
+            }
+            memcpy( send_buf, frame->data, frame->len );
+            memcpy( &send_buf[frame->len], frame->tail, frame->tail_len );
+            data.data = send_buf;
+            data.size = frame->len + frame->tail_len;
+        }
+        data.proto = frame->proto;
+        data.tos = MESH_TOS_P2P;
+
+        switch( frame->dest )
+        {
+            case TX_DEST_ADDR:
+                err = esp_mesh_send( &frame->to, &data, frame->flag, NULL, 0 );
+                break;
+            case TX_DEST_ALL:
+                err = mesh_fanout_send( &data, NULL );
+                break;
+            case TX_DEST_ROOT:
+            default:
+                err = esp_mesh_send( NULL, &data, frame->flag, NULL, 0 );
+                break;
+        }
+
+        portENTER_CRITICAL( &stats_lock );
+        if( err == ESP_OK )
+        {
+            stats.sent++;
+        }
+        else
+        {
+            stats.send_errors++;
+        }
+        portEXIT_CRITICAL( &stats_lock );
+
+        if( err == ESP_OK )
+        {
+            metrics_inc( METRIC_MESH_TX_FRAMES );
+            boot_mark( BOOT_FIRST_TX );
+            metrics_add( METRIC_MESH_TX_BYTES, data.size );
+        }
+        else
+        {
+            metrics_inc( METRIC_MESH_TX_ERRORS );
+        }
+
+        if( err != ESP_OK )
+        {
+            if( frame->persist )
+            {
+                fwdlog_append( frame->data, frame->len );
+            }
+            #ifdef DEBUG
+                ESP_LOGI( TAG, "ERROR : Sending Message! (0x%x, class %d)\r\n", err, frame->prio );
+            #endif
+        }
+
+        if( frame->done )
+        {
+            frame->done( frame, err, frame->arg );
+        }
+        tx_queue_release( frame );
+    }
+
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * FreeRTOS
+ */
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "uplink_batch.h"
+#include "input_events.h"
+#include "mqtt_app.h"
+#include "mqtt_outbox.h"
+
+/**
+ * Standard configurations loaded
+ */
+#include "sys_config.h"
+
+static const char *TAG = "batch: ";
+
+#define BATCH_TOPIC         "ESP-batch"
+#define BATCH_TOPIC_SINGLE  "ESP-send"
+
+static uplink_batch_stats_t stats = { 0, };
+static portMUX_TYPE batch_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_APP_BATCH_ENABLE
+
+/**
+ * "[65535,4294967295,-2147483648,-2147483648]," is the longest record
+ */
+#define BATCH_RECORD_MAX    ( 46 )
+#define BATCH_MSG_SIZE      ( 32 + CONFIG_APP_BATCH_MAX_RECORDS * BATCH_RECORD_MAX )
+
+/**
+ * A batch is written into a frame buffer and handed to the outbox by
+ * reference
+ */
+#if BATCH_MSG_SIZE > CONFIG_APP_FRAME_POOL_BUF_SIZE
+#error "CONFIG_APP_FRAME_POOL_BUF_SIZE cannot hold CONFIG_APP_BATCH_MAX_RECORDS readings"
+#endif
+
+/**
+ * How long a flush waits for a frame buffer before dropping the batch
+ */
+#define BATCH_BUF_WAIT_MS   ( 50 )
+
+typedef struct {
+    uint16_t node_id;
+    uint32_t seq;
+    int64_t  sampled_us;
+    int32_t  value;
+} batch_record_t;
+
+static batch_record_t records[CONFIG_APP_BATCH_MAX_RECORDS];
+static int count = 0;
+
+/**
+ * Flushing works on a copy so producers only wait for a memcpy;
+ * flush_mutex serializes the flushers (window timer and producers)
+ */
+static batch_record_t flushing[CONFIG_APP_BATCH_MAX_RECORDS];
+static SemaphoreHandle_t flush_mutex = NULL;
+static esp_timer_handle_t window_timer = NULL;
+static bool window_closed = false;
+
+/**
+ * Runs in the esp_timer task, which must not block: the flush waits for
+ * the mutex, a frame buffer and the outbox, so task_mesh_tx does it
+ */
+static void batch_window_expired( void *arg )
+{
+    __atomic_store_n( &window_closed, true, __ATOMIC_RELEASE );
+    input_events_post( INPUT_SRC_WAKE, 0 );
+}
+
+#endif
+
+esp_err_t uplink_batch_init( void )
+{
+#if CONFIG_APP_BATCH_ENABLE
+    if( flush_mutex )
+    {
+        return ESP_OK;
+    }
+
+    esp_timer_create_args_t timer_args = {
+        .callback = batch_window_expired,
+        .name = "batch_window",
+    };
+
+    flush_mutex = xSemaphoreCreateMutex();
+    if( !flush_mutex )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return esp_timer_create( &timer_args, &window_timer );
+#else
+    return ESP_OK;
+#endif
+}
+
+esp_err_t uplink_batch_add( uint16_t node_id, uint32_t seq, int64_t sampled_us, int32_t value )
+{
+#if CONFIG_APP_BATCH_ENABLE
+    bool first = false;
+    bool full = false;
+    bool dropped = false;
+
+    portENTER_CRITICAL( &batch_lock );
+    if( count == CONFIG_APP_BATCH_MAX_RECORDS )
+    {
+        /* a flush of the full batch has not picked it up yet */
+        stats.dropped++;
+        dropped = true;
+    }
+    else
+    {
+        records[count].node_id = node_id;
+        records[count].seq = seq;
+        records[count].sampled_us = sampled_us;
+        records[count].value = value;
+        first = count == 0;
+        count++;
+        full = count == CONFIG_APP_BATCH_MAX_RECORDS;
+    }
+    portEXIT_CRITICAL( &batch_lock );
+
+    if( dropped )
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if( full )
+    {
+        uplink_batch_flush();
+    }
+    else if( first && window_timer )
+    {
+        esp_timer_start_once( window_timer, CONFIG_APP_BATCH_WINDOW_MS * 1000ULL );
+    }
+    return ESP_OK;
+#else
+    char nodeDt[20];
+    esp_err_t err;
+
+    snprintf( nodeDt, sizeof( nodeDt ), "%d", value );
+    err = mqtt_outbox_post( BATCH_TOPIC_SINGLE, nodeDt, strlen( nodeDt ) );
+    if( err != ESP_OK )
+    {
+        ESP_LOGW( TAG, "outbox full, dropped publish on %s", BATCH_TOPIC_SINGLE );
+        return err;
+    }
+    portENTER_CRITICAL( &batch_lock );
+    stats.records++;
+    portEXIT_CRITICAL( &batch_lock );
+    return ESP_OK;
+#endif
+}
+
+void uplink_batch_flush( void )
+{
+#if CONFIG_APP_BATCH_ENABLE
+    int n;
+    int len;
+    int64_t t0;
+    frame_buf_t *fb;
+    char *batch_msg;
+
+    if( !flush_mutex )
+    {
+        return;
+    }
+    xSemaphoreTake( flush_mutex, portMAX_DELAY );
+
+    /**
+     * Stopped before taking the records: a reading added after the copy
+     * starts a new window, one added before is part of this batch
+     */
+    esp_timer_stop( window_timer );
+    __atomic_store_n( &window_closed, false, __ATOMIC_RELEASE );
+
+    portENTER_CRITICAL( &batch_lock );
+    n = count;
+    memcpy( flushing, records, n * sizeof( batch_record_t ) );
+    count = 0;
+    portEXIT_CRITICAL( &batch_lock );
+
+    fb = n > 0 ? frame_pool_alloc( pdMS_TO_TICKS( BATCH_BUF_WAIT_MS ) ) : NULL;
+    if( n > 0 && !fb )
+    {
+        portENTER_CRITICAL( &batch_lock );
+        stats.dropped += n;
+        portEXIT_CRITICAL( &batch_lock );
+        ESP_LOGW( TAG, "no frame buffer, dropped a batch of %d readings", n );
+    }
+    else if( n > 0 )
+    {
+        batch_msg = (char *)fb->data;
+        t0 = flushing[0].sampled_us / 1000;
+        len = snprintf( batch_msg, BATCH_MSG_SIZE, "{\"t0\":%lld,\"r\":[", (long long)t0 );
+        for( int i = 0; i < n; i++ )
+        {
+            len += snprintf( batch_msg + len, BATCH_MSG_SIZE - len, "%s[%u,%u,%d,%d]",
+                             i ? "," : "", flushing[i].node_id, flushing[i].seq,
+                             (int)( flushing[i].sampled_us / 1000 - t0 ), flushing[i].value );
+        }
+        len += snprintf( batch_msg + len, BATCH_MSG_SIZE - len, "]}" );
+        if( mqtt_outbox_post_buf( BATCH_TOPIC, fb, batch_msg, len ) != ESP_OK )
+        {
+            ESP_LOGW( TAG, "outbox full, dropped publish on %s", BATCH_TOPIC );
+        }
+        frame_pool_release( fb );
+
+        portENTER_CRITICAL( &batch_lock );
+        stats.batches++;
+        stats.records += n;
+        portEXIT_CRITICAL( &batch_lock );
+
+        #ifdef DEBUG
+            ESP_LOGI( TAG, "batch of %d readings published (%d bytes)", n, len );
+        #endif
+    }
+
+    xSemaphoreGive( flush_mutex );
+#endif
+}
+
+void uplink_batch_poll( void )
+{
+#if CONFIG_APP_BATCH_ENABLE
+    if( __atomic_load_n( &window_closed, __ATOMIC_ACQUIRE ) )
+    {
+        uplink_batch_flush();
+    }
+#endif
+}
+
+void uplink_batch_get_stats( uplink_batch_stats_t *out )
+{
+    portENTER_CRITICAL( &batch_lock );
+    *out = stats;
+    portEXIT_CRITICAL( &batch_lock );
+}